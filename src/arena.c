@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+#include "arena.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Enough for a parse window plus the tags of a typical file. */
+#define ARENA_BLOCK (256*1024)
+#define ALIGN 16
+
+struct arena_blk {
+    struct arena_blk *next;
+    size_t cap, used;
+    _Alignas(ALIGN) char mem[];
+};
+
+static struct arena_blk *new_blk(size_t need){
+    size_t cap = need > ARENA_BLOCK ? need : ARENA_BLOCK;
+    struct arena_blk *b = malloc(sizeof *b + cap);
+    if (!b) return NULL;
+    b->next = NULL;
+    b->cap = cap;
+    b->used = 0;
+    return b;
+}
+
+void *arena_alloc(struct arena *a, size_t n){
+    n = (n + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    struct arena_blk *b = a->head;
+    if (!b || b->cap - b->used < n) {
+        if (!(b = new_blk(n))) return NULL;
+        b->next = a->head;
+        a->head = b;
+        if (!a->first) a->first = b;
+    }
+    a->last = b->used;
+    b->used += n;
+    return b->mem + a->last;
+}
+
+void *arena_grow(struct arena *a, void *p, size_t n, size_t want){
+    struct arena_blk *b = a->head;
+    if (!p) return arena_alloc(a, want);
+    want = (want + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    if (b && (char *)p == b->mem + a->last && b->cap - a->last >= want) {
+        b->used = a->last + want;
+        return p;
+    }
+    void *np = arena_alloc(a, want);
+    if (np) memcpy(np, p, n);
+    return np;
+}
+
+char *arena_strndup(struct arena *a, const char *s, size_t n){
+    char *d = arena_alloc(a, n + 1);
+    if (!d) return NULL;
+    memcpy(d, s, n);
+    d[n] = 0;
+    return d;
+}
+
+char *arena_printf(struct arena *a, const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    if (n < 0) return NULL;
+    char *d = arena_alloc(a, (size_t)n + 1);
+    if (!d) return NULL;
+    va_start(ap, fmt);
+    vsnprintf(d, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    return d;
+}
+
+/* Overflow blocks go back to malloc; the first stays for the next user
+ * unless it was oversized itself. */
+void arena_reset(struct arena *a){
+    struct arena_blk *b = a->head;
+    while (b && b != a->first) {
+        struct arena_blk *next = b->next;
+        free(b);
+        b = next;
+    }
+    if (a->first && a->first->cap > ARENA_BLOCK) { free(a->first); a->first = NULL; }
+    a->head = a->first;
+    a->last = 0;
+    if (a->first) { a->first->used = 0; a->first->next = NULL; }
+}
+
+void arena_free(struct arena *a){
+    arena_reset(a);
+    free(a->first);
+    memset(a, 0, sizeof *a);
+}
@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+
+/* Bump-pointer allocator for short-lived data. Nothing is freed on its own;
+ * arena_reset drops everything at once and keeps the first block, so a
+ * reused arena whose contents fit in it allocates nothing at all. */
+struct arena_blk;
+
+struct arena {
+    struct arena_blk *head;     // current block; older ones follow ->next
+    struct arena_blk *first;    // kept across resets
+    size_t last;                // offset of the newest allocation in head
+};
+
+void *arena_alloc(struct arena *a, size_t n);
+/* Grow p (n bytes, from this arena) to want bytes, in place if p is the
+ * newest allocation and there is room. */
+void *arena_grow(struct arena *a, void *p, size_t n, size_t want);
+char *arena_strndup(struct arena *a, const char *s, size_t n);
+char *arena_printf(struct arena *a, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+void arena_reset(struct arena *a);
+void arena_free(struct arena *a);
+
+#endif
@@ -0,0 +1,151 @@
+#define _GNU_SOURCE
+#include "budget.h"
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#define BUDGET_MAX_PAUSE 10000      // ms pressure may hold one slice
+#define BUDGET_PRESSURE_POLL 1000   // ms between looks at /proc
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define BULK_NICE 19
+
+static long now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long budget_cpu_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void budget_init(struct budget *b, const struct config *cfg){
+    memset(b, 0, sizeof *b);
+    pthread_mutex_init(&b->lock, NULL);
+    b->io_rate = (double)cfg->bulk_io_rate;
+    b->file_rate = cfg->bulk_file_rate;
+    b->io_tokens = b->io_rate;
+    b->file_tokens = b->file_rate;
+    b->cpu = cfg->bulk_cpu;
+    b->idle = cfg->bulk_idle;
+    b->pressure = cfg->bulk_pressure;
+    b->load = cfg->bulk_load;
+    b->stamp = now_ms();
+}
+
+void budget_free(struct budget *b){
+    pthread_mutex_destroy(&b->lock);
+}
+
+/* Per worker thread: the mode it is in and what to go back to. Bulk
+ * threads get the idle I/O class and SCHED_BATCH, and nice only where the
+ * old nice value can be restored afterwards (root, or RLIMIT_NICE). */
+static __thread int cur_mode = -1;
+static __thread int base_ioprio, base_nice, renice;
+
+void budget_mode(const struct budget *b, bool bulk){
+    int mode = bulk && b->idle;
+    if (mode == cur_mode) return;
+    pid_t tid = (pid_t)syscall(SYS_gettid);
+    if (cur_mode < 0) {
+        base_ioprio = (int)syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, tid);
+        if (base_ioprio < 0) base_ioprio = 0;
+        base_nice = getpriority(PRIO_PROCESS, (id_t)tid);
+        struct rlimit rl;
+        renice = geteuid() == 0 ||
+                 (getrlimit(RLIMIT_NICE, &rl) == 0 && rl.rlim_cur >= (rlim_t)(20 - base_nice));
+    }
+    cur_mode = mode;
+    struct sched_param sp = {0};
+    if (mode) {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+        pthread_setschedparam(pthread_self(), SCHED_BATCH, &sp);
+        if (renice) setpriority(PRIO_PROCESS, (id_t)tid, BULK_NICE);
+    } else {
+        syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, base_ioprio);
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+        if (renice) setpriority(PRIO_PROCESS, (id_t)tid, base_nice);
+    }
+}
+
+/* System-wide readings, shared by every repo and refreshed at most once
+ * per poll interval. */
+static struct {
+    pthread_mutex_t lock;
+    long stamp;
+    double psi, load;       // -1 where unavailable
+} sys = { PTHREAD_MUTEX_INITIALIZER, 0, -1, -1 };
+
+static void sys_sample(long now, double *psi, double *load){
+    pthread_mutex_lock(&sys.lock);
+    if (!sys.stamp || now - sys.stamp >= BUDGET_PRESSURE_POLL) {
+        sys.stamp = now;
+        sys.psi = sys.load = -1;
+        FILE *f = fopen("/proc/pressure/io", "r");
+        if (f) {
+            if (fscanf(f, "some avg10=%lf", &sys.psi) != 1) sys.psi = -1;
+            fclose(f);
+        }
+        double avg;
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        if (getloadavg(&avg, 1) == 1) sys.load = avg / (double)(ncpu > 0 ? ncpu : 1);
+    }
+    *psi = sys.psi;
+    *load = sys.load;
+    pthread_mutex_unlock(&sys.lock);
+}
+
+static void refill(struct budget *b, long now){
+    double dt = (double)(now - b->stamp) / 1000.0;
+    b->stamp = now;
+    // At most a second's worth saved up.
+    if (b->io_rate > 0) {
+        b->io_tokens += b->io_rate * dt;
+        if (b->io_tokens > b->io_rate) b->io_tokens = b->io_rate;
+    }
+    if (b->file_rate > 0) {
+        b->file_tokens += b->file_rate * dt;
+        if (b->file_tokens > b->file_rate) b->file_tokens = b->file_rate;
+    }
+}
+
+long budget_wait(struct budget *b, long waited){
+    long now = now_ms(), ms = 0;
+    pthread_mutex_lock(&b->lock);
+    refill(b, now);
+    if (b->io_rate > 0 && b->io_tokens < 0) ms = (long)(-b->io_tokens * 1000.0 / b->io_rate) + 1;
+    if (b->file_rate > 0 && b->file_tokens < 0) {
+        long f = (long)(-b->file_tokens * 1000.0 / b->file_rate) + 1;
+        if (f > ms) ms = f;
+    }
+    if (b->cpu_until - now > ms) ms = b->cpu_until - now;
+    pthread_mutex_unlock(&b->lock);
+    if (ms || waited >= BUDGET_MAX_PAUSE || (!b->pressure && b->load <= 0)) return ms;
+    double psi, load;
+    sys_sample(now, &psi, &load);
+    if ((b->pressure && psi >= b->pressure) || (b->load > 0 && load >= b->load)) return BUDGET_PRESSURE_POLL;
+    return 0;
+}
+
+void budget_charge(struct budget *b, size_t files, size_t bytes, long cpu_us){
+    long now = now_ms();
+    pthread_mutex_lock(&b->lock);
+    refill(b, now);
+    if (b->io_rate > 0) b->io_tokens -= (double)bytes;
+    if (b->file_rate > 0) b->file_tokens -= (double)files;
+    if (b->cpu > 0 && b->cpu < 100) {
+        // Rest so that work is cpu% of work plus rest.
+        long rest = cpu_us * (100 - b->cpu) / b->cpu / 1000;
+        b->cpu_until = (b->cpu_until > now ? b->cpu_until : now) + rest;
+    }
+    pthread_mutex_unlock(&b->lock);
+}
@@ -0,0 +1,38 @@
+#ifndef BUDGET_H
+#define BUDGET_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "config.h"
+
+/* How hard the daemon's bulk work (initial scans, rescans, reconciles,
+ * new directories) in one repo may push the machine: token buckets for
+ * bytes and files read, a CPU duty cycle, and a pause while the system is
+ * under I/O pressure or loaded. A slice is charged after it ran and the
+ * next one waits until the debt is paid off. Single-file updates are never
+ * charged or held. */
+struct budget {
+    pthread_mutex_t lock;
+    double io_rate, file_rate;      // bytes/s, files/s; 0 = unlimited
+    double io_tokens, file_tokens;  // negative by what the last slice overspent
+    long stamp;                     // last refill, ms
+    long cpu_until;                 // end of the rest owed for CPU used, ms
+    int cpu;                        // % of a CPU bulk work may use
+    int idle;                       // bulk work at idle I/O and lowest CPU priority
+    int pressure;                   // pause above this % of I/O stall (PSI avg10), 0 = off
+    double load;                    // pause above this load average per CPU, 0 = off
+};
+
+void budget_init(struct budget *b, const struct config *cfg);
+void budget_free(struct budget *b);
+/* Put the calling thread at bulk or normal I/O and CPU priority. */
+void budget_mode(const struct budget *b, bool bulk);
+/* ms before the next bulk slice may start, 0 for now. waited is how long
+ * the slice has been held already: pressure holds it for a bounded time,
+ * so bulk work still creeps on under a permanently busy machine. */
+long budget_wait(struct budget *b, long waited);
+/* Charge a finished slice: files looked at, bytes read, CPU used in us. */
+void budget_charge(struct budget *b, size_t files, size_t bytes, long cpu_us);
+long budget_cpu_us(void);           // CPU time of the calling thread
+
+#endif
@@ -0,0 +1,181 @@
+#define _GNU_SOURCE
+#include "bundle.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hash.h"
+
+#define MAGIC "codetags-snapshot"
+#define VERSION 1
+
+/* Text, one record per line:
+ *   codetags-snapshot 1 <last id>
+ *   F <size> <mtime> <flags> <hash> <path>   a file; "- - - -" if not cached
+ *   K\t<id>\t<TAG::content>           a live key of the F above it
+ * Paths below the root are relative to it. */
+
+static int hash_file(const char *path, uint64_t *out){
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    char buf[65536];
+    uint64_t h = FNV1A64_INIT;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof buf)) > 0) h = fnv1a64_update(h, buf, (size_t)n);
+    close(fd);
+    if (n < 0) return -1;
+    *out = h;
+    return 0;
+}
+
+static const char *relpath(const struct cache *c, const char *p){
+    if (c->rlen && strncmp(p, c->root, c->rlen) == 0 && p[c->rlen] == '/') return p + c->rlen + 1;
+    return p;
+}
+
+/* One F line: with its cache entry and content hash if the entry still
+ * describes the file. */
+static void put_file(FILE *f, struct cache *c, const char *apath, struct bundle_stats *bs){
+    long size, mtime;
+    struct stat st;
+    unsigned flags = 0;
+    uint64_t h;
+    if (cache_get(c, apath, &size, &mtime) == 0 && stat(apath, &st) == 0 &&
+        (flags = cache_lookup(c, apath, (long)st.st_size, (long)st.st_mtime)) && hash_file(apath, &h) == 0) {
+        fprintf(f, "F %ld %ld %u %016" PRIx64 " %s\n", size, mtime, flags, h, relpath(c, apath));
+        bs->files++;
+    } else {
+        fprintf(f, "F - - - - %s\n", relpath(c, apath));
+    }
+}
+
+struct live { struct idmap_ent *e; size_t ord; };
+
+static int cmp_live(const void *a, const void *b){
+    const struct live *x = a, *y = b;
+    size_t n = x->e->plen < y->e->plen ? x->e->plen : y->e->plen;
+    int r = memcmp(x->e->key, y->e->key, n);
+    if (!r) r = x->e->plen < y->e->plen ? -1 : x->e->plen > y->e->plen;
+    return r ? r : x->ord < y->ord ? -1 : 1;
+}
+
+int bundle_save(const char *path, struct idmap *m, struct cache *c, struct bundle_stats *bs){
+    memset(bs, 0, sizeof *bs);
+    idmap_sync(m);
+    // Live keys grouped by path, in map order within each path.
+    struct live *lv = malloc((m->nlive ? m->nlive : 1) * sizeof *lv);
+    if (!lv) return -1;
+    size_t n = 0;
+    for (size_t i = 0; i < m->n && n < m->nlive; i++)
+        if (m->order[i]->live) { lv[n].e = m->order[i]; lv[n].ord = i; n++; }
+    qsort(lv, n, sizeof *lv, cmp_live);
+
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s.XXXXXX", path) < 0) { free(lv); return -1; }
+    int fd = mkstemp(tmp);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        if (fd >= 0) { close(fd); unlink(tmp); }
+        free(tmp); free(lv);
+        return -1;
+    }
+    fchmod(fd, 0644);
+    fprintf(f, "%s %d %ld\n", MAGIC, VERSION, idmap_last_id(m));
+    struct strset done = {0};
+    char apath[PATH_MAX];
+    for (size_t i = 0; i < n; i++) {
+        const struct idmap_ent *e = lv[i].e;
+        if (!i || e->plen != lv[i-1].e->plen || memcmp(e->key, lv[i-1].e->key, e->plen) != 0) {
+            if (e->plen >= sizeof apath) continue;
+            memcpy(apath, e->key, e->plen);
+            apath[e->plen] = 0;
+            strset_add(&done, apath);
+            put_file(f, c, apath, bs);
+        }
+        fprintf(f, "K\t%s\t%s\n", e->id, e->key + e->plen + 2);
+        bs->keys++;
+    }
+    // Files without tags are worth as much: the scan skips them too.
+    for (size_t i = 0; i < c->cap; i++) {
+        const char *p = c->ents[i].path;
+        if (p && !strset_has(&done, p, strlen(p))) put_file(f, c, p, bs);
+    }
+    strset_free(&done);
+    free(lv);
+    int rc = fclose(f) == 0 && rename(tmp, path) == 0 ? 0 : -1;
+    if (rc != 0) unlink(tmp);
+    free(tmp);
+    return rc;
+}
+
+int bundle_load(const char *path, struct idmap *m, struct cache *c, struct bundle_stats *bs){
+    memset(bs, 0, sizeof *bs);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char *line = NULL, *key = NULL;
+    size_t cap = 0, kcap = 0;
+    ssize_t len;
+    int ver = 0;
+    long last = 0;
+    if ((len = getline(&line, &cap, f)) <= 0 || sscanf(line, MAGIC " %d %ld", &ver, &last) != 2 || ver != VERSION) {
+        free(line);
+        fclose(f);
+        errno = 0;              // not a snapshot
+        return -1;
+    }
+    // Keys first get numbers above the bundle's, then one lock for the lot.
+    idmap_raise_last_id(m, last);
+    state_lock(&m->st);
+    char apath[PATH_MAX];
+    size_t alen = 0;
+    int rc = 0;
+    while ((len = getline(&line, &cap, f)) > 0) {
+        if (line[len-1] == '\n') line[--len] = 0;
+        if (line[0] == 'F' && line[1] == ' ') {
+            char sz[32], mt[32], fl[16], hx[32];
+            int off = 0;
+            alen = 0;
+            if (sscanf(line + 2, "%31s %31s %15s %31s %n", sz, mt, fl, hx, &off) != 4 || !off) continue;
+            const char *rel = line + 2 + off;
+            int w = rel[0] == '/' || !c->rlen ? snprintf(apath, sizeof apath, "%s", rel)
+                                              : snprintf(apath, sizeof apath, "%s/%s", c->root, rel);
+            if (w <= 0 || (size_t)w >= sizeof apath) continue;
+            alen = (size_t)w;
+            if (sz[0] == '-') continue;
+            bs->files++;
+            struct stat st;
+            long size = strtol(sz, NULL, 10);
+            unsigned flags = (unsigned)strtoul(fl, NULL, 10);
+            uint64_t want = strtoull(hx, NULL, 16), h;
+            // Same size and content: the checkout only touched the mtime. A
+            // restore that kept mtimes, or an entry we have, needs no read.
+            if (stat(apath, &st) != 0 || (long)st.st_size != size) continue;
+            if ((long)st.st_mtime != strtol(mt, NULL, 10) && !cache_lookup(c, apath, size, (long)st.st_mtime) &&
+                (hash_file(apath, &h) != 0 || h != want)) continue;
+            if (cache_store(c, apath, size, (long)st.st_mtime, flags) == 0) bs->kept++;
+        } else if (line[0] == 'K' && line[1] == '\t' && alen) {
+            char *id = line + 2, *tab = strchr(id, '\t');
+            if (!tab) continue;
+            *tab = 0;
+            size_t need = alen + 2 + strlen(tab + 1) + 1;
+            if (need > kcap) {
+                char *nk = realloc(key, need);
+                if (!nk) { rc = -1; break; }
+                key = nk; kcap = need;
+            }
+            snprintf(key, need, "%s::%s", apath, tab + 1);
+            if (idmap_ensure_mapping(m, key, id) != 0) { rc = -1; break; }
+            bs->keys++;
+        }
+    }
+    state_unlock(&m->st);
+    free(line);
+    free(key);
+    fclose(f);
+    return rc;
+}
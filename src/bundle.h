@@ -0,0 +1,21 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+#include <stddef.h>
+#include "cache.h"
+#include "idmap.h"
+
+/* A repo's ID map and file cache in one file that does not depend on where
+ * the repo lives ("codetags snapshot save/load"): paths are relative to the
+ * root and every cached file carries a hash of its content, so a fresh
+ * checkout elsewhere, where mtimes are whatever the checkout left, can take
+ * over the cache entries of files that did not change. */
+struct bundle_stats {
+    size_t keys, files;         // live keys and cached files in the bundle
+    size_t kept;                // files whose content still matched (load)
+};
+
+int bundle_save(const char *path, struct idmap *m, struct cache *c, struct bundle_stats *bs);
+/* Merge a bundle into m and c; keys already in m keep their IDs. */
+int bundle_load(const char *path, struct idmap *m, struct cache *c, struct bundle_stats *bs);
+
+#endif
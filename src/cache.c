@@ -1,15 +1,18 @@
 #define _GNU_SOURCE
 #include "cache.h"
+#include "canon.h"
+#include "hash.h"
 #include <sys/stat.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <limits.h>
 #include <unistd.h>
+#include <errno.h>
 
 static int canon_abs(const char *in, char out[PATH_MAX]){
-    // Prefer realpath (resolves symlinks and normalizes)
-    if (realpath(in, out)) return 0;
+    // Prefer the canonical path (symlinks resolved, normalized)
+    if (canon_path(in, out) == 0) return 0;
     // Fallback: build absolute from CWD
     char cwd[PATH_MAX];
     if (!getcwd(cwd, sizeof cwd)) return -1;
@@ -17,15 +20,299 @@ static int canon_abs(const char *in, char out[PATH_MAX]){
     return 0;
 }
 
-int cache_open(struct cache *c, const char *path){
+static size_t slot(const struct cache_ent *ents, size_t cap, const char *path){
+    size_t i = (size_t)fnv1a64(path, strlen(path)) & (cap - 1);
+    while (ents[i].path && strcmp(ents[i].path, path) != 0) i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static struct cache_ent *lookup(struct cache *c, const char *apath){
+    if (!c->cap) return NULL;
+    struct cache_ent *e = &c->ents[slot(c->ents, c->cap, apath)];
+    return e->path ? e : NULL;
+}
+
+/* Empty slot i, pulling later entries of its probe run back into the hole
+ * so lookups need no tombstones. */
+static void remove_at(struct cache *c, size_t i){
+    size_t m = c->cap - 1;
+    free(c->ents[i].path);
+    c->ents[i] = (struct cache_ent){0};
+    c->len--;
+    for (size_t j = (i + 1) & m; c->ents[j].path; j = (j + 1) & m) {
+        size_t h = (size_t)fnv1a64(c->ents[j].path, strlen(c->ents[j].path)) & m;
+        // Stays if its home lies cyclically in (i, j].
+        if (i <= j ? (i < h && h <= j) : (i < h || h <= j)) continue;
+        c->ents[i] = c->ents[j];
+        c->ents[j] = (struct cache_ent){0};
+        i = j;
+    }
+}
+
+static struct cache_ent *insert(struct cache *c, const char *apath){
+    if ((c->len + 1) * 2 > c->cap) {
+        size_t ncap = c->cap ? c->cap * 2 : 256;
+        struct cache_ent *ne = calloc(ncap, sizeof *ne);
+        if (!ne) return NULL;
+        for (size_t i = 0; i < c->cap; i++)
+            if (c->ents[i].path) ne[slot(ne, ncap, c->ents[i].path)] = c->ents[i];
+        free(c->ents);
+        c->ents = ne;
+        c->cap = ncap;
+    }
+    struct cache_ent *e = &c->ents[slot(c->ents, c->cap, apath)];
+    if (!e->path) {
+        if (!(e->path = strdup(apath))) return NULL;
+        c->len++;
+    }
+    return e;
+}
+
+/* "path size mtime [flags]"; entries written before the flags column
+ * existed were only ever recorded after a parse. */
+static int read_entry(FILE *f, char path[PATH_MAX], long *size, long *mtime, unsigned *flags){
+    char fl[8];
+    if (fscanf(f, "%4095s %ld %ld", path, size, mtime) != 3) return 0;
+    int ch;
+    while ((ch = fgetc(f)) == ' ' || ch == '\t') ;
+    *flags = CACHE_PARSED;
+    if (ch != '\n' && ch != EOF) {
+        ungetc(ch, f);
+        if (fscanf(f, "%7s", fl) == 1) {
+            *flags = 0;
+            for (char *p = fl; *p; p++) {
+                if (*p == 'p') *flags |= CACHE_PARSED;
+                else if (*p == 't') *flags |= CACHE_TEXT;
+                else if (*p == 'b') *flags |= CACHE_BINARY;
+            }
+        }
+        while ((ch = fgetc(f)) != '\n' && ch != EOF) ;
+    }
+    return 1;
+}
+
+static void write_entry(const struct cache *c, FILE *f, const struct cache_ent *e){
+    const char *rel = e->path;
+    if (c->rlen && strncmp(rel, c->root, c->rlen) == 0 && rel[c->rlen] == '/') rel += c->rlen + 1;
+    char fl[4]; int n = 0;
+    if (e->flags & CACHE_PARSED) fl[n++] = 'p';
+    if (e->flags & CACHE_TEXT) fl[n++] = 't';
+    if (e->flags & CACHE_BINARY) fl[n++] = 'b';
+    fl[n] = 0;
+    fprintf(f, "%s %ld %ld %s\n", rel, e->size, e->mtime, n ? fl : "-");
+}
+
+/* Add the entries of f that are not in memory yet. */
+static void load_missing(struct cache *c, FILE *f){
+    char rp[PATH_MAX], ap[PATH_MAX];
+    long size, mtime;
+    unsigned flags;
+    while (read_entry(f, rp, &size, &mtime, &flags)) {
+        if (c->rlen && rp[0] != '/') {
+            if (snprintf(ap, sizeof ap, "%s/%s", c->root, rp) >= (int)sizeof ap) continue;
+            strcpy(rp, ap);
+        }
+        if (lookup(c, rp) || strset_has(&c->gone, rp, strlen(rp))) continue;
+        struct cache_ent *e = insert(c, rp);
+        if (!e) break;
+        e->size = size; e->mtime = mtime; e->flags = flags;
+    }
+}
+
+int cache_open(struct cache *c, const char *path, const char *root){
+    memset(c, 0, sizeof *c);
+    c->st.fd = -1;
     c->path = strdup(path);
-    FILE *f = fopen(c->path, "a");
-    if (f) fclose(f);
+    if (root && !(c->root = realpath(root, NULL))) c->root = strdup(root);
+    c->rlen = c->root ? strlen(c->root) : 0;
+    if (c->rlen == 1) { free(c->root); c->root = NULL; c->rlen = 0; }
+    state_open_near(&c->st, path);
+    FILE *f = fopen(c->path, "r");
+    if (!f) {
+        f = fopen(c->path, "a");
+        if (f) fclose(f);
+        return 0;
+    }
+    load_missing(c, f);
+    fclose(f);
     return 0;
 }
 
+/* Under the state lock: merge in what other processes saved since we
+ * loaded (our own entries win, what we dropped stays dropped), then write a private temp file and rename
+ * it over the cache. */
+int cache_save(struct cache *c){
+    if (!c->dirty) return 0;
+    state_lock(&c->st);
+    struct stat st;
+    mode_t mode = 0644;
+    FILE *in = fopen(c->path, "r");
+    if (in) {
+        if (fstat(fileno(in), &st) == 0) mode = st.st_mode & 07777;
+        load_missing(c, in);
+        fclose(in);
+    }
+    int rc = -1;
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s.XXXXXX", c->path) >= 0) {
+        int fd = mkstemp(tmp);
+        FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (out) {
+            fchmod(fd, mode);
+            for (size_t i = 0; i < c->cap; i++) if (c->ents[i].path) write_entry(c, out, &c->ents[i]);
+            rc = fclose(out) == 0 && rename(tmp, c->path) == 0 ? 0 : -1;
+        } else if (fd >= 0) {
+            close(fd);
+        }
+        if (rc != 0 && fd >= 0) unlink(tmp);
+        free(tmp);
+    }
+    state_unlock(&c->st);
+    if (rc == 0) {
+        // What we dropped is off disk now; later writers may bring it back.
+        c->dirty = 0;
+        strset_free(&c->gone);
+    }
+    return rc;
+}
+
 void cache_close(struct cache *c){
+    cache_save(c);
+    state_close(&c->st);
+    for (size_t i = 0; i < c->cap; i++) free(c->ents[i].path);
+    free(c->ents);
+    strset_free(&c->gone);
     free(c->path);
+    free(c->root);
+    memset(c, 0, sizeof *c);
+}
+
+int cache_unparse(struct cache *c, const char *apath, bool subtree){
+    size_t pl = strlen(apath);
+    int n = 0;
+    for (size_t i = 0; i < c->cap; i++) {
+        struct cache_ent *e = &c->ents[i];
+        if (!e->path || !(e->flags & CACHE_PARSED) || strncmp(e->path, apath, pl) != 0) continue;
+        if (e->path[pl] && !(subtree && e->path[pl] == '/')) continue;
+        e->flags &= ~(unsigned)CACHE_PARSED;
+        c->dirty = 1;
+        n++;
+    }
+    return n;
+}
+
+static bool below(const char *p, const char *dir, size_t dl){
+    return strncmp(p, dir, dl) == 0 && (!p[dl] || p[dl] == '/');
+}
+
+int cache_forget(struct cache *c, const char *apath, bool subtree){
+    size_t pl = strlen(apath);
+    int n = 0;
+    strset_add(&c->gone, apath);
+    if (!subtree) {
+        struct cache_ent *e = lookup(c, apath);
+        if (!e) return 0;
+        remove_at(c, (size_t)(e - c->ents));
+        c->dirty = 1;
+        return 1;
+    }
+    for (size_t i = 0; i < c->cap; i++) {
+        const char *p = c->ents[i].path;
+        if (p && below(p, apath, pl)) n++;
+    }
+    if (!n) return 0;
+    struct cache_ent *ne = calloc(c->cap, sizeof *ne);
+    if (!ne) return 0;
+    for (size_t i = 0; i < c->cap; i++) {
+        struct cache_ent e = c->ents[i];
+        if (!e.path) continue;
+        if (below(e.path, apath, pl)) {
+            strset_add(&c->gone, e.path);
+            free(e.path);
+            c->len--;
+            continue;
+        }
+        ne[slot(ne, c->cap, e.path)] = e;
+    }
+    free(c->ents);
+    c->ents = ne;
+    c->dirty = 1;
+    return n;
+}
+
+size_t cache_prune(struct cache *c){
+    size_t n = 0;
+    for (size_t i = 0; i < c->cap; i++) {
+        char *p = c->ents[i].path;
+        if (!p || access(p, F_OK) == 0 || errno != ENOENT) continue;
+        strset_add(&c->gone, p);
+        free(p);
+        c->ents[i].path = NULL;
+        c->len--;
+        n++;
+    }
+    if (!n) return 0;
+    // Rehash what is left: the holes would break the probe chains.
+    struct cache_ent *ne = calloc(c->cap, sizeof *ne);
+    if (!ne) return n;
+    for (size_t i = 0; i < c->cap; i++)
+        if (c->ents[i].path) ne[slot(ne, c->cap, c->ents[i].path)] = c->ents[i];
+    free(c->ents);
+    c->ents = ne;
+    c->dirty = 1;
+    return n;
+}
+
+/* Move the entries of from, or with subtree of everything below it, to
+ * to. Entries already at to described whatever the move replaced and are
+ * dropped. A from with no entry at all leaves the cache alone. */
+int cache_rename(struct cache *c, const char *from, const char *to, bool subtree){
+    if (!subtree) {
+        struct cache_ent *e = lookup(c, from);
+        if (!e) return 0;
+        struct cache_ent keep = *e;
+        strset_add(&c->gone, from);
+        remove_at(c, (size_t)(e - c->ents));
+        if ((e = lookup(c, to))) {
+            strset_add(&c->gone, to);
+            remove_at(c, (size_t)(e - c->ents));
+        }
+        c->dirty = 1;
+        if (!(e = insert(c, to))) return -1;
+        e->size = keep.size; e->mtime = keep.mtime; e->flags = keep.flags;
+        return 0;
+    }
+    size_t fl = strlen(from), tl = strlen(to), hit = 0;
+    for (size_t i = 0; i < c->cap; i++) {
+        const char *p = c->ents[i].path;
+        if (p && below(p, from, fl)) hit++;
+    }
+    if (!hit) return 0;
+    struct cache_ent *ne = calloc(c->cap, sizeof *ne);
+    if (!ne) return -1;
+    size_t len = 0;
+    for (size_t i = 0; i < c->cap; i++) {
+        struct cache_ent e = c->ents[i];
+        if (!e.path) continue;
+        if (below(e.path, from, fl)) {
+            char *np = NULL;
+            strset_add(&c->gone, e.path);
+            if (asprintf(&np, "%s%s", to, e.path + fl) < 0) { free(e.path); continue; }
+            free(e.path);
+            e.path = np;
+        } else if (below(e.path, to, tl)) {
+            strset_add(&c->gone, e.path);
+            free(e.path);
+            continue;
+        }
+        ne[slot(ne, c->cap, e.path)] = e;
+        len++;
+    }
+    free(c->ents);
+    c->ents = ne;
+    c->len = len;
+    c->dirty = 1;
+    return 0;
 }
 
 static int read_stat(const char *p, long *size, long *mtime){
@@ -36,28 +323,39 @@ static int read_stat(const char *p, long *size, long *mtime){
     return 0;
 }
 
+/* Flags of apath's entry if it still matches the file on disk, else 0. */
+unsigned cache_lookup(struct cache *c, const char *apath, long size, long mtime){
+    struct cache_ent *e = lookup(c, apath);
+    if (!e || e->size != size || e->mtime != mtime) return 0;
+    return e->flags;
+}
+
+/* Size and mtime of apath as of its last parse. */
+int cache_get(struct cache *c, const char *apath, long *size, long *mtime){
+    struct cache_ent *e = lookup(c, apath);
+    if (!e) return -1;
+    *size = e->size;
+    *mtime = e->mtime;
+    return 0;
+}
+
 bool cache_is_fresh(struct cache *c, const char *path){
     char apath[PATH_MAX];
     if (canon_abs(path, apath) != 0) return false;
 
     long size, mtime;
     if (read_stat(apath, &size, &mtime) != 0) return false;
+    return (cache_lookup(c, apath, size, mtime) & CACHE_PARSED) != 0;
+}
 
-    FILE *f = fopen(c->path, "r");
-    if (!f) return false;
-
-    char rp[PATH_MAX];
-    long osize, omtime;
-    int fresh = 0;
-
-    while (fscanf(f, "%4095s %ld %ld\n", rp, &osize, &omtime) == 3) {
-        if (strcmp(rp, apath) == 0) {
-            if (osize == size && omtime == mtime) fresh = 1;
-            break;
-        }
-    }
-    fclose(f);
-    return fresh;
+int cache_store(struct cache *c, const char *apath, long size, long mtime, unsigned flags){
+    struct cache_ent *e = insert(c, apath);
+    if (!e) return -1;
+    e->size = size;
+    e->mtime = mtime;
+    e->flags = flags;
+    c->dirty = 1;
+    return 0;
 }
 
 int cache_update(struct cache *c, const char *path){
@@ -66,34 +364,26 @@ int cache_update(struct cache *c, const char *path){
 
     long size, mtime;
     if (read_stat(apath, &size, &mtime) != 0) return -1;
+    return cache_store(c, apath, size, mtime, CACHE_PARSED|CACHE_TEXT);
+}
 
-    FILE *in = fopen(c->path, "r");
-    char *tmp = NULL;
-    if (asprintf(&tmp, "%s.tmp", c->path) < 0) return -1;
-    FILE *out = fopen(tmp, "w");
-    if (!out) { free(tmp); return -1; }
-
-    if (in) {
-        char rp[PATH_MAX];
-        long osize, omtime;
-        int found = 0;
-        while (fscanf(in, "%4095s %ld %ld\n", rp, &osize, &omtime) == 3) {
-            if (strcmp(rp, apath) == 0) {
-                fprintf(out, "%s %ld %ld\n", apath, size, mtime);
-                found = 1;
-            } else {
-                fprintf(out, "%s %ld %ld\n", rp, osize, omtime);
-            }
-        }
-        if (!found) fprintf(out, "%s %ld %ld\n", apath, size, mtime);
-        fclose(in);
-    } else {
-        fprintf(out, "%s %ld %ld\n", apath, size, mtime);
-    }
+/* CACHE_TEXT or CACHE_BINARY if a verdict is cached for the current
+ * version of the file, else 0. */
+int cache_class(struct cache *c, const char *path){
+    char apath[PATH_MAX];
+    if (canon_abs(path, apath) != 0) return 0;
 
-    fclose(out);
-    rename(tmp, c->path);
-    free(tmp);
-    return 0;
+    long size, mtime;
+    if (read_stat(apath, &size, &mtime) != 0) return 0;
+    return (int)(cache_lookup(c, apath, size, mtime) & (CACHE_TEXT|CACHE_BINARY));
 }
 
+int cache_set_class(struct cache *c, const char *path, int cls){
+    char apath[PATH_MAX];
+    if (canon_abs(path, apath) != 0) return -1;
+
+    long size, mtime;
+    if (read_stat(apath, &size, &mtime) != 0) return -1;
+    unsigned keep = cache_lookup(c, apath, size, mtime) & CACHE_PARSED;
+    return cache_store(c, apath, size, mtime, keep | (unsigned)cls);
+}
@@ -1,15 +1,52 @@
 #ifndef CACHE_H
 #define CACHE_H
 #include <stdbool.h>
+#include <stddef.h>
+#include "hash.h"
+#include "state.h"
 
+struct cache_ent {
+    char *path;
+    long size, mtime;
+    unsigned flags;
+};
+
+/* filecache.tsv held in memory: loaded by cache_open, written back by
+ * cache_save and cache_close. Like the ID map it stores paths below the
+ * repo root relative to it and holds them absolute in memory. */
 struct cache {
     char *path;
+    char *root;                 // resolved repo root, NULL if none
+    size_t rlen;
+    struct cache_ent *ents;     // open-addressing table keyed by path
+    size_t cap, len;
+    int dirty;
+    struct strset gone;         // removed by us: not merged back from disk
+    struct state st;            // writer lock shared with other processes
 };
 
-int cache_open(struct cache *c, const char *path);
+/* Entry flags, stored as letters in the 4th column of filecache.tsv. */
+enum { CACHE_PARSED=1, CACHE_TEXT=2, CACHE_BINARY=4 };
+
+int cache_open(struct cache *c, const char *path, const char *root);
+int cache_save(struct cache *c);
 void cache_close(struct cache *c);
 bool cache_is_fresh(struct cache *c, const char *path);
 int cache_update(struct cache *c, const char *path);
+int cache_class(struct cache *c, const char *path);
+int cache_set_class(struct cache *c, const char *path, int cls);
+int cache_rename(struct cache *c, const char *from, const char *to, bool subtree);
+/* Drop the entry of apath, or of everything below it too, for good: a
+ * file that is gone. Returns how many entries were dropped. */
+int cache_forget(struct cache *c, const char *apath, bool subtree);
+/* cache_forget every file that no longer exists; how many. */
+size_t cache_prune(struct cache *c);
+/* Forget that apath, or everything below it too, was parsed, so the next
+ * look at it reads it again. */
+int cache_unparse(struct cache *c, const char *apath, bool subtree);
+/* The same on an already canonical path with its stat taken by the caller. */
+unsigned cache_lookup(struct cache *c, const char *apath, long size, long mtime);
+int cache_store(struct cache *c, const char *apath, long size, long mtime, unsigned flags);
+int cache_get(struct cache *c, const char *apath, long *size, long *mtime);
 
 #endif
-
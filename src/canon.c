@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include "canon.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+#define CANON_MAX 65536         // directories kept; when full the table starts over
+
+struct cdir {
+    char *key;                  // absolute spelling
+    char *real;                 // what realpath made of it
+};
+
+static struct {
+    pthread_rwlock_t lock;
+    struct cdir *v;             // open addressing by key
+    size_t cap, len;
+} tab = { PTHREAD_RWLOCK_INITIALIZER, NULL, 0, 0 };
+
+static size_t slot(const struct cdir *v, size_t cap, const char *key){
+    size_t i = (size_t)fnv1a64(key, strlen(key)) & (cap - 1);
+    while (v[i].key && strcmp(v[i].key, key) != 0) i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static int under(const char *s, const char *prefix, size_t pl){
+    return strncmp(s, prefix, pl) == 0 && (s[pl] == '/' || s[pl] == 0);
+}
+
+/* Rebuild the table at cap, leaving out entries under prefix (NULL: all
+ * of them, "" none). */
+static int rehash(size_t cap, const char *prefix){
+    struct cdir *nv = calloc(cap, sizeof *nv);
+    if (!nv) return -1;
+    size_t len = 0, pl = prefix ? strlen(prefix) : 0;
+    for (size_t i = 0; i < tab.cap; i++) {
+        struct cdir *e = &tab.v[i];
+        if (!e->key) continue;
+        if (!prefix || (pl && (under(e->key, prefix, pl) || under(e->real, prefix, pl)))) {
+            free(e->key);
+            free(e->real);
+            continue;
+        }
+        nv[slot(nv, cap, e->key)] = *e;
+        len++;
+    }
+    free(tab.v);
+    tab.v = nv;
+    tab.cap = cap;
+    tab.len = len;
+    return 0;
+}
+
+/* path made absolute against the cwd, with empty and "." components
+ * dropped. -1 if it has a ".." (that is realpath's to resolve). */
+static int spell(const char *path, char out[PATH_MAX]){
+    size_t n = 0;
+    if (path[0] != '/') {
+        if (!getcwd(out, PATH_MAX)) return -1;
+        n = strlen(out);
+        if (n == 1) n = 0;      // "/"
+    }
+    for (const char *p = path; *p; ) {
+        while (*p == '/') p++;
+        const char *e = strchrnul(p, '/');
+        size_t L = (size_t)(e - p);
+        if (L == 2 && p[0] == '.' && p[1] == '.') return -1;
+        if (L && !(L == 1 && p[0] == '.')) {
+            if (n + 1 + L >= PATH_MAX) { errno = ENAMETOOLONG; return -1; }
+            out[n++] = '/';
+            memcpy(out + n, p, L);
+            n += L;
+        }
+        p = e;
+    }
+    if (!n) out[n++] = '/';
+    out[n] = 0;
+    return 0;
+}
+
+static int dir_real(const char *dir, char out[PATH_MAX]){
+    pthread_rwlock_rdlock(&tab.lock);
+    const struct cdir *e = tab.cap ? &tab.v[slot(tab.v, tab.cap, dir)] : NULL;
+    int hit = e && e->key;
+    if (hit) snprintf(out, PATH_MAX, "%s", e->real);
+    pthread_rwlock_unlock(&tab.lock);
+    if (hit) return 0;
+    if (!realpath(dir, out)) return -1;
+    pthread_rwlock_wrlock(&tab.lock);
+    int ok = 1;
+    if (tab.len >= CANON_MAX) ok = rehash(tab.cap, NULL) == 0;
+    else if ((tab.len + 1) * 2 > tab.cap) ok = rehash(tab.cap ? tab.cap * 2 : 256, "") == 0;
+    if (ok) {
+        struct cdir *ne = &tab.v[slot(tab.v, tab.cap, dir)];
+        if (!ne->key && (ne->key = strdup(dir))) {
+            if ((ne->real = strdup(out))) tab.len++;
+            else { free(ne->key); ne->key = NULL; }
+        }
+    }
+    pthread_rwlock_unlock(&tab.lock);
+    return 0;
+}
+
+int canon_path(const char *path, char out[PATH_MAX]){
+    char abs[PATH_MAX], dir[PATH_MAX];
+    struct stat st;
+    if (spell(path, abs) != 0) return realpath(path, out) ? 0 : -1;
+    if (lstat(abs, &st) != 0) return -1;
+    char *slash = strrchr(abs, '/');
+    if (S_ISLNK(st.st_mode) || slash == abs) return realpath(abs, out) ? 0 : -1;
+    *slash = 0;
+    if (dir_real(abs, dir) != 0) return -1;
+    if (snprintf(out, PATH_MAX, "%s/%s", strcmp(dir, "/") ? dir : "", slash + 1) >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+void canon_forget(const char *dir){
+    char abs[PATH_MAX];
+    if (dir && (spell(dir, abs) != 0 || strcmp(abs, "/") == 0)) dir = NULL;
+    pthread_rwlock_wrlock(&tab.lock);
+    if (tab.len) rehash(tab.cap, dir ? abs : NULL);
+    pthread_rwlock_unlock(&tab.lock);
+}
@@ -0,0 +1,16 @@
+#ifndef CANON_H
+#define CANON_H
+#include <limits.h>
+
+/* realpath() for the paths of a scan, without its lstat of every path
+ * component on each call. Resolved directories are kept in a process-wide
+ * table keyed by their absolute spelling, so a file's canonical path is
+ * its directory's plus its name, after one lstat that confirms the file
+ * exists and is not a symlink itself. Paths with ".." and symlinked files
+ * go to realpath. Safe to call from several threads. */
+int canon_path(const char *path, char out[PATH_MAX]);
+/* Drop what is known about dir and everything below it, after it was
+ * created, removed or renamed; NULL drops everything. */
+void canon_forget(const char *dir);
+
+#endif
@@ -0,0 +1,271 @@
+#define _GNU_SOURCE
+#include "check.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "canon.h"
+#include "hash.h"
+
+#define CHECK_CHUNK 16          // files a worker claims at a time
+#define CHECK_READ_MAX (256 * 1024) // read up to this size, map larger files
+
+/* A tagged comment as found in a file. */
+struct chit {
+    int tag;
+    long line;
+    char *text;
+    char id[64];                // "" without one
+    long idline;                // first line holding the ID, as md finds it
+    char *idtext;               // and that line
+};
+
+struct cfile {
+    char *path;                 // resolved; NULL if it could not be
+    struct chit *hits;
+    size_t n, cap;
+    int err;
+    int big;                    // over max_file_size: scan keeps its keys unread
+};
+
+struct crun {
+    char *const *paths;
+    struct cfile *files;
+    size_t n;
+    size_t next;                // first file not claimed yet
+    const struct parse_opts *po;
+    size_t *byname;             // files sorted by path, for md lookups
+    size_t nbyname;
+};
+
+static void on_hit(void *ud, const struct parse_hit *h){
+    struct cfile *f = ud;
+    if (f->n == f->cap) {
+        size_t cap = f->cap ? f->cap * 2 : 8;
+        struct chit *nv = realloc(f->hits, cap * sizeof *nv);
+        if (!nv) { f->err = 1; return; }
+        f->hits = nv;
+        f->cap = cap;
+    }
+    struct chit *c = &f->hits[f->n];
+    memset(c, 0, sizeof *c);
+    c->tag = h->tag;
+    c->line = h->line;
+    if (!(c->text = strndup(h->text, h->tlen))) { f->err = 1; return; }
+    if (h->id) snprintf(c->id, sizeof c->id, "%s", h->id);
+    f->n++;
+}
+
+/* The first line of buf holding each ID, the way md finds an entry when
+ * it reads the file. Every ID starts with "CT-", so one pass over those
+ * does for all of them. */
+static void locate_ids(struct cfile *f, const char *buf, size_t n){
+    size_t left = 0;
+    for (size_t i = 0; i < f->n; i++) left += f->hits[i].id[0] != 0;
+    const char *p = buf, *end = buf + n, *ls = buf;
+    long line = 1;
+    while (left && p < end) {
+        const char *ct = memmem(p, (size_t)(end - p), "CT-", 3);
+        if (!ct) break;
+        for (const char *q = p; (q = memchr(q, '\n', (size_t)(ct - q))); q++) { line++; ls = q + 1; }
+        for (size_t i = 0; i < f->n; i++) {
+            struct chit *c = &f->hits[i];
+            size_t L = strlen(c->id);
+            if (!L || c->idtext || (size_t)(end - ct) < L || memcmp(ct, c->id, L) != 0) continue;
+            const char *nl = memchr(ls, '\n', (size_t)(end - ls));
+            c->idline = line;
+            c->idtext = strndup(ls, nl ? (size_t)(nl - ls) + 1 : (size_t)(end - ls));
+            left--;
+        }
+        p = ct + 1;
+    }
+}
+
+static void check_file(struct crun *r, char *tbuf, size_t i){
+    struct cfile *f = &r->files[i];
+    char real[PATH_MAX];
+    if (canon_path(r->paths[i], real) != 0 || !(f->path = strdup(real))) { f->err = 1; return; }
+    int fd = open(f->path, O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) { if (fd >= 0) close(fd); f->err = 1; return; }
+    size_t size = (size_t)st.st_size;
+    f->big = r->po->max_size > 0 && st.st_size > r->po->max_size;
+    if (!size || f->big) { close(fd); return; }
+    // Small files are cheaper to read than to map and unmap.
+    char *buf;
+    if (size <= CHECK_READ_MAX) {
+        buf = tbuf;
+        ssize_t got = pread(fd, buf, size, 0);
+        close(fd);
+        if (got < 0) { f->err = 1; return; }
+        size = (size_t)got;
+    } else {
+        buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (buf == MAP_FAILED) { f->err = 1; return; }
+        madvise(buf, size, MADV_SEQUENTIAL);
+    }
+    if (parse_buffer_hits(f->path, buf, size, r->po, on_hit, f) == 0) locate_ids(f, buf, size);
+    if (buf != tbuf) munmap(buf, size);
+}
+
+static void *worker(void *arg){
+    struct crun *r = arg;
+    char *tbuf = malloc(CHECK_READ_MAX);
+    for (;;) {
+        size_t i = __atomic_fetch_add(&r->next, CHECK_CHUNK, __ATOMIC_RELAXED);
+        if (i >= r->n) break;
+        size_t e = i + CHECK_CHUNK < r->n ? i + CHECK_CHUNK : r->n;
+        for (; i < e; i++) {
+            if (tbuf) check_file(r, tbuf, i);
+            else r->files[i].err = 1;
+        }
+    }
+    free(tbuf);
+    return NULL;
+}
+
+static int cmp_byname(const void *a, const void *b, void *ud){
+    const struct crun *r = ud;
+    return strcmp(r->files[*(const size_t *)a].path, r->files[*(const size_t *)b].path);
+}
+
+static struct cfile *file_named(struct crun *r, const char *path){
+    size_t lo = 0, hi = r->nbyname;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        int c = strcmp(r->files[r->byname[mid]].path, path);
+        if (c == 0) return &r->files[r->byname[mid]];
+        if (c < 0) lo = mid + 1; else hi = mid;
+    }
+    return NULL;
+}
+
+/* md_locate_fn over what the scan found, so rendering reads no file. */
+static int locate(void *ud, const char *path, const char *id, const char *tag, long *line, char display[MD_TEXT_MAX]){
+    struct cfile *f = file_named(ud, path);
+    if (!f || f->err || f->big) return -1;     // read it, as the scan's rebuild does
+    for (size_t i = 0; i < f->n; i++) {
+        if (strcmp(f->hits[i].id, id) != 0) continue;
+        if (!f->hits[i].idtext) return -1;
+        char *l = strdup(f->hits[i].idtext);
+        if (!l) return -1;
+        md_entry_text(l, tag, display);
+        free(l);
+        *line = f->hits[i].idline;
+        return 1;
+    }
+    return 0;
+}
+
+enum { K_NOID, K_UNKNOWN, K_STALE, K_OUTPUT, K_UNREADABLE, K_N };
+
+struct lister {
+    FILE *out;
+    size_t max;
+    size_t count[K_N];
+};
+
+static void list(struct lister *l, int kind, const char *fmt, ...){
+    if (++l->count[kind] > l->max) return;
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(l->out, fmt, ap);
+    va_end(ap);
+}
+
+static void on_stale_output(void *ud, const char *label){
+    list(ud, K_OUTPUT, "%s: out of date\n", label);
+}
+
+int check_run(char *const *paths, size_t n, const struct parse_opts *po, struct idmap *map, struct md_out *o,
+              const struct tagset *tags, int jobs, size_t max_list, FILE *report, struct check_stats *cs){
+    memset(cs, 0, sizeof *cs);
+    struct crun r = { .paths = paths, .n = n, .po = po };
+    if (!(r.files = calloc(n ? n : 1, sizeof *r.files))) return -1;
+    if (jobs < 1) jobs = 1;
+    pthread_t *tid = calloc((size_t)jobs, sizeof *tid);
+    int started = 0;
+    for (int j = 1; tid && j < jobs; j++, started++)
+        if (pthread_create(&tid[started], NULL, worker, &r) != 0) break;
+    worker(&r);
+    for (int j = 0; j < started; j++) pthread_join(tid[j], NULL);
+    free(tid);
+
+    struct lister l = { .out = report, .max = max_list };
+    struct strset matched = {0}, checked = {0};
+    char key[PATH_MAX + 256];
+    for (size_t i = 0; i < n; i++) {
+        struct cfile *f = &r.files[i];
+        if (f->err) { list(&l, K_UNREADABLE, "%s: cannot read\n", paths[i]); continue; }
+        if (f->big) continue;
+        cs->files++;
+        strset_add(&checked, f->path);
+        const char *rel = idmap_relpath(map, f->path);
+        for (size_t k = 0; k < f->n; k++) {
+            const struct chit *c = &f->hits[k];
+            const char *tag = tags->names[c->tag];
+            cs->tags++;
+            if (!c->id[0]) { list(&l, K_NOID, "%s:%ld: %s has no ID\n", rel, c->line, tag); continue; }
+            // As the scan builds it, length limit included.
+            snprintf(key, sizeof key, "%s::%s::%s", f->path, tag, c->text);
+            const char *id = idmap_lookup(map, key);
+            if (id && strcmp(id, c->id) == 0) strset_add(&matched, key);
+            else if (id) list(&l, K_UNKNOWN, "%s:%ld: %s [%s] is [%s] in the ID map\n", rel, c->line, tag, c->id, id);
+            else list(&l, K_UNKNOWN, "%s:%ld: %s [%s] is not in the ID map\n", rel, c->line, tag, c->id);
+        }
+    }
+    // Keys of files we looked at, or that are gone, whose tag we did not
+    // find. Files outside the walk (ignored since) or over the size cap are
+    // not ours to judge.
+    for (size_t k = 0; k < map->n; k++) {
+        const struct idmap_ent *e = map->order[k];
+        if (!e->live || strset_has(&matched, e->key, strlen(e->key))) continue;
+        char path[PATH_MAX];
+        if (e->plen >= sizeof path) continue;
+        memcpy(path, e->key, e->plen);
+        path[e->plen] = 0;
+        if (!strset_has(&checked, path, e->plen) && access(path, F_OK) == 0) continue;
+        const char *tag = e->key + e->plen + 2, *text = strstr(tag, "::");
+        if (!text) continue;
+        list(&l, K_STALE, "%s: %.*s [%s] is in the ID map but not in the file\n", idmap_relpath(map, path),
+             (int)(text - tag), tag, e->id);
+    }
+    strset_free(&matched);
+    strset_free(&checked);
+
+    // Render from the same scan, without opening a source file again.
+    if ((r.byname = malloc((n ? n : 1) * sizeof *r.byname))) {
+        for (size_t i = 0; i < n; i++) if (r.files[i].path) r.byname[r.nbyname++] = i;
+        qsort_r(r.byname, r.nbyname, sizeof *r.byname, cmp_byname, &r);
+        o->locate = locate;
+        o->locate_ud = &r;
+    }
+    int rc = md_check(o, map, tags, on_stale_output, &l) < 0 ? -1 : 0;
+    o->locate = NULL;
+    o->locate_ud = NULL;
+    free(r.byname);
+
+    static const char *more[K_N] = { "tags without an ID", "tags not in the ID map", "stale ID map entries",
+                                     "stale output files", "unreadable files" };
+    for (int k = 0; k < K_N; k++)
+        if (l.count[k] > l.max) fprintf(report, "... and %zu more %s\n", l.count[k] - l.max, more[k]);
+    cs->no_id = l.count[K_NOID];
+    cs->unknown = l.count[K_UNKNOWN];
+    cs->stale = l.count[K_STALE];
+    cs->outputs = l.count[K_OUTPUT];
+    cs->unreadable = l.count[K_UNREADABLE];
+
+    for (size_t i = 0; i < n; i++) {
+        for (size_t k = 0; k < r.files[i].n; k++) { free(r.files[i].hits[k].text); free(r.files[i].hits[k].idtext); }
+        free(r.files[i].hits);
+        free(r.files[i].path);
+    }
+    free(r.files);
+    return rc;
+}
@@ -0,0 +1,24 @@
+#ifndef CHECK_H
+#define CHECK_H
+#include <stdio.h>
+#include "parse.h"
+#include "md.h"
+
+/* What a check found. */
+struct check_stats {
+    size_t files, tags;
+    size_t no_id;               // tags without an ID
+    size_t unknown;             // IDs the map does not hold for their tag
+    size_t stale;               // live map keys whose tag is gone
+    size_t outputs;             // rendered files that differ from a fresh render
+    size_t unreadable;          // files that could not be mapped
+};
+
+/* Scan the files at paths on jobs threads, reading each once, and
+ * compare what they hold with map and with o's rendered files, all in
+ * memory: nothing is written. Problems are listed on report, at most
+ * max_list of each kind. Returns -1 on error, else 0 with cs filled in. */
+int check_run(char *const *paths, size_t n, const struct parse_opts *po, struct idmap *map, struct md_out *o,
+              const struct tagset *tags, int jobs, size_t max_list, FILE *report, struct check_stats *cs);
+
+#endif
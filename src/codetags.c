@@ -7,20 +7,50 @@
 #include <unistd.h>
 #include <limits.h>
 #include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/resource.h>
 #include "fs.h"
 #include "ignore.h"
 #include "parse.h"
 #include "md.h"
 #include "idmap.h"
 #include "cache.h"
+#include "config.h"
+#include "tags.h"
+#include "sniff.h"
+#include "workq.h"
+#include "snapshot.h"
+#include "hash.h"
+#include "trigram.h"
+#include "history.h"
+#include "bundle.h"
+#include "selfwrite.h"
+#include "hot.h"
+#include "budget.h"
+#include "check.h"
+#include "canon.h"
+#include "trace.h"
+#include "lexbench.h"
 
 #define REPO_DIR ".ctags"
 #define STATE_DIR ".ctags/.state"
 #define MAP_PATH ".ctags/.state/id_map.tsv"
 #define LASTID_PATH ".ctags/.state/last_id.txt"
 #define FILECACHE_PATH ".ctags/.state/filecache.tsv"
+#define CONFIG_PATH ".ctags/config"
+#define SNAPSHOT_PATH ".ctags/.state/snapshot.tsv"
+#define RENDER_PATH ".ctags/.state/render.tsv"
+#define TRIGRAM_PATH ".ctags/.state/trigram.idx"
+#define HISTORY_DIR ".ctags/.state/history"
+#define HOT_PATH ".ctags/.state/hot.tsv"
+#define WATCHES_PATH ".ctags/.state/watches.tsv"
 #define MD_PATH "codetags.md"
 
+#define CHECK_LIST 20            // problems of each kind codetags check lists
+
 #define GLOBAL_DIR ".ctags"
 #define GLOBAL_REGISTRY "registered_repos.txt"
 
@@ -30,21 +60,70 @@ static void usage(void) {
         "Usage:\n"
         "  codetags init\n"
         "  codetags scan <path>\n"
+        "  codetags scan --files-from <file|->\n"
+        "                          (only the files listed, one per line or\n"
+        "                          NUL-separated; for hooks and editors)\n"
         "  codetags reindex\n"
-        "  codetags watch   (system-wide; watches all registered repos)\n"
+        "  codetags gc             (drop stale keys and compact the ID map)\n"
+        "  codetags check [-j N]   (read-only: fail if tags lack IDs or the ID map\n"
+        "                          or codetags.md are out of date; for CI)\n"
+        "  codetags history [--since T] [--until T] [--tag TAG]\n"
+        "                          (tag lifecycle events; T is a date, 7d, @epoch)\n"
+        "  codetags snapshot save|load <file>\n"
+        "                          (ID map and file cache in one file, to warm-start\n"
+        "                          a checkout of the repo at any path)\n"
+        "  codetags grep [-E] [-i] [-t TAG] <pattern>\n"
+        "                          (search tag text in all registered repos;\n"
+        "                          -E for an extended regex)\n"
+        "  codetags status         (registered repos and files the daemon throttles)\n"
+        "  codetags watch [-j N] [--record <trace>]\n"
+        "                          (system-wide; watches all registered repos\n"
+        "                          with N worker threads, default min(4, CPUs);\n"
+        "                          --record writes every event to trace)\n"
+        "  codetags replay [--max] [-j N] [--repo <root>] <trace>\n"
+        "                          (feed a recorded trace to a copy of the repo in\n"
+        "                          the current directory and report throughput,\n"
+        "                          latency and work; --max: no pauses)\n"
+        "  codetags bench [MB]     (comment lexer throughput per syntax over\n"
+        "                          generated code, MB per language, default 16)\n"
     );
 }
 
-static int ensure_repo_workspace(void) {
-    if (mkdir(REPO_DIR, 0777) && errno != EEXIST) return -1;
-    if (mkdir(STATE_DIR, 0777) && errno != EEXIST) return -1;
-    FILE *f;
-    f = fopen(MAP_PATH, "a"); if (!f) return -1; fclose(f);
-    f = fopen(LASTID_PATH, "a"); if (!f) return -1; fclose(f);
-    f = fopen(FILECACHE_PATH, "a"); if (!f) return -1; fclose(f);
+/* root/rel in out; -1 if it does not fit. */
+static int repo_file(char out[PATH_MAX], const char *root, const char *rel) {
+    return snprintf(out, PATH_MAX, "%s/%s", root, rel) < PATH_MAX ? 0 : -1;
+}
+
+/* Load .ctags/config of the repo at root and compile its tag set and, when
+ * po is given, its file classifier. */
+static int load_config(const char *root, struct config *cfg, struct tagset *tags, struct sniffer *sn, struct parse_opts *po) {
+    char path[PATH_MAX];
+    if (repo_file(path, root, CONFIG_PATH) != 0) return -1;
+    config_load(cfg, path);
+    if (tagset_build(tags, cfg->tags, cfg->ntags) != 0) { config_free(cfg); return -1; }
+    if (po) {
+        if (sniffer_init(sn, cfg) != 0) { sniffer_free(sn); tagset_free(tags); config_free(cfg); return -1; }
+        *po = (struct parse_opts){ .tags = tags, .sniff = sn, .max_size = cfg->max_file_size,
+                                   .uring = cfg->io_uring };
+    }
+    return 0;
+}
+
+static int ensure_repo_workspace(const char *root, const struct tagset *tags) {
+    char p[PATH_MAX];
+    if (repo_file(p, root, REPO_DIR) != 0 || (mkdir(p, 0777) && errno != EEXIST)) return -1;
+    if (repo_file(p, root, STATE_DIR) != 0 || (mkdir(p, 0777) && errno != EEXIST)) return -1;
+    if (repo_file(p, root, CONFIG_PATH) != 0 || (config_write_default(p) != 0 && errno != EEXIST)) return -1;
+    const char *const touch[] = { MAP_PATH, LASTID_PATH, FILECACHE_PATH };
+    for (size_t i = 0; i < sizeof touch / sizeof *touch; i++) {
+        FILE *f;
+        if (repo_file(p, root, touch[i]) != 0 || !(f = fopen(p, "a"))) return -1;
+        fclose(f);
+    }
     struct stat st;
-    if (stat(MD_PATH, &st) != 0) {
-        if (md_initialize(MD_PATH) != 0) {
+    if (repo_file(p, root, MD_PATH) != 0) return -1;
+    if (stat(p, &st) != 0) {
+        if (md_initialize(p, tags) != 0) {
             fprintf(stderr, "Failed to initialize %s\n", MD_PATH);
             return -1;
         }
@@ -60,13 +139,20 @@ static int get_home(char home[PATH_MAX]) {
     return 0;
 }
 
+static int registry_path(char out_path[PATH_MAX]) {
+    char home[PATH_MAX];
+    if (get_home(home) != 0) return -1;
+    if (snprintf(out_path, PATH_MAX, "%s/%s/%s", home, GLOBAL_DIR, GLOBAL_REGISTRY) >= PATH_MAX) return -1;
+    return 0;
+}
+
 static int ensure_global_dirs(char out_path[PATH_MAX]) {
     char home[PATH_MAX];
     if (get_home(home) != 0) return -1;
     char dir[PATH_MAX];
-    snprintf(dir, sizeof dir, "%s/%s", home, GLOBAL_DIR);
+    if (snprintf(dir, sizeof dir, "%s/%s", home, GLOBAL_DIR) >= (int)sizeof dir) return -1;
     if (mkdir(dir, 0777) && errno != EEXIST) return -1;
-    snprintf(out_path, PATH_MAX, "%s/%s/%s", home, GLOBAL_DIR, GLOBAL_REGISTRY);
+    if (snprintf(out_path, PATH_MAX, "%s/%s/%s", home, GLOBAL_DIR, GLOBAL_REGISTRY) >= PATH_MAX) return -1;
     FILE *f = fopen(out_path, "a");
     if (!f) return -1;
     fclose(f);
@@ -78,6 +164,24 @@ static int repo_root_path(char out[PATH_MAX]) {
     return 0;
 }
 
+/* Output layout of the repo at root. */
+static int output_open(struct md_out *o, const struct config *cfg, const char *root) {
+    char state[PATH_MAX];
+    if (snprintf(state, sizeof state, "%s/%s", root, RENDER_PATH) >= (int)sizeof state) return -1;
+    return md_out_init(o, cfg, root, state);
+}
+
+/* Log the lifecycle of the tags that map's writes touch, for the repo at
+ * root. */
+static int history_attach(struct history *h, struct idmap *map, const struct config *cfg, const char *root) {
+    char dir[PATH_MAX];
+    *h = (struct history){ .fd = -1, .ifd = -1, .day = -1 };
+    if (snprintf(dir, sizeof dir, "%s/%s", root, HISTORY_DIR) >= (int)sizeof dir) return -1;
+    if (history_open(h, dir, root, cfg->history_days) != 0) return -1;
+    map->hist = h;
+    return 0;
+}
+
 static int registry_contains(const char *registry, const char *repo) {
     FILE *f = fopen(registry, "r");
     if (!f) return 0;
@@ -104,7 +208,13 @@ static int registry_add_repo(const char *repo) {
 }
 
 static int cmd_init(void) {
-    if (ensure_repo_workspace() != 0) {
+    struct config cfg;
+    struct tagset tags;
+    if (load_config(".", &cfg, &tags, NULL, NULL) != 0) { fprintf(stderr, "Failed to load config\n"); return 1; }
+    int rc = ensure_repo_workspace(".", &tags);
+    tagset_free(&tags);
+    config_free(&cfg);
+    if (rc != 0) {
         perror("init");
         return 1;
     }
@@ -120,122 +230,973 @@ static int cmd_init(void) {
     return 0;
 }
 
-static int onfile_parse_repo(const char *path, struct ignore *ig, void *a, void *b, void *c) {
-    (void)ig; (void)a;
-    return parse_file_inplace(path, (struct idmap*)b, (struct cache*)c);
+struct pathlist { char **v; size_t n, cap; };
+
+/* Collects into a; with an md_out in b, its rendered files are left out. */
+static int onfile_list(const char *path, struct ignore *ig, void *a, void *b, void *c) {
+    (void)ig; (void)c;
+    struct pathlist *l = a;
+    if (b && md_is_output(b, path)) return 0;
+    if (l->n == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 256;
+        char **nv = realloc(l->v, cap * sizeof *nv);
+        if (!nv) return -1;
+        l->v = nv;
+        l->cap = cap;
+    }
+    l->v[l->n++] = strdup(path);
+    return 0;
+}
+
+/* Canonical form of a path that may no longer exist, matching the
+ * realpath-based keys of the ID map: resolve the parent, keep the name. */
+static int canon_gone(const char *path, char out[PATH_MAX]) {
+    char dir[PATH_MAX], rdir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    const char *base = slash ? slash + 1 : path;
+    size_t dl = slash ? (size_t)(slash - path) : 0;
+    if (!slash) strcpy(dir, ".");
+    else if (dl == 0) strcpy(dir, "/");
+    else if (dl < sizeof dir) { memcpy(dir, path, dl); dir[dl] = 0; }
+    else return -1;
+    if (!*base || !realpath(dir, rdir)) return -1;
+    if (snprintf(out, PATH_MAX, "%s/%s", strcmp(rdir, "/") ? rdir : "", base) >= PATH_MAX) return -1;
+    return 0;
 }
 
-static int cmd_scan(const char *root) {
-    if (ensure_repo_workspace() != 0) { perror("scan"); return 1; }
-    struct ignore ig = {0};
-    ignore_load(&ig, ".ctagsignore");
+/* Paths from a file or "-" for stdin, NUL-separated if there is a NUL in
+ * it (git ... -z), else one per line. */
+static int read_list(const char *src, struct pathlist *l) {
+    FILE *f = strcmp(src, "-") == 0 ? stdin : fopen(src, "r");
+    if (!f) return -1;
+    char *buf = NULL;
+    size_t n = 0, cap = 0;
+    int rc = 0;
+    for (;;) {
+        if (cap - n < 4096) {       // room for the terminator too
+            char *nb = realloc(buf, cap = cap ? cap * 2 : 8192);
+            if (!nb) { rc = -1; break; }
+            buf = nb;
+        }
+        size_t got = fread(buf + n, 1, cap - n - 1, f);
+        if (got == 0) break;
+        n += got;
+    }
+    if (ferror(f)) rc = -1;
+    if (f != stdin) fclose(f);
+    char sep = rc == 0 && memchr(buf, 0, n) ? 0 : '\n';
+    for (char *p = buf, *end = buf + n; rc == 0 && p < end; ) {
+        char *e = memchr(p, sep, (size_t)(end - p));
+        if (!e) e = end;
+        *e = 0;
+        if (e > p && e[-1] == '\r') e[-1] = 0;
+        if (*p && onfile_list(p, NULL, l, NULL, NULL) != 0) rc = -1;
+        p = e + 1;
+    }
+    free(buf);
+    return rc;
+}
+
+/* Drop the keys of files below dir (all of them for NULL) that are
+ * ignored now, and their cache entries, so they are read again should
+ * that change back. Returns how many files lost keys. */
+static size_t drop_ignored(struct idmap *map, struct cache *fc, struct ignore *ig, const char *dir) {
+    char cdir[PATH_MAX];
+    size_t dl = 0, n = 0, dropped = 0;
+    if (dir) {
+        if (canon_path(dir, cdir) != 0) return 0;
+        dl = strlen(cdir);
+    }
+    char **paths = idmap_live_paths(map, &n);
+    for (size_t i = 0; i < n; i++) {
+        const char *p = paths[i];
+        if (dir && (strncmp(p, cdir, dl) != 0 || p[dl] != '/')) { free(paths[i]); continue; }
+        if (ignore_match(ig, idmap_relpath(map, p), false) && idmap_forget(map, p, false) > 0) {
+            cache_forget(fc, p, false);
+            dropped++;
+        }
+        free(paths[i]);
+    }
+    free(paths);
+    return dropped;
+}
+
+/* With list, only the files named in it (from read_list) instead of a
+ * walk of root: a file that is gone has its keys dropped, anything else
+ * is parsed if it is not ignored. The cost follows the list, not the
+ * repo. */
+static int cmd_scan(const char *root, const char *list) {
+    struct config cfg;
+    struct tagset tags;
+    struct sniffer sn;
+    struct parse_opts po;
+    if (load_config(".", &cfg, &tags, &sn, &po) != 0) { fprintf(stderr, "Failed to load config\n"); return 1; }
+    if (ensure_repo_workspace(".", &tags) != 0) { perror("scan"); return 1; }
     struct idmap map = {0};
-    if (idmap_open(&map, MAP_PATH, LASTID_PATH) != 0) {
+    char here[PATH_MAX];
+    if (repo_root_path(here) != 0 || idmap_open(&map, MAP_PATH, LASTID_PATH, here) != 0) {
         fprintf(stderr, "Failed to open id map\n"); return 1;
     }
+    struct ignore ig = {0};
+    ignore_load(&ig, here, cfg.gitignore);
     struct cache fc = {0};
-    cache_open(&fc, FILECACHE_PATH);
+    cache_open(&fc, FILECACHE_PATH, here);
+    struct md_out out;
+    output_open(&out, &cfg, here);
+    struct history hist;
+    history_attach(&hist, &map, &cfg, here);
 
-    int rc = fs_walk_files(root, &ig, onfile_parse_repo, NULL, &map, &fc);
-    if (rc != 0) fprintf(stderr, "Walk errors encountered\n");
-    md_rebuild(MD_PATH, &map);
+    // Walk first, then parse the whole list so its reads can be batched.
+    struct pathlist files = {0};
+    int rc = 0;
+    if (!list) {
+        if (fs_walk_files(root, &ig, onfile_list, &files, &out, NULL) != 0) fprintf(stderr, "Walk errors encountered\n");
+        drop_ignored(&map, &fc, &ig, root);
+    } else if (read_list(list, &files) != 0) {
+        fprintf(stderr, "scan: cannot read %s: %s\n", list, strerror(errno));
+        rc = 1;
+    } else {
+        size_t keep = 0;
+        char gone[PATH_MAX];
+        for (size_t i = 0; i < files.n; i++) {
+            char *p = files.v[i];
+            if (access(p, F_OK) != 0 && errno == ENOENT) {
+                if (canon_gone(p, gone) == 0) {
+                    idmap_forget(&map, gone, false);
+                    cache_forget(&fc, gone, false);
+                }
+                free(p);
+            } else if (!fs_should_parse_file(p, &ig) || md_is_output(&out, p)) {
+                free(p);
+            } else {
+                files.v[keep++] = p;
+            }
+        }
+        files.n = keep;
+    }
+    parse_files(files.v, files.n, &po, &map, &fc);
+    for (size_t i = 0; i < files.n; i++) free(files.v[i]);
+    free(files.v);
+    if (idmap_needs_compact(&map)) idmap_compact(&map);
+    md_rebuild(&out, &map, &tags, &fc);
+    tri_refresh(TRIGRAM_PATH, &map);
+    md_out_free(&out);
     idmap_close(&map);
+    history_close(&hist);
     cache_close(&fc);
     ignore_free(&ig);
-    return 0;
+    sniffer_free(&sn);
+    tagset_free(&tags);
+    config_free(&cfg);
+    return rc;
+}
+
+/* Exit status 0 if the repo is up to date, 1 if not, 2 if it cannot be
+ * checked. */
+static int cmd_check(int argc, char **argv) {
+    int jobs = 0;
+    for (int i = 2; i < argc; i++) {
+        if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) jobs = atoi(argv[++i]);
+        else { fprintf(stderr, "unknown check option: %s\n", argv[i]); return 2; }
+    }
+    if (jobs <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        jobs = n > 0 ? (int)n : 1;
+    }
+    struct config cfg;
+    struct tagset tags;
+    struct sniffer sn;
+    struct parse_opts po;
+    if (load_config(".", &cfg, &tags, &sn, &po) != 0) { fprintf(stderr, "Failed to load config\n"); return 2; }
+    struct idmap map;
+    char here[PATH_MAX];
+    if (repo_root_path(here) != 0 || idmap_open_ro(&map, MAP_PATH, here) != 0) {
+        fprintf(stderr, "check: no ID map here (run codetags init and codetags scan first)\n");
+        sniffer_free(&sn); tagset_free(&tags); config_free(&cfg);
+        return 2;
+    }
+    struct md_out out;
+    output_open(&out, &cfg, here);
+    struct ignore ig = {0};
+    ignore_load(&ig, here, cfg.gitignore);
+
+    struct pathlist files = {0};
+    if (fs_walk_files(here, &ig, onfile_list, &files, &out, NULL) != 0) fprintf(stderr, "Walk errors encountered\n");
+    int rc = 0;
+    struct check_stats cs;
+    if (check_run(files.v, files.n, &po, &map, &out, &tags, jobs, CHECK_LIST, stdout, &cs) != 0) rc = 2;
+    if (rc == 0) {
+        size_t bad = cs.no_id + cs.unknown + cs.stale + cs.outputs + cs.unreadable;
+        printf("check: %zu files, %zu tags: ", cs.files, cs.tags);
+        if (!bad) printf("up to date\n");
+        else printf("%zu without an ID, %zu not in the ID map, %zu stale in the ID map, %zu output files out of date"
+                    "%s\n", cs.no_id, cs.unknown, cs.stale, cs.outputs, cs.unreadable ? ", some files unreadable" : "");
+        rc = bad ? 1 : 0;
+    } else {
+        fprintf(stderr, "check: failed to walk or check the repo\n");
+    }
+    for (size_t i = 0; i < files.n; i++) free(files.v[i]);
+    free(files.v);
+    md_out_free(&out);
+    idmap_close(&map);
+    ignore_free(&ig);
+    sniffer_free(&sn);
+    tagset_free(&tags);
+    config_free(&cfg);
+    return rc;
 }
 
 static int cmd_reindex(void) {
-    if (ensure_repo_workspace() != 0) { perror("reindex"); return 1; }
+    struct config cfg;
+    struct tagset tags;
+    if (load_config(".", &cfg, &tags, NULL, NULL) != 0) { fprintf(stderr, "Failed to load config\n"); return 1; }
+    if (ensure_repo_workspace(".", &tags) != 0) { perror("reindex"); return 1; }
     struct idmap map = {0};
-    if (idmap_open(&map, MAP_PATH, LASTID_PATH) != 0) {
+    char here[PATH_MAX];
+    if (repo_root_path(here) != 0 || idmap_open(&map, MAP_PATH, LASTID_PATH, here) != 0) {
         fprintf(stderr, "Failed to open id map\n"); return 1;
     }
-    md_rebuild(MD_PATH, &map);
+    // No file cache: every output file is rendered again.
+    struct md_out out;
+    output_open(&out, &cfg, here);
+    md_rebuild(&out, &map, &tags, NULL);
+    tri_refresh(TRIGRAM_PATH, &map);
+    md_out_free(&out);
     idmap_close(&map);
+    tagset_free(&tags);
+    config_free(&cfg);
     puts("Reindexed codetags.");
     return 0;
 }
 
+/* Tombstone the keys of files that are gone and read the rest, so keys
+ * left behind by edited tags go too, then rewrite the map with only its
+ * live pairs. No source file is written. The file cache loses its gone
+ * files as well. */
+static int cmd_gc(void) {
+    struct config cfg;
+    struct tagset tags;
+    struct sniffer sn;
+    struct parse_opts po;
+    if (load_config(".", &cfg, &tags, &sn, &po) != 0) { fprintf(stderr, "Failed to load config\n"); return 1; }
+    if (ensure_repo_workspace(".", &tags) != 0) { perror("gc"); return 1; }
+    struct idmap map = {0};
+    char here[PATH_MAX];
+    if (repo_root_path(here) != 0 || idmap_open(&map, MAP_PATH, LASTID_PATH, here) != 0) {
+        fprintf(stderr, "Failed to open id map\n"); return 1;
+    }
+    struct cache fc = {0};
+    cache_open(&fc, FILECACHE_PATH, here);
+    struct history hist;
+    history_attach(&hist, &map, &cfg, here);
+
+    size_t npaths = 0, gone = 0;
+    char **paths = idmap_live_paths(&map, &npaths);
+    for (size_t i = 0; i < npaths; i++) {
+        if (access(paths[i], F_OK) != 0 && errno == ENOENT) {
+            idmap_forget(&map, paths[i], false);
+            gone++;
+        } else {
+            parse_file_prune(paths[i], &po, &map);
+        }
+        free(paths[i]);
+    }
+    free(paths);
+    size_t pruned = cache_prune(&fc);
+    size_t records = map.records;
+    int rc = idmap_compact(&map);
+    if (rc != 0) perror("gc");
+    struct md_out out;
+    output_open(&out, &cfg, here);
+    md_rebuild(&out, &map, &tags, &fc);
+    tri_refresh(TRIGRAM_PATH, &map);
+    md_out_free(&out);
+    if (rc == 0) printf("Compacted id map: %zu records -> %zu live keys (%zu files gone); %zu cache entries dropped.\n",
+                        records, map.nlive, gone, pruned);
+    idmap_close(&map);
+    history_close(&hist);
+    cache_close(&fc);
+    sniffer_free(&sn);
+    tagset_free(&tags);
+    config_free(&cfg);
+    return rc == 0 ? 0 : 1;
+}
+
+/* "2026-03-01", "2026-03-01T14:00[:SS]" or "2026-03-01 14:00" in local
+ * time, "7d" / "12h" / "30m" / "2w" ago, "@<epoch>" or "now". A bare date
+ * as an upper bound means the end of that day. */
+static int parse_when(const char *v, int upper, time_t *out) {
+    time_t now = time(NULL);
+    char *end;
+    if (strcmp(v, "now") == 0) { *out = now; return 0; }
+    if (v[0] == '@') {
+        long long t = strtoll(v + 1, &end, 10);
+        if (end == v + 1 || *end) return -1;
+        *out = (time_t)t; return 0;
+    }
+    long n = strtol(v, &end, 10);
+    if (end != v && end[0] && !end[1] && n >= 0) {
+        long unit = end[0] == 'm' ? 60 : end[0] == 'h' ? 3600 : end[0] == 'd' ? 86400 : end[0] == 'w' ? 604800 : 0;
+        if (!unit) return -1;
+        *out = now - (time_t)n * unit; return 0;
+    }
+    struct tm tm = {0};
+    int used = 0;
+    if (sscanf(v, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &used) != 3) return -1;
+    int timed = 0;
+    if (v[used] == 'T' || v[used] == ' ') {
+        int more = 0;
+        if (sscanf(v + used + 1, "%d:%d%n:%d%n", &tm.tm_hour, &tm.tm_min, &more, &tm.tm_sec, &more) < 2) return -1;
+        used += 1 + more;
+        timed = 1;
+    }
+    if (v[used]) return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == (time_t)-1) return -1;
+    *out = upper && !timed ? t + 86399 : t;
+    return 0;
+}
+
+struct history_tally { size_t count[HIST_RESOLVED + 1]; };
+
+static void history_print(void *ud, const struct hist_event *ev) {
+    struct history_tally *t = ud;
+    struct tm tm;
+    char when[32];
+    localtime_r(&ev->ts, &tm);
+    strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s  %-8s  [%s] %s  %s\n", when, history_type_name(ev->type), ev->id, ev->tag, ev->path);
+    t->count[ev->type]++;
+}
+
+/* Save or load the repo's portable state. A load renders the output again,
+ * like reindex, and leaves files whose content changed to the next scan. */
+static int cmd_snapshot(int argc, char **argv) {
+    bool save = argc == 4 && strcmp(argv[2], "save") == 0;
+    if (argc != 4 || (!save && strcmp(argv[2], "load") != 0)) {
+        fprintf(stderr, "snapshot: usage: codetags snapshot save|load <file>\n");
+        return 1;
+    }
+    struct config cfg;
+    struct tagset tags;
+    if (load_config(".", &cfg, &tags, NULL, NULL) != 0) { fprintf(stderr, "Failed to load config\n"); return 1; }
+    if (ensure_repo_workspace(".", &tags) != 0) { perror("snapshot"); return 1; }
+    struct idmap map = {0};
+    struct cache cache;
+    char here[PATH_MAX];
+    if (repo_root_path(here) != 0 || idmap_open(&map, MAP_PATH, LASTID_PATH, here) != 0) {
+        fprintf(stderr, "Failed to open id map\n"); return 1;
+    }
+    cache_open(&cache, FILECACHE_PATH, here);
+    struct bundle_stats bs;
+    errno = 0;
+    int rc = save ? bundle_save(argv[3], &map, &cache, &bs) : bundle_load(argv[3], &map, &cache, &bs);
+    if (rc != 0) {
+        fprintf(stderr, "snapshot: %s %s: %s\n", argv[2], argv[3], errno ? strerror(errno) : "bad snapshot");
+    } else if (save) {
+        printf("Saved %zu keys and %zu cached files to %s.\n", bs.keys, bs.files, argv[3]);
+    } else {
+        struct md_out out;
+        output_open(&out, &cfg, here);
+        md_rebuild(&out, &map, &tags, NULL);
+        tri_refresh(TRIGRAM_PATH, &map);
+        md_out_free(&out);
+        printf("Loaded %zu keys; %zu of %zu cached files still match.\n", bs.keys, bs.kept, bs.files);
+    }
+    cache_close(&cache);
+    idmap_close(&map);
+    tagset_free(&tags);
+    config_free(&cfg);
+    return rc != 0;
+}
+
+/* Lifecycle events of the current repo's tags in a time range, then how
+ * many of each kind. */
+static int cmd_history(int argc, char **argv) {
+    time_t since = 0, until = (time_t)UINT32_MAX;
+    const char *tag = NULL;
+    for (int i = 2; i < argc; i++) {
+        const char *opt = argv[i], *val = i + 1 < argc ? argv[i+1] : NULL;
+        if (!val) { fprintf(stderr, "history: %s needs a value\n", opt); return 1; }
+        if (strcmp(opt, "--since") == 0 && parse_when(val, 0, &since) == 0) i++;
+        else if (strcmp(opt, "--until") == 0 && parse_when(val, 1, &until) == 0) i++;
+        else if (strcmp(opt, "--tag") == 0) { tag = val; i++; }
+        else { fprintf(stderr, "history: bad option %s %s\n", opt, val); return 1; }
+    }
+    struct history_tally t = {0};
+    if (history_query(HISTORY_DIR, since, until, tag, history_print, &t) != 0) { perror("history"); return 1; }
+    printf("%zu created, %zu edited, %zu moved, %zu resolved\n", t.count[HIST_CREATED], t.count[HIST_EDITED],
+           t.count[HIST_MOVED], t.count[HIST_RESOLVED]);
+    return 0;
+}
+
 /* ===== System-wide watcher support ===== */
 
+/* Daemon work items, queued per repo on the shared work queue. Single-file
+ * events and removals are interactive; directory and whole-repo walks are
+ * bulk and run in slices so they never hold a worker for long. */
+enum { TASK_FILE=1, TASK_GONE_DIR, TASK_RENAME, TASK_RENAME_DIR, TASK_DIR, TASK_RESCAN, TASK_RECONCILE, TASK_IGNORE };
+
+#define REPO_QUEUE_CAP 1024
+#define RESCAN_SLICE 128
+#define CACHE_SAVE_SECS 30
+#define BULK_SLEEP_MS 100           // a held bulk slice looks for other work this often
+
+static volatile sig_atomic_t stop_requested;
+static FILE *record;                // watch --record: every event, as it comes
+static long long record_t0;
+static int use_fanotify = 1;        // off for replay: its events come from the trace
+
 typedef struct RepoCtx {
     char root[PATH_MAX];
+    struct config cfg;
+    struct tagset tags;
+    struct sniffer sn;
+    struct parse_opts po;
     struct ignore ig;
     struct idmap map;
     struct cache fc;
+    struct md_out out;
+    struct history hist;
+    struct selfwrites self;         // our own writes into the tree
+    struct hotset hot;              // event rates; main thread only
+    char watches[128];              // watch budget as last published; main thread only
+    struct budget budget;           // limits on bulk work
+    struct workq *wq;
     fs_watch_context wctx;
+    pthread_mutex_t wlock;          // wctx: main thread, reconciling worker
+    struct workq_queue q;
+    /* Worker-side state; only the worker holding q touches it. */
+    int dirty;                      // parsed since the last md_rebuild
+    time_t saved;                   // last cache_save
+    char **scan;                    // files of the bulk walk in progress
+    size_t nscan, scan_cap, scan_pos;
+    size_t nseen, nread;            // files and dirs bulk work looked at, bytes parsed
+    struct snapshot snap;           // directories still to reconcile
+    struct strset snap_set;
+    struct strset snap_changed;     // snapshot directories whose mtime moved
+    struct strset dirs;             // every directory bulk work found, for the next snapshot
+    size_t snap_pos;
     int initialized;
 } RepoCtx;
 
-static int repoctx_init(RepoCtx *r, const char *root) {
+/* Set up state and watches; the initial scan is queued, not run here. With
+ * a snapshot from the last clean shutdown the repo is ready at once: the
+ * snapshot's directories are watched without walking the tree and a
+ * background reconcile picks up whatever changed while we were down. */
+static int repoctx_init(RepoCtx *r, const char *root, struct workq *wq) {
     memset(r, 0, sizeof *r);
     strncpy(r->root, root, sizeof(r->root)-1);
-    char oldcwd[PATH_MAX];
-    if (!getcwd(oldcwd, sizeof oldcwd)) oldcwd[0] = 0;
-    if (chdir(root) != 0) return -1;
-    if (ensure_repo_workspace() != 0) { if (oldcwd[0]) chdir(oldcwd); return -1; }
-    ignore_load(&r->ig, ".ctagsignore");
-    if (idmap_open(&r->map, MAP_PATH, LASTID_PATH) != 0) { if (oldcwd[0]) chdir(oldcwd); return -1; }
-    cache_open(&r->fc, FILECACHE_PATH);
-    if (fs_watch_init(&r->wctx, root, &r->ig) != 0) {
-        idmap_close(&r->map); cache_close(&r->fc); ignore_free(&r->ig);
-        if (oldcwd[0]) chdir(oldcwd); return -1;
-    }
-    fs_walk_files(root, &r->ig, onfile_parse_repo, NULL, &r->map, &r->fc);
-    md_rebuild(MD_PATH, &r->map);
-    if (oldcwd[0]) chdir(oldcwd);
+    // Paths from the root, not the cwd: a worker sharing ours moves it.
+    char map[PATH_MAX], lastid[PATH_MAX], fc[PATH_MAX], snap[PATH_MAX];
+    if (repo_file(map, root, MAP_PATH) != 0 || repo_file(lastid, root, LASTID_PATH) != 0 ||
+        repo_file(fc, root, FILECACHE_PATH) != 0 || repo_file(snap, root, SNAPSHOT_PATH) != 0) return -1;
+    if (load_config(root, &r->cfg, &r->tags, &r->sn, &r->po) != 0) return -1;
+    if (ensure_repo_workspace(root, &r->tags) != 0) {
+        sniffer_free(&r->sn); tagset_free(&r->tags); config_free(&r->cfg);
+        return -1;
+    }
+    ignore_load(&r->ig, r->root, r->cfg.gitignore);
+    if (idmap_open(&r->map, map, lastid, r->root) != 0) {
+        sniffer_free(&r->sn); tagset_free(&r->tags); config_free(&r->cfg); ignore_free(&r->ig);
+        return -1;
+    }
+    cache_open(&r->fc, fc, r->root);
+    output_open(&r->out, &r->cfg, r->root);
+    history_attach(&r->hist, &r->map, &r->cfg, r->root);
+    selfw_init(&r->self);
+    r->po.self = r->out.self = &r->self;
+    hot_init(&r->hot, r->cfg.hot_rate, r->cfg.hot_max_delay);
+    budget_init(&r->budget, &r->cfg);
+    r->po.nread = &r->nread;
+    r->wq = wq;
+    int warm = snapshot_load(&r->snap, snap) == 0;
+    // A fanotify mark needs no directory list; inotify is the fallback.
+    int wrc = use_fanotify && r->cfg.fanotify ? fs_watch_init_fan(&r->wctx, root, &r->ig) : -1;
+    if (warm) {
+        char **dirs = malloc(r->snap.n * sizeof *dirs);
+        for (size_t i = 0; dirs && i < r->snap.n; i++) {
+            dirs[i] = r->snap.dirs[i].path;
+            strset_add(&r->snap_set, dirs[i]);
+        }
+        if (wrc != 0) wrc = dirs ? fs_watch_init_dirs(&r->wctx, root, dirs, r->snap.n, r->cfg.max_watches) : -1;
+        free(dirs);
+    } else if (wrc != 0) {
+        wrc = fs_watch_init(&r->wctx, root, &r->ig, r->cfg.max_watches);
+    }
+    if (wrc != 0) {
+        idmap_close(&r->map); history_close(&r->hist); cache_close(&r->fc); md_out_free(&r->out); ignore_free(&r->ig);
+        snapshot_free(&r->snap); strset_free(&r->snap_set); strset_free(&r->snap_changed); strset_free(&r->dirs); selfw_free(&r->self); hot_free(&r->hot);
+        budget_free(&r->budget); sniffer_free(&r->sn); tagset_free(&r->tags); config_free(&r->cfg);
+        return -1;
+    }
+    pthread_mutex_init(&r->wlock, NULL);
+    r->saved = time(NULL);
+    workq_queue_init(&r->q, r, REPO_QUEUE_CAP);
+    workq_push(wq, &r->q, WORKQ_BULK, warm ? TASK_RECONCILE : TASK_RESCAN, NULL, 1);
     r->initialized = 1;
     return 0;
 }
 
-static void repoctx_close(RepoCtx *r) {
+static int repoctx_process_event(RepoCtx *r, struct workq *wq);
+
+/* Write the warm-start snapshot, but only if nothing is left to do: a
+ * repo with pending work gets a cold start instead. */
+static void repoctx_save_snapshot(RepoCtx *r, int pending) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof path, "%s/%s", r->root, SNAPSHOT_PATH) >= (int)sizeof path) return;
+    if (pending || r->scan || r->snap_pos < r->snap.n) { unlink(path); return; }
+    // What the walks found, whatever watches them; those gone since are
+    // left out by snapshot_save.
+    char **dirs = malloc((r->dirs.len + 1) * sizeof *dirs);
+    if (!dirs) return;
+    size_t n = 0;
+    for (size_t i = 0; i < r->dirs.cap; i++) if (r->dirs.slots[i]) dirs[n++] = r->dirs.slots[i];
+    if (snapshot_save(path, dirs, n) != 0) unlink(path);
+    free(dirs);
+}
+
+static void repoctx_close(RepoCtx *r, struct workq *wq, int snapshot) {
     if (!r->initialized) return;
+    if (snapshot) while (repoctx_process_event(r, wq) > 0) ;
+    size_t pending = workq_detach(wq, &r->q) + hot_pending(&r->hot);
+    if (r->dirty) md_rebuild(&r->out, &r->map, &r->tags, &r->fc);
+    if (snapshot) repoctx_save_snapshot(r, pending > 0);
+    for (size_t i = r->scan_pos; i < r->nscan; i++) free(r->scan[i]);
+    free(r->scan);
+    snapshot_free(&r->snap);
+    strset_free(&r->snap_set);
+    strset_free(&r->snap_changed);
+    strset_free(&r->dirs);
+    pthread_mutex_destroy(&r->wlock);
     fs_watch_close(&r->wctx);
+    selfw_free(&r->self);
+    hot_free(&r->hot);
+    budget_free(&r->budget);
+    char hot[PATH_MAX];
+    if (snprintf(hot, sizeof hot, "%s/%s", r->root, HOT_PATH) < (int)sizeof hot) unlink(hot);
+    if (snprintf(hot, sizeof hot, "%s/%s", r->root, WATCHES_PATH) < (int)sizeof hot) unlink(hot);
     idmap_close(&r->map);
+    history_close(&r->hist);
     cache_close(&r->fc);
+    md_out_free(&r->out);
     ignore_free(&r->ig);
+    sniffer_free(&r->sn);
+    tagset_free(&r->tags);
+    config_free(&r->cfg);
     r->initialized = 0;
 }
 
-static int repoctx_process_event(RepoCtx *r) {
-    fs_event ev;
-    int rcode = fs_watch_next(&r->wctx, &ev);
-    if (rcode <= 0) return rcode;
-    char oldcwd[PATH_MAX];
-    if (!getcwd(oldcwd, sizeof oldcwd)) oldcwd[0] = 0;
-    chdir(r->root);
+static int onfile_collect(const char *path, struct ignore *ig, void *a, void *b, void *c) {
+    (void)ig; (void)b; (void)c;
+    RepoCtx *r = a;
+    if (selfw_is_temp(path) || md_is_output(&r->out, path)) return 0;
+    if (r->nscan == r->scan_cap) {
+        size_t cap = r->scan_cap ? r->scan_cap * 2 : 64;
+        char **ns = realloc(r->scan, cap * sizeof *ns);
+        if (!ns) return -1;
+        r->scan = ns;
+        r->scan_cap = cap;
+    }
+    r->nseen++;
+    r->scan[r->nscan++] = strdup(path);
+    return 0;
+}
+
+static void ondir_note(const char *path, void *a) {
+    RepoCtx *r = a;
+    strset_add(&r->dirs, path);
+}
+
+/* A directory was renamed: so are the ones noted below it. The old names
+ * stay; the next snapshot_save skips them. */
+static void dirs_rename(RepoCtx *r, const char *from, const char *to) {
+    size_t fl = strlen(from), n = 0;
+    char **moved = malloc((r->dirs.len + 1) * sizeof *moved);
+    if (!moved) return;
+    for (size_t i = 0; i < r->dirs.cap; i++) {
+        const char *p = r->dirs.slots[i];
+        if (p && strncmp(p, from, fl) == 0 && (!p[fl] || p[fl] == '/') && asprintf(&moved[n], "%s%s", to, p + fl) >= 0) n++;
+    }
+    for (size_t i = 0; i < n; i++) {
+        strset_add(&r->dirs, moved[i]);
+        free(moved[i]);
+    }
+    free(moved);
+}
+
+/* Queue the files of one snapshot directory for checking. Subdirectories
+ * the snapshot does not know were created while the daemon was down: watch
+ * and walk them. The dir mtime tells whether any can exist at all. */
+static void reconcile_dir(RepoCtx *r, const struct snap_dir *sd) {
+    DIR *d = opendir(sd->path);
+    if (!d) return;
+    r->nseen++;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+        char *p = NULL;
+        if (asprintf(&p, "%s/%s", sd->path, e->d_name) < 0) continue;
+        struct stat st;
+        if (stat(p, &st) != 0) { free(p); continue; }
+        if (S_ISREG(st.st_mode)) {
+            if (fs_should_parse_file(p, &r->ig)) onfile_collect(p, &r->ig, r, NULL, NULL);
+        } else if (S_ISDIR(st.st_mode) && sd->now != sd->mtime &&
+                   !strset_has(&r->snap_set, p, strlen(p)) && fs_should_walk_dir(p, &r->ig)) {
+            pthread_mutex_lock(&r->wlock);
+            fs_watch_add_dir_recursive(&r->wctx, p, &r->ig);
+            pthread_mutex_unlock(&r->wlock);
+            fs_walk(p, &r->ig, onfile_collect, ondir_note, r, NULL, NULL);
+        }
+        free(p);
+    }
+    closedir(d);
+}
+
+/* Drop the keys and cache entries of tagged files that no longer exist:
+ * of those directly in one of dirs, or of all with NULL. */
+static void forget_gone(RepoCtx *r, const struct strset *dirs) {
+    size_t n = 0;
+    char **paths = idmap_live_paths(&r->map, &n);
+    for (size_t i = 0; i < n; i++) {
+        const char *p = paths[i], *slash = strrchr(p, '/');
+        if ((!dirs || (slash && strset_has(dirs, p, (size_t)(slash - p)))) &&
+            access(p, F_OK) != 0 && errno == ENOENT) {
+            if (idmap_forget(&r->map, p, false) > 0) r->dirty = 1;
+            cache_forget(&r->fc, p, false);
+        }
+        free(paths[i]);
+    }
+    free(paths);
+}
+
+/* Hold a bulk slice until the repo's budget allows it. Returns 1 to put
+ * the task back instead, when interactive work is waiting on any repo.
+ * Once the daemon is stopping nothing is held. */
+static int bulk_gate(RepoCtx *r) {
+    long ms, waited = 0;
+    while (!stop_requested && (ms = budget_wait(&r->budget, waited)) > 0) {
+        if (workq_waiting(r->wq, &r->q, WORKQ_INTERACTIVE)) return 1;
+        if (ms > BULK_SLEEP_MS) ms = BULK_SLEEP_MS;
+        nanosleep(&(struct timespec){ 0, ms * 1000000 }, NULL);
+        waited += ms;
+    }
+    return 0;
+}
+
+static int repo_run_bulk(RepoCtx *r, struct workq_task *t);
+
+/* Worker side: runs with the cwd at the repo root. */
+static int repo_run_task(void *owner, struct workq_task *t) {
+    RepoCtx *r = owner;
+    if (chdir(r->root) != 0) return 0;
+    budget_mode(&r->budget, t->cls == WORKQ_BULK);
+    if (t->kind == TASK_FILE || t->kind == TASK_GONE_DIR) {
+        char gone[PATH_MAX];
+        if (access(t->path, F_OK) != 0 && errno == ENOENT) {
+            // Deleted or moved away by now: drop its keys, or for a
+            // directory every key below it.
+            if (canon_gone(t->path, gone) == 0) {
+                if (idmap_forget(&r->map, gone, t->kind == TASK_GONE_DIR) > 0) r->dirty = 1;
+                cache_forget(&r->fc, gone, t->kind == TASK_GONE_DIR);
+            }
+        } else if (t->kind == TASK_FILE && fs_should_parse_file(t->path, &r->ig)) {
+            parse_file_inplace(t->path, &r->po, &r->map, &r->fc);
+            r->dirty = 1;
+        }
+        return 0;
+    }
+    if (t->kind == TASK_RENAME || t->kind == TASK_RENAME_DIR) {
+        // Keys and cache entries follow the move; the content is the same,
+        // so nothing below a renamed directory is read again.
+        char from[PATH_MAX], to[PATH_MAX];
+        if (canon_gone(t->from, from) == 0 && canon_gone(t->path, to) == 0) {
+            if (idmap_rename(&r->map, from, to) > 0) r->dirty = 1;
+            bool dir = t->kind == TASK_RENAME_DIR;
+            cache_rename(&r->fc, from, to, dir);
+            // Moved to where it is ignored: as good as gone.
+            if (!(dir ? fs_should_walk_dir(t->path, &r->ig) : fs_should_parse_file(t->path, &r->ig))) {
+                if (idmap_forget(&r->map, to, dir) > 0) r->dirty = 1;
+                cache_forget(&r->fc, to, dir);
+            } else if (dir) {
+                dirs_rename(r, t->from, t->path);
+            }
+        }
+        // A file may also have changed before it was moved (an editor's
+        // save-and-rename); the cache check decides.
+        if (t->kind == TASK_RENAME && fs_should_parse_file(t->path, &r->ig)) {
+            parse_file_inplace(t->path, &r->po, &r->map, &r->fc);
+            r->dirty = 1;
+        }
+        return 0;
+    }
+    if (bulk_gate(r)) return 1;
+    long cpu = budget_cpu_us();
+    size_t seen = r->nseen, nread = r->nread;
+    int again = repo_run_bulk(r, t);
+    budget_charge(&r->budget, r->nseen - seen, r->nread - nread, budget_cpu_us() - cpu);
+    return again;
+}
+
+/* One slice of a directory walk, rescan or reconcile. */
+static int repo_run_bulk(RepoCtx *r, struct workq_task *t) {
+    if (t->kind == TASK_RECONCILE) {
+        // Most recently modified directories first, a slice per turn.
+        if (r->snap_pos == 0) snapshot_sort_recent(&r->snap);
+        size_t end = r->snap_pos + RESCAN_SLICE;
+        for (; r->snap_pos < r->snap.n && r->snap_pos < end; r->snap_pos++) {
+            const struct snap_dir *sd = &r->snap.dirs[r->snap_pos];
+            if (sd->now < 0) {
+                // Deleted while we were down, with everything below it.
+                if (idmap_forget(&r->map, sd->path, true) > 0) r->dirty = 1;
+                cache_forget(&r->fc, sd->path, true);
+                continue;
+            }
+            if (sd->now != sd->mtime) strset_add(&r->snap_changed, sd->path);
+            strset_add(&r->dirs, sd->path);
+            reconcile_dir(r, sd);
+        }
+        if (r->snap_pos < r->snap.n) return 1;
+        // A file deleted meanwhile moved its directory's mtime.
+        forget_gone(r, &r->snap_changed);
+        strset_free(&r->snap_changed);
+    } else if (!r->scan) {
+        if (t->kind == TASK_IGNORE) {
+            // An ignore file in t->path changed: drop what it now excludes,
+            // watch and walk what it no longer does.
+            if (drop_ignored(&r->map, &r->fc, &r->ig, t->path) > 0) r->dirty = 1;
+            pthread_mutex_lock(&r->wlock);
+            fs_watch_add_dir_recursive(&r->wctx, t->path, &r->ig);
+            pthread_mutex_unlock(&r->wlock);
+        }
+        fs_walk(t->path ? t->path : r->root, &r->ig, onfile_collect, ondir_note, r, NULL, NULL);
+        // A full rescan knows nothing of what went away in the meantime.
+        if (t->kind == TASK_RESCAN && !t->path) forget_gone(r, NULL);
+    }
+    size_t end = r->scan_pos + RESCAN_SLICE;
+    if (end > r->nscan) end = r->nscan;
+    parse_files(r->scan + r->scan_pos, end - r->scan_pos, &r->po, &r->map, &r->fc);
+    r->nseen += end - r->scan_pos;
+    for (; r->scan_pos < end; r->scan_pos++) free(r->scan[r->scan_pos]);
+    if (r->scan_pos < r->nscan) return 1;
+    free(r->scan);
+    r->scan = NULL;
+    r->nscan = r->scan_cap = r->scan_pos = 0;
+    r->dirty = 1;
+    cache_save(&r->fc);
+    r->saved = time(NULL);
+    return 0;
+}
+
+static void repo_batch_done(void *owner) {
+    RepoCtx *r = owner;
+    // Only the main thread reloads ignore rules and it reads the new ones
+    // from then on; the old could only still be in this batch's hands.
+    ignore_collect(&r->ig);
+    if (!r->dirty) return;
+    if (idmap_needs_compact(&r->map)) idmap_compact(&r->map);
+    md_rebuild(&r->out, &r->map, &r->tags, &r->fc);
+    char tri[PATH_MAX];
+    if (snprintf(tri, sizeof tri, "%s/%s", r->root, TRIGRAM_PATH) < (int)sizeof tri) tri_refresh(tri, &r->map);
+    r->dirty = 0;
+    if (time(NULL) - r->saved >= CACHE_SAVE_SECS) {
+        cache_save(&r->fc);
+        r->saved = time(NULL);
+    }
+}
+
+/* Whether ev is the echo of our own write: anything on our temp files or
+ * rendered output, or a file still as we wrote its IDs. A temp file renamed
+ * over a file someone changed since is their edit of that file. */
+static bool own_event(RepoCtx *r, fs_event *ev) {
+    if (ev->type == FS_EVENT_RENAME && selfw_is_temp(ev->from)) {
+        if (md_is_output(&r->out, ev->path) || selfw_is_echo(&r->self, ev->path)) return true;
+        ev->type = FS_EVENT_WRITE;
+        return false;
+    }
+    if (selfw_is_temp(ev->path) || md_is_output(&r->out, ev->path)) return true;
+    return (ev->type == FS_EVENT_WRITE || ev->type == FS_EVENT_CREATE_FILE || ev->type == FS_EVENT_MOVE) &&
+           selfw_is_echo(&r->self, ev->path);
+}
+
+/* A directory created, removed or renamed changes what the paths below it
+ * resolve to. */
+static void forget_dir(const RepoCtx *r, const char *path) {
+    char abs[PATH_MAX];
+    if (path[0] == '/') canon_forget(path);
+    else if (snprintf(abs, sizeof abs, "%s/%s", r->root, path) < (int)sizeof abs) canon_forget(abs);
+    else canon_forget(NULL);
+}
+
+/* path is an ignore file that changed: re-read its directory's ignore
+ * files and queue a pass over that directory. */
+static void ignore_changed(RepoCtx *r, struct workq *wq, const char *path) {
+    size_t rl = strlen(r->root);
+    const char *slash = strrchr(path, '/');
+    if (strncmp(path, r->root, rl) != 0 || path[rl] != '/' || !slash) return;
+    char dir[PATH_MAX];
+    if (snprintf(dir, sizeof dir, "%.*s", (int)(slash - path), path) >= (int)sizeof dir) return;
+    ignore_reload(&r->ig, slash - path > (ptrdiff_t)rl ? dir + rl + 1 : "");
+    workq_push(wq, &r->q, WORKQ_BULK, TASK_IGNORE, dir, 0);
+}
+
+/* Main thread: turn one watch event into queued work. Frees its paths. */
+static void repoctx_handle_event(RepoCtx *r, struct workq *wq, fs_event *evp) {
+    fs_event ev = *evp;
+    *evp = (fs_event){0};
+    if (own_event(r, &ev)) {
+        fs_event_free(&ev);
+        return;
+    }
+    if (ev.type == FS_EVENT_CREATE_DIR || ev.type == FS_EVENT_DELETE_DIR) forget_dir(r, ev.path);
+    else if (ev.type == FS_EVENT_RENAME_DIR) { forget_dir(r, ev.from); forget_dir(r, ev.path); }
+    if (ev.type == FS_EVENT_WRITE || ev.type == FS_EVENT_CREATE_FILE || ev.type == FS_EVENT_MOVE ||
+        ev.type == FS_EVENT_DELETE_FILE || ev.type == FS_EVENT_RENAME) {
+        if (ignore_is_file(ev.path)) ignore_changed(r, wq, ev.path);
+        if (ev.from && ignore_is_file(ev.from)) ignore_changed(r, wq, ev.from);
+    }
     if (ev.type == FS_EVENT_CREATE_DIR) {
-        fs_watch_add_dir_recursive(&r->wctx, ev.path, &r->ig);
-    } else if (ev.type == FS_EVENT_WRITE || ev.type == FS_EVENT_CREATE_FILE || ev.type == FS_EVENT_MOVE) {
-        parse_file_inplace(ev.path, &r->map, &r->fc);
-        md_rebuild(MD_PATH, &r->map);
+        // Made inside a directory that is ignored (and still watched).
+        int walk = fs_should_walk_dir(ev.path, &r->ig);
+        if (walk) {
+            pthread_mutex_lock(&r->wlock);
+            fs_watch_add_dir_recursive(&r->wctx, ev.path, &r->ig);
+            pthread_mutex_unlock(&r->wlock);
+        }
+        if (walk) workq_push(wq, &r->q, WORKQ_BULK, TASK_DIR, ev.path, 0);
+    } else if (ev.type == FS_EVENT_WRITE || ev.type == FS_EVENT_CREATE_FILE || ev.type == FS_EVENT_MOVE ||
+               ev.type == FS_EVENT_DELETE_FILE) {
+        // Files written nonstop are held and updated by repoctx_tick.
+        if (hot_event(&r->hot, ev.path, hot_now()))
+            workq_push(wq, &r->q, WORKQ_INTERACTIVE, TASK_FILE, ev.path, 0);
+    } else if (ev.type == FS_EVENT_DELETE_DIR) {
+        workq_push(wq, &r->q, WORKQ_INTERACTIVE, TASK_GONE_DIR, ev.path, 0);
+    } else if (ev.type == FS_EVENT_RENAME || ev.type == FS_EVENT_RENAME_DIR) {
+        workq_push_move(wq, &r->q, WORKQ_INTERACTIVE, ev.type == FS_EVENT_RENAME ? TASK_RENAME : TASK_RENAME_DIR,
+                        ev.from, ev.path);
     }
     fs_event_free(&ev);
-    if (oldcwd[0]) chdir(oldcwd);
+    // A full queue dropped events: fall back to one rescan of the repo.
+    if (workq_take_overflow(wq, &r->q)) {
+        canon_forget(NULL);
+        workq_push(wq, &r->q, WORKQ_BULK, TASK_RESCAN, NULL, 1);
+    }
+}
+
+/* Main thread: handle one pending watch event, if there is one. */
+static int repoctx_process_event(RepoCtx *r, struct workq *wq) {
+    fs_event ev;
+    pthread_mutex_lock(&r->wlock);
+    int rcode = fs_watch_next(&r->wctx, &ev);
+    pthread_mutex_unlock(&r->wlock);
+    if (rcode <= 0) return rcode;
+    if (record) trace_write(record, workq_now_us() - record_t0, r->root, &ev);
+    repoctx_handle_event(r, wq, &ev);
     return 1;
 }
 
-static RepoCtx* load_registry(size_t *out_count) {
+struct hot_push { RepoCtx *r; struct workq *wq; };
+
+static void push_held(void *ud, const char *path) {
+    struct hot_push *hp = ud;
+    workq_push(hp->wq, &hp->r->q, WORKQ_BULK, TASK_FILE, path, 0);
+}
+
+/* Main thread, every turn of the loop: queue held files that are due and
+ * publish the quarantined set for codetags status. */
+static void repoctx_tick(RepoCtx *r, struct workq *wq) {
+    struct hot_push hp = { r, wq };
+    hot_tick(&r->hot, hot_now(), push_held, &hp);
+    char path[PATH_MAX];
+    if (r->hot.changed && snprintf(path, sizeof path, "%s/%s", r->root, HOT_PATH) < (int)sizeof path)
+        hot_save(&r->hot, path, r->root);
+}
+
+/* Main thread: poll the directories that got no watch, handle what
+ * changed in them and publish the watch budget for codetags status. */
+static void repoctx_poll(RepoCtx *r, struct workq *wq) {
+    pthread_mutex_lock(&r->wlock);
+    size_t n = fs_watch_poll(&r->wctx);
+    size_t polled = 0;
+    for (size_t i = 0; i < r->wctx.poll.n; i++) polled += !r->wctx.poll.v[i].gone;
+    char line[sizeof r->watches];
+    snprintf(line, sizeof line, "%d\t%zu\t%d\t%zu\t%zu\t%d\t%d\n", r->wctx.nwatched, polled, r->wctx.max_watches,
+             r->wctx.promoted, r->wctx.demoted, r->wctx.full_until > 0, r->wctx.fan);
+    pthread_mutex_unlock(&r->wlock);
+    if (n) while (repoctx_process_event(r, wq) > 0) ;
+    char path[PATH_MAX], tmp[PATH_MAX];
+    if (strcmp(line, r->watches) == 0 || snprintf(path, sizeof path, "%s/%s", r->root, WATCHES_PATH) >= (int)sizeof path ||
+        snprintf(tmp, sizeof tmp, "%s.tmp", path) >= (int)sizeof tmp) return;
+    FILE *f = fopen(tmp, "w");
+    if (!f) return;
+    fputs(line, f);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) { unlink(tmp); return; }
+    memcpy(r->watches, line, sizeof line);
+}
+
+/* Read-only: closing a file opened for writing raises IN_CLOSE_WRITE even
+ * if nothing was written, and the daemon reloads the registry on that, so
+ * a reload that opened it that way would wake the daemon again, forever. */
+static char **load_registry(size_t *out_count) {
     char reg[PATH_MAX];
-    if (ensure_global_dirs(reg) != 0) return NULL;
+    *out_count = 0;
+    if (registry_path(reg) != 0) return NULL;
     FILE *f = fopen(reg, "r");
     if (!f) return NULL;
-    RepoCtx *repos = NULL; size_t n=0, cap=0;
+    char **roots = NULL; size_t n=0, cap=0;
     char *line = NULL; size_t capln = 0;
     while (getline(&line, &capln, f) > 0) {
         size_t L = strlen(line);
         while (L > 0 && (line[L-1] == '\n' || line[L-1] == '\r')) line[--L] = 0;
         if (L == 0) continue;
-        if (cap == n) { cap = cap ? cap*2 : 8; repos = realloc(repos, cap*sizeof *repos); }
-        if (repoctx_init(&repos[n], line) == 0) {
-            n++;
-        }
+        if (cap == n) { cap = cap ? cap*2 : 8; roots = realloc(roots, cap*sizeof *roots); }
+        roots[n++] = strdup(line);
     }
     free(line);
     fclose(f);
     *out_count = n;
-    return repos;
+    return roots;
+}
+
+/* Bring the running set in line with the registry: repos that are still
+ * registered keep their state, new ones are initialized and queued for a
+ * scan, dropped ones are closed. */
+static void sync_registry(RepoCtx ***repos, size_t *count, struct workq *wq) {
+    size_t nroots = 0;
+    char **roots = load_registry(&nroots);
+    RepoCtx **next = calloc(nroots ? nroots : 1, sizeof *next);
+    size_t n = 0;
+    for (size_t i = 0; i < nroots; i++) {
+        int dup = 0;
+        for (size_t j = 0; j < n; j++) if (strcmp(next[j]->root, roots[i]) == 0) dup = 1;
+        if (dup) { free(roots[i]); continue; }
+        RepoCtx *r = NULL;
+        for (size_t j = 0; j < *count; j++) {
+            if ((*repos)[j] && strcmp((*repos)[j]->root, roots[i]) == 0) {
+                r = (*repos)[j];
+                (*repos)[j] = NULL;
+                break;
+            }
+        }
+        if (!r) {
+            r = malloc(sizeof *r);
+            if (!r || repoctx_init(r, roots[i], wq) != 0) { free(r); free(roots[i]); continue; }
+        }
+        next[n++] = r;
+        free(roots[i]);
+    }
+    free(roots);
+    for (size_t j = 0; j < *count; j++) {
+        if (!(*repos)[j]) continue;
+        repoctx_close((*repos)[j], wq, 0);
+        free((*repos)[j]);
+    }
+    free(*repos);
+    *repos = next;
+    *count = n;
 }
 
 /* Registry file watch helpers */
@@ -264,9 +1225,31 @@ static int drain_registry_events(int fd, int *needs_readd) {
     return saw;
 }
 
-static int cmd_watch(void) {
+static void on_stop_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static int default_jobs(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    return n > 4 ? 4 : (int)n;
+}
+
+/* The main thread only waits on inotify and feeds per-repo queues; a pool
+ * of workers drains them round-robin, interactive work first. With a trace
+ * file every event is also written there, for codetags replay. */
+static int cmd_watch(int jobs, const char *trace) {
+    if (trace && !(record = trace_create(trace))) { perror(trace); return 1; }
+    record_t0 = workq_now_us();
+    struct workq wq;
+    if (workq_init(&wq, jobs > 0 ? jobs : default_jobs(), repo_run_task, repo_batch_done) != 0) {
+        fprintf(stderr, "Failed to start workers.\n");
+        return 1;
+    }
     size_t count = 0;
-    RepoCtx *repos = load_registry(&count);
+    RepoCtx **repos = NULL;
+    sync_registry(&repos, &count, &wq);
     char reg_path[PATH_MAX];
     if (open_registry(reg_path) != 0) {
         fprintf(stderr, "Failed to open registry.\n");
@@ -279,67 +1262,313 @@ static int cmd_watch(void) {
             fprintf(stderr, "Warning: failed to watch registry; falling back to periodic.\n");
         }
     }
-    puts("codetags system watcher running.");
+    printf("codetags system watcher running (%d workers).\n", wq.nworkers);
+    fflush(stdout);
+    struct sigaction sa = {0};
+    sa.sa_handler = on_stop_signal;
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    struct pollfd *pfds = NULL;
     unsigned long tick = 0;
-    for (;;) {
-        int progressed = 0;
+    while (!stop_requested) {
+        pfds = realloc(pfds, (count + 1) * sizeof *pfds);
+        for (size_t i=0; i<count; i++) pfds[i] = (struct pollfd){ .fd = repos[i]->wctx.inofd, .events = POLLIN };
+        pfds[count] = (struct pollfd){ .fd = reg_fd, .events = POLLIN };
+        if (poll(pfds, count + 1, 500) < 0 && errno != EINTR) break;
         for (size_t i=0; i<count; i++) {
-            int r = repoctx_process_event(&repos[i]);
-            if (r > 0) progressed = 1;
+            if (pfds[i].revents & POLLIN) while (repoctx_process_event(repos[i], &wq) > 0) ;
+            repoctx_tick(repos[i], &wq);
+            repoctx_poll(repos[i], &wq);
         }
+        if (record) fflush(record);
         if (reg_fd >= 0) {
             int needs_readd = 0;
-            if (drain_registry_events(reg_fd, &needs_readd)) {
-                size_t nc = 0;
-                RepoCtx *nr = load_registry(&nc);
-                if (nr) {
-                    for (size_t i=0; i<count; i++) repoctx_close(&repos[i]);
-                    free(repos);
-                    repos = nr;
-                    count = nc;
-                    progressed = 1;
-                }
+            if ((pfds[count].revents & POLLIN) && drain_registry_events(reg_fd, &needs_readd)) {
+                sync_registry(&repos, &count, &wq);
             }
             if (needs_readd) {
                 close(reg_fd);
                 reg_fd = watch_registry_fd(reg_path);
             }
-        } else {
-            tick++;
-            if (tick % 50 == 0) {
-                size_t nc = 0;
-                RepoCtx *nr = load_registry(&nc);
-                if (nr) {
-                    for (size_t i=0; i<count; i++) repoctx_close(&repos[i]);
-                    free(repos);
-                    repos = nr;
-                    count = nc;
-                    progressed = 1;
-                }
-            }
+        } else if (++tick % 10 == 0) {
+            sync_registry(&repos, &count, &wq);
         }
-        if (!progressed) usleep(100000);
     }
+    free(pfds);
     if (reg_fd >= 0) close(reg_fd);
-    for (size_t i=0; i<count; i++) repoctx_close(&repos[i]);
+    // Clean shutdown: snapshot every idle repo for the next warm start.
+    for (size_t i=0; i<count; i++) { repoctx_close(repos[i], &wq, 1); free(repos[i]); }
     free(repos);
+    workq_shutdown(&wq);
+    if (record) fclose(record);
+    record = NULL;
     return 0;
 }
 
+static struct trace_stats *replay_stats;    // set once the replay proper starts
+
+static int replay_run_task(void *owner, struct workq_task *t) {
+    long long start = workq_now_us();
+    int again = repo_run_task(owner, t);
+    long long now = workq_now_us();
+    if (replay_stats) trace_stats_task(replay_stats, again ? -1 : (long)(now - t->queued), (long)(now - start));
+    return again;
+}
+
+static void replay_batch_done(void *owner) {
+    RepoCtx *r = owner;
+    int dirty = r->dirty;
+    long long start = workq_now_us();
+    repo_batch_done(owner);
+    if (replay_stats && dirty) trace_stats_rebuild(replay_stats, (long)(workq_now_us() - start));
+}
+
+static void sleep_us(long long us) {
+    if (us > 0) nanosleep(&(struct timespec){ us / 1000000, us % 1000000 * 1000 }, NULL);
+}
+
+/* Make a trace path absolute against root; "." is root itself. */
+static void replay_path(char **p, const char *root) {
+    char *abs = NULL;
+    if (!*p || (*p)[0] == '/') return;
+    if (asprintf(&abs, "%s%s%s", root, strcmp(*p, ".") ? "/" : "", strcmp(*p, ".") ? *p : "") < 0) return;
+    free(*p);
+    *p = abs;
+}
+
+static double ms(long us) { return us / 1000.0; }
+
+/* Feed a trace recorded by watch --record to the daemon's event handling
+ * for a repo in the current directory, a copy of the recorded tree as it
+ * was after the recording. The watches of that repo are set up but never
+ * read. Its initial scan is not measured; after it every file counts as
+ * unparsed again, so each replayed event costs what it did when it came.
+ * Events run at their recorded pace, or back to back with --max. */
+static int cmd_replay(int argc, char **argv) {
+    int jobs = 0, max = 0;
+    const char *file = NULL, *repo = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--max") == 0) max = 1;
+        else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--repo") == 0 && i + 1 < argc) repo = argv[++i];
+        else if (argv[i][0] == '-' && argv[i][1]) { fprintf(stderr, "unknown replay option: %s\n", argv[i]); return 1; }
+        else if (!file) file = argv[i];
+        else { fprintf(stderr, "replay takes one trace\n"); return 1; }
+    }
+    if (!file) { fprintf(stderr, "replay requires a trace file\n"); return 1; }
+    FILE *f = trace_open(file);
+    if (!f) { fprintf(stderr, "replay: %s is not a trace\n", file); return 1; }
+    char root[PATH_MAX];
+    if (!getcwd(root, sizeof root)) { perror("getcwd"); fclose(f); return 1; }
+    use_fanotify = 0;
+    struct workq wq;
+    if (workq_init(&wq, jobs > 0 ? jobs : default_jobs(), replay_run_task, replay_batch_done) != 0) {
+        fprintf(stderr, "Failed to start workers.\n");
+        fclose(f);
+        return 1;
+    }
+    RepoCtx *r = malloc(sizeof *r);
+    if (!r || repoctx_init(r, root, &wq) != 0) {
+        fprintf(stderr, "replay: cannot set up %s\n", root);
+        free(r); workq_shutdown(&wq); fclose(f);
+        return 1;
+    }
+    workq_wait_idle(&wq);
+    cache_unparse(&r->fc, r->root, true);
+    struct trace_stats stats;
+    trace_stats_init(&stats);
+    replay_stats = &stats;
+    size_t nread = r->nread, nev = 0;
+    struct rusage ru0, ru1;
+    getrusage(RUSAGE_SELF, &ru0);
+
+    char *from = repo ? strdup(repo) : NULL;
+    struct trace_ev te;
+    int rc;
+    long long start = workq_now_us(), first = -1, ticked = start;
+    while ((rc = trace_read(f, &te)) > 0) {
+        // Only the events of one recorded repo: --repo or the first one.
+        if (!from) from = strdup(te.root);
+        if (!from || strcmp(te.root, from) != 0) { trace_ev_free(&te); continue; }
+        if (first < 0) first = te.us;
+        long long now;
+        while (!max && (now = workq_now_us()) < start + te.us - first) {
+            long long due = start + te.us - first - now;
+            sleep_us(due < 100000 ? due : 100000);
+            repoctx_tick(r, &wq);
+            ticked = workq_now_us();
+        }
+        replay_path(&te.ev.path, r->root);
+        replay_path(&te.ev.from, r->root);
+        repoctx_handle_event(r, &wq, &te.ev);
+        trace_ev_free(&te);
+        nev++;
+        if ((now = workq_now_us()) - ticked >= 100000) { repoctx_tick(r, &wq); ticked = now; }
+    }
+    if (rc < 0) fprintf(stderr, "replay: bad line in %s, stopped there\n", file);
+    // Done when the queue is and nothing is held back any more.
+    for (;;) {
+        workq_wait_idle(&wq);
+        if (!hot_pending(&r->hot)) break;
+        sleep_us(100000);
+        repoctx_tick(r, &wq);
+    }
+    long long elapsed = workq_now_us() - start;
+    getrusage(RUSAGE_SELF, &ru1);
+    replay_stats = NULL;
+
+    printf("%zu events in %.2f s (%.0f events/s)%s\n", nev, elapsed / 1e6,
+           elapsed ? nev * 1e6 / (double)elapsed : 0.0, max ? ", back to back" : "");
+    printf("latency: %zu tasks, p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n", stats.nlat,
+           ms(trace_stats_pct(&stats, 50)), ms(trace_stats_pct(&stats, 90)), ms(trace_stats_pct(&stats, 99)),
+           ms(trace_stats_pct(&stats, 100)));
+    printf("work: tasks %.2f s, %.2f MB parsed; %zu rebuilds, %.2f s\n", stats.task_us / 1e6,
+           (r->nread - nread) / 1048576.0, stats.rebuilds, stats.rebuild_us / 1e6);
+    printf("cpu: %.2f s user, %.2f s sys\n",
+           (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) + (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6,
+           (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) + (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6);
+    free(from);
+    if (f != stdin) fclose(f);
+    repoctx_close(r, &wq, 0);
+    free(r);
+    workq_shutdown(&wq);
+    trace_stats_free(&stats);
+    return rc < 0;
+}
+
+struct grep_ctx { const char *root; size_t hits; };
+
+static void grep_hit(void *ud, const char *key, const char *id) {
+    struct grep_ctx *g = ud;
+    const char *tag = strstr(key, "::");
+    const char *text = tag ? strstr(tag + 2, "::") : NULL;
+    if (!text) return;
+    printf("%s%s%.*s: [%s] %.*s: %s\n", key[0] == '/' ? "" : g->root, key[0] == '/' ? "" : "/",
+           (int)(tag - key), key, id, (int)(text - tag - 2), tag + 2, text + 2);
+    g->hits++;
+}
+
+/* Registered repos, the files the daemon is holding back in each and the
+ * directories it polls for want of watches. */
+static int cmd_status(void) {
+    size_t n = 0;
+    char **roots = load_registry(&n);
+    if (!n) puts("No registered repositories.");
+    char *line = NULL;
+    size_t cap = 0;
+    for (size_t i = 0; i < n; i++) {
+        char path[PATH_MAX];
+        FILE *f = snprintf(path, sizeof path, "%s/%s", roots[i], HOT_PATH) < (int)sizeof path ? fopen(path, "r") : NULL;
+        printf("%s\n", roots[i]);
+        ssize_t len;
+        while (f && (len = getline(&line, &cap, f)) > 0) {
+            if (line[len-1] == '\n') line[--len] = 0;
+            char *rate = strrchr(line, '\t');
+            if (!rate) continue;
+            *rate++ = 0;
+            char *delay = strrchr(line, '\t');
+            if (!delay) continue;
+            *delay++ = 0;
+            printf("  busy: %s (updated every %ss, %s writes/s)\n", line, delay, rate);
+        }
+        if (f) fclose(f);
+        int watched, max, full, fan = 0;
+        size_t polled, promoted, demoted;
+        f = snprintf(path, sizeof path, "%s/%s", roots[i], WATCHES_PATH) < (int)sizeof path ? fopen(path, "r") : NULL;
+        int got = f ? fscanf(f, "%d\t%zu\t%d\t%zu\t%zu\t%d\t%d", &watched, &polled, &max, &promoted, &demoted, &full, &fan) : 0;
+        if (got >= 6 && fan)
+            printf("  watches: fanotify mark on the filesystem\n");
+        else if (got >= 6) {
+            if (max) printf("  watches: %d/%d directories watched", watched, max);
+            else printf("  watches: %d directories watched", watched);
+            if (full) printf(" (fs.inotify.max_user_watches reached)");
+            if (polled) printf(", %zu polled", polled);
+            if (promoted) printf(", %zu moved to a watch", promoted);
+            if (demoted) printf(", %zu moved from one", demoted);
+            putchar('\n');
+        }
+        if (f) fclose(f);
+        free(roots[i]);
+    }
+    free(line);
+    free(roots);
+    return 0;
+}
+
+/* Search the tag text of every registered repo through its trigram index
+ * and ID map; no source file is opened. Exits 1 when nothing matched, like
+ * grep. */
+static int cmd_grep(int argc, char **argv) {
+    bool regex = false, icase = false;
+    const char *tag = NULL, *pattern = NULL;
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "-E") == 0) regex = true;
+        else if (strcmp(argv[i], "-i") == 0) icase = true;
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) tag = argv[++i];
+        else if (argv[i][0] == '-' && argv[i][1] && !pattern) { fprintf(stderr, "unknown grep option: %s\n", argv[i]); return 2; }
+        else if (!pattern) pattern = argv[i];
+        else { fprintf(stderr, "grep takes one pattern\n"); return 2; }
+    }
+    if (!pattern) { fprintf(stderr, "grep requires a pattern\n"); return 2; }
+    struct tri_query q;
+    char err[256];
+    if (tri_query_init(&q, pattern, regex, icase, tag, err, sizeof err) != 0) {
+        fprintf(stderr, "grep: %s\n", err); return 2;
+    }
+    size_t nroots = 0;
+    struct grep_ctx g = {0};
+    char **roots = load_registry(&nroots);
+    for (size_t i = 0; i < nroots; i++) {
+        char root[PATH_MAX], idx[PATH_MAX], map[PATH_MAX];
+        g.root = realpath(roots[i], root) ? root : roots[i];
+        if (snprintf(idx, sizeof idx, "%s/%s", g.root, TRIGRAM_PATH) < (int)sizeof idx &&
+            snprintf(map, sizeof map, "%s/%s", g.root, MAP_PATH) < (int)sizeof map)
+            tri_search(idx, map, g.root, &q, grep_hit, &g);
+        free(roots[i]);
+    }
+    free(roots);
+    tri_query_free(&q);
+    return g.hits ? 0 : 1;
+}
+
 int main(int argc, char **argv) {
     if (argc < 2) { usage(); return 1; }
     const char *cmd = argv[1];
     if (strcmp(cmd, "init") == 0) {
         return cmd_init();
     } else if (strcmp(cmd, "scan") == 0) {
+        if (argc == 4 && strcmp(argv[2], "--files-from") == 0) return cmd_scan(NULL, argv[3]);
         if (argc < 3) { fprintf(stderr, "scan requires a path\n"); return 1; }
-        return cmd_scan(argv[2]);
-    } else if (strcmp(cmd, "watch") == 0) {
-        return cmd_watch();
-    } else if (strcmp(cmd, "groot") == 0) {
-        return cmd_watch();
+        return cmd_scan(argv[2], NULL);
+    } else if (strcmp(cmd, "watch") == 0 || strcmp(cmd, "groot") == 0) {
+        int jobs = 0;
+        const char *trace = NULL;
+        for (int i = 2; i < argc; i++) {
+            if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) && i + 1 < argc) jobs = atoi(argv[++i]);
+            else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) trace = argv[++i];
+            else { fprintf(stderr, "unknown watch option: %s\n", argv[i]); return 1; }
+        }
+        return cmd_watch(jobs, trace);
     } else if (strcmp(cmd, "reindex") == 0) {
         return cmd_reindex();
+    } else if (strcmp(cmd, "gc") == 0) {
+        return cmd_gc();
+    } else if (strcmp(cmd, "check") == 0) {
+        return cmd_check(argc, argv);
+    } else if (strcmp(cmd, "history") == 0) {
+        return cmd_history(argc, argv);
+    } else if (strcmp(cmd, "status") == 0) {
+        return cmd_status();
+    } else if (strcmp(cmd, "snapshot") == 0) {
+        return cmd_snapshot(argc, argv);
+    } else if (strcmp(cmd, "grep") == 0) {
+        return cmd_grep(argc, argv);
+    } else if (strcmp(cmd, "replay") == 0) {
+        return cmd_replay(argc, argv);
+    } else if (strcmp(cmd, "bench") == 0) {
+        int mb = argc > 2 ? atoi(argv[2]) : 16;
+        if (mb < 1) { fprintf(stderr, "bench takes a size in MB\n"); return 1; }
+        return lex_bench(stdout, (size_t)mb) == 0 ? 0 : 1;
     } else {
         usage();
         return 1;
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+
+static const char *DEFAULT_TAGS[] = {"NOTE","TODO","WARNING","WARN","FIXME","FIX","BUG"};
+#define DEFAULT_MAX_FILE_SIZE (64LL*1024*1024)
+#define DEFAULT_HISTORY_DAYS 365
+#define DEFAULT_HOT_RATE 20
+#define DEFAULT_HOT_MAX_DELAY 60
+#define DEFAULT_BULK_PRESSURE 30
+#define DEFAULT_BULK_LOAD 1.5
+
+static void trim(char *s){
+    char *p=s; while(isspace((unsigned char)*p)) p++;
+    if(p!=s) memmove(s,p,strlen(s)+1);
+    size_t n=strlen(s);
+    while(n>0 && isspace((unsigned char)s[n-1])) s[--n]=0;
+}
+
+static void add_item(char ***list, size_t *n, const char *t){
+    char **nl = realloc(*list, (*n+1) * sizeof *nl);
+    if (!nl) return;
+    *list = nl;
+    nl[(*n)++] = strdup(t);
+}
+
+static void add_list(char ***list, size_t *n, char *v){
+    for (char *tok = strtok(v, " \t,"); tok; tok = strtok(NULL, " \t,")) add_item(list, n, tok);
+}
+
+static void free_list(char **list, size_t n){
+    for (size_t i = 0; i < n; i++) free(list[i]);
+    free(list);
+}
+
+/* "123", "64K", "64M", "1G" */
+static int parse_size(const char *v, long long *out){
+    char *end;
+    long long n = strtoll(v, &end, 10);
+    if (end == v || n < 0) return -1;
+    switch (toupper((unsigned char)*end)) {
+        case 0: break;
+        case 'K': n <<= 10; end++; break;
+        case 'M': n <<= 20; end++; break;
+        case 'G': n <<= 30; end++; break;
+        default: return -1;
+    }
+    if (*end && toupper((unsigned char)*end) != 'B') return -1;
+    *out = n;
+    return 0;
+}
+
+static int parse_int(const char *v, long lo, long hi, int *out){
+    char *end;
+    long n = strtol(v, &end, 10);
+    if (end == v || *end || n < lo || n > hi) return -1;
+    *out = (int)n;
+    return 0;
+}
+
+static int parse_real(const char *v, double lo, double hi, double *out){
+    char *end;
+    double n = strtod(v, &end);
+    if (end == v || *end || !(n >= lo && n <= hi)) return -1;
+    *out = n;
+    return 0;
+}
+
+/* "yes"/"no", "on"/"off", "true"/"false", "1"/"0" */
+static int parse_bool(const char *v, int *out){
+    static const char *yes[] = {"yes","on","true","1"}, *no[] = {"no","off","false","0"};
+    for (int i = 0; i < 4; i++) {
+        if (strcasecmp(v, yes[i]) == 0) { *out = 1; return 0; }
+        if (strcasecmp(v, no[i]) == 0) { *out = 0; return 0; }
+    }
+    return -1;
+}
+
+int config_load(struct config *cfg, const char *path){
+    memset(cfg, 0, sizeof *cfg);
+    cfg->max_file_size = DEFAULT_MAX_FILE_SIZE;
+    cfg->io_uring = 1;
+    cfg->gitignore = 1;
+    cfg->fanotify = 1;
+    cfg->history_days = DEFAULT_HISTORY_DAYS;
+    cfg->hot_rate = DEFAULT_HOT_RATE;
+    cfg->hot_max_delay = DEFAULT_HOT_MAX_DELAY;
+    cfg->bulk_cpu = 100;
+    cfg->bulk_idle = 1;
+    cfg->bulk_pressure = DEFAULT_BULK_PRESSURE;
+    cfg->bulk_load = DEFAULT_BULK_LOAD;
+    FILE *f = fopen(path, "r");
+    if (f) {
+        char *line = NULL; size_t cap = 0;
+        while (getline(&line, &cap, f) > 0) {
+            char *hash = strchr(line, '#');
+            if (hash) *hash = 0;
+            char *eq = strchr(line, '=');
+            if (!eq) continue;
+            *eq = 0;
+            char *key = line, *val = eq+1;
+            trim(key); trim(val);
+            if (strcmp(key, "tags") == 0) add_list(&cfg->tags, &cfg->ntags, val);
+            else if (strcmp(key, "text_ext") == 0) add_list(&cfg->text_ext, &cfg->ntext_ext, val);
+            else if (strcmp(key, "binary_ext") == 0) add_list(&cfg->binary_ext, &cfg->nbinary_ext, val);
+            else if (strcmp(key, "max_file_size") == 0) {
+                if (parse_size(val, &cfg->max_file_size) != 0)
+                    fprintf(stderr, "%s: bad max_file_size '%s'\n", path, val);
+            }
+            else if (strcmp(key, "shard_dirs") == 0) add_list(&cfg->shard_dirs, &cfg->nshard_dirs, val);
+            else if (strcmp(key, "output") == 0) {
+                if (strcmp(val, "single") == 0) cfg->output = OUTPUT_SINGLE;
+                else if (strcmp(val, "dirs") == 0) cfg->output = OUTPUT_DIRS;
+                else if (strcmp(val, "tags") == 0) cfg->output = OUTPUT_TAGS;
+                else fprintf(stderr, "%s: bad output '%s'\n", path, val);
+            }
+            else if (strcmp(key, "io_uring") == 0) {
+                if (parse_bool(val, &cfg->io_uring) != 0)
+                    fprintf(stderr, "%s: bad io_uring '%s'\n", path, val);
+            }
+            else if (strcmp(key, "gitignore") == 0) {
+                if (parse_bool(val, &cfg->gitignore) != 0)
+                    fprintf(stderr, "%s: bad gitignore '%s'\n", path, val);
+            }
+            else if (strcmp(key, "history_days") == 0) {
+                if (parse_int(val, 0, 100000, &cfg->history_days) != 0)
+                    fprintf(stderr, "%s: bad history_days '%s'\n", path, val);
+            }
+            else if (strcmp(key, "hot_rate") == 0) {
+                if (parse_int(val, 0, 1000000, &cfg->hot_rate) != 0)
+                    fprintf(stderr, "%s: bad hot_rate '%s'\n", path, val);
+            }
+            else if (strcmp(key, "hot_max_delay") == 0) {
+                if (parse_int(val, 1, 86400, &cfg->hot_max_delay) != 0)
+                    fprintf(stderr, "%s: bad hot_max_delay '%s'\n", path, val);
+            }
+            else if (strcmp(key, "max_watches") == 0) {
+                if (parse_int(val, 0, 100000000, &cfg->max_watches) != 0)
+                    fprintf(stderr, "%s: bad max_watches '%s'\n", path, val);
+            }
+            else if (strcmp(key, "fanotify") == 0) {
+                if (parse_bool(val, &cfg->fanotify) != 0)
+                    fprintf(stderr, "%s: bad fanotify '%s'\n", path, val);
+            }
+            else if (strcmp(key, "bulk_io_rate") == 0) {
+                if (parse_size(val, &cfg->bulk_io_rate) != 0)
+                    fprintf(stderr, "%s: bad bulk_io_rate '%s'\n", path, val);
+            }
+            else if (strcmp(key, "bulk_file_rate") == 0) {
+                if (parse_int(val, 0, 100000000, &cfg->bulk_file_rate) != 0)
+                    fprintf(stderr, "%s: bad bulk_file_rate '%s'\n", path, val);
+            }
+            else if (strcmp(key, "bulk_cpu") == 0) {
+                if (parse_int(val, 1, 100, &cfg->bulk_cpu) != 0)
+                    fprintf(stderr, "%s: bad bulk_cpu '%s'\n", path, val);
+            }
+            else if (strcmp(key, "bulk_idle") == 0) {
+                if (parse_bool(val, &cfg->bulk_idle) != 0)
+                    fprintf(stderr, "%s: bad bulk_idle '%s'\n", path, val);
+            }
+            else if (strcmp(key, "bulk_pressure") == 0) {
+                if (parse_int(val, 0, 100, &cfg->bulk_pressure) != 0)
+                    fprintf(stderr, "%s: bad bulk_pressure '%s'\n", path, val);
+            }
+            else if (strcmp(key, "bulk_load") == 0) {
+                if (parse_real(val, 0, 1000, &cfg->bulk_load) != 0)
+                    fprintf(stderr, "%s: bad bulk_load '%s'\n", path, val);
+            }
+            else fprintf(stderr, "%s: unknown key '%s'\n", path, key);
+        }
+        free(line);
+        fclose(f);
+    }
+    if (cfg->ntags == 0)
+        for (size_t i = 0; i < sizeof(DEFAULT_TAGS)/sizeof(DEFAULT_TAGS[0]); i++)
+            add_item(&cfg->tags, &cfg->ntags, DEFAULT_TAGS[i]);
+    return 0;
+}
+
+int config_write_default(const char *path){
+    FILE *f = fopen(path, "wx");
+    if (!f) return -1;
+    fprintf(f, "# codetags configuration\n\n");
+    fprintf(f, "# Tag vocabulary, in codetags.md section order. Repeat the key to\n");
+    fprintf(f, "# continue the list on another line.\n");
+    fprintf(f, "tags =");
+    for (size_t i = 0; i < sizeof(DEFAULT_TAGS)/sizeof(DEFAULT_TAGS[0]); i++) fprintf(f, " %s", DEFAULT_TAGS[i]);
+    fprintf(f, "\n\n");
+    fprintf(f, "# Files larger than this are not parsed (K/M/G suffixes, 0 = no limit).\n");
+    fprintf(f, "max_file_size = 64M\n\n");
+    fprintf(f, "# Files are classified by extension, then by sniffing their first block\n");
+    fprintf(f, "# for NUL bytes and invalid UTF-8. text_ext forces parsing, binary_ext\n");
+    fprintf(f, "# extends the built-in list of skipped extensions.\n");
+    fprintf(f, "#text_ext = txt\n");
+    fprintf(f, "#binary_ext = dump\n\n");
+    fprintf(f, "# Bulk scans read files through io_uring where the kernel allows it\n");
+    fprintf(f, "# and fall back to plain reads otherwise.\n");
+    fprintf(f, "io_uring = yes\n\n");
+    fprintf(f, "# Besides .ctagsignore files, skip what .gitignore files and\n");
+    fprintf(f, "# .git/info/exclude ignore.\n");
+    fprintf(f, "gitignore = yes\n\n");
+    fprintf(f, "# Output layout: single (codetags.md only), dirs (a codetags.md in\n");
+    fprintf(f, "# each shard_dirs root, default every top-level directory, indexed\n");
+    fprintf(f, "# from the root one) or tags (codetags/<TAG>.md per tag plus index).\n");
+    fprintf(f, "output = single\n");
+    fprintf(f, "#shard_dirs = services/api services/web\n\n");
+    fprintf(f, "# Days of tag history (created/edited/moved/resolved) to keep for\n");
+    fprintf(f, "# codetags history, 0 = forever.\n");
+    fprintf(f, "history_days = 365\n\n");
+    fprintf(f, "# The daemon quarantines files written more than hot_rate times a\n");
+    fprintf(f, "# second (0 = never): they are updated at most once per backoff\n");
+    fprintf(f, "# period, doubling up to hot_max_delay seconds while they stay busy.\n");
+    fprintf(f, "hot_rate = 20\n");
+    fprintf(f, "hot_max_delay = 60\n\n");
+    fprintf(f, "# At most max_watches directories get an inotify watch (0 = as many\n");
+    fprintf(f, "# as fs.inotify.max_user_watches allows). The rest are polled, less\n");
+    fprintf(f, "# often the longer they stay quiet, and the watches go to the most\n");
+    fprintf(f, "# active directories.\n");
+    fprintf(f, "max_watches = 0\n\n");
+    fprintf(f, "# With the privileges for it (CAP_SYS_ADMIN) the daemon watches the\n");
+    fprintf(f, "# whole filesystem with one fanotify mark instead, and needs no watch\n");
+    fprintf(f, "# per directory. Falls back to inotify when it cannot.\n");
+    fprintf(f, "fanotify = yes\n\n");
+    fprintf(f, "# Daemon bulk work (initial scans, rescans, new directories) runs at\n");
+    fprintf(f, "# idle I/O priority and lowest CPU priority (bulk_idle), within\n");
+    fprintf(f, "# bulk_io_rate bytes/s (K/M/G), bulk_file_rate files/s (0 = no\n");
+    fprintf(f, "# limit) and bulk_cpu %% of a CPU. It pauses while I/O stall (PSI) is\n");
+    fprintf(f, "# above bulk_pressure %% or the load average per CPU above bulk_load\n");
+    fprintf(f, "# (0 = never). Single-file updates are never held back.\n");
+    fprintf(f, "bulk_idle = yes\n");
+    fprintf(f, "bulk_io_rate = 0\n");
+    fprintf(f, "bulk_file_rate = 0\n");
+    fprintf(f, "bulk_cpu = 100\n");
+    fprintf(f, "bulk_pressure = 30\n");
+    fprintf(f, "bulk_load = 1.5\n");
+    fclose(f);
+    return 0;
+}
+
+void config_free(struct config *cfg){
+    free_list(cfg->tags, cfg->ntags);
+    free_list(cfg->text_ext, cfg->ntext_ext);
+    free_list(cfg->binary_ext, cfg->nbinary_ext);
+    free_list(cfg->shard_dirs, cfg->nshard_dirs);
+    memset(cfg, 0, sizeof *cfg);
+}
@@ -0,0 +1,40 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+#include <stddef.h>
+
+/* How codetags.md is laid out: one file, one per directory root plus an
+ * index, or one per tag plus an index. */
+enum { OUTPUT_SINGLE, OUTPUT_DIRS, OUTPUT_TAGS };
+
+/* Per-repo settings from .ctags/config ("key = value" lines, '#' comments). */
+struct config {
+    char **tags;
+    size_t ntags;
+    long long max_file_size;    // bytes, 0 = unlimited
+    char **text_ext;            // always parsed, never sniffed
+    size_t ntext_ext;
+    char **binary_ext;          // added to the built-in binary list
+    size_t nbinary_ext;
+    int io_uring;               // batch bulk-scan reads on io_uring if the kernel allows
+    int gitignore;              // honour .gitignore files and .git/info/exclude
+    int output;                 // OUTPUT_*
+    char **shard_dirs;          // OUTPUT_DIRS roots, relative to the repo; none = top-level dirs
+    size_t nshard_dirs;
+    int history_days;           // lifecycle log retention, 0 = keep forever
+    int hot_rate;               // daemon: events/s that quarantine a file, 0 = never
+    int hot_max_delay;          // seconds between updates of a quarantined file, at most
+    int max_watches;            // daemon: inotify watches, 0 = as many as the kernel allows
+    int fanotify;               // daemon: one fanotify mark per filesystem if privileged
+    long long bulk_io_rate;     // daemon bulk work: bytes/s read, 0 = unlimited
+    int bulk_file_rate;         // files/s looked at, 0 = unlimited
+    int bulk_cpu;               // % of a CPU, 100 = no duty cycle
+    int bulk_idle;              // idle I/O class, lowest CPU priority
+    int bulk_pressure;          // pause above this % of PSI I/O stall, 0 = never
+    double bulk_load;           // pause above this load average per CPU, 0 = never
+};
+
+int config_load(struct config *cfg, const char *path);
+int config_write_default(const char *path);
+void config_free(struct config *cfg);
+
+#endif
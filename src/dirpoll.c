@@ -0,0 +1,203 @@
+#define _GNU_SOURCE
+#include "dirpoll.h"
+#include "fs.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "hash.h"
+
+static void free_ents(struct pent *e, size_t n){
+    for (size_t i = 0; i < n; i++) free(e[i].name);
+    free(e);
+}
+
+static int by_name(const void *a, const void *b){
+    return strcmp(((const struct pent *)a)->name, ((const struct pent *)b)->name);
+}
+
+/* The entries of dir with what a poll compares, sorted by name. */
+static int listing(const char *dir, struct pent **out, size_t *nout){
+    DIR *d = opendir(dir);
+    if (!d) return -1;
+    struct pent *v = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+        struct stat st;
+        if (fstatat(dirfd(d), e->d_name, &st, 0) != 0) continue;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            struct pent *nv = realloc(v, cap * sizeof *nv);
+            if (!nv) break;
+            v = nv;
+        }
+        if (!(v[n].name = strdup(e->d_name))) break;
+        v[n].mtime = (long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        v[n].size = (long long)st.st_size;
+        v[n].dir = S_ISDIR(st.st_mode);
+        n++;
+    }
+    closedir(d);
+    if (n) qsort(v, n, sizeof *v, by_name);
+    *out = v;
+    *nout = n;
+    return 0;
+}
+
+static size_t hslot(const struct dirpoll *p, const char *path){
+    size_t i = (size_t)fnv1a64(path, strlen(path)) & (p->icap - 1);
+    while (p->idx[i] && strcmp(p->v[p->idx[i] - 1].path, path) != 0) i = (i + 1) & (p->icap - 1);
+    return i;
+}
+
+static int reindex(struct dirpoll *p){
+    size_t cap = 64;
+    while (cap < (p->n - p->dead) * 2 + 2) cap *= 2;
+    size_t *idx = calloc(cap, sizeof *idx);
+    if (!idx) return -1;
+    free(p->idx);
+    p->idx = idx;
+    p->icap = cap;
+    for (size_t i = 0; i < p->n; i++) if (!p->v[i].gone) p->idx[hslot(p, p->v[i].path)] = i + 1;
+    return 0;
+}
+
+long dirpoll_find(const struct dirpoll *p, const char *dir){
+    if (!p->icap) return -1;
+    size_t i = p->idx[hslot(p, dir)];
+    return i && !p->v[i - 1].gone ? (long)i - 1 : -1;
+}
+
+int dirpoll_add(struct dirpoll *p, const char *dir, long now){
+    if (dirpoll_find(p, dir) >= 0) return 0;
+    if (p->n == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 64;
+        struct pdir *nv = realloc(p->v, cap * sizeof *nv);
+        if (!nv) return -1;
+        p->v = nv;
+        p->cap = cap;
+    }
+    struct pdir *d = &p->v[p->n];
+    memset(d, 0, sizeof *d);
+    if (listing(dir, &d->ents, &d->n) != 0 || !(d->path = strdup(dir))) {
+        free_ents(d->ents, d->n);
+        return -1;
+    }
+    d->interval = DIRPOLL_MIN_MS;
+    d->due = now + d->interval;
+    p->n++;
+    if ((p->n - p->dead) * 2 > p->icap) return reindex(p);
+    p->idx[hslot(p, dir)] = p->n;
+    return 0;
+}
+
+static void emit(dirpoll_fn fn, void *ud, int type, const char *dir, const char *name){
+    char *path = NULL;
+    if (asprintf(&path, "%s/%s", dir, name) < 0) return;
+    fn(ud, type, path);
+    free(path);
+}
+
+int dirpoll_check(struct dirpoll *p, size_t i, long now, dirpoll_fn fn, void *ud){
+    struct pdir *d = &p->v[i];
+    struct pent *nv;
+    size_t nn;
+    if (listing(d->path, &nv, &nn) != 0) {
+        if (errno == ENOENT || errno == ENOTDIR) return -1;
+        d->due = now + d->interval;
+        return 0;
+    }
+    // Both sorted by name: one merge pass.
+    int changed = 0;
+    for (size_t a = 0, b = 0; a < d->n || b < nn; ) {
+        int c = a >= d->n ? 1 : b >= nn ? -1 : strcmp(d->ents[a].name, nv[b].name);
+        const struct pent *o = c <= 0 ? &d->ents[a] : NULL, *n = c >= 0 ? &nv[b] : NULL;
+        if (o && n && o->dir == n->dir) {
+            if (!n->dir && (o->mtime != n->mtime || o->size != n->size)) {
+                emit(fn, ud, FS_EVENT_WRITE, d->path, n->name);
+                changed = 1;
+            }
+        } else {
+            if (o) emit(fn, ud, o->dir ? FS_EVENT_DELETE_DIR : FS_EVENT_DELETE_FILE, d->path, o->name);
+            if (n) emit(fn, ud, n->dir ? FS_EVENT_CREATE_DIR : FS_EVENT_CREATE_FILE, d->path, n->name);
+            changed = 1;
+        }
+        a += o != NULL;
+        b += n != NULL;
+    }
+    free_ents(d->ents, d->n);
+    d->ents = nv;
+    d->n = nn;
+    if (changed) {
+        d->interval = DIRPOLL_MIN_MS;
+        d->changed = now;
+    } else if ((d->interval *= 2) > DIRPOLL_MAX_MS) {
+        d->interval = DIRPOLL_MAX_MS;
+    }
+    d->due = now + d->interval;
+    return changed;
+}
+
+void dirpoll_remove(struct dirpoll *p, size_t i){
+    struct pdir *d = &p->v[i];
+    if (d->gone) return;
+    free_ents(d->ents, d->n);
+    d->ents = NULL;
+    d->n = 0;
+    d->gone = 1;
+    p->dead++;
+}
+
+/* Drop removed entries for good. */
+static void sweep(struct dirpoll *p){
+    size_t n = 0;
+    for (size_t i = 0; i < p->n; i++) {
+        if (p->v[i].gone) free(p->v[i].path);
+        else p->v[n++] = p->v[i];
+    }
+    p->n = n;
+    p->dead = 0;
+    if (p->next >= n) p->next = 0;
+    reindex(p);
+}
+
+void dirpoll_rename(struct dirpoll *p, const char *from, const char *to){
+    size_t fl = strlen(from), hit = 0;
+    for (size_t i = 0; i < p->n; i++) {
+        char *path = p->v[i].path, *np = NULL;
+        if (p->v[i].gone || strncmp(path, from, fl) != 0 || (path[fl] && path[fl] != '/')) continue;
+        if (asprintf(&np, "%s%s", to, path + fl) < 0) continue;
+        free(path);
+        p->v[i].path = np;
+        hit++;
+    }
+    if (hit) sweep(p);
+}
+
+size_t dirpoll_run(struct dirpoll *p, long now, size_t max, dirpoll_fn fn, void *ud){
+    size_t polled = 0, i = p->next;
+    for (size_t k = 0; k < p->n && polled < max; k++, i = (i + 1) % p->n) {
+        struct pdir *d = &p->v[i];
+        if (d->gone || d->due > now) continue;
+        if (dirpoll_check(p, i, now, fn, ud) < 0) dirpoll_remove(p, i);
+        polled++;
+    }
+    p->next = i;
+    if (p->dead) sweep(p);
+    return polled;
+}
+
+void dirpoll_free(struct dirpoll *p){
+    for (size_t i = 0; i < p->n; i++) {
+        free_ents(p->v[i].ents, p->v[i].n);
+        free(p->v[i].path);
+    }
+    free(p->v);
+    free(p->idx);
+    memset(p, 0, sizeof *p);
+}
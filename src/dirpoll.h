@@ -0,0 +1,57 @@
+#ifndef DIRPOLL_H
+#define DIRPOLL_H
+#include <stddef.h>
+
+#define DIRPOLL_MIN_MS 2000     // a directory that just changed is polled this often
+#define DIRPOLL_MAX_MS 60000    // a quiet one backs off to this
+
+/* Directories the watcher has no inotify watch for, checked with stat
+ * instead. Each keeps its listing as last seen and a poll reports what
+ * differs as watch events. A directory that changed is polled again after
+ * DIRPOLL_MIN_MS; one that did not waits twice as long as last time, up to
+ * DIRPOLL_MAX_MS. Only the directory's own entries are looked at, as with
+ * a watch. */
+struct pent {
+    char *name;
+    long long mtime;            // ns
+    long long size;
+    int dir;
+};
+
+struct pdir {
+    char *path;
+    struct pent *ents;          // by name
+    size_t n;
+    long due, interval;         // ms
+    long changed;               // last change found, ms; 0 if none yet
+    int gone;                   // removed; dropped by the next dirpoll_run
+};
+
+struct dirpoll {
+    struct pdir *v;
+    size_t n, cap, dead;
+    size_t *idx;                // open addressing by path: index into v + 1
+    size_t icap;
+    size_t next;                // where the last run stopped
+};
+
+/* Called with an FS_EVENT_* type and the path of each difference. */
+typedef void (*dirpoll_fn)(void *ud, int type, const char *path);
+
+/* Start polling dir from its current listing; 0 if it already is. */
+int dirpoll_add(struct dirpoll *p, const char *dir, long now);
+/* Index of dir in p->v, or -1. */
+long dirpoll_find(const struct dirpoll *p, const char *dir);
+/* Poll v[i] now, whether due or not. -1 if it is gone, else whether it
+ * changed. */
+int dirpoll_check(struct dirpoll *p, size_t i, long now, dirpoll_fn fn, void *ud);
+/* Stop polling v[i]; indices stay valid until dirpoll_run. */
+void dirpoll_remove(struct dirpoll *p, size_t i);
+/* A directory was renamed: move it and everything polled below it. */
+void dirpoll_rename(struct dirpoll *p, const char *from, const char *to);
+/* Poll up to max directories that are due and drop those that are gone.
+ * Returns how many were polled. */
+size_t dirpoll_run(struct dirpoll *p, long now, size_t max, dirpoll_fn fn, void *ud);
+void dirpoll_free(struct dirpoll *p);
+
+#endif
@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include "fanwatch.h"
+#include "fs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include "hash.h"
+
+#define FAN_BUF (64*1024)
+#define FAN_CACHE 1024          // directory handles resolved, direct-mapped
+
+#define FAN_MASK_BASE (FAN_CREATE|FAN_DELETE|FAN_MODIFY|FAN_CLOSE_WRITE|FAN_ONDIR)
+#ifdef FAN_RENAME
+#define FAN_MASK_MOVE FAN_RENAME    // both ends in one event
+#else
+#define FAN_MASK_MOVE (FAN_MOVED_FROM|FAN_MOVED_TO)
+#endif
+
+struct fan_fs {
+    fsid_t fsid;
+    int mfd;                    // any fd on it, for open_by_handle_at
+};
+
+struct fan_dir {
+    unsigned char *key;         // fsid and handle
+    size_t klen;
+    char *path;
+};
+
+static struct {
+    int fd;
+    unsigned mask;
+    struct fan_fs *fs;
+    size_t nfs;
+    char *buf;
+    struct fan_dir cache[FAN_CACHE];
+} fan = { .fd = -1 };
+
+int fan_open(void){
+    if (fan.fd >= 0) return fan.fd;
+    // The queue is unbounded: an overflow would lose events of every repo.
+    fan.fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK | FAN_REPORT_DFID_NAME | FAN_UNLIMITED_QUEUE,
+                           O_RDONLY | O_LARGEFILE);
+    if (fan.fd < 0) return -1;
+    fan.mask = FAN_MASK_BASE | FAN_MASK_MOVE;
+    if (!(fan.buf = aligned_alloc(__alignof__(struct fanotify_event_metadata), FAN_BUF))) {
+        fan_close();
+        return -1;
+    }
+    return fan.fd;
+}
+
+int fan_mark(const char *path){
+    struct statfs sf;
+    if (fan.fd < 0 || statfs(path, &sf) != 0) return -1;
+    for (size_t i = 0; i < fan.nfs; i++)
+        if (memcmp(&fan.fs[i].fsid, &sf.f_fsid, sizeof sf.f_fsid) == 0) return 0;
+    int rc = fanotify_mark(fan.fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, fan.mask, AT_FDCWD, path);
+    if (rc != 0 && errno == EINVAL && fan.mask != (FAN_MASK_BASE | FAN_MOVED_FROM | FAN_MOVED_TO)) {
+        // A kernel without FAN_RENAME: the two halves of a move come apart.
+        fan.mask = FAN_MASK_BASE | FAN_MOVED_FROM | FAN_MOVED_TO;
+        rc = fanotify_mark(fan.fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, fan.mask, AT_FDCWD, path);
+    }
+    if (rc != 0) return -1;
+    struct fan_fs *nf = realloc(fan.fs, (fan.nfs + 1) * sizeof *nf);
+    int mfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (!nf || mfd < 0) {
+        if (nf) fan.fs = nf;
+        if (mfd >= 0) close(mfd);
+        fanotify_mark(fan.fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, fan.mask, AT_FDCWD, path);
+        return -1;
+    }
+    fan.fs = nf;
+    fan.fs[fan.nfs++] = (struct fan_fs){ sf.f_fsid, mfd };
+    return 0;
+}
+
+static void cache_clear(void){
+    for (size_t i = 0; i < FAN_CACHE; i++) {
+        free(fan.cache[i].key);
+        free(fan.cache[i].path);
+    }
+    memset(fan.cache, 0, sizeof fan.cache);
+}
+
+/* The path of the directory a handle names, as it is now. */
+static int dir_path(const struct fanotify_event_info_fid *fid, char out[PATH_MAX]){
+    struct file_handle *fh = (struct file_handle *)fid->handle;
+    size_t klen = sizeof fid->fsid + sizeof *fh + fh->handle_bytes;
+    unsigned char key[sizeof fid->fsid + sizeof *fh + MAX_HANDLE_SZ];
+    if (fh->handle_bytes > MAX_HANDLE_SZ) return -1;
+    memcpy(key, &fid->fsid, sizeof fid->fsid);
+    memcpy(key + sizeof fid->fsid, fh, klen - sizeof fid->fsid);
+    struct fan_dir *d = &fan.cache[fnv1a64(key, klen) & (FAN_CACHE - 1)];
+    if (d->key && d->klen == klen && memcmp(d->key, key, klen) == 0) {
+        snprintf(out, PATH_MAX, "%s", d->path);
+        return 0;
+    }
+    int mfd = -1;
+    for (size_t i = 0; i < fan.nfs && mfd < 0; i++)
+        if (memcmp(&fan.fs[i].fsid, &fid->fsid, sizeof fid->fsid) == 0) mfd = fan.fs[i].mfd;
+    int fd = mfd >= 0 ? open_by_handle_at(mfd, fh, O_PATH | O_CLOEXEC) : -1;
+    if (fd < 0) return -1;      // gone by now
+    char proc[64];
+    snprintf(proc, sizeof proc, "/proc/self/fd/%d", fd);
+    ssize_t n = readlink(proc, out, PATH_MAX - 1);
+    close(fd);
+    if (n <= 0 || out[0] != '/') return -1;
+    out[n] = 0;
+    free(d->key);
+    free(d->path);
+    d->key = malloc(klen);
+    d->path = strdup(out);
+    if (d->key && d->path) {
+        memcpy(d->key, key, klen);
+        d->klen = klen;
+    } else {
+        free(d->key);
+        free(d->path);
+        *d = (struct fan_dir){0};
+    }
+    return 0;
+}
+
+/* dir/name of an info record; "." names the directory itself. */
+static int info_path(const struct fanotify_event_info_fid *fid, char out[PATH_MAX]){
+    const struct file_handle *fh = (const struct file_handle *)fid->handle;
+    const char *name = (const char *)fh->f_handle + fh->handle_bytes;
+    char dir[PATH_MAX];
+    if (dir_path(fid, dir) != 0) return -1;
+    if (strcmp(name, ".") == 0) return snprintf(out, PATH_MAX, "%s", dir) < PATH_MAX ? 0 : -1;
+    return snprintf(out, PATH_MAX, "%s%s%s", dir, strcmp(dir, "/") ? "/" : "", name) < PATH_MAX ? 0 : -1;
+}
+
+static void one_event(const struct fanotify_event_metadata *m, fan_fn fn, void *ud){
+    char path[PATH_MAX], from[PATH_MAX];
+    int have = 0, have_from = 0;
+    const char *p = (const char *)(m + 1), *end = (const char *)m + m->event_len;
+    while (p + sizeof(struct fanotify_event_info_header) <= end) {
+        const struct fanotify_event_info_fid *fid = (const struct fanotify_event_info_fid *)p;
+        if (!fid->hdr.len) break;
+        int t = fid->hdr.info_type;
+#ifdef FAN_EVENT_INFO_TYPE_OLD_DFID_NAME
+        if (t == FAN_EVENT_INFO_TYPE_OLD_DFID_NAME) have_from = info_path(fid, from) == 0;
+        else if (t == FAN_EVENT_INFO_TYPE_NEW_DFID_NAME) have = info_path(fid, path) == 0;
+        else
+#endif
+        if (t == FAN_EVENT_INFO_TYPE_DFID_NAME) have = info_path(fid, path) == 0;
+        p += fid->hdr.len;
+    }
+    bool dir = m->mask & FAN_ONDIR;
+    if (dir && (m->mask & (FAN_DELETE | FAN_MOVED_FROM | FAN_MASK_MOVE))) cache_clear();
+    if (have && have_from) {
+        fn(ud, dir ? FS_EVENT_RENAME_DIR : FS_EVENT_RENAME, path, from);
+        return;
+    }
+    if (have_from) {            // renamed to where we cannot see
+        fn(ud, dir ? FS_EVENT_DELETE_DIR : FS_EVENT_DELETE_FILE, from, NULL);
+        return;
+    }
+    if (!have) return;
+    // Events on one name merge in the queue: what is there now decides.
+    int gone = (m->mask & (FAN_DELETE | FAN_MOVED_FROM)) != 0;
+    int made = (m->mask & (FAN_CREATE | FAN_MOVED_TO | FAN_MASK_MOVE)) != 0 && !(m->mask & FAN_MOVED_FROM);
+    if (gone && made) {
+        struct stat st;
+        gone = lstat(path, &st) != 0;
+        made = !gone;
+    }
+    if (gone) fn(ud, dir ? FS_EVENT_DELETE_DIR : FS_EVENT_DELETE_FILE, path, NULL);
+    else if (made) fn(ud, dir ? FS_EVENT_CREATE_DIR : FS_EVENT_CREATE_FILE, path, NULL);
+    else if (!dir && (m->mask & (FAN_MODIFY | FAN_CLOSE_WRITE))) fn(ud, FS_EVENT_WRITE, path, NULL);
+}
+
+int fan_read(fan_fn fn, void *ud){
+    if (fan.fd < 0) return -1;
+    ssize_t len = read(fan.fd, fan.buf, FAN_BUF);
+    if (len < 0) return errno == EAGAIN ? 0 : -1;
+    const struct fanotify_event_metadata *m = (const struct fanotify_event_metadata *)fan.buf;
+    for (; FAN_EVENT_OK(m, len); m = FAN_EVENT_NEXT(m, len)) {
+        if (m->vers != FANOTIFY_METADATA_VERSION) return -1;
+        if (m->fd >= 0) close(m->fd);
+        if (!(m->mask & FAN_Q_OVERFLOW)) one_event(m, fn, ud);
+    }
+    return len > 0;
+}
+
+void fan_close(void){
+    for (size_t i = 0; i < fan.nfs; i++) close(fan.fs[i].mfd);
+    free(fan.fs);
+    free(fan.buf);
+    cache_clear();
+    if (fan.fd >= 0) close(fan.fd);
+    fan.fd = -1;
+    fan.fs = NULL;
+    fan.nfs = 0;
+    fan.buf = NULL;
+}
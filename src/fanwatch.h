@@ -0,0 +1,26 @@
+#ifndef FANWATCH_H
+#define FANWATCH_H
+
+/* One fanotify group for the whole process. A mark covers a whole
+ * filesystem (FAN_MARK_FILESYSTEM), so watching a repo costs nothing per
+ * directory and every repo on that filesystem shares it. Events name the
+ * parent directory by file handle (FAN_REPORT_DFID_NAME), resolved to a
+ * path with open_by_handle_at. Needs CAP_SYS_ADMIN and
+ * CAP_DAC_READ_SEARCH. */
+
+/* Called with an FS_EVENT_* type, the path and, for a rename, the old
+ * path (else NULL). */
+typedef void (*fan_fn)(void *ud, int type, const char *path, const char *from);
+
+/* The group's fd, set up on first use; -1 if the kernel or our privileges
+ * do not allow it. */
+int fan_open(void);
+/* Mark the filesystem path is on, unless it already is. */
+int fan_mark(const char *path);
+/* Decode one read's worth of pending events. 1 if there were any, 0 if
+ * none, -1 on error. */
+int fan_read(fan_fn fn, void *ud);
+/* Drop the group and its marks. */
+void fan_close(void);
+
+#endif
@@ -1,5 +1,7 @@
 #define _GNU_SOURCE
 #include "fs.h"
+#include "canon.h"
+#include "fanwatch.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <dirent.h>
@@ -10,6 +12,7 @@
 #include <sys/inotify.h>
 #include <limits.h>
 #include <errno.h>
+#include <time.h>
 
 static char *strdup0(const char *s){
     if(!s) return NULL;
@@ -41,149 +44,438 @@ static char *relpath_from_root(const char *root, const char *abs){
 
 bool fs_should_parse_file(const char *path, struct ignore *ig){
     if(!is_reg(path)) return false;
-    const char *ext=strrchr(path,'.');
-    if(ext && (!strcmp(ext,".png")||!strcmp(ext,".jpg")||!strcmp(ext,".jpeg")||
-               !strcmp(ext,".gif")||!strcmp(ext,".pdf")||!strcmp(ext,".zip")||
-               !strcmp(ext,".gz")||!strcmp(ext,".tar")||!strcmp(ext,".jar")||
-               !strcmp(ext,".war")||!strcmp(ext,".class")||!strcmp(ext,".exe")||
-               !strcmp(ext,".so")||!strcmp(ext,".o")||!strcmp(ext,".a")))
-        return false;
-    if(strstr(path, "/.ctags/")!=NULL || strcmp(path,".ctags")==0) return false;
-    char cwd[PATH_MAX];
-    if (!getcwd(cwd,sizeof cwd)) return false;
+    if(strstr(path, "/.ctags/")!=NULL || strstr(path, "/.git/")!=NULL) return false;
     char abspath[PATH_MAX];
-    if (!realpath(path, abspath)) return false;
-    char *rel = relpath_from_root(cwd, abspath);
+    if (!ig->root || canon_path(path, abspath) != 0) return false;
+    char *rel = relpath_from_root(ig->root, abspath);
     bool ignored = ignore_match(ig, rel, false);
     free(rel);
     return !ignored;
 }
 
-int fs_walk_files(const char *root, struct ignore *ig, onfile_cb cb, void *a, void *b, void *c){
+/* Never walked, watched or parsed: our state and git's. */
+static bool private_dir(const char *name){
+    return strcmp(name,".ctags")==0 || strcmp(name,".git")==0;
+}
+
+/* One stat and one canonical lookup per entry; the cwd is taken once. dir
+ * is the ignore matcher of root, each subdirectory's pushed on the way
+ * down. */
+static int walk(const char *root, const char *cwd, const struct ignore_dir *dir, struct ignore *ig,
+                onfile_cb cb, ondir_cb ondir, void *a, void *b, void *c){
     DIR *d=opendir(root);
     if(!d) return -1;
+    if(ondir) ondir(root, a);
     struct dirent *e;
     while((e=readdir(d))){
         if(!strcmp(e->d_name,".")||!strcmp(e->d_name,"..")) continue;
         char *p=NULL; if (asprintf(&p, "%s/%s", root, e->d_name) < 0) continue;
-        int isdir = is_dir(p);
-        char cwd[PATH_MAX];
-        if (!getcwd(cwd,sizeof cwd)){ free(p); continue; }
+        struct stat st;
         char abspath[PATH_MAX];
-        if (!realpath(p, abspath)){ free(p); continue; }
+        if (stat(p, &st) != 0 || canon_path(p, abspath) != 0){ free(p); continue; }
+        int isdir = S_ISDIR(st.st_mode);
         char *rel = relpath_from_root(cwd, abspath);
-        int ignored = ignore_match(ig, rel, isdir);
-        free(rel);
-        if(ignored){ free(p); continue; }
+        if(!rel || ignore_match_in(dir, rel, isdir)){ free(rel); free(p); continue; }
         if(isdir){
-            if(strcmp(e->d_name,".ctags")==0){ free(p); continue; }
-            fs_walk_files(p, ig, cb, a, b, c);
-        } else {
-            if(fs_should_parse_file(p, ig)) cb(p, ig, a, b, c);
+            const struct ignore_dir *sub = private_dir(e->d_name) ? NULL : ignore_push(ig, rel);
+            if(sub) walk(p, cwd, sub, ig, cb, ondir, a, b, c);
+        } else if(S_ISREG(st.st_mode)){
+            cb(p, ig, a, b, c);
         }
+        free(rel);
         free(p);
     }
     closedir(d);
     return 0;
 }
 
-static void wdmap_add(fs_watch_context *c, int wd, const char *path){
+int fs_walk(const char *root, struct ignore *ig, onfile_cb cb, ondir_cb ondir, void *a, void *b, void *c){
+    char cwd[PATH_MAX], abspath[PATH_MAX];
+    if (!getcwd(cwd,sizeof cwd) || canon_path(root, abspath) != 0) return -1;
+    char *rel = relpath_from_root(cwd, abspath);
+    const struct ignore_dir *dir = rel ? ignore_push(ig, rel) : NULL;
+    free(rel);
+    return dir ? walk(root, cwd, dir, ig, cb, ondir, a, b, c) : -1;
+}
+
+int fs_walk_files(const char *root, struct ignore *ig, onfile_cb cb, void *a, void *b, void *c){
+    return fs_walk(root, ig, cb, NULL, a, b, c);
+}
+
+#define WATCH_MASK (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_MODIFY|IN_CLOSE_WRITE|IN_DELETE_SELF|IN_MOVE_SELF)
+#define WATCH_RETRY_MS 30000    // after the kernel ran out of watches
+#define WATCH_COLD_MS 300000    // a watch this long without events can go to a busier directory
+#define POLL_ACTIVE_MS 60000    // a polled directory that changed this recently wants a watch
+#define POLL_SLICE 256          // directories polled per fs_watch_poll
+#define REBALANCE_MS 10000
+#define PROMOTE_MAX 1024        // polled directories given a free watch per rebalance
+#define SWAP_MAX 32             // watches moved to busier directories per rebalance
+
+static long now_ms(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+static void wdmap_add(fs_watch_context *c, int wd, const char *path, long now){
     if(c->wds_len==c->wds_cap){
         c->wds_cap = c->wds_cap? c->wds_cap*2 : 64;
         c->wds = realloc(c->wds, c->wds_cap*sizeof *c->wds);
     }
     c->wds[c->wds_len].wd = wd;
     c->wds[c->wds_len].path = strdup0(path);
+    c->wds[c->wds_len].last = now;
     c->wds_len++;
+    c->nwatched++;
 }
 
-static char *wd_path(fs_watch_context *c, int wd){
-    for(int i=0;i<c->wds_len;i++) if(c->wds[i].wd==wd) return c->wds[i].path;
+static struct wdmap *wd_find(fs_watch_context *c, int wd){
+    for(int i=0;i<c->wds_len;i++) if(c->wds[i].wd==wd) return &c->wds[i];
     return NULL;
 }
 
-int fs_watch_init(fs_watch_context *c, const char *root, struct ignore *ig){
+/* The kernel dropped wd: its directory is gone or we gave the watch up. */
+static void wdmap_drop(fs_watch_context *c, int wd){
+    struct wdmap *w = wd_find(c, wd);
+    if(!w) return;
+    if(w->last>=0) c->nwatched--;
+    free(w->path);
+    *w = c->wds[--c->wds_len];
+}
+
+int fs_watch_init(fs_watch_context *c, const char *root, struct ignore *ig, int max_watches){
     memset(c,0,sizeof *c);
     c->root = realpath(root, NULL);
+    c->max_watches = max_watches;
     c->inofd = inotify_init1(IN_NONBLOCK);
     if(c->inofd<0) return -1;
     return fs_watch_add_dir_recursive(c, root, ig);
 }
 
+static bool room(const fs_watch_context *c, long now){
+    return (!c->max_watches || c->nwatched < c->max_watches) && now >= c->full_until;
+}
+
+/* A watch for dir, or a place among the polled ones once the budget is
+ * spent. */
 static int add_watch_dir(fs_watch_context *c, const char *dir){
-    int mask = IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|
-               IN_MODIFY|IN_CLOSE_WRITE|IN_DELETE_SELF|IN_MOVE_SELF;
-    int wd = inotify_add_watch(c->inofd, dir, mask);
-    if(wd<0) return -1;
-    wdmap_add(c, wd, dir);
+    long now = now_ms();
+    if(dirpoll_find(&c->poll, dir) >= 0) return 0;     // rebalancing will see to it
+    if(!room(c, now)) return dirpoll_add(&c->poll, dir, now);
+    int wd = inotify_add_watch(c->inofd, dir, WATCH_MASK);
+    if(wd<0){
+        if(errno!=ENOSPC) return -1;
+        c->full_until = now + WATCH_RETRY_MS;
+        return dirpoll_add(&c->poll, dir, now);
+    }
+    if(!wd_find(c, wd)) wdmap_add(c, wd, dir, now);   // already watched otherwise
     return 0;
 }
 
+/* Whether a directory should be walked and watched. */
+bool fs_should_walk_dir(const char *path, struct ignore *ig){
+    const char *base=strrchr(path,'/');
+    base = base ? base+1 : path;
+    if(private_dir(base) || strstr(path,"/.ctags/")!=NULL || strstr(path,"/.git/")!=NULL) return false;
+    char abspath[PATH_MAX];
+    if (!ig->root || canon_path(path, abspath) != 0) return false;
+    char *rel = relpath_from_root(ig->root, abspath);
+    int ignored = ignore_match(ig, rel, true);
+    free(rel);
+    return !ignored;
+}
+
 int fs_watch_add_dir_recursive(fs_watch_context *c, const char *dir, struct ignore *ig){
+    if(c->fan) return 0;        // the mark covers it
     add_watch_dir(c, dir);
     DIR *d=opendir(dir); if(!d) return 0;
     struct dirent *e;
     while((e=readdir(d))){
         if(!strcmp(e->d_name,".")||!strcmp(e->d_name,"..")) continue;
         char *p=NULL; if (asprintf(&p, "%s/%s", dir, e->d_name) < 0) continue;
-        if(is_dir(p)){
-            char cwd[PATH_MAX];
-            if (!getcwd(cwd,sizeof cwd)){ free(p); continue; }
-            char abspath[PATH_MAX];
-            if (!realpath(p, abspath)){ free(p); continue; }
-            char *rel = relpath_from_root(cwd, abspath);
-            int ignored = ignore_match(ig, rel, true);
-            free(rel);
-            if(ignored || strstr(p,"/.ctags/")!=NULL || strcmp(e->d_name,".ctags")==0){ free(p); continue; }
-            fs_watch_add_dir_recursive(c, p, ig);
-        }
+        if(is_dir(p) && fs_should_walk_dir(p, ig)) fs_watch_add_dir_recursive(c, p, ig);
         free(p);
     }
     closedir(d);
     return 0;
 }
 
+/* Watch exactly the given directories, e.g. from a snapshot, instead of
+ * discovering them by walking the tree. */
+int fs_watch_init_dirs(fs_watch_context *c, const char *root, char *const *dirs, size_t n, int max_watches){
+    memset(c,0,sizeof *c);
+    c->root = realpath(root, NULL);
+    c->max_watches = max_watches;
+    c->inofd = inotify_init1(IN_NONBLOCK);
+    if(c->inofd<0) return -1;
+    for(size_t i=0;i<n;i++) add_watch_dir(c, dirs[i]);
+    return 0;
+}
+
 int fs_watch_remove_dir(fs_watch_context *c, const char *dir){
     (void)c; (void)dir;
     return 0;
 }
 
-int fs_watch_next(fs_watch_context *c, fs_event *ev){
-    char buf[64*1024] __attribute__ ((aligned(__alignof__(struct inotify_event))));
-    ssize_t len = read(c->inofd, buf, sizeof buf);
-    if(len<0){
-        if(errno==EAGAIN){ usleep(100000); return 0; }
+#define EVBUF_SIZE (64*1024)
+
+/* Next raw event, refilling the buffer from the fd once it is used up. The
+ * event stays in the buffer until evpos is advanced past it. */
+static int raw_next(fs_watch_context *c, struct inotify_event **out){
+    if(c->evpos >= c->evlen){
+        ssize_t len = read(c->inofd, c->evbuf, EVBUF_SIZE);
+        if(len<0) return errno==EAGAIN ? 0 : -1;
+        if(len==0) return 0;
+        c->evlen = (size_t)len;
+        c->evpos = 0;
+    }
+    *out = (struct inotify_event *)(c->evbuf + c->evpos);
+    return 1;
+}
+
+static char *event_path(fs_watch_context *c, const struct inotify_event *ie){
+    struct wdmap *w = wd_find(c, ie->wd);
+    if(!w) return NULL;
+    if(w->last>=0) w->last = now_ms();
+    const char *dpath = w->path;
+    char *path=NULL;
+    if(ie->len && ie->name[0]){
+        if (asprintf(&path, "%s/%s", dpath, ie->name) < 0) path=NULL;
+    } else {
+        path = strdup0(dpath);
+    }
+    return path;
+}
+
+/* A watched directory was renamed: its watches (and those below it) follow
+ * the inode, only the paths we report need rewriting. */
+static void rename_watches(fs_watch_context *c, const char *from, const char *to){
+    size_t fl = strlen(from);
+    for(int i=0;i<c->wds_len;i++){
+        char *p = c->wds[i].path;
+        if(strncmp(p, from, fl)!=0 || (p[fl] && p[fl]!='/')) continue;
+        char *np=NULL;
+        if(asprintf(&np, "%s%s", to, p+fl) < 0) continue;
+        free(p);
+        c->wds[i].path = np;
+    }
+    dirpoll_rename(&c->poll, from, to);
+}
+
+static void pend_add(fs_watch_context *c, int type, const char *path, const char *from){
+    if(c->npend==c->pend_cap){
+        size_t cap = c->pend_cap ? c->pend_cap*2 : 64;
+        fs_event *np = realloc(c->pend, cap*sizeof *np);
+        if(!np) return;
+        c->pend = np;
+        c->pend_cap = cap;
+    }
+    char *p = strdup0(path), *f = strdup0(from);
+    if(p && (f || !from)) c->pend[c->npend++] = (fs_event){ type, p, f };
+    else { free(p); free(f); }
+}
+
+static void pend_event(void *ud, int type, const char *path){
+    pend_add(ud, type, path, NULL);
+}
+
+static int pend_pop(fs_watch_context *c, fs_event *ev){
+    if(c->pend_pos>=c->npend) return 0;
+    *ev = c->pend[c->pend_pos++];
+    if(c->pend_pos==c->npend) c->npend = c->pend_pos = 0;
+    return 1;
+}
+
+/* Every fan context; main thread only. One read of the group serves them
+ * all: each event goes to the contexts it is below the root of. */
+static fs_watch_context **fans;
+static size_t nfans;
+
+/* path relative to c->root if it is an entry of a directory c would
+ * watch, else NULL. */
+static const char *fan_rel(const fs_watch_context *c, const char *path){
+    size_t rl = strlen(c->root);
+    if(strncmp(path, c->root, rl)!=0 || path[rl]!='/') return NULL;
+    const char *rel = path+rl+1, *slash = strrchr(rel, '/');
+    if(!slash) return rel;
+    char parent[PATH_MAX];
+    if((size_t)(slash-rel)>=sizeof parent) return NULL;
+    memcpy(parent, rel, (size_t)(slash-rel));
+    parent[slash-rel] = 0;
+    for(char *p=parent, *e; p; p = e ? e+1 : NULL){
+        if((e=strchr(p,'/'))) *e = 0;
+        if(private_dir(p)) return NULL;
+        if(e) *e = '/';
+    }
+    return ignore_match(c->ig, parent, true) ? NULL : rel;
+}
+
+/* A rename with one end outside a context is a create or delete to it. */
+static void fan_dispatch(void *ud, int type, const char *path, const char *from){
+    (void)ud;
+    bool dir = type==FS_EVENT_RENAME_DIR;
+    for(size_t i=0;i<nfans;i++){
+        fs_watch_context *c = fans[i];
+        bool in = fan_rel(c, path)!=NULL, was = from && fan_rel(c, from)!=NULL;
+        if(in && was) pend_add(c, type, path, from);
+        else if(in) pend_add(c, !from ? type : dir ? FS_EVENT_CREATE_DIR : FS_EVENT_CREATE_FILE, path, NULL);
+        else if(was) pend_add(c, dir ? FS_EVENT_DELETE_DIR : FS_EVENT_DELETE_FILE, from, NULL);
+    }
+}
+
+int fs_watch_init_fan(fs_watch_context *c, const char *root, struct ignore *ig){
+    memset(c,0,sizeof *c);
+    c->inofd = -1;
+    c->root = realpath(root, NULL);
+    fs_watch_context **nf = realloc(fans, (nfans+1)*sizeof *nf);
+    if(nf) fans = nf;
+    if(!c->root || !nf || (c->inofd = fan_open())<0 || fan_mark(c->root)!=0){
+        if(!nfans) fan_close();
+        free(c->root);
+        c->root = NULL;
+        c->inofd = -1;
         return -1;
     }
-    size_t i=0;
-    while(i < (size_t)len){
-        struct inotify_event *ie = (struct inotify_event *)(buf + i);
-        i += sizeof(*ie) + ie->len;
-        char *dpath = wd_path(c, ie->wd);
-        if(!dpath) continue;
-        char *path=NULL;
-        if(ie->len && ie->name[0]){
-            if (asprintf(&path, "%s/%s", dpath, ie->name) < 0) path=NULL;
-        } else {
-            path = strdup0(dpath);
+    c->fan = 1;
+    c->ig = ig;
+    fans[nfans++] = c;
+    return 0;
+}
+
+/* Returns 1 with an event, 0 when the inotify fd has nothing pending (it
+ * is non-blocking; poll it for readiness), -1 on error. Events left over
+ * from one read are returned by the following calls. A move within the
+ * watched tree is paired by its cookie into one rename event; a move in or
+ * out of it is reported as a create or delete. */
+int fs_watch_next(fs_watch_context *c, fs_event *ev){
+    if(c->fan){
+        for(;;){
+            if(pend_pop(c, ev)) return 1;
+            int rc = fan_read(fan_dispatch, NULL);
+            if(rc<=0) return rc;
         }
+    }
+    if(!c->evbuf){
+        c->evbuf = aligned_alloc(__alignof__(struct inotify_event), EVBUF_SIZE);
+        if(!c->evbuf) return -1;
+    }
+    for(;;){
+        struct inotify_event *ie;
+        int rc = raw_next(c, &ie);
+        if(rc==0 && pend_pop(c, ev)) return 1;
+        if(rc<=0) return rc;
+        c->evpos += sizeof(*ie) + ie->len;
+        if(ie->mask & IN_IGNORED){ wdmap_drop(c, ie->wd); continue; }
+        // Moves of a watched directory itself arrive paired in its parent.
+        if(ie->mask & IN_MOVE_SELF) continue;
+        char *path = event_path(c, ie);
+        if(!path) continue;
+        uint32_t mask = ie->mask, cookie = ie->cookie;
         ev->path = path;
-        if(ie->mask & IN_ISDIR){
-            if(ie->mask & (IN_CREATE|IN_MOVED_TO)){ ev->type = FS_EVENT_CREATE_DIR; return 1; }
-            if(ie->mask & (IN_DELETE|IN_MOVED_FROM|IN_DELETE_SELF)){ ev->type = FS_EVENT_DELETE_DIR; return 1; }
+        ev->from = NULL;
+        struct inotify_event *to;
+        // The kernel queues both halves of a rename back to back.
+        if((mask & IN_MOVED_FROM) && cookie && raw_next(c, &to) > 0 &&
+           (to->mask & IN_MOVED_TO) && to->cookie == cookie){
+            c->evpos += sizeof(*to) + to->len;
+            char *npath = event_path(c, to);
+            if(npath){
+                ev->from = path;
+                ev->path = npath;
+                if(mask & IN_ISDIR){
+                    rename_watches(c, path, npath);
+                    ev->type = FS_EVENT_RENAME_DIR;
+                } else {
+                    ev->type = FS_EVENT_RENAME;
+                }
+                return 1;
+            }
+        }
+        if(mask & IN_ISDIR){
+            if(mask & (IN_CREATE|IN_MOVED_TO)){ ev->type = FS_EVENT_CREATE_DIR; return 1; }
+            if(mask & (IN_DELETE|IN_MOVED_FROM|IN_DELETE_SELF)){ ev->type = FS_EVENT_DELETE_DIR; return 1; }
         } else {
-            if(ie->mask & (IN_CLOSE_WRITE|IN_MODIFY)){ ev->type = FS_EVENT_WRITE; return 1; }
-            if(ie->mask & (IN_CREATE|IN_MOVED_TO)){ ev->type = FS_EVENT_CREATE_FILE; return 1; }
-            if(ie->mask & (IN_DELETE|IN_MOVED_FROM)){ ev->type = FS_EVENT_DELETE_FILE; return 1; }
+            if(mask & (IN_CLOSE_WRITE|IN_MODIFY)){ ev->type = FS_EVENT_WRITE; return 1; }
+            if(mask & (IN_CREATE|IN_MOVED_TO)){ ev->type = FS_EVENT_CREATE_FILE; return 1; }
+            if(mask & (IN_DELETE|IN_MOVED_FROM)){ ev->type = FS_EVENT_DELETE_FILE; return 1; }
         }
         ev->type = FS_EVENT_MOVE;
         return 1;
     }
+}
+
+/* Move polled directory i to a watch. Its last poll covers what changed
+ * before the watch was in place, the watch what changes after. */
+static int promote(fs_watch_context *c, size_t i, long now){
+    const char *dir = c->poll.v[i].path;
+    int wd = inotify_add_watch(c->inofd, dir, WATCH_MASK);
+    if(wd<0){
+        if(errno==ENOSPC) c->full_until = now + WATCH_RETRY_MS;
+        else dirpoll_remove(&c->poll, i);
+        return -1;
+    }
+    if(!wd_find(c, wd)) wdmap_add(c, wd, dir, now);
+    dirpoll_check(&c->poll, i, now, pend_event, c);
+    dirpoll_remove(&c->poll, i);
+    c->promoted++;
+    return 0;
+}
+
+/* Give up the watch of the directory that has been quiet longest, if any
+ * has been quiet for WATCH_COLD_MS and longer than since busy. Its events
+ * queued so far still arrive: the kernel's IN_IGNORED comes after them. */
+static int demote(fs_watch_context *c, long busy, long now){
+    int w = -1;
+    for(int i=0;i<c->wds_len;i++){
+        long last = c->wds[i].last;
+        if(last>=0 && now-last>=WATCH_COLD_MS && last<busy && (w<0 || last<c->wds[w].last)) w = i;
+    }
+    if(w<0 || dirpoll_add(&c->poll, c->wds[w].path, now)!=0) return -1;
+    inotify_rm_watch(c->inofd, c->wds[w].wd);
+    c->wds[w].last = -1;
+    c->nwatched--;
+    c->demoted++;
     return 0;
 }
 
+static const struct dirpoll *by_changed_poll;
+static int by_changed(const void *a, const void *b){
+    long x = by_changed_poll->v[*(const size_t *)a].changed, y = by_changed_poll->v[*(const size_t *)b].changed;
+    return (y > x) - (y < x);
+}
+
+/* Watches go to the polled directories that changed most recently: as
+ * long as there is room for them, then in exchange for cold watches. */
+static void rebalance(fs_watch_context *c, long now){
+    size_t *cand = malloc((c->poll.n ? c->poll.n : 1)*sizeof *cand), nc = 0;
+    if(!cand) return;
+    bool free_room = room(c, now);
+    for(size_t i=0;i<c->poll.n;i++){
+        const struct pdir *d = &c->poll.v[i];
+        if(!d->gone && (free_room || (d->changed && now-d->changed<POLL_ACTIVE_MS))) cand[nc++] = i;
+    }
+    by_changed_poll = &c->poll;
+    qsort(cand, nc, sizeof *cand, by_changed);
+    for(size_t k=0, swaps=0; k<nc && k<PROMOTE_MAX; k++){
+        if(!room(c, now) && (++swaps>SWAP_MAX || demote(c, c->poll.v[cand[k]].changed, now)!=0)) break;
+        if(promote(c, cand[k], now)!=0) break;
+    }
+    free(cand);
+}
+
+size_t fs_watch_poll(fs_watch_context *c){
+    long now = now_ms();
+    if(c->poll.n) dirpoll_run(&c->poll, now, POLL_SLICE, pend_event, c);
+    if(c->poll.n && now-c->rebalanced>=REBALANCE_MS){
+        c->rebalanced = now;
+        rebalance(c, now);
+    }
+    return c->npend - c->pend_pos;
+}
+
 void fs_event_free(fs_event *ev){
-    free(ev->path); ev->path=NULL; ev->type=FS_EVENT_NONE;
+    free(ev->path); free(ev->from);
+    ev->path=ev->from=NULL; ev->type=FS_EVENT_NONE;
 }
 
 void fs_watch_close(fs_watch_context *c){
@@ -192,7 +484,14 @@ void fs_watch_close(fs_watch_context *c){
         free(c->wds[i].path);
     }
     free(c->wds);
-    if(c->inofd>=0) close(c->inofd);
+    for(size_t i=c->pend_pos;i<c->npend;i++) fs_event_free(&c->pend[i]);
+    free(c->pend);
+    dirpoll_free(&c->poll);
+    if(c->fan){
+        for(size_t i=0;i<nfans;i++) if(fans[i]==c){ fans[i] = fans[--nfans]; break; }
+        if(!nfans) fan_close();
+    } else if(c->inofd>=0) close(c->inofd);
     free(c->root);
+    free(c->evbuf);
 }
 
@@ -1,11 +1,14 @@
 #ifndef FS_H
 #define FS_H
 #include <stdbool.h>
+#include <stddef.h>
 #include "ignore.h"
+#include "dirpoll.h"
 
 typedef struct {
     int type;
     char *path;
+    char *from;                 // old path of a rename, else NULL
 } fs_event;
 
 enum {
@@ -15,25 +18,58 @@ enum {
     FS_EVENT_DELETE_FILE,
     FS_EVENT_MOVE,
     FS_EVENT_CREATE_DIR,
-    FS_EVENT_DELETE_DIR
+    FS_EVENT_DELETE_DIR,
+    FS_EVENT_RENAME,            // both ends watched: from -> path
+    FS_EVENT_RENAME_DIR
 };
 
+/* Watches are a budget: at most max_watches, or what the kernel gives us.
+ * Directories beyond it are polled (see dirpoll.h), and fs_watch_poll
+ * moves the watches of directories that have gone quiet to polled ones
+ * that turn out to be busy. A fanotify context (fs_watch_init_fan) needs
+ * none of that: it shares one group with every other such context and
+ * gets its events through pend. */
 typedef struct {
-    int inofd;
-    struct wdmap { int wd; char *path; } *wds;
+    int inofd;                  // the shared fanotify fd for a fan context
+    int fan;
+    struct ignore *ig;          // fan: events below ignored directories are dropped
+    struct wdmap { int wd; char *path; long last; } *wds;  // last event, ms; -1 once given up
     int wds_len, wds_cap;
+    int nwatched;               // wds not given up
+    int max_watches;            // 0: no limit of our own
+    long full_until;            // ms; the kernel is out of watches, don't ask before
+    struct dirpoll poll;        // directories without a watch
+    long rebalanced;            // ms
+    size_t promoted, demoted;   // directories moved to and from a watch
+    fs_event *pend;             // found by polling, not returned yet
+    size_t npend, pend_cap, pend_pos;
     char *root;
+    char *evbuf;                // events read but not yet returned
+    size_t evlen, evpos;
 } fs_watch_context;
 
 typedef int (*onfile_cb)(const char *path, struct ignore *ig, void *a, void *b, void *c);
 
+typedef void (*ondir_cb)(const char *path, void *a);
+
 int fs_walk_files(const char *root, struct ignore *ig, onfile_cb cb, void *a, void *b, void *c);
+/* fs_walk_files that also calls ondir with root and each directory it
+ * enters. */
+int fs_walk(const char *root, struct ignore *ig, onfile_cb cb, ondir_cb ondir, void *a, void *b, void *c);
 bool fs_should_parse_file(const char *path, struct ignore *ig);
+bool fs_should_walk_dir(const char *path, struct ignore *ig);
 
-int fs_watch_init(fs_watch_context *c, const char *root, struct ignore *ig);
+int fs_watch_init(fs_watch_context *c, const char *root, struct ignore *ig, int max_watches);
+int fs_watch_init_dirs(fs_watch_context *c, const char *root, char *const *dirs, size_t n, int max_watches);
+/* Watch root through a fanotify mark on its filesystem. -1 without the
+ * privileges or kernel support; use inotify then. */
+int fs_watch_init_fan(fs_watch_context *c, const char *root, struct ignore *ig);
 int fs_watch_add_dir_recursive(fs_watch_context *c, const char *dir, struct ignore *ig);
 int fs_watch_remove_dir(fs_watch_context *c, const char *dir);
 int fs_watch_next(fs_watch_context *c, fs_event *ev);
+/* Poll the directories that are due and rebalance the watches now and
+ * then. Returns how many events it left for fs_watch_next. */
+size_t fs_watch_poll(fs_watch_context *c);
 void fs_event_free(fs_event *ev);
 void fs_watch_close(fs_watch_context *c);
 
@@ -1,9 +1,10 @@
 #include "hash.h"
 #include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
-uint64_t fnv1a64(const void *data, size_t len){
+uint64_t fnv1a64_update(uint64_t h, const void *data, size_t len){
     const unsigned char *p = (const unsigned char*)data;
-    uint64_t h = 1469598103934665603ULL;
     while(len--) {
         h ^= *p++;
         h *= 1099511628211ULL;
@@ -11,3 +12,49 @@ uint64_t fnv1a64(const void *data, size_t len){
     return h;
 }
 
+uint64_t fnv1a64(const void *data, size_t len){
+    return fnv1a64_update(FNV1A64_INIT, data, len);
+}
+
+static size_t probe(char *const *slots, size_t cap, const char *key, size_t len){
+    size_t i = (size_t)fnv1a64(key, len) & (cap - 1);
+    while (slots[i] && !(strncmp(slots[i], key, len) == 0 && slots[i][len] == 0))
+        i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static int grow(struct strset *s){
+    size_t ncap = s->cap ? s->cap * 2 : 32;
+    char **ns = calloc(ncap, sizeof *ns);
+    if (!ns) return -1;
+    for (size_t i = 0; i < s->cap; i++)
+        if (s->slots[i]) ns[probe(ns, ncap, s->slots[i], strlen(s->slots[i]))] = s->slots[i];
+    free(s->slots);
+    s->slots = ns;
+    s->cap = ncap;
+    return 0;
+}
+
+int strset_add(struct strset *s, const char *key){
+    if ((s->len + 1) * 2 > s->cap && grow(s) != 0) return -1;
+    size_t len = strlen(key);
+    size_t i = probe(s->slots, s->cap, key, len);
+    if (s->slots[i]) return 0;
+    char *d = malloc(len + 1);
+    if (!d) return -1;
+    memcpy(d, key, len + 1);
+    s->slots[i] = d;
+    s->len++;
+    return 1;
+}
+
+bool strset_has(const struct strset *s, const char *key, size_t len){
+    if (!s->cap) return false;
+    return s->slots[probe(s->slots, s->cap, key, len)] != NULL;
+}
+
+void strset_free(struct strset *s){
+    for (size_t i = 0; i < s->cap; i++) free(s->slots[i]);
+    free(s->slots);
+    memset(s, 0, sizeof *s);
+}
@@ -2,7 +2,21 @@
 #define HASH_H
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
+
+#define FNV1A64_INIT 1469598103934665603ULL
 
 uint64_t fnv1a64(const void *data, size_t len);
-#endif
+/* Continue a hash over more data, starting from FNV1A64_INIT. */
+uint64_t fnv1a64_update(uint64_t h, const void *data, size_t len);
 
+/* Open-addressing set of strings keyed by fnv1a64. */
+struct strset {
+    char **slots;
+    size_t cap, len;
+};
+
+int strset_add(struct strset *s, const char *key);
+bool strset_has(const struct strset *s, const char *key, size_t len);
+void strset_free(struct strset *s);
+#endif
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "history.h"
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DAY 86400
+#define INDEX_EVERY 4096        // log bytes per sparse index entry
+#define REC_MAX 65535
+
+/* A record is a u16 length of the rest, then u32 time, u8 type, and the
+ * ID, tag and path, each behind its length (u8, u8, u16). An index entry
+ * is the time and offset of the record holding each 4 KiB boundary. */
+struct hist_mark { uint64_t ts, off; };
+
+static const char *const TYPE_NAMES[] = { "?", "created", "edited", "moved", "resolved" };
+
+const char *history_type_name(int type){
+    return type >= HIST_CREATED && type <= HIST_RESOLVED ? TYPE_NAMES[type] : TYPE_NAMES[0];
+}
+
+static void seg_path(char *out, size_t n, const char *dir, long day, const char *ext){
+    time_t t = (time_t)day * DAY;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    snprintf(out, n, "%s/%04d-%02d-%02d.%s", dir, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, ext);
+}
+
+/* Day number of a segment file name, -1 for anything else. */
+static long seg_day(const char *name, const char *ext){
+    struct tm tm = {0};
+    char tail[8];
+    if (sscanf(name, "%4d-%2d-%2d.%7s", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, tail) != 4 ||
+        strcmp(tail, ext) != 0) return -1;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    time_t t = timegm(&tm);
+    return t < 0 ? -1 : (long)(t / DAY);
+}
+
+static void expire(const struct history *h, long today){
+    if (h->days <= 0) return;
+    DIR *d = opendir(h->dir);
+    if (!d) return;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        long day = seg_day(de->d_name, "log");
+        if (day < 0) day = seg_day(de->d_name, "idx");
+        if (day >= 0 && day <= today - h->days) unlinkat(dirfd(d), de->d_name, 0);
+    }
+    closedir(d);
+}
+
+static void close_seg(struct history *h){
+    if (h->fd >= 0) close(h->fd);
+    if (h->ifd >= 0) close(h->ifd);
+    h->fd = h->ifd = -1;
+    h->day = -1;
+}
+
+/* Switch to today's segment; starting one is when old ones expire. */
+static int open_seg(struct history *h, long day){
+    close_seg(h);
+    if (mkdir(h->dir, 0755) != 0 && errno != EEXIST) return -1;
+    char p[4096];
+    seg_path(p, sizeof p, h->dir, day, "log");
+    h->fd = open(p, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    seg_path(p, sizeof p, h->dir, day, "idx");
+    h->ifd = open(p, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (h->fd < 0 || h->ifd < 0) { close_seg(h); return -1; }
+    h->day = day;
+    expire(h, day);
+    return 0;
+}
+
+int history_open(struct history *h, const char *dir, const char *root, int days){
+    memset(h, 0, sizeof *h);
+    h->fd = h->ifd = -1;
+    h->day = -1;
+    h->days = days;
+    h->dir = strdup(dir);
+    h->root = root ? strdup(root) : NULL;
+    return h->dir && (!root || h->root) ? 0 : -1;
+}
+
+void history_close(struct history *h){
+    close_seg(h);
+    free(h->dir);
+    free(h->root);
+    h->dir = h->root = NULL;
+}
+
+static unsigned char *put(unsigned char *p, const void *v, size_t n){
+    memcpy(p, v, n);
+    return p + n;
+}
+
+int history_append(struct history *h, int type, const char *key, const char *id){
+    const char *sep = strstr(key, "::");
+    const char *tag = sep ? sep + 2 : NULL;
+    const char *end = tag ? strstr(tag, "::") : NULL;
+    if (!end) return -1;
+    const char *path = key;
+    size_t pl = (size_t)(sep - key), tl = (size_t)(end - tag), il = strlen(id);
+    size_t rl = h->root ? strlen(h->root) : 0;
+    if (rl && pl > rl && memcmp(key, h->root, rl) == 0 && key[rl] == '/') { path += rl + 1; pl -= rl + 1; }
+    size_t len = 4 + 1 + 1 + il + 1 + tl + 2 + pl;
+    if (il > 255 || tl > 255 || len > REC_MAX) return -1;
+    time_t now = time(NULL);
+    long day = (long)(now / DAY);
+    if (day != h->day && open_seg(h, day) != 0) return -1;
+
+    unsigned char rec[2 + REC_MAX], *p = rec;
+    uint16_t u16 = (uint16_t)len;
+    uint32_t ts = (uint32_t)now;
+    uint8_t u8 = (uint8_t)type;
+    p = put(p, &u16, 2);
+    p = put(p, &ts, 4);
+    p = put(p, &u8, 1);
+    u8 = (uint8_t)il; p = put(p, &u8, 1); p = put(p, id, il);
+    u8 = (uint8_t)tl; p = put(p, &u8, 1); p = put(p, tag, tl);
+    u16 = (uint16_t)pl; p = put(p, &u16, 2); p = put(p, path, pl);
+
+    struct stat st;
+    off_t off = fstat(h->fd, &st) == 0 ? st.st_size : -1;
+    if (write(h->fd, rec, (size_t)(p - rec)) != p - rec) return -1;
+    // Writers are serialized by the state lock, so off is where it landed.
+    if (off >= 0 && (off % INDEX_EVERY == 0 || (off / INDEX_EVERY + 1) * INDEX_EVERY < off + (p - rec))) {
+        struct hist_mark mk = { ts, (uint64_t)off };
+        if (write(h->ifd, &mk, sizeof mk) != (ssize_t)sizeof mk) { /* the query reads a little more */ }
+    }
+    return 0;
+}
+
+/* Offset of the last indexed record before since, where reading starts. */
+static off_t seek_since(const char *idx, time_t since){
+    int fd = open(idx, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    struct hist_mark *mk = NULL;
+    size_t n = 0;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof *mk && (mk = malloc((size_t)st.st_size))) {
+        ssize_t got = pread(fd, mk, (size_t)st.st_size, 0);
+        n = got > 0 ? (size_t)got / sizeof *mk : 0;
+    }
+    close(fd);
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if ((time_t)mk[mid].ts < since) lo = mid + 1;
+        else hi = mid;
+    }
+    off_t off = lo ? (off_t)mk[lo-1].off : 0;
+    free(mk);
+    return off;
+}
+
+static int cmp_long(const void *a, const void *b){
+    long x = *(const long *)a, y = *(const long *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Parse one record body; false if it does not hold together. */
+static bool parse_rec(unsigned char *b, size_t len, struct hist_event *ev, char *id, char *tag){
+    if (len < 9) return false;
+    uint32_t ts;
+    memcpy(&ts, b, 4);
+    ev->ts = (time_t)ts;
+    ev->type = b[4];
+    size_t i = 5, il = b[i++];
+    if (i + il + 1 > len) return false;
+    memcpy(id, b + i, il); id[il] = 0; i += il;
+    size_t tl = b[i++];
+    if (i + tl + 2 > len) return false;
+    memcpy(tag, b + i, tl); tag[tl] = 0; i += tl;
+    uint16_t pl;
+    memcpy(&pl, b + i, 2); i += 2;
+    if (i + pl != len) return false;
+    memmove(b, b + i, pl); b[pl] = 0;
+    ev->id = id; ev->tag = tag; ev->path = (const char *)b;
+    return ev->type >= HIST_CREATED && ev->type <= HIST_RESOLVED;
+}
+
+static bool next_rec(FILE *f, unsigned char *b, struct hist_event *ev, char *id, char *tag){
+    uint16_t len;
+    return fread(&len, 2, 1, f) == 1 && fread(b, 1, len, f) == len && parse_rec(b, len, ev, id, tag);
+}
+
+static void scan_seg(const char *log, off_t from, time_t since, time_t until, const char *want,
+                     hist_fn fn, void *ud){
+    FILE *f = fopen(log, "rb");
+    unsigned char *b = malloc(REC_MAX + 1);
+    char id[256], tag[256];
+    struct hist_event ev;
+    bool ok = f && b && fseeko(f, from, SEEK_SET) == 0 && next_rec(f, b, &ev, id, tag);
+    // An index entry off a record boundary: read the segment from the start.
+    if (f && b && !ok && from > 0) ok = fseeko(f, 0, SEEK_SET) == 0 && next_rec(f, b, &ev, id, tag);
+    // Times only grow within a segment; a torn record ends it.
+    for (; ok && ev.ts <= until; ok = next_rec(f, b, &ev, id, tag))
+        if (ev.ts >= since && (!want || strcasecmp(want, tag) == 0)) fn(ud, &ev);
+    free(b);
+    if (f) fclose(f);
+}
+
+int history_query(const char *dir, time_t since, time_t until, const char *tag, hist_fn fn, void *ud){
+    DIR *d = opendir(dir);
+    if (!d) return errno == ENOENT ? 0 : -1;
+    long *days = NULL;
+    size_t n = 0, cap = 0;
+    struct dirent *de;
+    while ((de = readdir(d))) {
+        long day = seg_day(de->d_name, "log");
+        if (day < 0 || (time_t)day * DAY > until || (time_t)(day + 1) * DAY <= since) continue;
+        if (n == cap) {
+            long *nd = realloc(days, (cap = cap ? cap * 2 : 16) * sizeof *nd);
+            if (!nd) break;
+            days = nd;
+        }
+        days[n++] = day;
+    }
+    closedir(d);
+    qsort(days, n, sizeof *days, cmp_long);
+    char log[4096], idx[4096];
+    for (size_t i = 0; i < n; i++) {
+        seg_path(log, sizeof log, dir, days[i], "log");
+        seg_path(idx, sizeof idx, dir, days[i], "idx");
+        off_t from = (time_t)days[i] * DAY < since ? seek_since(idx, since) : 0;
+        scan_seg(log, from, since, until, tag, fn, ud);
+    }
+    free(days);
+    return 0;
+}
@@ -0,0 +1,37 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+#include <stddef.h>
+#include <time.h>
+
+/* Tag lifecycle log of a repo: one binary segment per UTC day in
+ * .ctags/.state/history ("YYYY-MM-DD.log"), each with a sparse index
+ * ("YYYY-MM-DD.idx") of (time, offset) pairs, one per 4 KiB of log, so a
+ * time-range query seeks instead of reading whole segments. Segments older
+ * than the retention are deleted when a new one is started. */
+enum { HIST_CREATED = 1, HIST_EDITED, HIST_MOVED, HIST_RESOLVED };
+
+struct history {
+    char *dir;
+    char *root;                 // paths under it are logged relative to it
+    int days;                   // retention, 0 = keep forever
+    long day;                   // day of the open segment, -1 if none
+    int fd, ifd;                // its log and index
+};
+
+struct hist_event {
+    time_t ts;
+    int type;                   // HIST_*
+    const char *id, *tag, *path;
+};
+typedef void (*hist_fn)(void *ud, const struct hist_event *ev);
+
+int history_open(struct history *h, const char *dir, const char *root, int days);
+void history_close(struct history *h);
+/* Append one event for key ("path::TAG::content") and its ID. */
+int history_append(struct history *h, int type, const char *key, const char *id);
+
+/* Events in [since, until] in log order, of tag only if given. */
+int history_query(const char *dir, time_t since, time_t until, const char *tag, hist_fn fn, void *ud);
+const char *history_type_name(int type);
+
+#endif
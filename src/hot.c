@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "hot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hash.h"
+
+#define HOT_FORGET_MS 10000     // rate state of an idle, free path is dropped
+
+long hot_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void hot_init(struct hotset *h, int rate, int max_delay){
+    memset(h, 0, sizeof *h);
+    h->rate = rate;
+    h->max_delay = max_delay > 0 ? max_delay : 1;
+}
+
+void hot_free(struct hotset *h){
+    for (size_t i = 0; i < h->cap; i++) free(h->ents[i].path);
+    free(h->ents);
+    memset(h, 0, sizeof *h);
+}
+
+static size_t slot(const struct hot_ent *v, size_t cap, const char *path){
+    size_t i = (size_t)fnv1a64(path, strlen(path)) & (cap - 1);
+    while (v[i].path && strcmp(v[i].path, path) != 0) i = (i + 1) & (cap - 1);
+    return i;
+}
+
+/* Rebuild at cap. With now, free entries idle since long enough go. */
+static int rehash(struct hotset *h, size_t cap, long now){
+    struct hot_ent *nv = calloc(cap, sizeof *nv);
+    if (!nv) return -1;
+    size_t len = 0;
+    for (size_t i = 0; i < h->cap; i++) {
+        struct hot_ent *e = &h->ents[i];
+        if (!e->path) continue;
+        if (now && !e->due && now - e->last >= HOT_FORGET_MS) { free(e->path); continue; }
+        nv[slot(nv, cap, e->path)] = *e;
+        len++;
+    }
+    free(h->ents);
+    h->ents = nv;
+    h->cap = cap;
+    h->len = len;
+    return 0;
+}
+
+bool hot_event(struct hotset *h, const char *path, long now){
+    if (h->rate <= 0) return true;
+    if ((h->len + 1) * 2 > h->cap && rehash(h, h->cap ? h->cap * 2 : 64, 0) != 0) return true;
+    struct hot_ent *e = &h->ents[slot(h->ents, h->cap, path)];
+    if (!e->path) {
+        if (!(e->path = strdup(path))) return true;
+        e->win = now;
+        h->len++;
+    }
+    if (now - e->win >= 1000) { e->win = now; e->count = 0; }
+    e->count++;
+    e->held++;
+    e->last = now;
+    if (!e->due && e->count > (unsigned)h->rate) {
+        e->delay = 1;
+        e->due = now + 1000;
+        e->held = e->count;
+        e->rate = e->count;
+        h->nquar++;
+        h->changed = 1;
+        fprintf(stderr, "codetags: %s is busy (over %d writes/s); updating it every %ds\n", path, h->rate, e->delay);
+    }
+    if (!e->due) return true;
+    e->pending = 1;
+    return false;
+}
+
+void hot_tick(struct hotset *h, long now, hot_fn fn, void *ud){
+    size_t idle = 0;
+    for (size_t i = 0; i < h->cap; i++) {
+        struct hot_ent *e = &h->ents[i];
+        if (!e->path) continue;
+        if (!e->due) { idle += now - e->last >= HOT_FORGET_MS; continue; }
+        if (now < e->due) continue;
+        e->rate = (double)e->held * 1000.0 / (double)(now - e->due + (long)e->delay * 1000);
+        if (e->pending) fn(ud, e->path);
+        if (!e->held) {
+            // A whole period without a write: no longer hot.
+            fprintf(stderr, "codetags: %s is quiet again\n", e->path);
+            e->due = 0;
+            e->delay = 0;
+            e->count = 0;
+            h->nquar--;
+            h->changed = 1;
+            continue;
+        }
+        // Still over the limit: back off further.
+        if (e->rate > h->rate && e->delay < h->max_delay)
+            e->delay = e->delay * 2 < h->max_delay ? e->delay * 2 : h->max_delay;
+        h->changed = 1;
+        e->pending = 0;
+        e->held = 0;
+        e->due = now + (long)e->delay * 1000;
+    }
+    if (idle * 4 > h->len && h->len > 64) rehash(h, h->cap, now);
+}
+
+size_t hot_pending(const struct hotset *h){
+    size_t n = 0;
+    for (size_t i = 0; i < h->cap; i++) n += h->ents[i].path && h->ents[i].pending;
+    return n;
+}
+
+int hot_save(struct hotset *h, const char *path, const char *root){
+    if (!h->changed) return 0;
+    h->changed = 0;
+    if (!h->nquar) return unlink(path) == 0 || access(path, F_OK) != 0 ? 0 : -1;
+    char tmp[4096];
+    if (snprintf(tmp, sizeof tmp, "%s.tmp", path) >= (int)sizeof tmp) return -1;
+    FILE *f = fopen(tmp, "w");
+    if (!f) return -1;
+    size_t rl = strlen(root);
+    for (size_t i = 0; i < h->cap; i++) {
+        const struct hot_ent *e = &h->ents[i];
+        if (!e->path || !e->due) continue;
+        const char *p = strncmp(e->path, root, rl) == 0 && e->path[rl] == '/' ? e->path + rl + 1 : e->path;
+        fprintf(f, "%s\t%d\t%.0f\n", p, e->delay, e->rate);
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) { unlink(tmp); return -1; }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef HOT_H
+#define HOT_H
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Per-path event rates of one watched repo, kept by the daemon's event
+ * loop. A file written more than rate times within a second (a log, a
+ * database journal) is quarantined: its events are held and it is updated
+ * at most once per backoff period. The period starts at a second, doubles
+ * up to max_delay while the file stays busy, and the file is let go once a
+ * whole period passes without an event. */
+struct hot_ent {
+    char *path;
+    long win;                   // start of the current one-second window, ms
+    unsigned count;             // events in that window
+    unsigned held;              // events since the last update
+    long last;                  // last event, ms
+    long due;                   // next update, ms; 0 if not quarantined
+    int delay;                  // backoff period, s
+    int pending;                // events held since the last update
+    double rate;                // events/s over the last period, for status
+};
+
+struct hotset {
+    struct hot_ent *ents;       // open addressing by path
+    size_t cap, len;
+    size_t nquar;               // quarantined entries
+    int rate, max_delay;        // 0 rate: never quarantine
+    int changed;                // the quarantined set changed since hot_save
+};
+
+typedef void (*hot_fn)(void *ud, const char *path);
+
+long hot_now(void);             // monotonic ms
+void hot_init(struct hotset *h, int rate, int max_delay);
+void hot_free(struct hotset *h);
+/* Count an event on path: true to handle it now, false if it is held. */
+bool hot_event(struct hotset *h, const char *path, long now);
+/* Call fn for every held path that is due, advance or end its backoff and
+ * forget paths that have been idle for a while. */
+void hot_tick(struct hotset *h, long now, hot_fn fn, void *ud);
+/* Held paths not handed out yet. */
+size_t hot_pending(const struct hotset *h);
+/* The quarantined set as "path\tperiod\tevents/s" lines, paths relative
+ * to root; no file if it is empty. */
+int hot_save(struct hotset *h, const char *path, const char *root);
+
+#endif
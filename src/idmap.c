@@ -1,6 +1,7 @@
 #define _GNU_SOURCE
 #include "idmap.h"
 #include "hash.h"
+#include "state.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -9,6 +10,12 @@
 #include <time.h>
 #include <unistd.h>
 
+#define TOMBSTONE "-"
+#define MOVE_MARK '>'           // "from\t>to": keys of from and below move to to
+/* Auto-compact once the log holds this many records and at least half of
+ * them are superseded or tombstoned. */
+#define COMPACT_MIN_RECORDS 1024
+
 static long read_last(const char *p){
     FILE *f=fopen(p,"r");
     if(!f) return 0;
@@ -28,78 +35,530 @@ static int urand32(uint32_t *out){
     return n==sizeof *out ? 0 : -1;
 }
 
-int idmap_open(struct idmap *m, const char *map_path, const char *lastid_path){
+static size_t key_slot(struct idmap_ent *const *slots, size_t cap, const char *key){
+    size_t i = (size_t)fnv1a64(key, strlen(key)) & (cap - 1);
+    while (slots[i] && strcmp(slots[i]->key, key) != 0) i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static size_t path_slot(struct idmap_ent *const *paths, size_t cap, const char *path, size_t plen){
+    size_t i = (size_t)fnv1a64(path, plen) & (cap - 1);
+    while (paths[i] && !(paths[i]->plen == plen && memcmp(paths[i]->key, path, plen) == 0))
+        i = (i + 1) & (cap - 1);
+    return i;
+}
+
+static struct idmap_ent *find(const struct idmap *m, const char *key){
+    if (!m->cap) return NULL;
+    return m->slots[key_slot(m->slots, m->cap, key)];
+}
+
+static struct idmap_ent *path_head(const struct idmap *m, const char *path){
+    if (!m->pcap) return NULL;
+    return m->paths[path_slot(m->paths, m->pcap, path, strlen(path))];
+}
+
+static struct idmap_ent **id_bucket(const struct idmap *m, const char *id){
+    return &m->ids[(size_t)fnv1a64(id, strlen(id)) & (m->cap - 1)];
+}
+
+static void id_link(struct idmap *m, struct idmap_ent *e){
+    if (!e->id[0]) return;
+    struct idmap_ent **b = id_bucket(m, e->id);
+    e->inext = *b;
+    *b = e;
+}
+
+static void id_unlink(struct idmap *m, struct idmap_ent *e){
+    if (!e->id[0]) return;
+    for (struct idmap_ent **p = id_bucket(m, e->id); *p; p = &(*p)->inext)
+        if (*p == e) { *p = e->inext; break; }
+}
+
+static void index_ent(struct idmap *m, struct idmap_ent *e){
+    m->slots[key_slot(m->slots, m->cap, e->key)] = e;
+    size_t ps = path_slot(m->paths, m->pcap, e->key, e->plen);
+    if (!m->paths[ps]) m->npaths++;
+    e->pnext = m->paths[ps];
+    m->paths[ps] = e;
+    id_link(m, e);
+}
+
+/* Size the tables for `want` entries and re-index everything in map order. */
+static int reindex(struct idmap *m, size_t want){
+    size_t cap = m->cap ? m->cap : 256;
+    while (want * 2 > cap) cap *= 2;
+    struct idmap_ent **slots = calloc(cap, sizeof *slots);
+    struct idmap_ent **paths = calloc(cap, sizeof *paths);
+    struct idmap_ent **ids = calloc(cap, sizeof *ids);
+    if (!slots || !paths || !ids) { free(slots); free(paths); free(ids); return -1; }
+    free(m->slots); free(m->paths); free(m->ids);
+    m->slots = slots; m->paths = paths; m->ids = ids;
+    m->cap = m->pcap = cap;
+    m->npaths = 0;
+    for (size_t i = 0; i < m->n; i++) index_ent(m, m->order[i]);
+    return 0;
+}
+
+static struct idmap_ent *add(struct idmap *m, const char *key){
+    if ((m->n + 1) * 2 > m->cap && reindex(m, m->n + 1) != 0) return NULL;
+    if (m->n == m->ocap) {
+        size_t ocap = m->ocap ? m->ocap * 2 : 256;
+        struct idmap_ent **no = realloc(m->order, ocap * sizeof *no);
+        if (!no) return NULL;
+        m->order = no;
+        m->ocap = ocap;
+    }
+    struct idmap_ent *e = calloc(1, sizeof *e);
+    if (!e || !(e->key = strdup(key))) { free(e); return NULL; }
+    const char *sep = strstr(key, "::");
+    e->plen = sep ? (size_t)(sep - key) : strlen(key);
+    m->order[m->n++] = e;
+    index_ent(m, e);
+    return e;
+}
+
+static bool under(const struct idmap_ent *e, const char *p, size_t pl){
+    return e->plen >= pl && memcmp(e->key, p, pl) == 0 && (e->plen == pl || e->key[pl] == '/');
+}
+
+/* Rewrite the path prefix of every key of from or below it to to. Keys that
+ * were at to already belong to whatever the move replaced and are dropped.
+ * Keys change, so the tables are rebuilt. */
+static size_t move_keys(struct idmap *m, const char *from, const char *to){
+    size_t fl = strlen(from), tl = strlen(to), moved = 0, k = 0;
+    for (size_t i = 0; i < m->n; i++) {
+        struct idmap_ent *e = m->order[i];
+        if (under(e, from, fl)) {
+            char *nk = NULL;
+            if (asprintf(&nk, "%s%s", to, e->key + fl) >= 0) {
+                free(e->key);
+                e->key = nk;
+                e->plen = e->plen - fl + tl;
+                if (e->live) moved++;
+            }
+        } else if (under(e, to, tl)) {
+            if (e->live) m->nlive--;
+            free(e->key);
+            free(e);
+            continue;
+        }
+        m->order[k++] = e;
+    }
+    m->n = k;
+    reindex(m, m->n);
+    return moved;
+}
+
+const char *idmap_relpath(const struct idmap *m, const char *path){
+    if (m->rlen && strncmp(path, m->root, m->rlen) == 0 && path[m->rlen] == '/') return path + m->rlen + 1;
+    return path;
+}
+
+/* A stored path back to absolute, in *buf if it needs the root. */
+static const char *abspath(const struct idmap *m, const char *p, char **buf, size_t *cap){
+    if (!m->rlen || p[0] == '/') return p;
+    size_t need = m->rlen + strlen(p) + 2;
+    if (need > *cap) {
+        char *nb = realloc(*buf, need);
+        if (!nb) return p;
+        *buf = nb;
+        *cap = need;
+    }
+    snprintf(*buf, *cap, "%s/%s", m->root, p);
+    return *buf;
+}
+
+/* Replay one record. A key that is already live keeps its first ID, as
+ * lookups always returned the first match in the file. */
+static int apply(struct idmap *m, const char *key, const char *id){
+    m->records++;
+    if (id[0] == MOVE_MARK) { move_keys(m, key, id + 1); return 0; }
+    struct idmap_ent *e = find(m, key);
+    if (strcmp(id, TOMBSTONE) == 0) {
+        if (e && e->live) { e->live = 0; m->nlive--; }
+        return 0;
+    }
+    if (!e && !(e = add(m, key))) return -1;
+    if (!e->live) {
+        if (strncmp(e->id, id, sizeof e->id - 1) != 0) {
+            id_unlink(m, e);
+            strncpy(e->id, id, sizeof e->id - 1);
+            e->id[sizeof e->id - 1] = 0;
+            id_link(m, e);
+        }
+        e->live = 1;
+        m->nlive++;
+    }
+    return 0;
+}
+
+static void reset(struct idmap *m){
+    for (size_t i = 0; i < m->n; i++) { free(m->order[i]->key); free(m->order[i]); }
+    free(m->order); free(m->slots); free(m->paths); free(m->ids);
+    m->order = m->slots = m->paths = m->ids = NULL;
+    m->n = m->ocap = m->cap = m->pcap = m->npaths = 0;
+    m->nlive = m->records = 0;
+    m->off = 0;
+}
+
+/* Replay whatever was appended since the last sync. A different inode or a
+ * shorter file means the map was compacted: start over from the new file.
+ * Without the lock only the length published in the state header is read,
+ * so a record a writer is still appending is never seen; a header naming
+ * another inode is from a compaction racing with us and is retried. */
+int idmap_sync(struct idmap *m){
+    // Nothing published past what we replayed: skip opening the map, which
+    // every parsed file would otherwise pay for.
+    if (m->st.depth == 0 && m->ino) {
+        ino_t pino; off_t psize;
+        state_read_map(&m->st, &pino, &psize);
+        if (pino == m->ino && psize == m->off) return 0;
+    }
+    FILE *f = NULL;
+    struct stat st;
+    off_t limit = -1;
+    for (int tries = 0; tries < 3; tries++) {
+        if (f) fclose(f);
+        if (!(f = fopen(m->map_path, "r"))) return -1;
+        if (fstat(fileno(f), &st) != 0) { fclose(f); return -1; }
+        if (m->st.depth > 0) break;
+        ino_t pino; off_t psize;
+        state_read_map(&m->st, &pino, &psize);
+        if (!pino) break;
+        if (pino == st.st_ino) { limit = psize; break; }
+    }
+    if (limit < 0 || limit > st.st_size) limit = st.st_size;
+    if (st.st_ino != m->ino || limit < m->off) {
+        reset(m);
+        m->ino = st.st_ino;
+        if (m->mapf) fclose(m->mapf);
+        m->mapf = m->ro ? NULL : fopen(m->map_path, "a");
+    }
+    if (limit == m->off || fseeko(f, m->off, SEEK_SET) != 0) { fclose(f); return 0; }
+    char *line = NULL, *kbuf = NULL; size_t cap = 0, kcap = 0; ssize_t len;
+    while (m->off < limit && (len = getline(&line, &cap, f)) > 0) {
+        if (line[len-1] != '\n' || m->off + len > limit) break;   // partial record
+        m->off += len;
+        line[--len] = 0;
+        if (len > 0 && line[len-1] == '\r') line[--len] = 0;
+        char *tab = strrchr(line, '\t');    // IDs never contain tabs, keys might
+        if (!tab) continue;
+        *tab = 0;
+        const char *key = abspath(m, line, &kbuf, &kcap), *id = tab + 1;
+        char *mv = NULL;
+        if (id[0] == MOVE_MARK && m->rlen && id[1] != '/') {
+            if (asprintf(&mv, "%c%s/%s", MOVE_MARK, m->root, id + 1) < 0) continue;
+            id = mv;
+        }
+        apply(m, key, id);
+        free(mv);
+    }
+    free(line); free(kbuf);
+    fclose(f);
+    return 0;
+}
+
+/* Writers hold the state lock from wbegin to wend and are then fully
+ * synced. A partial record left by a writer that died mid-append is cut off
+ * rather than appended to. */
+static void wbegin(struct idmap *m){
+    state_lock(&m->st);
+    idmap_sync(m);
+    struct stat st;
+    if (m->mapf && m->st.h && fstat(fileno(m->mapf), &st) == 0 && st.st_ino == m->ino && st.st_size > m->off)
+        if (ftruncate(fileno(m->mapf), m->off) != 0) { /* the next sync skips it */ }
+}
+
+static void wend(struct idmap *m, int compacted){
+    state_publish_map(&m->st, m->ino, m->off, compacted);
+    state_unlock(&m->st);
+}
+
+/* Append a record. Under the lock we are the only writer; without a state
+ * header another process may have appended in between, in which case our
+ * record is replayed again on the next sync, which is harmless. */
+static int write_record(struct idmap *m, const char *key, const char *id){
+    if (!m->mapf) return -1;
+    key = idmap_relpath(m, key);
+    if (fprintf(m->mapf, "%s\t%s\n", key, id) < 0 || fflush(m->mapf) != 0) return -1;
+    off_t len = (off_t)(strlen(key) + strlen(id) + 2);
+    struct stat st;
+    if (fstat(fileno(m->mapf), &st) == 0 && st.st_ino == m->ino && st.st_size == m->off + len)
+        m->off = st.st_size;
+    return 0;
+}
+
+static bool id_live(const struct idmap *m, const char *id){
+    for (struct idmap_ent *e = m->cap ? *id_bucket(m, id) : NULL; e; e = e->inext)
+        if (e->live && strcmp(e->id, id) == 0) return true;
+    return false;
+}
+
+/* What a new key for an existing or fresh ID means. A key is only added
+ * when it is not live, so live entries with the ID are other keys: in the
+ * same file the text changed (its old key is tombstoned at the end of the
+ * parse), elsewhere the tag moved. An ID back after being resolved was
+ * moved here if it was last seen in another file. */
+static int add_event(const struct idmap *m, const char *key, const char *id){
+    const char *sep = strstr(key, "::");
+    size_t plen = sep ? (size_t)(sep - key) : strlen(key);
+    bool live_there = false, dead_here = false, dead_there = false;
+    for (struct idmap_ent *e = m->cap ? *id_bucket(m, id) : NULL; e; e = e->inext) {
+        if (strcmp(e->id, id) != 0) continue;
+        bool here = e->plen == plen && memcmp(e->key, key, plen) == 0;
+        if (e->live && here) return HIST_EDITED;
+        if (e->live) live_there = true;
+        else if (here) dead_here = true;
+        else dead_there = true;
+    }
+    return live_there || (dead_there && !dead_here) ? HIST_MOVED : HIST_CREATED;
+}
+
+/* Write, apply and log a record. A tombstone resolves its tag unless the
+ * ID lives on under another key. */
+static int append(struct idmap *m, const char *key, const char *id){
+    if (write_record(m, key, id) != 0) return -1;
+    if (!m->hist) return apply(m, key, id);
+    if (strcmp(id, TOMBSTONE) == 0) {
+        struct idmap_ent *e = find(m, key);
+        bool was = e && e->live;
+        int rc = apply(m, key, id);
+        if (was && !id_live(m, e->id)) history_append(m->hist, HIST_RESOLVED, e->key, e->id);
+        return rc;
+    }
+    int type = add_event(m, key, id);
+    int rc = apply(m, key, id);
+    if (rc == 0) history_append(m->hist, type, key, id);
+    return rc;
+}
+
+static void set_root(struct idmap *m, const char *root){
+    if (!root) return;
+    // Keys are realpath'd, so the root has to be too.
+    m->root = realpath(root, NULL);
+    if (!m->root) m->root = strdup(root);
+    m->rlen = m->root ? strlen(m->root) : 0;
+    if (m->rlen == 1) { free(m->root); m->root = NULL; m->rlen = 0; }    // "/" is no root
+}
+
+int idmap_open(struct idmap *m, const char *map_path, const char *lastid_path, const char *root){
+    memset(m, 0, sizeof *m);
+    m->st.fd = -1;
     m->map_path = strdup(map_path);
     m->lastid_path = strdup(lastid_path);
-    m->mapf = fopen(map_path, "a+");
+    set_root(m, root);
+    m->mapf = fopen(map_path, "a");
     if(!m->mapf) return -1;
-    return 0;
+    struct stat st;
+    if (fstat(fileno(m->mapf), &st) == 0) m->ino = st.st_ino;
+    state_open_near(&m->st, map_path);     // without it, no locking (as before)
+    return idmap_sync(m);
+}
+
+int idmap_open_ro(struct idmap *m, const char *map_path, const char *root){
+    memset(m, 0, sizeof *m);
+    m->st.fd = -1;
+    m->ro = 1;
+    m->map_path = strdup(map_path);
+    set_root(m, root);
+    state_open_ro(&m->st, map_path);
+    return idmap_sync(m);
+}
+
+const char *idmap_lookup(const struct idmap *m, const char *key){
+    const struct idmap_ent *e = find(m, key);
+    return e && e->live ? e->id : NULL;
 }
 
 void idmap_close(struct idmap *m){
     if(m->mapf) fclose(m->mapf);
-    free(m->map_path); free(m->lastid_path);
+    state_close(&m->st);
+    reset(m);
+    free(m->map_path); free(m->lastid_path); free(m->root);
+    m->mapf = NULL; m->map_path = m->lastid_path = m->root = NULL;
+    m->rlen = 0;
+}
+
+/* Live entry for key, re-syncing once before giving up on it. */
+static struct idmap_ent *lookup_live(struct idmap *m, const char *key){
+    struct idmap_ent *e = find(m, key);
+    if (e && e->live) return e;
+    idmap_sync(m);
+    e = find(m, key);
+    return e && e->live ? e : NULL;
 }
 
 int idmap_get_or_assign(struct idmap *m, const char *key, char out_id[64]){
-    fflush(m->mapf);
-    FILE *f = fopen(m->map_path, "r");
-    if(f){
-        char *line=NULL; size_t cap=0;
-        while(getline(&line,&cap,f)>0){
-            char *tab=strchr(line,'\t');
-            if(!tab) continue;
-            *tab=0;
-            if(strcmp(line,key)==0){
-                char *id=tab+1; size_t n=strlen(id);
-                while(n>0 && (id[n-1]=='\n' || id[n-1]=='\r')) id[--n]=0;
-                strncpy(out_id,id,63); out_id[63]=0;
-                free(line); fclose(f); return 0;
-            }
-        }
-        free(line); fclose(f);
+    struct idmap_ent *e = lookup_live(m, key);
+    if (!e) {
+        wbegin(m);
+        e = find(m, key);
     }
-    long next = read_last(m->lastid_path) + 1;
-    write_last(m->lastid_path, next);
-    uint32_t rnd;
-    if (urand32(&rnd) != 0) {
-        uint64_t h = fnv1a64(key, strlen(key));
-        rnd = (uint32_t)(h ^ (uint64_t)next);
+    if (!e || !e->live) {
+        // Sequence numbers come from the header under the lock, so
+        // concurrent processes never hand out the same one. last_id.txt is
+        // still kept up to date for whoever reads it.
+        long next = state_next_id(&m->st, read_last(m->lastid_path));
+        write_last(m->lastid_path, next);
+        uint32_t rnd;
+        if (urand32(&rnd) != 0) {
+            uint64_t h = fnv1a64(key, strlen(key));
+            rnd = (uint32_t)(h ^ (uint64_t)next);
+        }
+        char id[64];
+        snprintf(id, sizeof id, "CT-%ld-%08x", next, rnd);
+        e = append(m, key, id) == 0 ? find(m, key) : NULL;
     }
-    snprintf(out_id, 64, "CT-%ld-%08x", next, rnd);
-    m->mapf = fopen(m->map_path, "a");
-    if(!m->mapf) return -1;
-    fprintf(m->mapf, "%s\t%s\n", key, out_id);
-    fclose(m->mapf);
-    m->mapf = fopen(m->map_path, "a+");
+    if (m->st.depth > 0) wend(m, 0);
+    if (!e) return -1;
+    e->seen = m->epoch;
+    strncpy(out_id, e->id, 63); out_id[63] = 0;
     return 0;
 }
 
-
 int idmap_ensure_mapping(struct idmap *m, const char *key, const char *id){
     // Return 0 if mapping exists or was created, -1 on error
-    fflush(m->mapf);
-    // Check existing
-    FILE *f = fopen(m->map_path, "r");
-    if (f) {
-        char *line = NULL; size_t cap = 0; int found = 0;
-        while (getline(&line, &cap, f) > 0) {
-            char *tab = strchr(line, '\t');
-            if (!tab) continue;
-            *tab = 0;
-            if (strcmp(line, key) == 0) { found = 1; break; }
+    struct idmap_ent *e = lookup_live(m, key);
+    if (!e) {
+        wbegin(m);
+        e = find(m, key);
+        if (!e || !e->live) e = append(m, key, id) == 0 ? find(m, key) : NULL;
+        wend(m, 0);
+        if (!e) return -1;
+    }
+    e->seen = m->epoch;
+    return 0;
+}
+
+long idmap_last_id(const struct idmap *m){
+    return read_last(m->lastid_path);
+}
+
+void idmap_raise_last_id(struct idmap *m, long floor){
+    state_lock(&m->st);
+    if (read_last(m->lastid_path) < floor) write_last(m->lastid_path, state_next_id(&m->st, floor - 1));
+    state_unlock(&m->st);
+}
+
+void idmap_begin_file(struct idmap *m){
+    idmap_sync(m);
+    if (++m->epoch == 0) m->epoch = 1;
+}
+
+size_t idmap_end_file(struct idmap *m, const char *path){
+    struct idmap_ent *e = path_head(m, path);
+    while (e && !(e->live && e->seen != m->epoch)) e = e->pnext;
+    if (!e) return 0;
+    size_t n = 0;
+    wbegin(m);
+    for (e = path_head(m, path); e; e = e->pnext)
+        if (e->live && e->seen != m->epoch && append(m, e->key, TOMBSTONE) == 0) n++;
+    wend(m, 0);
+    return n;
+}
+
+static size_t forget_chain(struct idmap *m, struct idmap_ent *e){
+    size_t n = 0;
+    for (; e; e = e->pnext)
+        if (e->live && append(m, e->key, TOMBSTONE) == 0) n++;
+    return n;
+}
+
+size_t idmap_forget(struct idmap *m, const char *path, bool subtree){
+    wbegin(m);
+    size_t n = forget_chain(m, path_head(m, path));
+    size_t L = strlen(path);
+    for (size_t i = 0; subtree && i < m->pcap; i++) {
+        struct idmap_ent *h = m->paths[i];
+        if (h && h->plen > L && h->key[L] == '/' && memcmp(h->key, path, L) == 0)
+            n += forget_chain(m, h);
+    }
+    wend(m, 0);
+    return n;
+}
+
+/* Whether any entry lives at path or below it. */
+static bool has_subtree(const struct idmap *m, const char *path){
+    if (path_head(m, path)) return true;
+    size_t L = strlen(path);
+    for (size_t i = 0; i < m->pcap; i++)
+        if (m->paths[i] && under(m->paths[i], path, L)) return true;
+    return false;
+}
+
+size_t idmap_rename(struct idmap *m, const char *from, const char *to){
+    wbegin(m);
+    // Nothing known under from (an editor's temp file, say): whatever was
+    // at to stays until a parse of to says otherwise.
+    size_t moved = 0;
+    char *mv = NULL;
+    if (has_subtree(m, from) && asprintf(&mv, "%c%s", MOVE_MARK, idmap_relpath(m, to)) >= 0) {
+        if (write_record(m, from, mv) == 0) {
+            m->records++;
+            moved = move_keys(m, from, to);
+            size_t tl = strlen(to);
+            for (size_t i = 0; m->hist && i < m->n; i++)
+                if (m->order[i]->live && under(m->order[i], to, tl))
+                    history_append(m->hist, HIST_MOVED, m->order[i]->key, m->order[i]->id);
         }
-        free(line);
-        fclose(f);
-        if (found) return 0;
-    }
-    // Append mapping
-    FILE *a = fopen(m->map_path, "a");
-    if (!a) return -1;
-    fprintf(a, "%s\t%s\n", key, id);
-    fclose(a);
-    // Reopen mapf in append+read mode for future ops
+        free(mv);
+    }
+    wend(m, 0);
+    return moved;
+}
+
+char **idmap_live_paths(struct idmap *m, size_t *n){
+    *n = 0;
+    char **out = malloc((m->npaths ? m->npaths : 1) * sizeof *out);
+    if (!out) return NULL;
+    for (size_t i = 0; i < m->pcap; i++) {
+        struct idmap_ent *e = m->paths[i];
+        while (e && !e->live) e = e->pnext;
+        if (e) out[(*n)++] = strndup(e->key, e->plen);
+    }
+    return out;
+}
+
+bool idmap_needs_compact(const struct idmap *m){
+    return m->records >= COMPACT_MIN_RECORDS && (m->records - m->nlive) * 2 >= m->records;
+}
+
+/* Rewrite the map with only its live (key, id) pairs, in map order, and
+ * rename it over the log. Dead entries are dropped from memory too. */
+int idmap_compact(struct idmap *m){
+    wbegin(m);
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s.XXXXXX", m->map_path) < 0) { wend(m, 0); return -1; }
+    int fd = mkstemp(tmp);
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!out) {
+        if (fd >= 0) { close(fd); unlink(tmp); }
+        free(tmp); wend(m, 0); return -1;
+    }
+    for (size_t i = 0; i < m->n; i++)
+        if (m->order[i]->live) fprintf(out, "%s\t%s\n", idmap_relpath(m, m->order[i]->key), m->order[i]->id);
+    struct stat st;
+    if (m->mapf && fstat(fileno(m->mapf), &st) == 0) fchmod(fd, st.st_mode & 07777);
+    if (fclose(out) != 0 || rename(tmp, m->map_path) != 0) { unlink(tmp); free(tmp); wend(m, 0); return -1; }
+    free(tmp);
+
+    size_t k = 0;
+    for (size_t i = 0; i < m->n; i++) {
+        struct idmap_ent *e = m->order[i];
+        if (e->live) m->order[k++] = e;
+        else { free(e->key); free(e); }
+    }
+    m->n = k;
+    m->records = m->nlive;
     if (m->mapf) fclose(m->mapf);
-    m->mapf = fopen(m->map_path, "a+");
-    return m->mapf ? 0 : -1;
+    m->mapf = fopen(m->map_path, "a");
+    if (m->mapf && fstat(fileno(m->mapf), &st) == 0) { m->ino = st.st_ino; m->off = st.st_size; }
+    memset(m->slots, 0, m->cap * sizeof *m->slots);
+    memset(m->paths, 0, m->pcap * sizeof *m->paths);
+    memset(m->ids, 0, m->cap * sizeof *m->ids);
+    m->npaths = 0;
+    for (size_t i = 0; i < m->n; i++) index_ent(m, m->order[i]);
+    wend(m, 1);
+    return 0;
 }
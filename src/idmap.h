@@ -1,17 +1,84 @@
 #ifndef IDMAP_H
 #define IDMAP_H
 #include <stdio.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "state.h"
+#include "history.h"
 
+/* One key of id_map.tsv. Entries are never freed before a compaction: a
+ * removed key stays as a dead entry and comes back in place if the tag
+ * reappears. */
+struct idmap_ent {
+    char *key;                  // "path::tag::content"
+    size_t plen;                // length of the path part of key
+    char id[64];
+    int live;
+    unsigned seen;              // parse epoch that last reported the key
+    struct idmap_ent *pnext;    // next entry with the same path
+    struct idmap_ent *inext;    // next entry in the same ID bucket
+};
+
+/* id_map.tsv is an append-only log of "key\tid" records; "key\t-" is a
+ * tombstone and "path\t>newpath" a rename of a file or directory. It is
+ * replayed into memory on open and re-synced from the file whenever
+ * another process appended to or compacted it. Paths below the repo root
+ * are stored relative to it, so the map survives the repo moving; in
+ * memory every key is absolute. */
 struct idmap {
     FILE *mapf;
     char *map_path;
     char *lastid_path;
+    char *root;                 // repo root, resolved; NULL stores paths as they are
+    size_t rlen;
+    struct idmap_ent **slots;   // by key
+    struct idmap_ent **paths;   // by path, head of each pnext chain
+    struct idmap_ent **ids;     // by ID, chained through inext (cap buckets)
+    size_t cap, pcap, npaths;
+    struct idmap_ent **order;   // map order, live and dead
+    size_t n, ocap;
+    size_t nlive, records;      // live keys, records in the file
+    ino_t ino;
+    off_t off;                  // file offset replayed so far
+    unsigned epoch;
+    struct state st;            // shared header: writer lock, published length
+    struct history *hist;       // lifecycle events of our own writes, if set
+    int ro;                     // opened by idmap_open_ro
 };
 
-int idmap_open(struct idmap *m, const char *map_path, const char *lastid_path);
+int idmap_open(struct idmap *m, const char *map_path, const char *lastid_path, const char *root);
+/* For readers that never write: nothing is created and only the map as
+ * last published is replayed. Only lookups and syncs may follow. */
+int idmap_open_ro(struct idmap *m, const char *map_path, const char *root);
 void idmap_close(struct idmap *m);
+/* The live ID of key, NULL if it has none. */
+const char *idmap_lookup(const struct idmap *m, const char *key);
 int idmap_get_or_assign(struct idmap *m, const char *key, char out_id[64]);
 int idmap_ensure_mapping(struct idmap *m, const char *key, const char *id);
 
+/* Bracket the parse of one file: keys of path not reported through the two
+ * calls above in between are tombstoned by idmap_end_file. */
+void idmap_begin_file(struct idmap *m);
+size_t idmap_end_file(struct idmap *m, const char *path);
+/* Tombstone every key of path, and with subtree those below path/ too. */
+size_t idmap_forget(struct idmap *m, const char *path, bool subtree);
+/* Move the keys of from, or of everything below it for a directory, to to
+ * with their IDs. One record whatever the number of keys. Returns the
+ * number of live keys moved. */
+size_t idmap_rename(struct idmap *m, const char *from, const char *to);
+/* Copies of the paths that still have a live key; free each and the array. */
+char **idmap_live_paths(struct idmap *m, size_t *n);
+
+/* The number of the last ID handed out, and making sure the next ones are
+ * numbered above floor (IDs brought in from elsewhere). */
+long idmap_last_id(const struct idmap *m);
+void idmap_raise_last_id(struct idmap *m, long floor);
+
+/* path as stored: relative if it is below the root. */
+const char *idmap_relpath(const struct idmap *m, const char *path);
+
+int idmap_sync(struct idmap *m);
+bool idmap_needs_compact(const struct idmap *m);
+int idmap_compact(struct idmap *m);
 
 #endif
@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include "hash.h"
 
 static char *strdup0(const char *s){
     if(!s) return NULL;
@@ -13,59 +16,140 @@ static char *strdup0(const char *s){
     return d;
 }
 
+/* Leading blanks go; trailing ones too unless escaped ("foo\ "). */
 static void trim(char *s){
     char *p=s; while(isspace((unsigned char)*p)) p++;
     if(p!=s) memmove(s,p,strlen(s)+1);
     size_t n=strlen(s);
-    while(n>0 && isspace((unsigned char)s[n-1])) s[--n]=0;
+    while(n>0 && isspace((unsigned char)s[n-1]) && !(n>1 && s[n-2]=='\\' && s[n-1]==' ')) s[--n]=0;
 }
 
+/* One line, gitignore syntax: a pattern with a slash before its end is
+ * anchored to the file's directory, one without matches a name at any
+ * depth below it. */
 static int parse_line(const char *line, struct ignore_rule **out){
     char *buf=strdup0(line);
+    if(!buf) return -1;
     trim(buf);
     if(buf[0]==0 || buf[0]=='#'){ free(buf); return 0; }
     struct ignore_rule *r=calloc(1,sizeof *r);
+    if(!r){ free(buf); return -1; }
     if(buf[0]=='!'){ r->neg=true; memmove(buf,buf+1,strlen(buf)); }
+    else if(buf[0]=='\\' && (buf[1]=='!' || buf[1]=='#')) memmove(buf,buf+1,strlen(buf));
     size_t n=strlen(buf);
-    if(n>0 && buf[n-1]=='/'){ r->only_dir=true; buf[n-1]=0; }
-    if(buf[0]=='/'){ r->anchored=true; memmove(buf,buf+1,strlen(buf)); }
+    if(n>0 && buf[n-1]=='/'){ r->only_dir=true; buf[--n]=0; }
+    if(strchr(buf,'/')) r->anchored=true;
+    if(buf[0]=='/') memmove(buf,buf+1,strlen(buf));
+    if(!buf[0]){ free(buf); free(r); return 0; }
     r->pattern=buf;
     *out=r;
     return 1;
 }
 
-int ignore_load(struct ignore *ig, const char *file){
-    ig->rules=NULL;
+/* Prepend the rules of file to *rules, so its last line comes first. */
+static void load_file(struct ignore_rule **rules, const char *file){
     FILE *f=fopen(file,"r");
-    if(!f) return 0;
+    if(!f) return;
     char *line=NULL; size_t cap=0;
     while(getline(&line,&cap,f)>0){
         struct ignore_rule *r=NULL;
         if(parse_line(line,&r)>0){
-            r->next=ig->rules;
-            ig->rules=r;
+            r->next=*rules;
+            *rules=r;
         }
     }
     free(line);
     fclose(f);
-    return 0;
 }
 
-static bool match_glob_segment(const char *name, const char *pat){
-    const char *n=name, *p=pat, *star=NULL, *np=NULL;
-    while(*n){
-        if(*p=='*'){ star=p++; np=n; }
-        else if(*p=='?' || *p==*n){ p++; n++; }
-        else if(star){ p=star+1; n=++np; }
-        else return false;
+static void free_rules(struct ignore_rule *r){
+    while(r){
+        struct ignore_rule *n=r->next;
+        free(r->pattern);
+        free(r);
+        r=n;
+    }
+}
+
+static struct ignore_rule *load_dir(const struct ignore *ig, const char *rel){
+    struct ignore_rule *rules=NULL;
+    char path[PATH_MAX];
+    const char *sep = rel[0] ? "/" : "";
+    if(ig->gitignore && !rel[0] &&
+       snprintf(path,sizeof path,"%s/.git/info/exclude",ig->root) < (int)sizeof path)
+        load_file(&rules, path);
+    if(ig->gitignore && snprintf(path,sizeof path,"%s/%s%s%s",ig->root,rel,sep,IGNORE_GIT) < (int)sizeof path)
+        load_file(&rules, path);
+    if(snprintf(path,sizeof path,"%s/%s%s%s",ig->root,rel,sep,IGNORE_CTAGS) < (int)sizeof path)
+        load_file(&rules, path);
+    return rules;
+}
+
+static size_t bucket(const struct ignore *ig, const char *rel, size_t len){
+    return (size_t)fnv1a64(rel, len) & (ig->cap - 1);
+}
+
+/* Under the lock: the matcher of rel[0..len), built with its parents. */
+static struct ignore_dir *get(struct ignore *ig, const char *rel, size_t len){
+    if(ig->cap){
+        for(struct ignore_dir *d=ig->slots[bucket(ig,rel,len)]; d; d=d->hnext)
+            if(d->rlen==len && memcmp(d->rel,rel,len)==0) return d;
+    }
+    struct ignore_dir *parent=NULL;
+    if(len){
+        const char *slash=memrchr(rel,'/',len);
+        if(!(parent=get(ig, rel, slash ? (size_t)(slash-rel) : 0))) return NULL;
+    }
+    if(ig->n>=ig->cap){
+        size_t cap=ig->cap ? ig->cap*2 : 64;
+        struct ignore_dir **ns=calloc(cap,sizeof *ns);
+        if(!ns) return NULL;
+        for(size_t i=0;i<ig->cap;i++){
+            for(struct ignore_dir *d=ig->slots[i], *nx; d; d=nx){
+                nx=d->hnext;
+                size_t b=(size_t)fnv1a64(d->rel,d->rlen) & (cap-1);
+                d->hnext=ns[b];
+                ns[b]=d;
+            }
+        }
+        free(ig->slots);
+        ig->slots=ns;
+        ig->cap=cap;
     }
-    while(*p=='*') p++;
-    return *p==0;
+    struct ignore_dir *d=calloc(1,sizeof *d);
+    if(!d || !(d->rel=strndup(rel,len))){ free(d); return NULL; }
+    d->rlen=len;
+    d->parent=parent;
+    d->rules=load_dir(ig, d->rel);
+    size_t b=bucket(ig,rel,len);
+    d->hnext=ig->slots[b];
+    ig->slots[b]=d;
+    ig->n++;
+    return d;
+}
+
+int ignore_load(struct ignore *ig, const char *root, bool gitignore){
+    memset(ig,0,sizeof *ig);
+    pthread_mutex_init(&ig->lock,NULL);
+    ig->gitignore=gitignore;
+    if(!(ig->root=strdup0(root))) return -1;
+    return ignore_push(ig,"") ? 0 : -1;
+}
+
+const struct ignore_dir *ignore_push(struct ignore *ig, const char *rel){
+    if(!ig->root) return NULL;
+    size_t len=strlen(rel);
+    if(rel[0]=='/') len=0;      // outside the repo: only its root's files apply
+    while(len && rel[len-1]=='/') len--;
+    pthread_mutex_lock(&ig->lock);
+    struct ignore_dir *d=get(ig, rel, len);
+    pthread_mutex_unlock(&ig->lock);
+    return d;
 }
 
 static bool match_double_star(const char *path, const char *pat){
     if(!*pat) return !*path;
-    if(pat[0]=='*' && pat[1]=='*'){
+    if(pat[0]=='*' && pat[1]=='*' && (pat[2]=='/' || !pat[2])){
         pat+=2;
         if(*pat=='/') { pat++; }
         const char *p=path;
@@ -84,7 +168,7 @@ static bool match_double_star(const char *path, const char *pat){
         if(plen>=sizeof pb || nlen>=sizeof nb) return false;
         memcpy(pb, pat, plen); pb[plen]=0;
         memcpy(nb, path, nlen); nb[nlen]=0;
-        if(!match_glob_segment(nb, pb)) return false;
+        if(fnmatch(pb, nb, 0)!=0) return false;
         if(pslash) {
             if(!nslash) return false;
             return match_double_star(nslash+1, pslash+1);
@@ -94,37 +178,102 @@ static bool match_double_star(const char *path, const char *pat){
     }
 }
 
-static bool pattern_match_path(const char *relpath, const char *pat, bool anchored){
-    if(anchored) {
-        return match_double_star(relpath, pat);
+static bool rule_match(const struct ignore_rule *r, const char *sub){
+    if(r->anchored) return match_double_star(sub, r->pattern);
+    const char *base=strrchr(sub,'/');
+    return fnmatch(r->pattern, base ? base+1 : sub, 0)==0;
+}
+
+bool ignore_match_in(const struct ignore_dir *d, const char *relpath, bool is_dir){
+    for(; d; d=d->parent){
+        const char *sub=relpath;
+        if(d->rlen){
+            if(strncmp(relpath,d->rel,d->rlen)!=0 || relpath[d->rlen]!='/') continue;
+            sub=relpath+d->rlen+1;
+        }
+        for(const struct ignore_rule *r=__atomic_load_n(&d->rules,__ATOMIC_ACQUIRE); r; r=r->next){
+            if(r->only_dir && !is_dir) continue;
+            if(rule_match(r, sub)) return !r->neg;
+        }
     }
-    const char *p=relpath;
-    do {
-        if(match_double_star(p, pat)) return true;
-        p = strchr(p, '/');
-        if(p) p++;
-    } while(p);
     return false;
 }
 
-bool ignore_match(const struct ignore *ig, const char *relpath, bool is_dir){
-    for(const struct ignore_rule *r=ig->rules; r; r=r->next){
-        if(r->only_dir && !is_dir) continue;
-        if(pattern_match_path(relpath, r->pattern, r->anchored)){
-            return !r->neg;
+bool ignore_match(struct ignore *ig, const char *relpath, bool is_dir){
+    const struct ignore_dir *d=ignore_push(ig,"");
+    if(!d) return false;
+    if(relpath[0]=='/') return ignore_match_in(d, relpath, is_dir);
+    char buf[PATH_MAX];
+    if(snprintf(buf,sizeof buf,"%s",relpath) >= (int)sizeof buf) return false;
+    // A file under an ignored directory is ignored, whatever its own rules.
+    for(char *s=buf; (s=strchr(s,'/')); *s++='/'){
+        *s=0;
+        if(ignore_match_in(d, buf, true) || !(d=ignore_push(ig, buf))) return true;
+    }
+    return ignore_match_in(d, buf, is_dir);
+}
+
+bool ignore_is_file(const char *path){
+    const char *base=strrchr(path,'/');
+    base = base ? base+1 : path;
+    return strcmp(base,IGNORE_GIT)==0 || strcmp(base,IGNORE_CTAGS)==0;
+}
+
+static void free_old(struct ignore_old *o){
+    for(struct ignore_old *nx; o; o=nx){
+        nx=o->next;
+        free_rules(o->rules);
+        free(o);
+    }
+}
+
+void ignore_reload(struct ignore *ig, const char *rel){
+    if(!ig->root) return;
+    size_t len=strlen(rel);
+    while(len && rel[len-1]=='/') len--;
+    pthread_mutex_lock(&ig->lock);
+    struct ignore_dir *d=NULL;
+    if(ig->cap){
+        for(d=ig->slots[bucket(ig,rel,len)]; d; d=d->hnext)
+            if(d->rlen==len && memcmp(d->rel,rel,len)==0) break;
+    }
+    // Not loaded yet: it will be read fresh when first needed.
+    if(d){
+        struct ignore_rule *old=d->rules;
+        __atomic_store_n(&d->rules, load_dir(ig, d->rel), __ATOMIC_RELEASE);
+        // A walk may still be reading them, so their links stay as they are.
+        struct ignore_old *o;
+        if(old && (o=malloc(sizeof *o))){
+            o->rules=old;
+            o->next=ig->old;
+            ig->old=o;
         }
     }
-    return false;
+    pthread_mutex_unlock(&ig->lock);
+}
+
+void ignore_collect(struct ignore *ig){
+    if(!ig->root) return;
+    pthread_mutex_lock(&ig->lock);
+    struct ignore_old *old=ig->old;
+    ig->old=NULL;
+    pthread_mutex_unlock(&ig->lock);
+    free_old(old);
 }
 
 void ignore_free(struct ignore *ig){
-    struct ignore_rule *r=ig->rules;
-    while(r){
-        struct ignore_rule *n=r->next;
-        free(r->pattern);
-        free(r);
-        r=n;
+    if(!ig->root) return;
+    for(size_t i=0;i<ig->cap;i++){
+        for(struct ignore_dir *d=ig->slots[i], *nx; d; d=nx){
+            nx=d->hnext;
+            free_rules(d->rules);
+            free(d->rel);
+            free(d);
+        }
     }
-    ig->rules=NULL;
+    free_old(ig->old);
+    free(ig->slots);
+    free(ig->root);
+    pthread_mutex_destroy(&ig->lock);
+    memset(ig,0,sizeof *ig);
 }
-
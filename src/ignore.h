@@ -1,22 +1,66 @@
 #ifndef IGNORE_H
 #define IGNORE_H
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 struct ignore_rule {
     char *pattern;
     bool neg;
     bool only_dir;
-    bool anchored;
+    bool anchored;              // relative to its file's directory
     struct ignore_rule *next;
 };
 
-struct ignore {
+/* The compiled ignore files of one directory, on top of its parent's: a
+ * walk pushes a directory's matcher as it enters it and is back at the
+ * parent's when it leaves. Matchers are loaded on first use and live as
+ * long as the struct ignore. */
+struct ignore_dir {
+    char *rel;                  // from the repo root, "" for the root
+    size_t rlen;
+    struct ignore_rule *rules;  // last line of the last file first
+    struct ignore_dir *parent;
+    struct ignore_dir *hnext;   // hash chain
+};
+
+/* The rules of one directory that ignore_reload replaced. */
+struct ignore_old {
     struct ignore_rule *rules;
+    struct ignore_old *next;
+};
+
+/* Every .ctagsignore in the repo and, with gitignore, every .gitignore and
+ * .git/info/exclude. In a directory .gitignore comes before .ctagsignore
+ * and a deeper directory's files before its parent's, so they win. */
+struct ignore {
+    char *root;                 // absolute
+    bool gitignore;
+    pthread_mutex_t lock;       // for the table; matchers are read unlocked
+    struct ignore_dir **slots;
+    size_t cap, n;
+    struct ignore_old *old;     // rules replaced by ignore_reload, until ignore_collect
 };
 
-int ignore_load(struct ignore *ig, const char *file);
-bool ignore_match(const struct ignore *ig, const char *relpath, bool is_dir);
+#define IGNORE_CTAGS ".ctagsignore"
+#define IGNORE_GIT ".gitignore"
+
+int ignore_load(struct ignore *ig, const char *root, bool gitignore);
+/* The matcher of directory rel (relative to the root), loading its files
+ * and its parents' if this is the first time. NULL without memory. */
+const struct ignore_dir *ignore_push(struct ignore *ig, const char *rel);
+/* Whether relpath, an entry of directory d, is ignored. Its parents are
+ * taken as not ignored, as they are on the way down a walk. */
+bool ignore_match_in(const struct ignore_dir *d, const char *relpath, bool is_dir);
+/* Whether relpath or any directory above it is ignored. */
+bool ignore_match(struct ignore *ig, const char *relpath, bool is_dir);
+/* Whether path's base name is that of an ignore file. */
+bool ignore_is_file(const char *path);
+/* Re-read the ignore files of directory rel after one of them changed. */
+void ignore_reload(struct ignore *ig, const char *rel);
+/* Free the rules ignore_reload replaced. Only when no match or walk that
+ * began before the reload can still be running. */
+void ignore_collect(struct ignore *ig);
 void ignore_free(struct ignore *ig);
 
 #endif
-
@@ -0,0 +1,210 @@
+#define _GNU_SOURCE
+#include "ingest.h"
+#include "uring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Files in flight. Each has at most one request queued, so the ring never
+ * holds more than INGEST_DEPTH entries. A file goes statx (path), openat,
+ * statx (fd), then read until complete. */
+#define INGEST_DEPTH 256
+/* Buffered file data allowed in flight; a file that would exceed it waits
+ * before being opened unless nothing else is buffered. */
+#define INGEST_BYTES (32*1024*1024)
+
+enum { SLOT_FREE, SLOT_STATX, SLOT_WAIT, SLOT_OPEN, SLOT_FSTAT, SLOT_READ };
+
+struct slot {
+    int state;
+    size_t idx;             // into paths
+    int fd;
+    char *buf;
+    size_t len, got;
+    struct statx stx, prev;     // of the path, then of the open file
+};
+
+struct ingest {
+    struct uring u;
+    char *const *paths;
+    const struct ingest_ops *ops;
+    void *ud;
+    struct slot slots[INGEST_DEPTH];
+    size_t bytes;           // buffers of files past SLOT_WAIT
+    int nwait;
+};
+
+static void release(struct ingest *g, struct slot *s){
+    if (s->fd >= 0) close(s->fd);
+    if (s->buf) g->bytes -= s->len;
+    free(s->buf);
+    memset(s, 0, sizeof *s);
+    s->fd = -1;
+}
+
+static void start_statx(struct ingest *g, struct slot *s, size_t idx){
+    struct io_uring_sqe *q = uring_sqe(&g->u);
+    s->state = SLOT_STATX;
+    s->idx = idx;
+    q->opcode = IORING_OP_STATX;
+    q->fd = AT_FDCWD;
+    q->addr = (uintptr_t)g->paths[idx];
+    q->len = STATX_TYPE|STATX_MODE|STATX_INO|STATX_SIZE|STATX_MTIME|STATX_NLINK|STATX_UID|STATX_GID;
+    q->off = (uintptr_t)&s->stx;
+    q->user_data = (uintptr_t)(s - g->slots);
+}
+
+static void start_fstat(struct ingest *g, struct slot *s){
+    struct io_uring_sqe *q = uring_sqe(&g->u);
+    s->prev = s->stx;
+    s->state = SLOT_FSTAT;
+    q->opcode = IORING_OP_STATX;
+    q->fd = s->fd;
+    q->addr = (uintptr_t)"";
+    q->statx_flags = AT_EMPTY_PATH;
+    q->len = STATX_TYPE|STATX_MODE|STATX_INO|STATX_SIZE|STATX_MTIME|STATX_NLINK|STATX_UID|STATX_GID;
+    q->off = (uintptr_t)&s->stx;
+    q->user_data = (uintptr_t)(s - g->slots);
+}
+
+static int same_file(const struct statx *a, const struct statx *b){
+    return a->stx_ino == b->stx_ino && a->stx_dev_major == b->stx_dev_major &&
+           a->stx_dev_minor == b->stx_dev_minor && a->stx_size == b->stx_size &&
+           a->stx_mtime.tv_sec == b->stx_mtime.tv_sec && a->stx_mtime.tv_nsec == b->stx_mtime.tv_nsec;
+}
+
+static void start_read(struct ingest *g, struct slot *s){
+    struct io_uring_sqe *q = uring_sqe(&g->u);
+    q->opcode = IORING_OP_READ;
+    q->fd = s->fd;
+    q->addr = (uintptr_t)(s->buf + s->got);
+    q->len = (unsigned)(s->len - s->got);
+    q->off = s->got;
+    q->user_data = (uintptr_t)(s - g->slots);
+}
+
+/* Reserve the buffer and queue the open. An empty file skips the I/O. */
+static void start_open(struct ingest *g, struct slot *s){
+    if (s->len == 0) {
+        g->ops->data(g->ud, s->idx, "", 0, &s->stx);
+        release(g, s);
+        return;
+    }
+    if (!(s->buf = malloc(s->len))) { release(g, s); return; }
+    g->bytes += s->len;
+    struct io_uring_sqe *q = uring_sqe(&g->u);
+    s->state = SLOT_OPEN;
+    q->opcode = IORING_OP_OPENAT;
+    q->fd = AT_FDCWD;
+    q->addr = (uintptr_t)g->paths[s->idx];
+    q->open_flags = O_RDONLY|O_CLOEXEC;
+    q->user_data = (uintptr_t)(s - g->slots);
+}
+
+static int fits(struct ingest *g, size_t len){
+    return g->bytes == 0 || g->bytes + len <= INGEST_BYTES;
+}
+
+static void complete(struct ingest *g, struct slot *s, int res){
+    switch (s->state) {
+    case SLOT_STATX:
+        if (res < 0 || !S_ISREG(s->stx.stx_mode) || !g->ops->want(g->ud, s->idx, &s->stx)) {
+            release(g, s);
+            return;
+        }
+        s->len = (size_t)s->stx.stx_size;
+        if (!fits(g, s->len)) { s->state = SLOT_WAIT; g->nwait++; return; }
+        start_open(g, s);
+        return;
+    case SLOT_OPEN:
+        if (res < 0) { release(g, s); return; }
+        s->fd = res;
+        start_fstat(g, s);
+        return;
+    case SLOT_FSTAT:
+        // The path may have been replaced (another scan renaming its rewrite
+        // over it) between the statx and the open. Go by the file we have.
+        if (res < 0) { release(g, s); return; }
+        if (!same_file(&s->prev, &s->stx)) {
+            if (!S_ISREG(s->stx.stx_mode) || !g->ops->want(g->ud, s->idx, &s->stx)) { release(g, s); return; }
+            size_t len = (size_t)s->stx.stx_size;
+            if (len == 0) {
+                g->ops->data(g->ud, s->idx, "", 0, &s->stx);
+                release(g, s);
+                return;
+            }
+            if (len != s->len) {
+                char *nb = realloc(s->buf, len);
+                if (!nb) { release(g, s); return; }
+                g->bytes += len - s->len;
+                s->buf = nb;
+                s->len = len;
+            }
+        }
+        s->state = SLOT_READ;
+        start_read(g, s);
+        return;
+    case SLOT_READ:
+        if (res == -EINTR || res == -EAGAIN) { start_read(g, s); return; }
+        if (res < 0) { release(g, s); return; }
+        s->got += (size_t)res;
+        // A file that shrank since the statx ends early; rewriting it later
+        // notices the change and backs off.
+        if (res > 0 && s->got < s->len) { start_read(g, s); return; }
+        g->ops->data(g->ud, s->idx, s->buf, s->got, &s->stx);
+        release(g, s);
+        return;
+    }
+}
+
+int ingest_files(char *const *paths, size_t n, const struct ingest_ops *ops, void *ud){
+    struct ingest *g = calloc(1, sizeof *g);
+    if (!g) return -1;
+    if (uring_init(&g->u, INGEST_DEPTH) != 0) { free(g); return -1; }
+    if (!uring_supports(&g->u, IORING_OP_STATX) || !uring_supports(&g->u, IORING_OP_OPENAT) ||
+        !uring_supports(&g->u, IORING_OP_READ)) {
+        uring_free(&g->u);
+        free(g);
+        return -1;
+    }
+    g->paths = paths;
+    g->ops = ops;
+    g->ud = ud;
+    for (int i = 0; i < INGEST_DEPTH; i++) g->slots[i].fd = -1;
+
+    size_t next = 0;
+    int rc = 0;
+    for (;;) {
+        int active = 0;
+        for (int i = 0; i < INGEST_DEPTH; i++) {
+            struct slot *s = &g->slots[i];
+            if (s->state == SLOT_WAIT && fits(g, s->len)) {
+                g->nwait--;
+                start_open(g, s);
+            }
+            if (s->state == SLOT_FREE && next < n) start_statx(g, s, next++);
+            if (s->state != SLOT_FREE && s->state != SLOT_WAIT) active++;
+        }
+        if (active == 0 && g->nwait == 0) break;
+        if (uring_submit(&g->u, 1) != 0) { rc = -1; break; }
+        struct io_uring_cqe *c;
+        while ((c = uring_peek(&g->u))) {
+            struct slot *s = &g->slots[c->user_data];
+            int res = c->res;
+            uring_seen(&g->u);
+            complete(g, s, res);
+        }
+    }
+    uring_free(&g->u);
+    if (rc != 0) {
+        // io_uring_enter itself failed with requests pending. The kernel may
+        // still complete them into our buffers, so leak those on purpose.
+        for (int i = 0; i < INGEST_DEPTH; i++) if (g->slots[i].fd >= 0) close(g->slots[i].fd);
+        return -1;
+    }
+    free(g);
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef INGEST_H
+#define INGEST_H
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* Callbacks of ingest_files, all run on the calling thread. want sees the
+ * statx of paths[i] and returns 1 to have the file read, 0 to skip it.
+ * data gets the whole file; buf is only valid during the call. */
+struct ingest_ops {
+    int (*want)(void *ud, size_t i, const struct statx *stx);
+    void (*data)(void *ud, size_t i, const char *buf, size_t n, const struct statx *stx);
+};
+
+/* statx, open and read the regular files among paths with many requests in
+ * flight on an io_uring. Files that vanish or fail to read are skipped.
+ * Returns -1 when io_uring is not available (before any callback) or fails
+ * midway; the caller takes the blocking path for files it did not see. */
+int ingest_files(char *const *paths, size_t n, const struct ingest_ops *ops, void *ud);
+
+#endif
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+#include "lex.h"
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+enum { F_LINE=1, F_OPEN=2, F_STR=4, F_CHAR=8 };
+
+static const struct lex_syntax SYN_C = {
+    "c", {"//"}, {"/*"}, {"*/"}, {"\"","'"}, 0, 0, '\\', false, LEX_DIGIT_SEP
+};
+static const struct lex_syntax SYN_RUST = {
+    "rust", {"//"}, {"/*"}, {"*/"}, {"\""}, 0, 0, '\\', false, LEX_CHAR_LIT
+};
+static const struct lex_syntax SYN_JS = {
+    "js", {"//"}, {"/*"}, {"*/"}, {"\"","'","`"}, 1u<<2, 0, '\\', false, 0
+};
+static const struct lex_syntax SYN_GO = {
+    "go", {"//"}, {"/*"}, {"*/"}, {"\"","'","`"}, 1u<<2, 1u<<2, '\\', false, 0
+};
+static const struct lex_syntax SYN_CSS = {
+    "css", {NULL}, {"/*"}, {"*/"}, {"\"","'"}, 0, 0, '\\', false, 0
+};
+static const struct lex_syntax SYN_PY = {
+    "python", {"#"}, {"\"\"\"","'''"}, {"\"\"\"","'''"}, {"\"","'"}, 0, 0, '\\', false, 0
+};
+static const struct lex_syntax SYN_SH = {
+    "shell", {"#"}, {NULL}, {NULL}, {"\"","'"}, 0, 0, '\\', false, 0
+};
+/* The shell itself: # starts a comment only at the start of a word, as in
+ * ${#a}, and nothing is escaped inside '...'. */
+static const struct lex_syntax SYN_SHELL = {
+    "sh", {"#"}, {NULL}, {NULL}, {"\"","'"}, 0, 1u<<1, '\\', false, LEX_WORD_LINE
+};
+/* YAML and TOML: a quote opens a string only where a value starts, so
+ * plain text such as "don't" does not. */
+static const struct lex_syntax SYN_CONF = {
+    "conf", {"#"}, {NULL}, {NULL}, {"\"","'"}, 0, 0, '\\', false, LEX_STR_TOKEN
+};
+static const struct lex_syntax SYN_LUA = {
+    "lua", {"--"}, {"--[["}, {"]]"}, {"\"","'"}, 0, 0, '\\', false, 0
+};
+static const struct lex_syntax SYN_SQL = {
+    "sql", {"--"}, {"/*"}, {"*/"}, {"'","\""}, 0, 0, 0, false, 0
+};
+static const struct lex_syntax SYN_HS = {
+    "haskell", {"--"}, {"{-"}, {"-}"}, {"\""}, 0, 0, '\\', false, 0
+};
+static const struct lex_syntax SYN_HTML = {
+    "html", {NULL}, {"<!--"}, {"-->"}, {NULL}, 0, 0, 0, false, 0
+};
+static const struct lex_syntax SYN_LISP = {
+    "lisp", {";"}, {"#|"}, {"|#"}, {"\""}, 0, 0, '\\', false, 0
+};
+static const struct lex_syntax SYN_TEX = {
+    "tex", {"%"}, {NULL}, {NULL}, {NULL}, 0, 0, 0, false, 0
+};
+/* Unknown extensions keep the historical behaviour: any of the old
+ * prefixes, only as the first thing on a line, no string tracking. */
+static const struct lex_syntax SYN_DEFAULT = {
+    "default", {"#","//",";","--","%"}, {NULL}, {NULL}, {NULL}, 0, 0, 0, true, 0
+};
+
+static const struct { const char *ext; const struct lex_syntax *syn; } EXTS[] = {
+    {"c",&SYN_C},{"h",&SYN_C},{"cc",&SYN_C},{"cpp",&SYN_C},{"cxx",&SYN_C},
+    {"hh",&SYN_C},{"hpp",&SYN_C},{"hxx",&SYN_C},{"java",&SYN_C},{"cs",&SYN_C},
+    {"rs",&SYN_RUST},{"swift",&SYN_C},{"kt",&SYN_C},{"kts",&SYN_C},{"scala",&SYN_C},
+    {"php",&SYN_C},{"m",&SYN_C},{"mm",&SYN_C},{"proto",&SYN_C},{"zig",&SYN_C},
+    {"js",&SYN_JS},{"jsx",&SYN_JS},{"mjs",&SYN_JS},{"cjs",&SYN_JS},{"ts",&SYN_JS},
+    {"tsx",&SYN_JS},{"dart",&SYN_JS},
+    {"go",&SYN_GO},
+    {"css",&SYN_CSS},{"scss",&SYN_C},{"less",&SYN_C},
+    {"py",&SYN_PY},{"pyi",&SYN_PY},
+    {"sh",&SYN_SHELL},{"bash",&SYN_SHELL},{"zsh",&SYN_SHELL},{"rb",&SYN_SH},{"pl",&SYN_SH},
+    {"pm",&SYN_SH},{"r",&SYN_SH},{"yml",&SYN_CONF},{"yaml",&SYN_CONF},{"toml",&SYN_CONF},
+    {"cmake",&SYN_SH},{"mk",&SYN_SH},{"nix",&SYN_SH},{"ex",&SYN_SH},{"exs",&SYN_SH},
+    {"lua",&SYN_LUA},
+    {"sql",&SYN_SQL},
+    {"hs",&SYN_HS},{"elm",&SYN_HS},
+    {"html",&SYN_HTML},{"htm",&SYN_HTML},{"xml",&SYN_HTML},{"svg",&SYN_HTML},
+    {"md",&SYN_HTML},{"vue",&SYN_HTML},
+    {"lisp",&SYN_LISP},{"el",&SYN_LISP},{"clj",&SYN_LISP},{"scm",&SYN_LISP},
+    {"asm",&SYN_LISP},{"s",&SYN_LISP},{"ini",&SYN_LISP},
+    {"tex",&SYN_TEX},{"sty",&SYN_TEX},{"erl",&SYN_TEX},
+};
+
+const struct lex_syntax *lex_syntax_for(const char *path){
+    const char *base = strrchr(path, '/');
+    base = base ? base+1 : path;
+    if (strcmp(base, "Makefile") == 0 || strcmp(base, "CMakeLists.txt") == 0 ||
+        strcmp(base, "Dockerfile") == 0) return &SYN_SH;
+    const char *ext = strrchr(base, '.');
+    if (!ext || ext == base) return &SYN_DEFAULT;
+    ext++;
+    for (size_t i = 0; i < sizeof(EXTS)/sizeof(EXTS[0]); i++)
+        if (strcasecmp(ext, EXTS[i].ext) == 0) return EXTS[i].syn;
+    return &SYN_DEFAULT;
+}
+
+void lex_init(struct lexer *lx, const struct lex_syntax *syn){
+    memset(lx, 0, sizeof *lx);
+    lx->syn = syn;
+    for (int k = 0; k < LEX_MAX && syn->line[k]; k++) {
+        lx->line_len[k] = (unsigned char)strlen(syn->line[k]);
+        lx->first[(unsigned char)syn->line[k][0]] |= F_LINE;
+    }
+    for (int k = 0; k < LEX_MAX && syn->open[k]; k++) {
+        lx->open_len[k] = (unsigned char)strlen(syn->open[k]);
+        lx->close_len[k] = (unsigned char)strlen(syn->close[k]);
+        lx->first[(unsigned char)syn->open[k][0]] |= F_OPEN;
+    }
+    for (int k = 0; k < LEX_MAX && syn->str[k]; k++) {
+        lx->str_len[k] = (unsigned char)strlen(syn->str[k]);
+        lx->first[(unsigned char)syn->str[k][0]] |= F_STR;
+    }
+    if (syn->quirks & LEX_CHAR_LIT) lx->first['\''] |= F_CHAR;
+}
+
+static int at(const char *s, size_t i, size_t n, const char *tok, size_t tl){
+    return i + tl <= n && memcmp(s + i, tok, tl) == 0;
+}
+
+/* Whether the quote at s[i] cannot open a string under the syntax's quirks. */
+static int not_str(const struct lex_syntax *syn, const char *s, size_t i){
+    if (syn->quirks & LEX_STR_TOKEN)
+        return i > 0 && !isspace((unsigned char)s[i-1]) && !strchr("[{(,:=", s[i-1]);
+    if ((syn->quirks & LEX_DIGIT_SEP) && s[i] == '\'' && i > 0 && isxdigit((unsigned char)s[i-1])) {
+        // the literal must start with a digit: u8'x' is a character
+        size_t b = i;
+        while (b > 0 && (isalnum((unsigned char)s[b-1]) || s[b-1] == '\'' || s[b-1] == '.')) b--;
+        return isdigit((unsigned char)s[b]);
+    }
+    return 0;
+}
+
+/* Length of the character literal at s[i], 0 if the ' opens none (a Rust
+ * lifetime such as 'a). */
+static size_t char_lit(const char *s, size_t i, size_t n){
+    size_t j = i + 1;
+    if (j < n && s[j] == '\\') {
+        // '\n', '\'', '\u{1F600}'
+        for (j += 2; j < n && j < i + 12 && s[j] != '\''; j++) ;
+    } else {
+        // one character, however many UTF-8 bytes
+        for (j++; j < n && ((unsigned char)s[j] & 0xC0) == 0x80; j++) ;
+    }
+    return j < n && s[j] == '\'' ? j - i + 1 : 0;
+}
+
+/* Trim the body and hand it to the callback. Leading decoration such as the
+ * '*' column of a C block or repeated openers ("///", ";;") is skipped. */
+static int emit(const char *s, size_t b, size_t e, char deco, lex_cb cb, void *ud){
+    while (b < e && (s[b] == deco || isspace((unsigned char)s[b]))) b++;
+    while (e > b && isspace((unsigned char)s[e-1])) e--;
+    if (b >= e) return 0;
+    return cb(s, b, e, ud);
+}
+
+void lex_line(const struct lexer *lx, struct lex_state *st, const char *s, size_t n, lex_cb cb, void *ud){
+    const struct lex_syntax *syn = lx->syn;
+    int done = 0;
+    size_t i = 0, seg = 0;
+
+    if (syn->bol_only) {
+        while (i < n && isspace((unsigned char)s[i])) i++;
+        for (int k = 0; k < LEX_MAX && syn->line[k]; k++) {
+            if (at(s, i, n, syn->line[k], lx->line_len[k])) {
+                emit(s, i + lx->line_len[k], n, syn->line[k][lx->line_len[k]-1], cb, ud);
+                break;
+            }
+        }
+        return;
+    }
+
+    if (st->mode == LEX_BLOCK) {
+        // continuation line of a block comment: the body starts at column 0
+        while (seg < n && isspace((unsigned char)s[seg])) seg++;
+        i = seg;
+    } else if (st->mode == LEX_STR && !(syn->mline_str & (1u << st->which))) {
+        st->mode = LEX_CODE;
+    }
+
+    while (i < n) {
+        if (st->mode == LEX_CODE) {
+            unsigned char f = lx->first[(unsigned char)s[i]];
+            if (!f) { i++; continue; }
+            int k;
+            if (f & F_CHAR) {
+                size_t cl = char_lit(s, i, n);
+                if (cl) { i += cl; continue; }
+            }
+            if (f & F_OPEN) {
+                for (k = 0; k < LEX_MAX && syn->open[k]; k++)
+                    if (at(s, i, n, syn->open[k], lx->open_len[k])) break;
+                if (k < LEX_MAX && syn->open[k]) {
+                    st->mode = LEX_BLOCK; st->which = k;
+                    i += lx->open_len[k];
+                    seg = i;
+                    continue;
+                }
+            }
+            if (f & F_LINE) {
+                for (k = 0; k < LEX_MAX && syn->line[k]; k++)
+                    if (at(s, i, n, syn->line[k], lx->line_len[k])) break;
+                if (k < LEX_MAX && syn->line[k] && (syn->quirks & LEX_WORD_LINE) && i > 0 &&
+                    !isspace((unsigned char)s[i-1]) && !strchr(";&|()<>", s[i-1])) {
+                    i++;
+                    continue;
+                }
+                if (k < LEX_MAX && syn->line[k]) {
+                    if (!done) emit(s, i + lx->line_len[k], n, syn->line[k][lx->line_len[k]-1], cb, ud);
+                    return;
+                }
+            }
+            if (f & F_STR) {
+                for (k = 0; k < LEX_MAX && syn->str[k]; k++)
+                    if (at(s, i, n, syn->str[k], lx->str_len[k])) break;
+                if (k < LEX_MAX && syn->str[k] && !not_str(syn, s, i)) {
+                    st->mode = LEX_STR; st->which = k;
+                    i += lx->str_len[k];
+                    continue;
+                }
+            }
+            i++;
+        } else if (st->mode == LEX_BLOCK) {
+            const char *cl = syn->close[st->which];
+            if (s[i] == cl[0] && at(s, i, n, cl, lx->close_len[st->which])) {
+                if (!done) done = emit(s, seg, i, '*', cb, ud);
+                st->mode = LEX_CODE;
+                i += lx->close_len[st->which];
+            } else {
+                i++;
+            }
+        } else {
+            if (syn->esc && s[i] == syn->esc && !(syn->raw_str & (1u << st->which))) { i += 2; continue; }
+            if (at(s, i, n, syn->str[st->which], lx->str_len[st->which])) {
+                st->mode = LEX_CODE;
+                i += lx->str_len[st->which];
+            } else {
+                i++;
+            }
+        }
+    }
+    if (st->mode == LEX_BLOCK && !done) emit(s, seg, n, '*', cb, ud);
+}
@@ -0,0 +1,53 @@
+#ifndef LEX_H
+#define LEX_H
+#include <stdbool.h>
+#include <stddef.h>
+
+#define LEX_MAX 6
+
+/* Comment/string syntax of one language family. Arrays are NULL-terminated. */
+struct lex_syntax {
+    const char *name;
+    const char *line[LEX_MAX];      // line comment openers
+    const char *open[LEX_MAX];      // block comment openers...
+    const char *close[LEX_MAX];     // ...and their matching closers
+    const char *str[LEX_MAX];       // string delimiters (same open/close)
+    unsigned mline_str;             // bit i set: str[i] may span lines
+    unsigned raw_str;               // bit i set: nothing is escaped in str[i]
+    char esc;                       // escape byte inside strings, 0 if none
+    bool bol_only;                  // line comments only at start of line
+    unsigned quirks;                // LEX_* below
+};
+
+/* Quirks: LEX_DIGIT_SEP, a ' inside a number is a separator (1'000);
+ * LEX_STR_TOKEN, strings open only where a value starts; LEX_CHAR_LIT,
+ * 'x' is a character literal and a lone ' is not a string; LEX_WORD_LINE,
+ * line comments open only at the start of a word. */
+enum { LEX_DIGIT_SEP=1, LEX_STR_TOKEN=2, LEX_CHAR_LIT=4, LEX_WORD_LINE=8 };
+
+/* Syntax compiled for a single pass: first[] flags which token kinds can
+ * start at a byte, so plain code costs one table lookup per byte. */
+struct lexer {
+    const struct lex_syntax *syn;
+    unsigned char first[256];
+    unsigned char line_len[LEX_MAX], open_len[LEX_MAX], close_len[LEX_MAX], str_len[LEX_MAX];
+};
+
+enum { LEX_CODE=0, LEX_BLOCK, LEX_STR };
+
+/* Carried between lines of the same file. */
+struct lex_state {
+    int mode;
+    int which;
+};
+
+/* Called for every comment body on a line: [start,end) with surrounding
+ * whitespace and decoration trimmed. Return nonzero to stop reporting for
+ * the rest of the line (state tracking continues). */
+typedef int (*lex_cb)(const char *line, size_t start, size_t end, void *ud);
+
+const struct lex_syntax *lex_syntax_for(const char *path);
+void lex_init(struct lexer *lx, const struct lex_syntax *syn);
+void lex_line(const struct lexer *lx, struct lex_state *st, const char *s, size_t n, lex_cb cb, void *ud);
+
+#endif
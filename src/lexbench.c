@@ -0,0 +1,131 @@
+#define _GNU_SOURCE
+#include "lexbench.h"
+#include "lex.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_RUNS 3
+
+/* A file name that picks the syntax, and lines repeated to fill the
+ * corpus; %zu in a line becomes the repetition count. */
+struct corpus {
+    const char *file;
+    const char *lines[8];
+};
+
+static const struct corpus CORPORA[] = {
+    { "main.c", { "int f%zu(int x) { return x * 3 + 1'000; }",
+                  "const char *s%zu = \"a // string /* not */ a comment\";",
+                  "char c%zu = '\"';",
+                  "/* block comment %zu",
+                  " * TODO: spans lines */",
+                  "    x += y; // FIXME: trailing %zu" } },
+    { "lib.rs", { "fn f%zu<'a>(x: &'a str) -> &'a str { x }",
+                  "let c = '\"'; let s = \"// %zu\";",
+                  "/* block %zu */ let y = 2;",
+                  "    y += 1; // TODO: trailing %zu" } },
+    { "app.js", { "const s%zu = `template ${x} // %zu`;",
+                  "let t = 'it\\'s'; let u = \"/* no */\";",
+                  "/** doc %zu",
+                  " * NOTE: spans lines */",
+                  "x = y / 2; // TODO: trailing %zu" } },
+    { "main.go", { "var s%zu = `C:\\` + \"// %zu\"",
+                   "r := '\\''",
+                   "/* block %zu */ x++",
+                   "x += 1 // TODO: trailing %zu" } },
+    { "style.css", { ".c%zu { color: #fff; content: \"/* %zu */\"; }",
+                     "/* rule %zu */",
+                     "a:hover { margin: 0 }" } },
+    { "app.py", { "def f%zu(x): return x * 2",
+                  "s = 'a # not a comment %zu'",
+                  "\"\"\"docstring %zu",
+                  "TODO: spans lines\"\"\"",
+                  "x += 1  # FIXME: trailing %zu" } },
+    { "build.rb", { "x%zu = \"a # not %zu\"",
+                    "puts 'it' # TODO: trailing %zu" } },
+    { "build.sh", { "echo ${#arr[@]} \"a # %zu\" # TODO: trailing",
+                    "cp 'C:\\' x%zu",
+                    "for i in 1 2 3; do echo $i; done # %zu" } },
+    { "conf.yaml", { "key%zu: don't # TODO: trailing",
+                     "s: 'a # not' # %zu",
+                     "list: [a, b, c]" } },
+    { "init.lua", { "local s%zu = \"-- not %zu\"",
+                    "--[[ block %zu ]] x = 1",
+                    "x = x + 1 -- TODO: trailing %zu" } },
+    { "q.sql", { "SELECT '-- not %zu' FROM t%zu; -- TODO: trailing",
+                 "/* block %zu */ UPDATE t SET x = 1;" } },
+    { "m.hs", { "f%zu x = x * 2 -- TODO: trailing",
+                "{- block %zu -} s = \"-- not\"" } },
+    { "page.html", { "<div class=\"c%zu\">text %zu</div>",
+                     "<!-- TODO: comment %zu -->" } },
+    { "core.lisp", { "(defun f%zu (x) (* x 2)) ; TODO: trailing",
+                     "#| block %zu |# (print \"; not\")" } },
+    { "doc.tex", { "\\section{S%zu} text 50\\%% % TODO: trailing",
+                   "plain line %zu" } },
+    { "notes.txt", { "plain text line %zu",
+                     "# TODO: at line start %zu" } },
+};
+
+static int count(const char *line, size_t start, size_t end, void *ud){
+    (void)line; (void)start; (void)end;
+    ++*(size_t *)ud;
+    return 0;
+}
+
+static double now_s(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Fill buf with c's lines until it holds about cap bytes; the lengths of
+ * the lines go to lens. Returns the number of lines. */
+static size_t fill(const struct corpus *c, char *buf, size_t cap, size_t *lens, size_t maxlines){
+    size_t used = 0, nl = 0;
+    for (size_t rep = 0; nl < maxlines; rep++) {
+        for (int k = 0; k < 8 && c->lines[k] && nl < maxlines; k++) {
+            if (cap - used < 256) return nl;
+            int w = snprintf(buf + used, cap - used, c->lines[k], rep, rep);
+            if (w < 0 || (size_t)w >= cap - used) return nl;
+            lens[nl++] = (size_t)w;
+            used += (size_t)w;
+        }
+    }
+    return nl;
+}
+
+int lex_bench(FILE *out, size_t mb){
+    size_t cap = (mb ? mb : 1) << 20, maxlines = cap / 8;
+    char *buf = malloc(cap);
+    size_t *lens = malloc(maxlines * sizeof *lens);
+    if (!buf || !lens) { free(buf); free(lens); return -1; }
+    fprintf(out, "%-10s %-10s %8s %10s %10s\n", "syntax", "file", "MB", "MB/s", "comments");
+    for (size_t i = 0; i < sizeof CORPORA / sizeof *CORPORA; i++) {
+        const struct corpus *c = &CORPORA[i];
+        size_t nl = fill(c, buf, cap, lens, maxlines), bytes = 0, comments = 0;
+        for (size_t l = 0; l < nl; l++) bytes += lens[l];
+        const struct lex_syntax *syn = lex_syntax_for(c->file);
+        struct lexer lx;
+        lex_init(&lx, syn);
+        double best = 0;
+        for (int run = 0; run < BENCH_RUNS; run++) {
+            struct lex_state st = {0};
+            size_t n = 0;
+            const char *p = buf;
+            double t0 = now_s();
+            for (size_t l = 0; l < nl; l++) {
+                lex_line(&lx, &st, p, lens[l], count, &n);
+                p += lens[l];
+            }
+            double t = now_s() - t0;
+            if (run == 0 || t < best) best = t;
+            comments = n;
+        }
+        fprintf(out, "%-10s %-10s %8.1f %10.0f %10zu\n", syn->name, c->file, bytes / 1048576.0,
+                best > 0 ? bytes / 1048576.0 / best : 0.0, comments);
+    }
+    free(buf);
+    free(lens);
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef LEXBENCH_H
+#define LEXBENCH_H
+#include <stddef.h>
+#include <stdio.h>
+
+/* Lexer throughput per syntax: for each language a corpus of about mb
+ * megabytes is generated from typical lines (code, strings holding
+ * comment markers, block and trailing comments) and lexed in memory, best
+ * of three runs. One line per syntax on out. -1 without memory. */
+int lex_bench(FILE *out, size_t mb);
+
+#endif
@@ -1,112 +1,545 @@
 #define _GNU_SOURCE
 #include "md.h"
+#include "canon.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/stat.h>
 
-static const char *SECS[] = {"NOTE","TODO","WARNING","WARN","FIXME","FIX","BUG"};
+#define MD_NAME "codetags.md"
+#define TAGS_DIR "codetags"
 
-int md_initialize(const char *mdpath){
+int md_initialize(const char *mdpath, const struct tagset *tags){
     FILE *f = fopen(mdpath,"w");
     if(!f) return -1;
     fprintf(f,"# Codetags\n\n");
-    for(size_t i=0; i<sizeof(SECS)/sizeof(SECS[0]); i++){
-        fprintf(f,"## %s\n\n_No entries yet._\n\n", SECS[i]);
+    for(size_t i=0; i<tags->n; i++){
+        fprintf(f,"## %s\n\n_No entries yet._\n\n", tags->names[i]);
     }
     fclose(f);
     return 0;
 }
 
-static void write_section(FILE *out, const char *tag, FILE *mapf){
-    rewind(mapf);
-    char *line = NULL; size_t cap = 0;
+static char *join(const char *a, const char *b){
+    char *p = NULL;
+    if(asprintf(&p, "%s/%s", a, b) < 0) return NULL;
+    return p;
+}
+
+int md_out_init(struct md_out *o, const struct config *cfg, const char *root, const char *state){
+    memset(o, 0, sizeof *o);
+    o->mode = cfg->output;
+    o->root = strdup(root);
+    o->state = strdup(state);
+    if(!o->root || !o->state){ md_out_free(o); return -1; }
+    if(o->mode == OUTPUT_DIRS && cfg->nshard_dirs){
+        o->dirs = calloc(cfg->nshard_dirs, sizeof *o->dirs);
+        if(!o->dirs){ md_out_free(o); return -1; }
+        for(size_t i=0; i<cfg->nshard_dirs; i++){
+            char *p = join(root, cfg->shard_dirs[i]), real[PATH_MAX];
+            if(!p) continue;
+            size_t L = strlen(p);
+            while(L > 1 && p[L-1] == '/') p[--L] = 0;
+            // Keys hold resolved paths, so match against the resolved root.
+            if(realpath(p, real)){ free(p); p = strdup(real); }
+            if(p) o->dirs[o->ndirs++] = p;
+        }
+    }
+    return 0;
+}
+
+void md_out_free(struct md_out *o){
+    for(size_t i=0; i<o->ndirs; i++) free(o->dirs[i]);
+    free(o->dirs);
+    free(o->root);
+    free(o->state);
+    memset(o, 0, sizeof *o);
+}
+
+/* Points into the map's keys, which stay put while we render. */
+struct entry {
+    const char *path;
+    size_t plen;
+    const char *id;
+    struct entry *next;
+};
+
+/* One output file. shards[0] is root/codetags.md: every entry in single
+ * mode, otherwise the index plus (dirs mode) entries outside all shards. */
+struct shard {
+    char *out;
+    char *label;                // out relative to the root, for the index
+    char *dir;                  // dirs mode: entries below this directory
+    size_t dlen;
+    struct entry **head, **tail;
+    size_t *count, total;
+    uint64_t fp;
+    int keep;                   // written even without entries
+};
+
+/* What the last render left behind, from o->state. */
+struct rendered {
+    char *out;
+    uint64_t fp;
+    long size, mtime;
+};
+
+static uint64_t mix(uint64_t h, const void *data, size_t len){
+    const unsigned char *p = data;
+    while(len--){ h ^= *p++; h *= 1099511628211ULL; }
+    return h;
+}
+
+static struct shard *add_shard(struct shard **v, size_t *n, size_t ntags, char *out, char *label){
+    struct shard *nv = realloc(*v, (*n + 1) * sizeof *nv);
+    if(!nv){ free(out); free(label); return NULL; }
+    *v = nv;
+    struct shard *s = &nv[(*n)++];
+    memset(s, 0, sizeof *s);
+    s->out = out;
+    s->label = label;
+    s->head = calloc(ntags ? ntags : 1, sizeof *s->head);
+    s->tail = calloc(ntags ? ntags : 1, sizeof *s->tail);
+    s->count = calloc(ntags ? ntags : 1, sizeof *s->count);
+    if(!out || !label || !s->head || !s->tail || !s->count){
+        free(s->out); free(s->label); free(s->head); free(s->tail); free(s->count);
+        (*n)--;
+        return NULL;
+    }
+    return s;
+}
+
+static void free_shards(struct shard *v, size_t n, size_t ntags){
+    for(size_t i=0; i<n; i++){
+        for(size_t t=0; t<ntags; t++)
+            for(struct entry *e=v[i].head[t], *nx; e; e=nx){ nx = e->next; free(e); }
+        free(v[i].out); free(v[i].label); free(v[i].dir); free(v[i].head); free(v[i].tail); free(v[i].count);
+    }
+    free(v);
+}
+
+static const char *rel_to(const char *path, const char *root){
+    size_t L = strlen(root);
+    if(strncmp(path, root, L) == 0 && path[L] == '/') return path + L + 1;
+    return path;
+}
+
+bool md_is_output(const struct md_out *o, const char *path){
+    char abs[PATH_MAX];
+    if(path[0] != '/' && canon_path(path, abs) == 0) path = abs;   // a walk of "."
+    const char *rel = rel_to(path, o->root), *slash = strchr(rel, '/');
+    if(rel == path) return false;
+    if(strcmp(rel, MD_NAME) == 0) return true;
+    if(o->mode == OUTPUT_TAGS){
+        size_t L = strlen(rel);
+        return strncmp(rel, TAGS_DIR "/", sizeof TAGS_DIR) == 0 && !strchr(rel + sizeof TAGS_DIR, '/') &&
+               L > 3 && strcmp(rel + L - 3, ".md") == 0;
+    }
+    if(o->mode != OUTPUT_DIRS) return false;
+    if(!o->ndirs) return slash && strcmp(slash + 1, MD_NAME) == 0;
+    for(size_t i=0; i<o->ndirs; i++){
+        size_t L = strlen(o->dirs[i]);
+        if(strncmp(path, o->dirs[i], L) == 0 && path[L] == '/' && strcmp(path + L + 1, MD_NAME) == 0) return true;
+    }
+    return false;
+}
+
+/* Index of the shard an entry of path goes to. Dirs-mode shards without
+ * configured roots are created on demand, which may move *v. */
+static size_t shard_for(const struct md_out *o, struct shard **v, size_t *n, size_t ntags,
+                        const char *path, size_t plen, int tag){
+    if(o->mode == OUTPUT_SINGLE) return 0;
+    if(o->mode == OUTPUT_TAGS) return 1 + (size_t)tag;
+    size_t best = 0;
+    for(size_t i=1; i<*n; i++){
+        const struct shard *s = &(*v)[i];
+        if(plen > s->dlen && path[s->dlen] == '/' && memcmp(path, s->dir, s->dlen) == 0 &&
+           (!best || s->dlen > (*v)[best].dlen)) best = i;
+    }
+    if(best || o->ndirs) return best;
+
+    // Default shards: the top-level directory of the file, if it has one.
+    size_t L = strlen(o->root);
+    if(plen <= L + 1 || memcmp(path, o->root, L) != 0 || path[L] != '/') return 0;
+    const char *top = path + L + 1, *slash = memchr(top, '/', plen - L - 1);
+    if(!slash) return 0;
+    char *dir = strndup(path, (size_t)(slash - path));
+    char *label = NULL;
+    if(!dir || asprintf(&label, "%.*s/" MD_NAME, (int)(slash - top), top) < 0){ free(dir); return 0; }
+    struct shard *s = add_shard(v, n, ntags, join(dir, MD_NAME), label);
+    if(!s){ free(dir); return 0; }
+    s->dir = dir;
+    s->dlen = strlen(dir);
+    return *n - 1;
+}
+
+void md_entry_text(char *line, const char *tag, char display[MD_TEXT_MAX]){
+    display[0] = 0;
+    char *pos = (char*)strcasestr(line, tag);
+    if(!pos) return;
+    pos = strchr(pos, ':');
+    if(!pos) return;
+    pos++;
+    while(*pos && isspace((unsigned char)*pos)) pos++;
+    // Strip trailing [CT-...] if present
+    char *lb = strrchr(pos,'[');
+    if(lb && strncmp(lb,"[CT-",4) == 0){
+        char *q = lb;
+        while(q > pos && isspace((unsigned char)*(q-1))) q--;
+        *q = 0;
+    }
+    // Trim newline and CR
+    size_t L = strlen(pos);
+    while(L > 0 && (pos[L-1] == '\n' || pos[L-1] == '\r')){
+        pos[--L] = 0;
+    }
+    strncpy(display, pos, MD_TEXT_MAX - 1);
+    display[MD_TEXT_MAX - 1] = 0;
+}
+
+/* Locate the line carrying `id` in `path` and print its entry. */
+static int write_entry(FILE *out, const struct md_out *o, const char *tag, const char *path, const char *id){
+    char display[MD_TEXT_MAX] = {0};
+    long cur = 0;
+    int found = o->locate ? o->locate(o->locate_ud, path, id, tag, &cur, display) : -1;
+    if(found >= 0){
+        if(found) fprintf(out, "- [%s] %s:%ld — %s\n", id, rel_to(path, o->root), cur, display);
+        return found;
+    }
+    FILE *ff = fopen(path,"r");
+    if(!ff) return 0;
+
+    char *fl = NULL; size_t fcap = 0;
+    found = 0;
+    while(getline(&fl,&fcap,ff) > 0){
+        cur++;
+        if(strstr(fl, id)){
+            md_entry_text(fl, tag, display);
+            fprintf(out, "- [%s] %s:%ld — %s\n", id, rel_to(path, o->root), cur, display);
+            found = 1;
+            break;
+        }
+    }
+    free(fl);
+    fclose(ff);
+    return found;
+}
+
+static void write_section(FILE *out, const struct md_out *o, const struct shard *s, size_t t, const char *tag){
     int wrote_any = 0;
-    char cwd[PATH_MAX];
-    if (!getcwd(cwd,sizeof cwd)) cwd[0] = 0;
-
-    while(getline(&line,&cap,mapf) > 0){
-        char *tab = strchr(line,'\t');
-        if(!tab) continue;
-        *tab = 0;
-        char *key = line;
-        char *id = tab+1;
-        size_t n = strlen(id);
-        while(n>0 && (id[n-1]=='\n' || id[n-1]=='\r')) id[--n] = 0;
+    char path[PATH_MAX];
+    for(const struct entry *e=s->head[t]; e; e=e->next){
+        if(e->plen >= sizeof path) continue;
+        memcpy(path, e->path, e->plen);
+        path[e->plen] = 0;
+        if(write_entry(out, o, tag, path, e->id)) wrote_any = 1;
+    }
+    if(!wrote_any) fprintf(out, "_No entries yet._\n");
+    fprintf(out,"\n");
+}
+
+static void write_index(FILE *out, const struct md_out *o, const struct shard *v, size_t n, const struct tagset *tags){
+    fprintf(out,"# Codetags\n\n");
+    int listed = 0;
+    for(size_t i=1; i<n; i++){
+        if(!v[i].total && !v[i].keep) continue;
+        fprintf(out, "- [%s](%s) —", v[i].label, v[i].label);
+        if(o->mode == OUTPUT_TAGS && v[i].total) fprintf(out, " %zu", v[i].total);
+        int first = 1;
+        for(size_t t=0; o->mode == OUTPUT_DIRS && t<tags->n; t++){
+            if(!v[i].count[t]) continue;
+            fprintf(out, "%s %s %zu", first ? "" : ",", tags->names[t], v[i].count[t]);
+            first = 0;
+        }
+        if(!v[i].total) fprintf(out, " no entries");
+        fprintf(out, "\n");
+        listed = 1;
+    }
+    if(listed) fprintf(out, "\n");
+    // Entries that fall outside every shard stay in the root file.
+    for(size_t t=0; t<tags->n; t++){
+        if(!v[0].count[t]) continue;
+        fprintf(out,"## %s\n\n", tags->names[t]);
+        write_section(out, o, &v[0], t, tags->names[t]);
+        listed = 1;
+    }
+    if(!listed) fprintf(out, "_No entries yet._\n");
+}
+
+static void write_shard(FILE *out, const struct md_out *o, const struct shard *v, size_t n, size_t i, const struct tagset *tags){
+    const struct shard *s = &v[i];
+    if(i == 0 && o->mode != OUTPUT_SINGLE){
+        write_index(out, o, v, n, tags);
+    } else if(o->mode == OUTPUT_TAGS){
+        size_t t = i - 1;
+        fprintf(out,"# %s\n\n", tags->names[t]);
+        write_section(out, o, s, t, tags->names[t]);
+    } else {
+        if(i == 0) fprintf(out,"# Codetags\n\n");
+        else fprintf(out,"# Codetags — %s\n\n", rel_to(s->dir, o->root));
+        for(size_t t=0; t<tags->n; t++){
+            fprintf(out,"## %s\n\n", tags->names[t]);
+            write_section(out, o, s, t, tags->names[t]);
+        }
+    }
+}
+
+/* Written aside and renamed into place, so readers and a concurrent
+ * rebuild by another process never see a half-written file. */
+static int render(const struct md_out *o, const struct shard *v, size_t n, size_t i, const struct tagset *tags, struct stat *done){
+    const struct shard *s = &v[i];
+    char *tmp = NULL;
+    FILE *out = NULL;
+    int fd = -1;
+    if(asprintf(&tmp, "%s" SELFW_TEMP, s->out) < 0) return -1;
+    if((fd = mkstemp(tmp)) < 0){ free(tmp); return -1; }
+    struct stat st;
+    fchmod(fd, stat(s->out,&st) == 0 ? (st.st_mode & 07777) : 0644);
+    if(!(out = fdopen(fd,"w"))){ close(fd); unlink(tmp); free(tmp); return -1; }
+    write_shard(out, o, v, n, i, tags);
+    struct stat wrote;
+    if(o->self && fflush(out) == 0 && fstat(fd, &wrote) == 0) selfw_note(o->self, s->out, &wrote);
+    int rc = fclose(out) == 0 && rename(tmp, s->out) == 0 ? 0 : -1;
+    if(rc != 0) unlink(tmp);
+    else if(stat(s->out, done) != 0) memset(done, 0, sizeof *done);
+    free(tmp);
+    return rc;
+}
+
+static struct rendered *load_rendered(const char *path, size_t *n){
+    *n = 0;
+    FILE *f = fopen(path, "r");
+    if(!f) return NULL;
+    struct rendered *v = NULL;
+    size_t cap = 0;
+    char *line = NULL; size_t lcap = 0; ssize_t len;
+    while((len = getline(&line, &lcap, f)) > 0){
+        if(line[len-1] == '\n') line[--len] = 0;
+        unsigned long long fp; long size, mtime; int off = 0;
+        if(sscanf(line, "%llx\t%ld\t%ld\t%n", &fp, &size, &mtime, &off) != 3 || !off || !line[off]) continue;
+        if(*n == cap){
+            cap = cap ? cap * 2 : 16;
+            struct rendered *nv = realloc(v, cap * sizeof *nv);
+            if(!nv) break;
+            v = nv;
+        }
+        v[*n] = (struct rendered){ strdup(line + off), fp, size, mtime };
+        if(v[*n].out) (*n)++;
+    }
+    free(line);
+    fclose(f);
+    return v;
+}
+
+static struct rendered *find_rendered(struct rendered *v, size_t n, const char *out){
+    for(size_t i=0; i<n; i++) if(v[i].out && strcmp(v[i].out, out) == 0) return &v[i];
+    return NULL;
+}
+
+/* The file on disk is still the one we rendered. */
+static int untouched(const struct rendered *r){
+    struct stat st;
+    return stat(r->out, &st) == 0 && (long)st.st_size == r->size && (long)st.st_mtime == r->mtime;
+}
+
+/* Below this repo: a render state copied along with the tree still names
+ * the original's files. */
+static int ours(const struct md_out *o, const char *out){
+    size_t n = strlen(o->root);
+    return strncmp(out, o->root, n) == 0 && out[n] == '/';
+}
+
+/* The output files of the layout with the live entries of map bucketed
+ * into them by tag, in map order. */
+static struct shard *collect(const struct md_out *o, struct idmap *map, const struct tagset *tags, size_t *nout){
+    size_t ntags = tags->n, n = 0;
+    struct shard *v = NULL;
+    if(!add_shard(&v, &n, ntags, join(o->root, MD_NAME), strdup(MD_NAME))) return NULL;
+    for(size_t i=0; o->mode == OUTPUT_DIRS && i<o->ndirs; i++){
+        char *label = join(rel_to(o->dirs[i], o->root), MD_NAME);
+        struct shard *s = add_shard(&v, &n, ntags, join(o->dirs[i], MD_NAME), label);
+        if(!s) continue;
+        if(!(s->dir = strdup(o->dirs[i]))){ free_shards(v, n, ntags); return NULL; }
+        s->dlen = strlen(s->dir);
+        struct stat st;
+        s->keep = stat(s->dir, &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    if(o->mode == OUTPUT_TAGS){
+        char *dir = join(o->root, TAGS_DIR);
+        for(size_t t=0; dir && t<ntags; t++){
+            char *out = NULL, *label = NULL;
+            if(asprintf(&out, "%s/%s.md", dir, tags->names[t]) < 0) out = NULL;
+            if(asprintf(&label, TAGS_DIR "/%s.md", tags->names[t]) < 0) label = NULL;
+            struct shard *s = add_shard(&v, &n, ntags, out, label);
+            if(s) s->keep = 1;
+        }
+        free(dir);
+        if(n != ntags + 1){ free_shards(v, n, ntags); return NULL; }
+    }
+
+    // One pass over the live keys, bucketing entries by shard and tag in
+    // map order.
+    size_t last = 0;
+    const char *lastp = NULL; size_t lastl = 0;
+    for(size_t k=0; k<map->n; k++){
+        const struct idmap_ent *me = map->order[k];
+        if(!me->live) continue;
 
         // key format: path::tag::content
-        char *p1 = strstr(key,"::"); if(!p1) continue; *p1 = 0; char *path = key;
-        char *p2 = strstr(p1+2,"::"); if(!p2) continue; *p2 = 0; char *ktag = p1+2;
-
-        if(strcmp(ktag, tag) != 0) continue;
-
-        FILE *ff = fopen(path,"r");
-        if(!ff) continue;
-
-        char *fl = NULL; size_t fcap = 0; long cur = 0; int found = 0;
-        char display[4096] = {0};
-        while(getline(&fl,&fcap,ff) > 0){
-            cur++;
-            if(strstr(fl, id)){
-                char *pos = (char*)strcasestr(fl, tag);
-                if(pos){
-                    pos = strchr(pos, ':');
-                    if(pos){
-                        pos++;
-                        while(*pos && isspace((unsigned char)*pos)) pos++;
-                    }
-                    // Strip trailing [CT-...] if present
-                    char *lb = strrchr(pos,'[');
-                    if(lb && strncmp(lb,"[CT-",4) == 0){
-                        char *q = lb;
-                        while(q > pos && isspace((unsigned char)*(q-1))) q--;
-                        *q = 0;
-                    }
-                    // Trim newline and CR
-                    size_t L = strlen(pos);
-                    while(L > 0 && (pos[L-1] == '\n' || pos[L-1] == '\r')){
-                        pos[--L] = 0;
-                    }
-                    strncpy(display,pos,sizeof display - 1);
-                }
-                const char *out_path = path;
-                if(cwd[0] && strncmp(path,cwd,strlen(cwd)) == 0){
-                    const char *rp = path + strlen(cwd);
-                    if(*rp == '/') rp++;
-                    out_path = rp;
+        const char *ktag = me->key + me->plen;
+        if(strncmp(ktag,"::",2) != 0) continue;
+        ktag += 2;
+        const char *kend = strstr(ktag,"::");
+        if(!kend) continue;
+        char tagbuf[128];
+        if((size_t)(kend - ktag) >= sizeof tagbuf) continue;
+        memcpy(tagbuf, ktag, (size_t)(kend - ktag));
+        tagbuf[kend - ktag] = 0;
+
+        int t = tagset_index(tags, tagbuf);
+        if(t < 0) continue;
+        // Keys of one file are mostly adjacent; reuse its shard.
+        if(o->mode == OUTPUT_TAGS || !lastp || lastl != me->plen || memcmp(lastp, me->key, lastl) != 0)
+            last = shard_for(o, &v, &n, ntags, me->key, me->plen, t);
+        lastp = me->key; lastl = me->plen;
+        struct shard *s = &v[last];
+        struct entry *e = malloc(sizeof *e);
+        if(!e) continue;
+        *e = (struct entry){ me->key, me->plen, me->id, NULL };
+        if(s->tail[t]) s->tail[t]->next = e; else s->head[t] = e;
+        s->tail[t] = e;
+        s->count[t]++;
+        s->total++;
+    }
+    *nout = n;
+    return v;
+}
+
+int md_rebuild(const struct md_out *o, struct idmap *map, const struct tagset *tags, struct cache *fc){
+    idmap_sync(map);
+    size_t ntags = tags->n, n = 0;
+    struct shard *v = collect(o, map, tags, &n);
+    if(!v) return -1;
+    if(o->mode == OUTPUT_TAGS){
+        char *dir = join(o->root, TAGS_DIR);
+        if(dir && mkdir(dir, 0777) != 0 && errno != EEXIST){ /* render reports it */ }
+        free(dir);
+    }
+
+    // Fingerprint each file's entries together with the version of every
+    // source file they point into, as of its last parse.
+    char path[PATH_MAX];
+    for(size_t i=0; i<n; i++){
+        uint64_t h = 1469598103934665603ULL;
+        h = mix(h, &o->mode, sizeof o->mode);
+        for(size_t t=0; t<ntags; t++){
+            h = mix(h, tags->names[t], strlen(tags->names[t]) + 1);
+            for(const struct entry *e=v[i].head[t]; e; e=e->next){
+                long st[2] = {0, 0};
+                h = mix(h, e->id, strlen(e->id) + 1);
+                h = mix(h, e->path, e->plen + 1);
+                if(fc && e->plen < sizeof path){
+                    memcpy(path, e->path, e->plen);
+                    path[e->plen] = 0;
+                    cache_get(fc, path, &st[0], &st[1]);
                 }
-                fprintf(out, "- [%s] %s:%ld — %s\n", id, out_path, cur, display);
-                wrote_any = 1;
-                found = 1;
-                break;
+                h = mix(h, st, sizeof st);
             }
         }
-        free(fl);
-        fclose(ff);
-        if(!found) continue;
+        if(i == 0 && o->mode != OUTPUT_SINGLE)
+            for(size_t j=1; j<n; j++){
+                h = mix(h, v[j].label, strlen(v[j].label) + 1);
+                h = mix(h, v[j].count, ntags * sizeof *v[j].count);
+                h = mix(h, &v[j].keep, sizeof v[j].keep);
+            }
+        v[i].fp = h;
+    }
+
+    size_t nold = 0;
+    struct rendered *old = fc ? load_rendered(o->state, &nold) : NULL;
+    struct rendered *now = calloc(n ? n : 1, sizeof *now);
+    size_t nnow = 0;
+    int rc = 0;
+    for(size_t i=0; now && i<n; i++){
+        if(i > 0 && !v[i].total && !v[i].keep) continue;
+        struct rendered *r = find_rendered(old, nold, v[i].out);
+        if(r && r->fp == v[i].fp && untouched(r)){
+            now[nnow++] = (struct rendered){ r->out, r->fp, r->size, r->mtime };
+            r->out = NULL;
+            continue;
+        }
+        struct stat st;
+        if(render(o, v, n, i, tags, &st) != 0){ rc = -1; continue; }
+        now[nnow++] = (struct rendered){ strdup(v[i].out), v[i].fp, (long)st.st_size, (long)st.st_mtime };
+    }
+    // Shards that lost their last entry (or a changed layout) leave files
+    // behind; remove the ones nobody touched since we wrote them.
+    for(size_t i=0; i<nold; i++){
+        if(old[i].out && !find_rendered(now, nnow, old[i].out) && ours(o, old[i].out) && untouched(&old[i])) unlink(old[i].out);
+        free(old[i].out);
+    }
+    free(old);
+    if(o->mode != OUTPUT_TAGS){
+        char *dir = join(o->root, TAGS_DIR);
+        if(dir) rmdir(dir);     // only goes if we emptied it
+        free(dir);
     }
-    free(line);
-    if(!wrote_any) fprintf(out, "_No entries yet._\n");
-    fprintf(out,"\n");
-}
 
-int md_rebuild(const char *mdpath, struct idmap *map){
-    FILE *mf = fopen(map->map_path, "r");
-    if(!mf) return -1;
-    FILE *out = fopen(mdpath,"w");
-    if(!out){
-        fclose(mf);
-        return -1;
+    char *tmp = NULL;
+    int fd = -1;
+    FILE *f = NULL;
+    if(now && asprintf(&tmp, "%s.XXXXXX", o->state) >= 0 && (fd = mkstemp(tmp)) >= 0 && !(f = fdopen(fd, "w"))) close(fd);
+    for(size_t i=0; i<nnow; i++){
+        if(f && now[i].out) fprintf(f, "%016llx\t%ld\t%ld\t%s\n", (unsigned long long)now[i].fp, now[i].size, now[i].mtime, now[i].out);
+        free(now[i].out);
     }
-    fprintf(out,"# Codetags\n\n");
-    for(size_t i=0; i<sizeof(SECS)/sizeof(SECS[0]); i++){
-        fprintf(out,"## %s\n\n", SECS[i]);
-        write_section(out, SECS[i], mf);
+    free(now);
+    if(f && (fclose(f) != 0 || rename(tmp, o->state) != 0)) unlink(tmp);
+    else if(!f && fd >= 0) unlink(tmp);
+    free(tmp);
+    free_shards(v, n, ntags);
+    return rc;
+}
+
+/* Whether the file at path holds exactly the n bytes at want. */
+static bool same_content(const char *path, const char *want, size_t n){
+    FILE *f = fopen(path, "r");
+    if(!f) return false;
+    char buf[65536];
+    size_t off = 0, got;
+    bool same = true;
+    while(same && (got = fread(buf, 1, sizeof buf, f)) > 0){
+        same = off + got <= n && memcmp(buf, want + off, got) == 0;
+        off += got;
     }
-    fclose(out);
-    fclose(mf);
-    return 0;
+    fclose(f);
+    return same && off == n;
 }
 
+int md_check(const struct md_out *o, struct idmap *map, const struct tagset *tags, md_stale_fn fn, void *ud){
+    size_t ntags = tags->n, n = 0;
+    struct shard *v = collect(o, map, tags, &n);
+    if(!v) return -1;
+    int stale = 0;
+    for(size_t i=0; i<n; i++){
+        if(i > 0 && !v[i].total && !v[i].keep) continue;
+        char *buf = NULL;
+        size_t len = 0;
+        FILE *out = open_memstream(&buf, &len);
+        if(!out){ stale = -1; break; }
+        write_shard(out, o, v, n, i, tags);
+        if(fclose(out) != 0){ free(buf); stale = -1; break; }
+        if(!same_content(v[i].out, buf, len)){
+            stale++;
+            if(fn) fn(ud, v[i].label);
+        }
+        free(buf);
+    }
+    free_shards(v, n, ntags);
+    return stale;
+}
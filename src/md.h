@@ -1,9 +1,48 @@
 #ifndef MD_H
 #define MD_H
 #include "idmap.h"
+#include "tags.h"
+#include "cache.h"
+#include "config.h"
+#include "selfwrite.h"
 
-int md_initialize(const char *mdpath);
-int md_rebuild(const char *mdpath, struct idmap *map);
+#define MD_TEXT_MAX 4096
 
-#endif
+/* Where an entry's ID is in path without reading the file: 1 with its
+ * line and text, 0 if it is not there, -1 to read the file after all. */
+typedef int (*md_locate_fn)(void *ud, const char *path, const char *id, const char *tag, long *line,
+                            char display[MD_TEXT_MAX]);
+typedef void (*md_stale_fn)(void *ud, const char *label);
+
+/* Where a repo's codetags files go (config "output" and "shard_dirs"),
+ * with absolute paths so rendering does not depend on the cwd. */
+struct md_out {
+    int mode;                   // OUTPUT_*
+    char *root;                 // repo root; the index/single file is root/codetags.md
+    char **dirs;                // OUTPUT_DIRS shard roots; none = top-level directories
+    size_t ndirs;
+    char *state;                // what the last render wrote, to skip unchanged shards
+    struct selfwrites *self;    // rendered files are noted here, if set
+    md_locate_fn locate;        // entry lookups, if set
+    void *locate_ud;
+};
+
+/* Whether path is one of the files o renders. */
+bool md_is_output(const struct md_out *o, const char *path);
 
+int md_initialize(const char *mdpath, const struct tagset *tags);
+int md_out_init(struct md_out *o, const struct config *cfg, const char *root, const char *state);
+void md_out_free(struct md_out *o);
+/* Re-render the files whose entries changed since the last render. The
+ * entries' files are fingerprinted through fc, the size and mtime they were
+ * last parsed at; without fc every file is rendered. */
+int md_rebuild(const struct md_out *o, struct idmap *map, const struct tagset *tags, struct cache *fc);
+/* Render every output file in memory and compare it with the one on disk,
+ * writing nothing. Calls fn with the label of each file that differs and
+ * returns their number, or -1 on error. */
+int md_check(const struct md_out *o, struct idmap *map, const struct tagset *tags, md_stale_fn fn, void *ud);
+/* The text an entry shows for the source line holding its ID; line is
+ * cut short in the process. */
+void md_entry_text(char *line, const char *tag, char display[MD_TEXT_MAX]);
+
+#endif
@@ -1,175 +1,463 @@
 #define _GNU_SOURCE
 #include "parse.h"
+#include "lex.h"
+#include "sniff.h"
+#include "ingest.h"
+#include "arena.h"
+#include "canon.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 //NOTE: hello world [CT-1-76a9538c]
-//TODO: Add more tags [CT-2-89272b86]
-static const char *TAGS[] = {"NOTE","TODO","WARNING","WARN","FIXME","FIX","BUG"};
-//TODO: Add more programming langs to mamke it more comprehensive. [CT-3-140e99a2]
-static const char *PFX[]  = {"#","//",";","--","%"};
-
-static int extract_id_token(const char *line, char out[64]){
-    const char *lb = strrchr(line, '[');
-    const char *rb = lb ? strchr(lb, ']') : NULL;
-    if (!lb || !rb || rb < lb) return 0;
-    if (strncmp(lb, "[CT-", 4) != 0) return 0;
-    for (const char *p = rb+1; *p; ++p) if (!isspace((unsigned char)*p)) return 0;
-    size_t m = (size_t)(rb - (lb+1));
+
+#define PARSE_WINDOW (64*1024)
+#define PARSE_MAX_LINE (1024*1024)
+/* Batched files larger than this are streamed rather than read whole. */
+#define PARSE_BUFFER_MAX (8*1024*1024)
+
+/* First tagged comment body found on a line by the lexer. */
+struct tag_hit {
+    const struct tagset *tags;
+    int found;
+    int tag;            // index into tags->names
+    size_t content;     // offset of the text after "TAG:"
+    size_t end;         // end of the comment body (ID is inserted here)
+};
+
+static int match_tag(const char *line, size_t start, size_t end, void *ud){
+    struct tag_hit *h = ud;
+    size_t tl;
+    int t = tagset_match(h->tags, line + start, end - start, &tl);
+    if (t < 0) return 0;
+    size_t c = start + tl + 1;
+    while(c < end && isspace((unsigned char)line[c])) c++;
+    h->tag = t;
+    h->content = c;
+    h->end = end;
+    h->found = 1;
+    return 1;
+}
+
+/* "[CT-...]" closing the comment body [b,e), if any. *at is set to where the
+ * token starts with the preceding whitespace removed. */
+static int extract_id_token(const char *line, size_t b, size_t e, char out[64], size_t *at){
+    if (e <= b || line[e-1] != ']') return 0;
+    size_t lb = e-1;
+    while (lb > b && line[lb] != '[') lb--;
+    if (line[lb] != '[' || e - lb < 5 || strncmp(line+lb, "[CT-", 4) != 0) return 0;
+    size_t m = e - 1 - (lb + 1);
     if (m >= 63) m = 63;
-    memcpy(out, lb+1, m);
+    memcpy(out, line+lb+1, m);
     out[m] = 0;
+    while (lb > b && isspace((unsigned char)line[lb-1])) lb--;
+    *at = lb;
     return 1;
 }
 
-static int starts_with_prefix_and_tag(const char *line, char *tag_out, size_t tag_out_sz, char **content_out){
-    const char *s=line;
-    while(isspace((unsigned char)*s)) s++;
-    for(size_t i=0;i<sizeof(PFX)/sizeof(PFX[0]);i++){
-        size_t l=strlen(PFX[i]);
-        if(strncmp(s,PFX[i],l)==0){
-            s+=l;
-            while(isspace((unsigned char)*s)) s++;
-            for(size_t t=0;t<sizeof(TAGS)/sizeof(TAGS[0]);t++){
-                size_t tl=strlen(TAGS[t]);
-                if(strncasecmp(s,TAGS[t],tl)==0 && s[tl]==':'){
-                    strncpy(tag_out,TAGS[t],tag_out_sz-1);
-                    tag_out[tag_out_sz-1]=0;
-                    s += tl+1;
-                    while(isspace((unsigned char)*s)) s++;
-                    *content_out=(char*)s;
-                    return 1;
-                }
+/* Transient allocations of the file being parsed, dropped all at once when
+ * the next file starts. One per thread, as daemon workers parse in parallel. */
+static _Thread_local struct arena scratch;
+
+/* Scan state of one file. Only the window and the pending ID insertions are
+ * held in memory, so peak usage does not depend on the file size. Both live
+ * in the scratch arena. */
+struct scan {
+    const struct tagset *tags;
+    struct idmap *map;
+    const char *ppath;
+    struct lexer lx;
+    struct lex_state ls;
+    int sniff;          // classify the first block before scanning
+    struct selfwrites *self;
+    struct edit { off_t at; char id[64]; } *edits;
+    size_t nedits, cap;
+    parse_hit_fn hit;   // set: report tags here and leave the map alone
+    void *ud;
+    long lineno;        // of the line being scanned, scan_buffer only
+};
+
+static void scan_line(struct scan *sc, const char *line, size_t len, off_t off){
+    struct tag_hit hit = { .tags = sc->tags };
+    lex_line(&sc->lx, &sc->ls, line, len, match_tag, &hit);
+    if (!hit.found) return;
+
+    // Check if the comment already carries an ID token (legacy or current)
+    char idbuf[64] = {0};
+    size_t cend = hit.end;
+    int has_existing_id = extract_id_token(line, hit.content, hit.end, idbuf, &cend);
+
+    int clen = cend > hit.content ? (int)(cend - hit.content) : 0;
+    if (sc->hit) {
+        sc->hit(sc->ud, &(struct parse_hit){ hit.tag, line + hit.content, (size_t)clen,
+                                             has_existing_id ? idbuf : NULL, sc->lineno });
+        return;
+    }
+    char keybuf[PATH_MAX + 256];
+    snprintf(keybuf, sizeof keybuf, "%s::%s::%.*s", sc->ppath, sc->tags->names[hit.tag], clen, line + hit.content);
+
+    if (has_existing_id) {
+        if (idmap_ensure_mapping(sc->map, keybuf, idbuf) != 0) {
+            // If ensure failed, proceed without changing the line
+        }
+    } else if (idmap_get_or_assign(sc->map, keybuf, idbuf) == 0) {
+        // Insert at the end of the comment body so block closers and any
+        // code after a trailing comment stay where they were.
+        if (sc->nedits == sc->cap) {
+            size_t cap = sc->cap ? sc->cap*2 : 16;
+            struct edit *ne = arena_grow(&scratch, sc->edits, sc->cap * sizeof *ne, cap * sizeof *ne);
+            if (!ne) return;
+            sc->edits = ne;
+            sc->cap = cap;
+        }
+        sc->edits[sc->nedits].at = off + (off_t)hit.end;
+        memcpy(sc->edits[sc->nedits].id, idbuf, sizeof idbuf);
+        sc->nedits++;
+    }
+}
+
+/* Feed every line of f to scan_line, one window at a time. A line longer
+ * than PARSE_MAX_LINE is skipped rather than buffered. Returns 1 without
+ * scanning if sniffing finds the first block to be binary. */
+static int scan_stream(struct scan *sc, FILE *f){
+    size_t cap = PARSE_WINDOW, have = 0;
+    char *buf = arena_alloc(&scratch, cap);
+    if (!buf) return -1;
+    off_t base = 0;
+    int eof = 0, skipping = 0;
+    for (;;) {
+        if (!eof) {
+            size_t n = fread(buf + have, 1, cap - have, f);
+            if (n == 0) eof = 1;
+            have += n;
+        }
+        if (sc->sniff) {
+            if (!eof && have < SNIFF_BLOCK && have < cap) continue;
+            size_t sn = have < SNIFF_BLOCK ? have : SNIFF_BLOCK;
+            sc->sniff = 0;
+            if (sniff_content((const unsigned char*)buf, sn, !(eof && sn == have)) == SNIFF_BINARY) return 1;
+        }
+        size_t pos = 0;
+        if (skipping) {
+            char *nl = memchr(buf, '\n', have);
+            pos = nl ? (size_t)(nl - buf) + 1 : have;
+            if (nl) skipping = 0;
+        }
+        while (!skipping && pos < have) {
+            char *nl = memchr(buf + pos, '\n', have - pos);
+            size_t len;
+            if (nl) len = (size_t)(nl - (buf + pos)) + 1;
+            else if (eof) len = have - pos;
+            else break;
+            scan_line(sc, buf + pos, len, base + (off_t)pos);
+            pos += len;
+        }
+        memmove(buf, buf + pos, have - pos);
+        base += (off_t)pos;
+        have -= pos;
+        if (eof && have == 0) break;
+        if (have == cap) {
+            if (cap < PARSE_MAX_LINE) {
+                char *nb = arena_grow(&scratch, buf, cap, cap * 2);
+                if (!nb) return -1;
+                buf = nb; cap *= 2;
+            } else {
+                base += (off_t)have; have = 0; skipping = 1;
+                sc->ls.mode = LEX_CODE;
             }
         }
     }
+    return ferror(f) ? -1 : 0;
+}
+
+/* scan_stream over a file already in memory. */
+static int scan_buffer(struct scan *sc, const char *buf, size_t n){
+    if (sc->sniff) {
+        sc->sniff = 0;
+        if (sniff_content((const unsigned char*)buf, n < SNIFF_BLOCK ? n : SNIFF_BLOCK, n > SNIFF_BLOCK) == SNIFF_BINARY) return 1;
+    }
+    for (size_t pos = 0; pos < n; ) {
+        const char *nl = memchr(buf + pos, '\n', n - pos);
+        size_t len = nl ? (size_t)(nl - (buf + pos)) + 1 : n - pos;
+        sc->lineno++;
+        if (len > PARSE_MAX_LINE) sc->ls.mode = LEX_CODE;
+        else scan_line(sc, buf + pos, len, (off_t)pos);
+        pos += len;
+    }
     return 0;
 }
 
+/* Copy the finished temp file back over path itself: keeps its owner and
+ * any other hard links, which a rename would not. */
+static int copy_back(const char *path, FILE *out, struct selfwrites *self){
+    int fd = open(path, O_WRONLY | O_TRUNC | O_CLOEXEC);
+    if (fd < 0) return -1;
+    char *buf = arena_alloc(&scratch, PARSE_WINDOW);
+    int rc = buf && fflush(out) == 0 && fseeko(out, 0, SEEK_SET) == 0 ? 0 : -1;
+    size_t n;
+    while (rc == 0 && (n = fread(buf, 1, PARSE_WINDOW, out)) > 0)
+        for (size_t w = 0; rc == 0 && w < n; ) {
+            ssize_t k = write(fd, buf + w, n - w);
+            if (k < 0) rc = -1;
+            else w += (size_t)k;
+        }
+    if (ferror(out)) rc = -1;
+    struct stat done;
+    if (rc == 0 && self && fstat(fd, &done) == 0) selfw_note(self, path, &done);
+    if (close(fd) != 0) rc = -1;
+    return rc;
+}
 
+/* Stream `in` into a sibling temp file with the ID insertions applied, then
+ * rename it over `path`. Bails out if the file changed since `st`. The
+ * result is noted in self before the rename makes it visible. A file with
+ * other links, or whose owner we cannot give the temp file, is rewritten
+ * in place instead. */
+static int rewrite_stream(const char *path, FILE *in, const struct stat *st, const struct edit *ed, size_t ned,
+                          struct selfwrites *self){
+    char *tmp = arena_printf(&scratch, "%s" SELFW_TEMP, path);
+    if (!tmp) return -1;
+    int fd = mkstemp(tmp);
+    if (fd < 0) return -1;
+    FILE *out = fdopen(fd, "w+");
+    if (!out) { close(fd); unlink(tmp); return -1; }
 
-int parse_file_inplace(const char *path, struct idmap *map, struct cache *fc){
-    int may_skip = cache_is_fresh(fc, path);
-    if (may_skip) {
-        FILE *tf = fopen(path, "r");
-        if (tf) {
-            int has_ct = 0;
-            char *l = NULL; size_t cap = 0;
-            while (getline(&l, &cap, tf) > 0) {
-                if (strstr(l, "[CT-")) { has_ct = 1; break; }
-            }
-            free(l);
-            fclose(tf);
-            if (!has_ct) {
-                may_skip = 0; 
-            }
-        } else {
-            may_skip = 0; 
-
+    char *buf = arena_alloc(&scratch, PARSE_WINDOW);
+    int rc = buf ? 0 : -1;
+    off_t pos = 0;
+    rewind(in);
+    for (size_t i = 0; rc == 0 && i <= ned; i++) {
+        off_t stop = i < ned ? ed[i].at : (off_t)-1;
+        while (stop < 0 || pos < stop) {
+            size_t want = PARSE_WINDOW;
+            if (stop >= 0 && (off_t)want > stop - pos) want = (size_t)(stop - pos);
+            size_t n = fread(buf, 1, want, in);
+            if (n == 0) { if (stop >= 0 || ferror(in)) rc = -1; break; }
+            if (fwrite(buf, 1, n, out) != n) { rc = -1; break; }
+            pos += (off_t)n;
         }
+        if (rc == 0 && i < ned) fprintf(out, " [%s]", ed[i].id);
+    }
+
+    struct stat now;
+    if (rc == 0 && (stat(path, &now) != 0 || now.st_ino != st->st_ino ||
+                    now.st_size != st->st_size || now.st_mtime != st->st_mtime)) rc = -1;
+    int inplace = rc == 0 && (st->st_nlink > 1 || fchown(fileno(out), st->st_uid, st->st_gid) != 0);
+    if (inplace) {
+        rc = copy_back(path, out, self);
+        fclose(out);
+        unlink(tmp);
+        return rc;
+    }
+    if (rc == 0) fchmod(fileno(out), st->st_mode & 07777);
+    if (fflush(out) != 0) rc = -1;
+    struct stat done;
+    if (rc == 0 && self && fstat(fileno(out), &done) == 0) selfw_note(self, path, &done);
+    if (fclose(out) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) unlink(tmp);
+    return rc;
+}
+
+/* Tombstone the keys of this file that the scan no longer produced (edited
+ * or removed tags, or the file turned out binary) and write new IDs back.
+ * Returns 1 if the file was rewritten. */
+static int finish_scan(struct scan *sc, int rc, FILE *in, const struct stat *st){
+    int changed = 0;
+    if (rc >= 0) idmap_end_file(sc->map, sc->ppath);
+    if (rc == 0 && sc->nedits > 0 && in)
+        changed = rewrite_stream(sc->ppath, in, st, sc->edits, sc->nedits, sc->self) == 0;
+    return changed;
+}
+
+int parse_file_inplace(const char *path, const struct parse_opts *po, struct idmap *map, struct cache *fc){
+    int kind = sniff_path(po->sniff, path);
+    if (kind == SNIFF_BINARY) return 0;
+    if (kind == SNIFF_UNKNOWN) {
+        int cls = cache_class(fc, path);
+        if (cls == CACHE_BINARY) return 0;
+        if (cls == CACHE_TEXT) kind = SNIFF_TEXT;
     }
-    if (may_skip) return 0;
+    if (!po->force && cache_is_fresh(fc, path)) return 0;
 
     char apath[PATH_MAX];
     const char *opath = path;
-    if (realpath(path, apath)) opath = apath;
+    if (canon_path(path, apath) == 0) opath = apath;
 
     FILE *f = fopen(opath, "r");
     if (!f) return 0;
-
-    char **lines = NULL; size_t nlines = 0, cap = 0;
-    char *line = NULL; size_t capln = 0;
-    while (getline(&line, &capln, f) > 0) {
-        if (nlines == cap) {
-            cap = cap ? cap*2 : 256;
-            lines = realloc(lines, cap * sizeof *lines);
-        }
-        lines[nlines++] = strdup(line);
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || (po->max_size > 0 && st.st_size > po->max_size)) {
+        fclose(f);
+        return 0;
     }
-    free(line);
+    if (po->nread) *po->nread += (size_t)st.st_size;
+
+    arena_reset(&scratch);
+    struct scan sc = { .tags = po->tags, .map = map, .ppath = opath, .sniff = kind == SNIFF_UNKNOWN,
+                       .self = po->self };
+    lex_init(&sc.lx, lex_syntax_for(opath));
+
+    idmap_begin_file(map);
+    int rc = scan_stream(&sc, f);
+    int changed = finish_scan(&sc, rc, f, &st);
     fclose(f);
 
-    int changed = 0;
-    for (size_t i = 0; i < nlines; i++) {
-        char tag[16] = {0}; char *content = NULL;
-        if (!starts_with_prefix_and_tag(lines[i], tag, sizeof tag, &content)) continue;
-
-        // Check if line already has an ID token (legacy or current)
-        char idbuf[64] = {0};
-        int has_existing_id = extract_id_token(lines[i], idbuf);
-
-        char canon_path[PATH_MAX];
-        const char *ppath = opath;
-        if (realpath(opath, canon_path)) ppath = canon_path;
-
-        char *clean = strdup(content);
-        if (!clean) continue;
-        {
-            char *lb = strrchr(clean, '[');
-            if (lb && strncmp(lb, "[CT-", 4) == 0) {
-                while (lb > clean && isspace((unsigned char)*(lb-1))) lb--;
-                *lb = 0;
-            }
-            size_t lc = strlen(clean);
-            while (lc > 0 && isspace((unsigned char)clean[lc-1])) clean[--lc] = 0;
-        }
+    if (rc == 1) cache_set_class(fc, opath, CACHE_BINARY);
+    else cache_update(fc, opath);
+    return changed;
+}
 
-        char keybuf[PATH_MAX + 256];
-        snprintf(keybuf, sizeof keybuf, "%s::%s::%s", ppath, tag, clean);
+/* Batch state of parse_files. */
+struct batch {
+    const struct parse_opts *po;
+    struct idmap *map;
+    struct cache *fc;
+    char **apath;           // realpath of each file, NULL if unresolved
+    signed char *kind;      // sniff_path verdict, -1 once handled
+    size_t *defer;          // left to parse_file_inplace
+    size_t ndefer;
+    int changed;
+};
 
-        if (has_existing_id) {
-            if (idmap_ensure_mapping(map, keybuf, idbuf) != 0) {
-                // If ensure failed, proceed without changing the line
-            }
-        } else {
-            if (idmap_get_or_assign(map, keybuf, idbuf) == 0) {
-                char *newline = NULL;
-                char *orig = strdup(lines[i]);
-                if (orig) {
-                    char *lb2 = strrchr(orig, '[');
-                    if (lb2 && strncmp(lb2, "[CT-", 4) == 0) {
-                        while (lb2 > orig && isspace((unsigned char)*(lb2-1))) lb2--;
-                        *lb2 = 0;
-                    }
-                    size_t leno = strlen(orig);
-                    while (leno > 0 && isspace((unsigned char)orig[leno-1])) orig[--leno] = 0;
-
-                    if (asprintf(&newline, "%s [%s]\n", orig, idbuf) >= 0) {
-                        if (strcmp(lines[i], newline) != 0) {
-                            free(lines[i]); lines[i] = newline; changed = 1;
-                        } else {
-                            free(newline);
-                        }
-                    }
-                    free(orig);
-                }
-            }
-        }
+static void batch_defer(struct batch *b, size_t i){
+    b->defer[b->ndefer++] = i;
+    b->kind[i] = -1;
+}
 
-        free(clean);
-    }
+static int batch_want(void *ud, size_t i, const struct statx *stx){
+    struct batch *b = ud;
+    unsigned flags = cache_lookup(b->fc, b->apath[i], (long)stx->stx_size, (long)stx->stx_mtime.tv_sec);
+    if (b->kind[i] == SNIFF_UNKNOWN && (flags & CACHE_BINARY)) { b->kind[i] = -1; return 0; }
+    if (flags & CACHE_TEXT) b->kind[i] = SNIFF_TEXT;
+    if ((!b->po->force && (flags & CACHE_PARSED)) ||
+        (b->po->max_size > 0 && (long long)stx->stx_size > b->po->max_size)) { b->kind[i] = -1; return 0; }
+    // Very large files are streamed instead of held whole.
+    if (stx->stx_size > PARSE_BUFFER_MAX) { batch_defer(b, i); return 0; }
+    return 1;
+}
 
-    if (changed) {
-        FILE *o = fopen(opath, "w");
-        if (o) {
-            for (size_t i = 0; i < nlines; i++) {
-                fputs(lines[i], o);
-                free(lines[i]);
-            }
-            fclose(o);
-        } else {
-            for (size_t i = 0; i < nlines; i++) free(lines[i]);
-        }
+static void batch_data(void *ud, size_t i, const char *buf, size_t n, const struct statx *stx){
+    struct batch *b = ud;
+    struct stat st = {0};
+    st.st_ino = (ino_t)stx->stx_ino;
+    st.st_size = (off_t)stx->stx_size;
+    st.st_mtime = (time_t)stx->stx_mtime.tv_sec;
+    st.st_mode = stx->stx_mode;
+    st.st_nlink = (nlink_t)stx->stx_nlink;
+    st.st_uid = (uid_t)stx->stx_uid;
+    st.st_gid = (gid_t)stx->stx_gid;
+
+    const char *opath = b->apath[i];
+    if (b->po->nread) *b->po->nread += n;
+    arena_reset(&scratch);
+    struct scan sc = { .tags = b->po->tags, .map = b->map, .ppath = opath, .sniff = b->kind[i] == SNIFF_UNKNOWN,
+                       .self = b->po->self };
+    lex_init(&sc.lx, lex_syntax_for(opath));
+    b->kind[i] = -1;
+
+    idmap_begin_file(b->map);
+    int rc = scan_buffer(&sc, buf, n);
+    FILE *in = NULL;
+    if (rc == 0 && sc.nedits > 0 && n > 0) in = fmemopen((void *)buf, n, "r");
+    int changed = finish_scan(&sc, rc, in, &st);
+    if (in) fclose(in);
+    b->changed += changed;
+
+    if (rc == 1) {
+        unsigned keep = cache_lookup(b->fc, opath, (long)st.st_size, (long)st.st_mtime) & CACHE_PARSED;
+        cache_store(b->fc, opath, (long)st.st_size, (long)st.st_mtime, keep | CACHE_BINARY);
+    } else if (changed || n != (size_t)st.st_size) {
+        cache_update(b->fc, opath);
     } else {
-        for (size_t i = 0; i < nlines; i++) free(lines[i]);
+        cache_store(b->fc, opath, (long)st.st_size, (long)st.st_mtime, CACHE_PARSED|CACHE_TEXT);
+    }
+}
+
+int parse_files(char *const *paths, size_t n, const struct parse_opts *po, struct idmap *map, struct cache *fc){
+    struct batch b = { .po = po, .map = map, .fc = fc };
+    int changed = 0;
+    if (po->uring && n > 1) {
+        b.apath = calloc(n, sizeof *b.apath);
+        b.kind = malloc(n);
+        b.defer = malloc(n * sizeof *b.defer);
+    }
+    if (!b.apath || !b.kind || !b.defer) {
+        for (size_t i = 0; i < n; i++) changed += parse_file_inplace(paths[i], po, map, fc) > 0;
+        free(b.apath); free(b.kind); free(b.defer);
+        return changed;
     }
-    free(lines);
 
-    cache_update(fc, opath);
+    char real[PATH_MAX];
+    for (size_t i = 0; i < n; i++) {
+        b.kind[i] = (signed char)sniff_path(po->sniff, paths[i]);
+        if (b.kind[i] == SNIFF_BINARY) b.kind[i] = -1;
+        else if (canon_path(paths[i], real) == 0) b.apath[i] = strdup(real);
+        else batch_defer(&b, i);
+    }
+    // Unresolved files get an empty path, which the statx fails on.
+    char **ipaths = malloc(n * sizeof *ipaths);
+    for (size_t i = 0; ipaths && i < n; i++) ipaths[i] = b.apath[i] && b.kind[i] >= 0 ? b.apath[i] : "";
+    if (!ipaths || ingest_files(ipaths, n, &(struct ingest_ops){ batch_want, batch_data }, &b) != 0) {
+        // No io_uring here (or it failed): stream whatever was not handled.
+        for (size_t i = 0; i < n; i++) if (b.kind[i] >= 0) batch_defer(&b, i);
+    }
+    free(ipaths);
+
+    changed = b.changed;
+    for (size_t j = 0; j < b.ndefer; j++) changed += parse_file_inplace(paths[b.defer[j]], po, map, fc) > 0;
+    for (size_t i = 0; i < n; i++) free(b.apath[i]);
+    free(b.apath); free(b.kind); free(b.defer);
     return changed;
 }
 
+int parse_buffer_hits(const char *path, const char *buf, size_t n, const struct parse_opts *po, parse_hit_fn fn, void *ud){
+    int kind = sniff_path(po->sniff, path);
+    if (kind == SNIFF_BINARY) return 1;
+    struct scan sc = { .tags = po->tags, .ppath = path, .sniff = kind == SNIFF_UNKNOWN, .hit = fn, .ud = ud };
+    lex_init(&sc.lx, lex_syntax_for(path));
+    return scan_buffer(&sc, buf, n);
+}
+
+struct keep {
+    struct idmap *map;
+    const char *path;
+    const struct tagset *tags;
+};
+
+static void keep_hit(void *ud, const struct parse_hit *h){
+    struct keep *k = ud;
+    char key[PATH_MAX + 256];
+    snprintf(key, sizeof key, "%s::%s::%.*s", k->path, k->tags->names[h->tag], (int)h->tlen, h->text);
+    const char *id = idmap_lookup(k->map, key);
+    if (id) idmap_ensure_mapping(k->map, key, id);
+}
+
+size_t parse_file_prune(const char *path, const struct parse_opts *po, struct idmap *map){
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (po->max_size > 0 && st.st_size > po->max_size)) {
+        close(fd);
+        return 0;
+    }
+    size_t n = (size_t)st.st_size, got = 0;
+    char *buf = malloc(n ? n : 1);
+    while (buf && got < n) {
+        ssize_t r = read(fd, buf + got, n - got);
+        if (r <= 0) break;
+        got += (size_t)r;
+    }
+    close(fd);
+    if (!buf || got < n) { free(buf); return 0; }
+    struct keep k = { map, path, po->tags };
+    idmap_begin_file(map);
+    int rc = parse_buffer_hits(path, buf, n, po, keep_hit, &k);
+    free(buf);
+    return rc == 0 ? idmap_end_file(map, path) : 0;
+}
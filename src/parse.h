@@ -2,8 +2,43 @@
 #define PARSE_H
 #include "idmap.h"
 #include "cache.h"
+#include "tags.h"
+#include "sniff.h"
+#include "selfwrite.h"
 
-int parse_file_inplace(const char *path, struct idmap *map, struct cache *fc);
+struct parse_opts {
+    const struct tagset *tags;
+    const struct sniffer *sniff;
+    long long max_size;     // larger files are skipped; 0 = no limit
+    int force;              // parse even if the file cache says it is unchanged
+    int uring;              // let parse_files read through io_uring
+    struct selfwrites *self;  // files we write IDs back to are noted here, if set
+    size_t *nread;          // bytes read are added here, if set
+};
+
+/* A tagged comment: index of its tag, its text without the ID, the ID if
+ * it has one, and its line, counting from 1. */
+struct parse_hit {
+    int tag;
+    const char *text;
+    size_t tlen;
+    const char *id;
+    long line;
+};
+typedef void (*parse_hit_fn)(void *ud, const struct parse_hit *h);
+
+int parse_file_inplace(const char *path, const struct parse_opts *po, struct idmap *map, struct cache *fc);
+/* parse_file_inplace over many files, with their reads batched on io_uring
+ * when available. Returns the number of files rewritten. */
+int parse_files(char *const *paths, size_t n, const struct parse_opts *po, struct idmap *map, struct cache *fc);
+/* Report the tagged comments of path, held whole in buf, to fn; nothing
+ * is looked up, assigned or written. Returns 1 if the file is binary, -1
+ * on error. */
+int parse_buffer_hits(const char *path, const char *buf, size_t n, const struct parse_opts *po, parse_hit_fn fn, void *ud);
+/* Tombstone the keys of path whose tag it no longer holds, reading it
+ * only. A file over max_size, binary or unreadable keeps its keys, as a
+ * scan would leave them. Returns the number of keys dropped. */
+size_t parse_file_prune(const char *path, const struct parse_opts *po, struct idmap *map);
 
 #endif
 
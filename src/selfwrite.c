@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include "selfwrite.h"
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+
+#define SELFW_MAX 4096          // entries kept; when full the older half goes
+
+void selfw_init(struct selfwrites *s){
+    memset(s, 0, sizeof *s);
+    pthread_mutex_init(&s->lock, NULL);
+}
+
+void selfw_free(struct selfwrites *s){
+    for (size_t i = 0; i < s->cap; i++) free(s->ents[i].path);
+    free(s->ents);
+    pthread_mutex_destroy(&s->lock);
+    memset(s, 0, sizeof *s);
+}
+
+static size_t slot(const struct selfw_ent *v, size_t cap, const char *path){
+    size_t i = (size_t)fnv1a64(path, strlen(path)) & (cap - 1);
+    while (v[i].path && strcmp(v[i].path, path) != 0) i = (i + 1) & (cap - 1);
+    return i;
+}
+
+/* Rebuild the table at cap with the entries newer than generation after;
+ * dead entries (generation 0) go either way. */
+static int rehash(struct selfwrites *s, size_t cap, unsigned long after){
+    struct selfw_ent *nv = calloc(cap, sizeof *nv);
+    if (!nv) return -1;
+    size_t len = 0;
+    for (size_t i = 0; i < s->cap; i++) {
+        struct selfw_ent *e = &s->ents[i];
+        if (!e->path) continue;
+        if (e->gen <= after) { free(e->path); continue; }
+        nv[slot(nv, cap, e->path)] = *e;
+        len++;
+    }
+    free(s->ents);
+    s->ents = nv;
+    s->cap = cap;
+    s->len = len;
+    return 0;
+}
+
+void selfw_note(struct selfwrites *s, const char *path, const struct stat *st){
+    pthread_mutex_lock(&s->lock);
+    int ok = 0;
+    if (s->len >= SELFW_MAX) ok = rehash(s, s->cap, s->gen - SELFW_MAX / 2) == 0;
+    else if ((s->len + 1) * 2 > s->cap) ok = rehash(s, s->cap ? s->cap * 2 : 64, 0) == 0;
+    else ok = 1;
+    if (ok) {
+        struct selfw_ent *e = &s->ents[slot(s->ents, s->cap, path)];
+        if (!e->path && (e->path = strdup(path))) s->len++;
+        if (e->path) {
+            e->dev = st->st_dev;
+            e->ino = st->st_ino;
+            e->size = st->st_size;
+            e->mtime = st->st_mtim;
+            e->gen = ++s->gen;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+bool selfw_is_echo(struct selfwrites *s, const char *path){
+    struct stat st;
+    if (stat(path, &st) != 0) return false;
+    bool echo = false;
+    pthread_mutex_lock(&s->lock);
+    if (s->cap) {
+        struct selfw_ent *e = &s->ents[slot(s->ents, s->cap, path)];
+        if (e->path && e->gen) {
+            echo = e->dev == st.st_dev && e->ino == st.st_ino && e->size == st.st_size &&
+                   e->mtime.tv_sec == st.st_mtim.tv_sec && e->mtime.tv_nsec == st.st_mtim.tv_nsec;
+            // Changed since: a user edit, and so is every later event.
+            if (!echo) e->gen = 0;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return echo;
+}
+
+bool selfw_is_temp(const char *path){
+    size_t n = strlen(path), k = sizeof SELFW_TEMP - 1;
+    return n > k && path[n-k-1] != '/' && memcmp(path + n - k, SELFW_TEMP, k - 6) == 0 &&
+           !memchr(path + n - 6, '/', 6);
+}
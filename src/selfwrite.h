@@ -0,0 +1,42 @@
+#ifndef SELFWRITE_H
+#define SELFWRITE_H
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* Files the daemon itself wrote inside a watched repo (IDs written back,
+ * rendered output), as it left them, so the inotify events they cause are
+ * not taken for user edits. An event on a recorded path whose file still
+ * has the recorded inode, size and mtime is our own echo. Workers record,
+ * the event loop checks; entries age out by generation. */
+struct selfw_ent {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    unsigned long gen;
+};
+
+struct selfwrites {
+    pthread_mutex_t lock;
+    struct selfw_ent *ents;     // open addressing by path
+    size_t cap, len;
+    unsigned long gen;          // of the latest write
+};
+
+/* Every such write goes through a temp file with this suffix next to its
+ * target, renamed over it. */
+#define SELFW_TEMP ".ctags.XXXXXX"
+
+void selfw_init(struct selfwrites *s);
+void selfw_free(struct selfwrites *s);
+/* Record path as about to be renamed from a temp file with stat st. */
+void selfw_note(struct selfwrites *s, const char *path, const struct stat *st);
+/* Whether path on disk is still what we wrote there. */
+bool selfw_is_echo(struct selfwrites *s, const char *path);
+/* Whether path is named like one of our temp files. */
+bool selfw_is_temp(const char *path);
+
+#endif
@@ -0,0 +1,82 @@
+#define _GNU_SOURCE
+#include "snapshot.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// 2: mtimes in nanoseconds; a change in the same second as the save
+// must still show.
+#define SNAP_MAGIC "#codetags-snapshot 2"
+
+static long long mtime_ns(const struct stat *st){
+    return (long long)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+int snapshot_load(struct snapshot *s, const char *path){
+    memset(s, 0, sizeof *s);
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    char *line = NULL; size_t cap = 0, scap = 0;
+    int ok = getline(&line, &cap, f) > 0 && strncmp(line, SNAP_MAGIC, strlen(SNAP_MAGIC)) == 0;
+    while (ok && getline(&line, &cap, f) > 0) {
+        size_t L = strlen(line);
+        while (L > 0 && (line[L-1] == '\n' || line[L-1] == '\r')) line[--L] = 0;
+        char *tab = strchr(line, '\t');
+        if (!tab) continue;
+        *tab = 0;
+        if (s->n == scap) {
+            scap = scap ? scap*2 : 64;
+            struct snap_dir *nd = realloc(s->dirs, scap * sizeof *nd);
+            if (!nd) { ok = 0; break; }
+            s->dirs = nd;
+        }
+        s->dirs[s->n].mtime = strtoll(line, NULL, 10);
+        s->dirs[s->n].now = -1;
+        s->dirs[s->n].path = strdup(tab+1);
+        s->n++;
+    }
+    free(line);
+    fclose(f);
+    if (!ok || s->n == 0) { snapshot_free(s); return -1; }
+    return 0;
+}
+
+/* Records the current mtime of each directory; written atomically. */
+int snapshot_save(const char *path, char *const *dirs, size_t n){
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s.tmp", path) < 0) return -1;
+    FILE *f = fopen(tmp, "w");
+    if (!f) { free(tmp); return -1; }
+    fprintf(f, "%s\n", SNAP_MAGIC);
+    for (size_t i = 0; i < n; i++) {
+        struct stat st;
+        if (stat(dirs[i], &st) != 0 || !S_ISDIR(st.st_mode)) continue;
+        fprintf(f, "%lld\t%s\n", mtime_ns(&st), dirs[i]);
+    }
+    int rc = fclose(f) == 0 && rename(tmp, path) == 0 ? 0 : -1;
+    if (rc != 0) unlink(tmp);
+    free(tmp);
+    return rc;
+}
+
+static int by_recent(const void *a, const void *b){
+    const struct snap_dir *x = a, *y = b;
+    return (y->now > x->now) - (y->now < x->now);
+}
+
+/* Stat every directory and order them most recently modified first. */
+void snapshot_sort_recent(struct snapshot *s){
+    for (size_t i = 0; i < s->n; i++) {
+        struct stat st;
+        s->dirs[i].now = stat(s->dirs[i].path, &st) == 0 && S_ISDIR(st.st_mode) ? mtime_ns(&st) : -1;
+    }
+    qsort(s->dirs, s->n, sizeof *s->dirs, by_recent);
+}
+
+void snapshot_free(struct snapshot *s){
+    for (size_t i = 0; i < s->n; i++) free(s->dirs[i].path);
+    free(s->dirs);
+    memset(s, 0, sizeof *s);
+}
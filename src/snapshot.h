@@ -0,0 +1,24 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+#include <stddef.h>
+
+/* Directory list of a repo as of the daemon's last clean shutdown. Together
+ * with the persisted file cache and id map it lets the daemon start without
+ * walking the tree. */
+struct snap_dir {
+    char *path;
+    long long mtime;    // nanoseconds, as recorded
+    long long now;      // as found on reconcile, -1 if gone
+};
+
+struct snapshot {
+    struct snap_dir *dirs;
+    size_t n;
+};
+
+int snapshot_load(struct snapshot *s, const char *path);
+int snapshot_save(const char *path, char *const *dirs, size_t n);
+void snapshot_sort_recent(struct snapshot *s);
+void snapshot_free(struct snapshot *s);
+
+#endif
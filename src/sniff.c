@@ -0,0 +1,93 @@
+#define _GNU_SOURCE
+#include "sniff.h"
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+static const char *BINARY_EXTS[] = {
+    "png","jpg","jpeg","gif","bmp","ico","tif","tiff","webp","psd",
+    "pdf","zip","gz","tgz","bz2","xz","zst","7z","rar","tar","iso","dmg",
+    "jar","war","class","exe","dll","so","dylib","o","a","lib","obj",
+    "pyc","pyo","wasm","bin","dat","db","sqlite","sqlite3",
+    "woff","woff2","ttf","otf","eot",
+    "mp3","mp4","m4a","mov","avi","mkv","webm","wav","flac","ogg",
+    "npy","npz","pt","pth","onnx","safetensors","gguf","parquet","whl",
+};
+
+static int add_lower(struct strset *s, const char *ext){
+    char buf[64];
+    size_t n = strlen(ext);
+    if (n == 0 || n >= sizeof buf) return 0;
+    if (ext[0] == '.') { ext++; n--; }
+    for (size_t i = 0; i <= n; i++) buf[i] = (char)tolower((unsigned char)ext[i]);
+    return strset_add(s, buf);
+}
+
+int sniffer_init(struct sniffer *sn, const struct config *cfg){
+    memset(sn, 0, sizeof *sn);
+    for (size_t i = 0; i < sizeof(BINARY_EXTS)/sizeof(BINARY_EXTS[0]); i++)
+        if (add_lower(&sn->binary_ext, BINARY_EXTS[i]) < 0) return -1;
+    for (size_t i = 0; i < cfg->nbinary_ext; i++)
+        if (add_lower(&sn->binary_ext, cfg->binary_ext[i]) < 0) return -1;
+    for (size_t i = 0; i < cfg->ntext_ext; i++)
+        if (add_lower(&sn->text_ext, cfg->text_ext[i]) < 0) return -1;
+    return 0;
+}
+
+void sniffer_free(struct sniffer *sn){
+    strset_free(&sn->text_ext);
+    strset_free(&sn->binary_ext);
+}
+
+int sniff_path(const struct sniffer *sn, const char *path){
+    const char *base = strrchr(path, '/');
+    base = base ? base+1 : path;
+    const char *ext = strrchr(base, '.');
+    if (!ext || ext == base) return SNIFF_UNKNOWN;
+    ext++;
+    char buf[64];
+    size_t n = strlen(ext);
+    if (n >= sizeof buf) return SNIFF_UNKNOWN;
+    for (size_t i = 0; i < n; i++) buf[i] = (char)tolower((unsigned char)ext[i]);
+    if (strset_has(&sn->text_ext, buf, n)) return SNIFF_TEXT;
+    if (strset_has(&sn->binary_ext, buf, n)) return SNIFF_BINARY;
+    return SNIFF_UNKNOWN;
+}
+
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* Length of the pure-ASCII, NUL-free prefix, eight bytes per step: a word
+ * is clean when no byte has its high bit set and no byte is zero. */
+static size_t ascii_prefix(const unsigned char *p, size_t n){
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        memcpy(&w, p + i, 8);
+        if ((w & HIGHS) || ((w - ONES) & ~w & HIGHS)) break;
+    }
+    for (; i < n; i++) if (p[i] == 0 || p[i] >= 0x80) break;
+    return i;
+}
+
+/* Text unless the block holds a NUL byte or more than 1/8 of its bytes
+ * are invalid UTF-8 (a few stray Latin-1 bytes are tolerated). A
+ * multi-byte sequence cut by the end of a partial block is not counted. */
+int sniff_content(const unsigned char *buf, size_t n, int partial){
+    size_t bad = 0, i = 0;
+    while (i < n) {
+        i += ascii_prefix(buf + i, n - i);
+        if (i >= n) break;
+        unsigned char c = buf[i];
+        if (c == 0) return SNIFF_BINARY;
+        size_t need = c >= 0xF0 && c <= 0xF4 ? 3 : c >= 0xE0 ? 2 : c >= 0xC2 && c < 0xE0 ? 1 : 0;
+        if (c >= 0xF5) need = 0;
+        if (!need) { bad++; i++; continue; }
+        if (i + need >= n && partial) break;
+        size_t k = 1;
+        while (k <= need && i + k < n && (buf[i+k] & 0xC0) == 0x80) k++;
+        if (k <= need) bad++;
+        i += k;
+    }
+    return bad * 8 > n ? SNIFF_BINARY : SNIFF_TEXT;
+}
@@ -0,0 +1,23 @@
+#ifndef SNIFF_H
+#define SNIFF_H
+#include <stddef.h>
+#include "hash.h"
+#include "config.h"
+
+#define SNIFF_BLOCK 8192
+
+enum { SNIFF_UNKNOWN=0, SNIFF_TEXT, SNIFF_BINARY };
+
+/* Extension verdicts: text_ext always parses, binary_ext never does,
+ * everything else is decided by sniff_content on the first block. */
+struct sniffer {
+    struct strset text_ext;
+    struct strset binary_ext;
+};
+
+int sniffer_init(struct sniffer *sn, const struct config *cfg);
+void sniffer_free(struct sniffer *sn);
+int sniff_path(const struct sniffer *sn, const char *path);
+int sniff_content(const unsigned char *buf, size_t n, int partial);
+
+#endif
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include "state.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define LOAD(p) __atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELAXED)
+/* A reader gives up on a header that stays mid-update this long (a writer
+ * died inside an update) and falls back to reading the files directly. */
+#define READ_SPINS 10000
+
+static int ofd_lock(int fd, short type){
+    struct flock fl = { .l_type = type, .l_whence = SEEK_SET, .l_start = 0, .l_len = 0 };
+    int rc;
+    while ((rc = fcntl(fd, F_OFD_SETLKW, &fl)) != 0 && errno == EINTR) ;
+    return rc;
+}
+
+static int map_hdr(struct state *s){
+    void *p = mmap(NULL, sizeof *s->h, PROT_READ|PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (p == MAP_FAILED) return -1;
+    s->h = p;
+    return 0;
+}
+
+/* Open the header in the directory of `sibling`. Only creating or repairing
+ * it takes the lock, so readers attach without waiting for a writer. */
+int state_open_near(struct state *s, const char *sibling){
+    memset(s, 0, sizeof *s);
+    s->fd = -1;
+    const char *slash = strrchr(sibling, '/');
+    char *path = NULL;
+    if (asprintf(&path, "%.*sstate", slash ? (int)(slash - sibling + 1) : 0, sibling) < 0) return -1;
+    s->fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0666);
+    free(path);
+    if (s->fd < 0) return -1;
+    struct stat st;
+    if (fstat(s->fd, &st) == 0 && st.st_size >= (off_t)sizeof *s->h && map_hdr(s) == 0 &&
+        s->h->magic == STATE_MAGIC && s->h->version == STATE_VERSION) return 0;
+
+    if (ofd_lock(s->fd, F_WRLCK) != 0) { state_close(s); return -1; }
+    if (!s->h && (fstat(s->fd, &st) != 0 ||
+                  (st.st_size < (off_t)sizeof *s->h && ftruncate(s->fd, sizeof *s->h) != 0) ||
+                  map_hdr(s) != 0)) {
+        ofd_lock(s->fd, F_UNLCK);
+        state_close(s);
+        return -1;
+    }
+    if (s->h->magic != STATE_MAGIC || s->h->version != STATE_VERSION) {
+        memset(s->h, 0, sizeof *s->h);
+        s->h->magic = STATE_MAGIC;
+        s->h->version = STATE_VERSION;
+    }
+    ofd_lock(s->fd, F_UNLCK);
+    return 0;
+}
+
+int state_open_ro(struct state *s, const char *sibling){
+    memset(s, 0, sizeof *s);
+    s->fd = -1;
+    const char *slash = strrchr(sibling, '/');
+    char *path = NULL;
+    if (asprintf(&path, "%.*sstate", slash ? (int)(slash - sibling + 1) : 0, sibling) < 0) return -1;
+    s->fd = open(path, O_RDONLY|O_CLOEXEC);
+    free(path);
+    struct stat st;
+    void *p;
+    if (s->fd < 0 || fstat(s->fd, &st) != 0 || st.st_size < (off_t)sizeof *s->h ||
+        (p = mmap(NULL, sizeof *s->h, PROT_READ, MAP_SHARED, s->fd, 0)) == MAP_FAILED) {
+        state_close(s);
+        return -1;
+    }
+    s->h = p;
+    if (s->h->magic != STATE_MAGIC || s->h->version != STATE_VERSION) { state_close(s); return -1; }
+    return 0;
+}
+
+void state_close(struct state *s){
+    if (s->h) munmap(s->h, sizeof *s->h);
+    if (s->fd >= 0) close(s->fd);
+    s->h = NULL;
+    s->fd = -1;
+}
+
+/* Exclusive writer lock, blocking. Nests within one handle. */
+int state_lock(struct state *s){
+    if (!s->h) return 0;
+    if (s->depth++ > 0) return 0;
+    if (ofd_lock(s->fd, F_WRLCK) != 0) { s->depth--; return -1; }
+    // An odd seq with the lock free means a writer died mid-update.
+    if (LOAD(s->h->seq) & 1) __atomic_store_n(&s->h->seq, LOAD(s->h->seq) + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void state_unlock(struct state *s){
+    if (!s->h || s->depth == 0) return;
+    if (--s->depth == 0) ofd_lock(s->fd, F_UNLCK);
+}
+
+static void write_begin(struct state_hdr *h){
+    STORE(h->seq, LOAD(h->seq) + 1);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void write_end(struct state_hdr *h){
+    __atomic_store_n(&h->seq, LOAD(h->seq) + 1, __ATOMIC_RELEASE);
+}
+
+void state_publish_map(struct state *s, ino_t ino, off_t size, int compacted){
+    if (!s->h) return;
+    write_begin(s->h);
+    STORE(s->h->map_ino, (uint64_t)ino);
+    STORE(s->h->map_size, (uint64_t)size);
+    if (compacted) STORE(s->h->map_gen, LOAD(s->h->map_gen) + 1);
+    write_end(s->h);
+}
+
+/* Next sequence number, never below floor + 1 so a counter kept elsewhere
+ * (last_id.txt from before the header existed) carries over. */
+long state_next_id(struct state *s, long floor){
+    if (!s->h) return floor + 1;
+    uint64_t last = LOAD(s->h->last_id);
+    if ((uint64_t)floor > last) last = (uint64_t)floor;
+    write_begin(s->h);
+    STORE(s->h->last_id, last + 1);
+    write_end(s->h);
+    return (long)(last + 1);
+}
+
+void state_read_map(const struct state *s, ino_t *ino, off_t *size){
+    *ino = 0; *size = 0;
+    if (!s->h) return;
+    struct state_hdr *h = s->h;
+    for (int spin = 0; spin < READ_SPINS; spin++) {
+        uint64_t s1 = __atomic_load_n(&h->seq, __ATOMIC_ACQUIRE);
+        if (s1 & 1) { sched_yield(); continue; }
+        uint64_t i = LOAD(h->map_ino), z = LOAD(h->map_size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (LOAD(h->seq) != s1) continue;
+        *ino = (ino_t)i; *size = (off_t)z;
+        return;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef STATE_H
+#define STATE_H
+#include <stdint.h>
+#include <sys/types.h>
+
+#define STATE_MAGIC 0x53544354u
+#define STATE_VERSION 1
+
+/* Header of a repo's .ctags/.state, in the file "state" next to the maps and
+ * mapped shared by every process using the repo. Writers serialize on an
+ * OFD lock of that file and publish through a seqlock: seq is odd while an
+ * update is in progress. Readers never lock; they retry until they see the
+ * same even seq before and after copying the fields. */
+struct state_hdr {
+    uint32_t magic, version;
+    uint64_t seq;
+    uint64_t map_ino;           // id_map.tsv as last published...
+    uint64_t map_size;          // ...and its committed length
+    uint64_t map_gen;           // bumped by every compaction
+    uint64_t last_id;           // last sequence number handed out
+};
+
+/* One handle per user of the header. Without it (e.g. a read-only state
+ * directory) h is NULL and locking and publishing do nothing. */
+struct state {
+    int fd;
+    struct state_hdr *h;
+    int depth;                  // nesting of state_lock by this handle
+};
+
+int state_open_near(struct state *s, const char *sibling);
+/* Reader-only handle: nothing is created or repaired, and without a valid
+ * header h stays NULL. */
+int state_open_ro(struct state *s, const char *sibling);
+void state_close(struct state *s);
+int state_lock(struct state *s);
+void state_unlock(struct state *s);
+
+/* Writers, with the lock held. */
+void state_publish_map(struct state *s, ino_t ino, off_t size, int compacted);
+long state_next_id(struct state *s, long floor);
+
+/* Readers: a consistent copy of the published map fields; zeros if nothing
+ * was published yet. */
+void state_read_map(const struct state *s, ino_t *ino, off_t *size);
+
+#endif
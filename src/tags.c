@@ -0,0 +1,88 @@
+#define _GNU_SOURCE
+#include "tags.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static int byte_class(unsigned char c){
+    if (c >= 'a' && c <= 'z') return 1 + (c - 'a');
+    if (c >= 'A' && c <= 'Z') return 1 + (c - 'A');
+    if (c >= '0' && c <= '9') return 27 + (c - '0');
+    if (c == '_') return 37;
+    if (c == '-') return 38;
+    return 0;
+}
+
+static int new_state(struct tagset *ts, int *cap){
+    if (ts->nstates == *cap) {
+        *cap = *cap ? *cap*2 : 64;
+        ts->next = realloc(ts->next, (size_t)*cap * sizeof *ts->next);
+        ts->term = realloc(ts->term, (size_t)*cap * sizeof *ts->term);
+    }
+    memset(ts->next[ts->nstates], 0, sizeof ts->next[0]);
+    ts->term[ts->nstates] = 0;
+    return ts->nstates++;
+}
+
+int tagset_build(struct tagset *ts, char *const *names, size_t n){
+    memset(ts, 0, sizeof *ts);
+    int cap = 0;
+    new_state(ts, &cap);   // root
+    ts->names = calloc(n ? n : 1, sizeof *ts->names);
+    if (!ts->names) return -1;
+    for (size_t i = 0; i < n; i++) {
+        const char *s = names[i];
+        size_t L = strlen(s);
+        int ok = L > 0;
+        for (size_t k = 0; k < L && ok; k++) ok = byte_class((unsigned char)s[k]) != 0;
+        if (!ok) { fprintf(stderr, "Ignoring invalid tag name '%s'\n", s); continue; }
+        int st = 0;
+        for (size_t k = 0; k < L; k++) {
+            int c = byte_class((unsigned char)s[k]);
+            if (!ts->next[st][c]) {
+                int ns = new_state(ts, &cap);
+                ts->next[st][c] = ns;
+            }
+            st = ts->next[st][c];
+        }
+        if (ts->term[st]) continue;   // duplicate (case-insensitively)
+        char *up = strdup(s);
+        for (char *p = up; *p; p++) if (*p >= 'a' && *p <= 'z') *p -= 'a' - 'A';
+        ts->names[ts->n] = up;
+        ts->term[st] = (int)++ts->n;
+    }
+    return 0;
+}
+
+void tagset_free(struct tagset *ts){
+    for (size_t i = 0; i < ts->n; i++) free(ts->names[i]);
+    free(ts->names);
+    free(ts->next);
+    free(ts->term);
+    memset(ts, 0, sizeof *ts);
+}
+
+int tagset_match(const struct tagset *ts, const char *s, size_t n, size_t *len){
+    int st = 0;
+    for (size_t k = 0; k < n; k++) {
+        if (s[k] == ':') {
+            if (!ts->term[st]) return -1;
+            *len = k;
+            return ts->term[st] - 1;
+        }
+        int c = byte_class((unsigned char)s[k]);
+        if (!c || !(st = ts->next[st][c])) return -1;
+    }
+    return -1;
+}
+
+int tagset_index(const struct tagset *ts, const char *name){
+    size_t L = strlen(name);
+    int st = 0;
+    for (size_t k = 0; k < L; k++) {
+        int c = byte_class((unsigned char)name[k]);
+        if (!c || !(st = ts->next[st][c])) return -1;
+    }
+    return ts->term[st] - 1;
+}
@@ -0,0 +1,25 @@
+#ifndef TAGS_H
+#define TAGS_H
+#include <stddef.h>
+
+#define TAG_ALPHA 39   // class 0 = not a tag byte, then A-Z, 0-9, '_', '-'
+
+/* Tag vocabulary compiled into a case-insensitive trie, i.e. the goto
+ * function of an Aho-Corasick automaton. Tags are only matched where a
+ * comment body starts, so no failure links are needed: a lookup costs at
+ * most one transition per byte of the longest tag, whatever the number of
+ * tags. */
+struct tagset {
+    char **names;
+    size_t n;
+    int (*next)[TAG_ALPHA];
+    int *term;              // tag index + 1 at accepting states, else 0
+    int nstates;
+};
+
+int tagset_build(struct tagset *ts, char *const *names, size_t n);
+void tagset_free(struct tagset *ts);
+int tagset_match(const struct tagset *ts, const char *s, size_t n, size_t *len);
+int tagset_index(const struct tagset *ts, const char *name);
+
+#endif
@@ -0,0 +1,150 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC "#codetags-trace 1"
+
+static const char *const names[] = {
+    [FS_EVENT_WRITE] = "write", [FS_EVENT_CREATE_FILE] = "create", [FS_EVENT_DELETE_FILE] = "delete",
+    [FS_EVENT_MOVE] = "move", [FS_EVENT_CREATE_DIR] = "mkdir", [FS_EVENT_DELETE_DIR] = "rmdir",
+    [FS_EVENT_RENAME] = "rename", [FS_EVENT_RENAME_DIR] = "renamedir",
+};
+#define NNAMES (sizeof names / sizeof *names)
+
+FILE *trace_create(const char *path){
+    FILE *f = fopen(path, "w");
+    if (f) fprintf(f, "%s\n", TRACE_MAGIC);
+    return f;
+}
+
+/* Tabs, newlines and backslashes in a path are escaped C-style. */
+static void put_path(FILE *f, const char *root, const char *p){
+    size_t rl = root ? strlen(root) : 0;
+    if (!p) { fputs("-", f); return; }
+    if (rl && strncmp(p, root, rl) == 0 && p[rl] == '/') p += rl + 1;
+    else if (rl && strcmp(p, root) == 0) p = ".";
+    for (; *p; p++) {
+        if (*p == '\t') fputs("\\t", f);
+        else if (*p == '\n') fputs("\\n", f);
+        else if (*p == '\\') fputs("\\\\", f);
+        else fputc(*p, f);
+    }
+}
+
+void trace_write(FILE *f, long long us, const char *root, const fs_event *ev){
+    if (ev->type <= 0 || (size_t)ev->type >= NNAMES || !names[ev->type]) return;
+    fprintf(f, "%lld\t%s\t", us, names[ev->type]);
+    put_path(f, NULL, root);
+    fputc('\t', f);
+    put_path(f, root, ev->path);
+    fputc('\t', f);
+    put_path(f, root, ev->from);
+    fputc('\n', f);
+}
+
+FILE *trace_open(const char *path){
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    char *line = NULL;
+    size_t cap = 0;
+    if (f && (getline(&line, &cap, f) <= 0 || strncmp(line, TRACE_MAGIC, strlen(TRACE_MAGIC)) != 0)) {
+        if (f != stdin) fclose(f);
+        f = NULL;
+    }
+    free(line);
+    return f;
+}
+
+static char *get_path(char *s){
+    if (strcmp(s, "-") == 0) return NULL;
+    char *d = s;
+    for (char *p = s; *p; p++) {
+        if (*p == '\\' && p[1]) {
+            p++;
+            *d++ = *p == 't' ? '\t' : *p == 'n' ? '\n' : *p;
+        } else *d++ = *p;
+    }
+    *d = 0;
+    return strdup(s);
+}
+
+int trace_read(FILE *f, struct trace_ev *te){
+    memset(te, 0, sizeof *te);
+    char *line = NULL;
+    size_t cap = 0;
+    ssize_t len;
+    while ((len = getline(&line, &cap, f)) > 0 && (line[0] == '#' || line[0] == '\n')) ;
+    if (len <= 0) { free(line); return 0; }
+    if (line[len-1] == '\n') line[--len] = 0;
+    char *field[5], *p = line;
+    int n = 0;
+    while (n < 5 && p) field[n++] = strsep(&p, "\t");
+    int rc = -1;
+    if (n == 5) {
+        char *end;
+        te->us = strtoll(field[0], &end, 10);
+        for (size_t i = 1; i < NNAMES; i++) if (names[i] && strcmp(names[i], field[1]) == 0) te->ev.type = (int)i;
+        if (!*end && te->ev.type) {
+            te->root = get_path(field[2]);
+            te->ev.path = get_path(field[3]);
+            te->ev.from = get_path(field[4]);
+            rc = te->root && te->ev.path ? 1 : -1;
+        }
+    }
+    free(line);
+    if (rc != 1) trace_ev_free(te);
+    return rc;
+}
+
+void trace_ev_free(struct trace_ev *te){
+    fs_event_free(&te->ev);
+    free(te->root);
+    memset(te, 0, sizeof *te);
+}
+
+void trace_stats_init(struct trace_stats *s){
+    memset(s, 0, sizeof *s);
+    pthread_mutex_init(&s->lock, NULL);
+}
+
+void trace_stats_task(struct trace_stats *s, long latency_us, long run_us){
+    pthread_mutex_lock(&s->lock);
+    if (s->nlat == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        long *nl = realloc(s->lat, cap * sizeof *nl);
+        if (nl) { s->lat = nl; s->cap = cap; }
+    }
+    if (latency_us >= 0 && s->nlat < s->cap) s->lat[s->nlat++] = latency_us;
+    s->task_us += run_us;
+    pthread_mutex_unlock(&s->lock);
+}
+
+void trace_stats_rebuild(struct trace_stats *s, long us){
+    pthread_mutex_lock(&s->lock);
+    s->rebuilds++;
+    s->rebuild_us += us;
+    pthread_mutex_unlock(&s->lock);
+}
+
+static int by_value(const void *a, const void *b){
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+long trace_stats_pct(struct trace_stats *s, int q){
+    pthread_mutex_lock(&s->lock);
+    long v = 0;
+    if (s->nlat) {
+        qsort(s->lat, s->nlat, sizeof *s->lat, by_value);
+        size_t i = (s->nlat * (size_t)q + 99) / 100;
+        v = s->lat[i ? i - 1 : 0];
+    }
+    pthread_mutex_unlock(&s->lock);
+    return v;
+}
+
+void trace_stats_free(struct trace_stats *s){
+    free(s->lat);
+    pthread_mutex_destroy(&s->lock);
+    memset(s, 0, sizeof *s);
+}
@@ -0,0 +1,43 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <pthread.h>
+#include <stdio.h>
+#include "fs.h"
+
+/* Watch event traces: what fs_watch_next returned, one event per line as
+ * "usecs\ttype\troot\tpath\tfrom", with usecs counted from the start of
+ * the recording, paths under root relative to it and "-" for no from.
+ * Written by codetags watch --record, fed back by codetags replay. */
+struct trace_ev {
+    long long us;
+    fs_event ev;
+    char *root;
+};
+
+FILE *trace_create(const char *path);
+void trace_write(FILE *f, long long us, const char *root, const fs_event *ev);
+/* NULL if path cannot be read or is not a trace; "-" is stdin. */
+FILE *trace_open(const char *path);
+/* The next event of f. 1 on success, 0 at the end, -1 on a bad line. */
+int trace_read(FILE *f, struct trace_ev *te);
+void trace_ev_free(struct trace_ev *te);
+
+/* What a replay measured: per-task latency from queueing to completion,
+ * and the work the tasks and rebuilds did. Shared by the workers. */
+struct trace_stats {
+    pthread_mutex_t lock;
+    long *lat;                  // usecs
+    size_t nlat, cap;
+    long task_us, rebuild_us;
+    size_t rebuilds;
+};
+
+void trace_stats_init(struct trace_stats *s);
+/* A task ran for run_us; a negative latency for a slice that was put back. */
+void trace_stats_task(struct trace_stats *s, long latency_us, long run_us);
+void trace_stats_rebuild(struct trace_stats *s, long us);
+/* The q-th percentile (0-100) of the latencies; sorts them. */
+long trace_stats_pct(struct trace_stats *s, int q);
+void trace_stats_free(struct trace_stats *s);
+
+#endif
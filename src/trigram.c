@@ -0,0 +1,514 @@
+#define _GNU_SOURCE
+#include "trigram.h"
+#include "hash.h"
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRI_MAGIC 0x49525443u   // "CTRI"
+#define TRI_VERSION 2      // 2: keys relative to the repo root
+/* Rebuild once the tail is past this and a quarter of what the index
+ * covers: rebuilds stay amortized O(1) per record and the tail short. */
+#define TRI_TAIL_MIN (64*1024)
+
+/* File layout: header, entries, posting list heads sorted by trigram, the
+ * postings (entry numbers, ascending per list), then "key\0id\0" strings. */
+struct tri_hdr {
+    uint32_t magic, version;
+    uint64_t map_ino, map_off;  // the prefix of id_map.tsv this index covers
+    uint32_t nents, nlists;
+    uint64_t npost, size;
+};
+struct tri_ent { uint32_t key, id; };           // offsets into the strings
+struct tri_list { uint32_t tri, at, n; };       // postings [at, at+n)
+
+static inline uint32_t fold(unsigned char c){ return c < 0x80 ? (uint32_t)tolower(c) : c; }
+
+static inline uint32_t tri_at(const char *s){
+    return fold(s[0]) << 16 | fold(s[1]) << 8 | fold(s[2]);
+}
+
+static size_t key_plen(const char *key){
+    const char *sep = strstr(key, "::");
+    return sep ? (size_t)(sep - key) : strlen(key);
+}
+
+/* The tag and text of "path::TAG::content"; NULL for anything else. */
+static const char *key_text(const char *key, const char **tag, size_t *taglen){
+    const char *t = strstr(key, "::");
+    const char *c = t ? strstr(t + 2, "::") : NULL;
+    if (!c) return NULL;
+    *tag = t + 2;
+    *taglen = (size_t)(c - *tag);
+    return c + 2;
+}
+
+/* ===== Queries ===== */
+
+static int add_trigrams(struct tri_query *q, const char *s, size_t n, size_t *cap){
+    for (size_t i = 0; i + 3 <= n; i++) {
+        if (q->ntris == *cap) {
+            size_t nc = *cap ? *cap * 2 : 16;
+            uint32_t *nt = realloc(q->tris, nc * sizeof *nt);
+            if (!nt) return -1;
+            q->tris = nt;
+            *cap = nc;
+        }
+        q->tris[q->ntris++] = tri_at(s + i);
+    }
+    return 0;
+}
+
+/* Literal runs every match of an extended regex must contain. Alternation
+ * anywhere gives up (everything is scanned); groups, bracket expressions,
+ * anchors and escapes like \w end the current run, and an atom made
+ * optional by * ? or {} is taken back off it. */
+static int regex_literals(struct tri_query *q, const char *p, size_t *cap){
+    if (strchr(p, '|')) return 0;
+    char *run = malloc(strlen(p) + 1);
+    if (!run) return -1;
+    size_t rl = 0;
+    int depth = 0, rc = 0;
+    for (const char *s = p; *s && rc == 0; s++) {
+        char c = *s;
+        if (depth > 0) {
+            if (c == '\\' && s[1]) s++;
+            else if (c == '(') depth++;
+            else if (c == ')') depth--;
+            continue;
+        }
+        if (c == '\\') {
+            if (!s[1]) break;
+            c = *++s;
+            if (isalnum((unsigned char)c)) { rc = add_trigrams(q, run, rl, cap); rl = 0; continue; }
+        } else if (c == '*' || c == '?' || c == '{') {
+            if (rl) rl--;
+            if (c == '{') while (s[1] && *s != '}') s++;
+            rc = add_trigrams(q, run, rl, cap); rl = 0;
+            continue;
+        } else if (c == '[') {
+            if (s[1] == '^') s++;
+            if (s[1] == ']') s++;
+            while (s[1] && s[1] != ']') s++;
+            if (s[1]) s++;
+            rc = add_trigrams(q, run, rl, cap); rl = 0;
+            continue;
+        } else if (strchr("().^$+", c)) {
+            if (c == '(') depth = 1;
+            rc = add_trigrams(q, run, rl, cap); rl = 0;
+            continue;
+        }
+        run[rl++] = c;
+    }
+    if (rc == 0) rc = add_trigrams(q, run, rl, cap);
+    free(run);
+    return rc;
+}
+
+static int cmp_u32(const void *a, const void *b){
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int tri_query_init(struct tri_query *q, const char *pattern, bool regex, bool icase, const char *tag,
+                   char *err, size_t errlen){
+    memset(q, 0, sizeof *q);
+    q->pattern = pattern;
+    q->tag = tag;
+    q->regex = regex;
+    q->icase = icase;
+    size_t cap = 0;
+    if (regex) {
+        int rc = regcomp(&q->re, pattern, REG_EXTENDED | REG_NOSUB | (icase ? REG_ICASE : 0));
+        if (rc != 0) { regerror(rc, &q->re, err, errlen); return -1; }
+        if (regex_literals(q, pattern, &cap) != 0) { tri_query_free(q); snprintf(err, errlen, "out of memory"); return -1; }
+    } else if (add_trigrams(q, pattern, strlen(pattern), &cap) != 0) {
+        tri_query_free(q); snprintf(err, errlen, "out of memory"); return -1;
+    }
+    qsort(q->tris, q->ntris, sizeof *q->tris, cmp_u32);
+    size_t k = 0;
+    for (size_t i = 0; i < q->ntris; i++)
+        if (k == 0 || q->tris[k-1] != q->tris[i]) q->tris[k++] = q->tris[i];
+    q->ntris = k;
+    return 0;
+}
+
+void tri_query_free(struct tri_query *q){
+    if (q->regex) regfree(&q->re);
+    free(q->tris);
+    q->tris = NULL;
+    q->ntris = 0;
+    q->regex = false;
+}
+
+static bool query_match(const struct tri_query *q, const char *key){
+    const char *tag; size_t tl;
+    const char *text = key_text(key, &tag, &tl);
+    if (!text) return false;
+    if (q->tag && (strlen(q->tag) != tl || strncasecmp(q->tag, tag, tl) != 0)) return false;
+    if (q->regex) return regexec(&q->re, text, 0, NULL, 0) == 0;
+    return (q->icase ? strcasestr(text, q->pattern) : strstr(text, q->pattern)) != NULL;
+}
+
+/* ===== Building ===== */
+
+/* Stable LSD radix sort of (trigram << 32 | entry) pairs on the 24 trigram
+ * bits. The pairs come in entry order, so each list ends up ascending.
+ * Returns whichever buffer holds the result. */
+static uint64_t *sort_pairs(uint64_t *a, uint64_t *tmp, size_t n){
+    for (int shift = 32; shift < 56; shift += 8) {
+        size_t cnt[257] = {0};
+        for (size_t i = 0; i < n; i++) cnt[((a[i] >> shift) & 0xff) + 1]++;
+        for (int b = 0; b < 256; b++) cnt[b+1] += cnt[b];
+        for (size_t i = 0; i < n; i++) tmp[cnt[(a[i] >> shift) & 0xff]++] = a[i];
+        uint64_t *t = a; a = tmp; tmp = t;
+    }
+    return a;
+}
+
+static int write_index(const char *path, const struct tri_hdr *h, const struct tri_ent *ents,
+                       const struct tri_list *lists, const uint32_t *post, const char *strs, size_t strsz){
+    char *tmp = NULL;
+    if (asprintf(&tmp, "%s.XXXXXX", path) < 0) return -1;
+    int fd = mkstemp(tmp);
+    FILE *f = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!f) {
+        if (fd >= 0) { close(fd); unlink(tmp); }
+        free(tmp);
+        return -1;
+    }
+    fwrite(h, sizeof *h, 1, f);
+    fwrite(ents, sizeof *ents, h->nents, f);
+    fwrite(lists, sizeof *lists, h->nlists, f);
+    fwrite(post, sizeof *post, h->npost, f);
+    fwrite(strs, 1, strsz, f);
+    int rc = ferror(f) ? -1 : 0;
+    if (fclose(f) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, path) != 0) rc = -1;
+    if (rc != 0) unlink(tmp);
+    free(tmp);
+    return rc;
+}
+
+static int build(const char *path, const struct idmap *m){
+    size_t n = 0, strsz = 0, npairs = 0;
+    for (size_t i = 0; i < m->n; i++) {
+        const struct idmap_ent *e = m->order[i];
+        if (!e->live) continue;
+        n++;
+        strsz += strlen(idmap_relpath(m, e->key)) + strlen(e->id) + 2;
+        const char *tag; size_t tl;
+        const char *text = key_text(e->key, &tag, &tl);
+        size_t len = text ? strlen(text) : 0;
+        if (len >= 3) npairs += len - 2;
+    }
+    if (strsz > UINT32_MAX || n > UINT32_MAX) return -1;
+    struct tri_ent *ents = malloc((n ? n : 1) * sizeof *ents);
+    char *strs = malloc(strsz ? strsz : 1);
+    uint64_t *pairs = malloc((npairs ? npairs : 1) * sizeof *pairs);
+    uint64_t *tmp = malloc((npairs ? npairs : 1) * sizeof *tmp);
+    struct tri_list *lists = NULL;
+    int rc = -1;
+    if (!ents || !strs || !pairs || !tmp) goto out;
+
+    size_t k = 0, at = 0, np = 0;
+    for (size_t i = 0; i < m->n; i++) {
+        const struct idmap_ent *e = m->order[i];
+        if (!e->live) continue;
+        const char *key = idmap_relpath(m, e->key);
+        size_t kl = strlen(key) + 1, il = strlen(e->id) + 1;
+        ents[k] = (struct tri_ent){ (uint32_t)at, (uint32_t)(at + kl) };
+        memcpy(strs + at, key, kl);
+        memcpy(strs + at + kl, e->id, il);
+        at += kl + il;
+        const char *tag; size_t tl;
+        const char *text = key_text(e->key, &tag, &tl);
+        for (size_t j = 0; text && text[j] && text[j+1] && text[j+2]; j++)
+            pairs[np++] = (uint64_t)tri_at(text + j) << 32 | k;
+        k++;
+    }
+    uint64_t *sorted = sort_pairs(pairs, tmp, np);
+    // Drop repeats of a trigram within one entry, then cut into lists.
+    size_t u = 0, nlists = 0;
+    for (size_t i = 0; i < np; i++) {
+        if (u && sorted[u-1] == sorted[i]) continue;
+        if (!u || sorted[u-1] >> 32 != sorted[i] >> 32) nlists++;
+        sorted[u++] = sorted[i];
+    }
+    if (!(lists = malloc((nlists ? nlists : 1) * sizeof *lists))) goto out;
+    uint32_t *post = (uint32_t *)(sorted == pairs ? tmp : pairs);
+    size_t l = 0;
+    for (size_t i = 0; i < u; i++) {
+        uint32_t tri = (uint32_t)(sorted[i] >> 32);
+        if (i == 0 || lists[l-1].tri != tri) lists[l++] = (struct tri_list){ tri, (uint32_t)i, 0 };
+        lists[l-1].n++;
+        post[i] = (uint32_t)sorted[i];
+    }
+    struct tri_hdr h = {
+        .magic = TRI_MAGIC, .version = TRI_VERSION,
+        .map_ino = (uint64_t)m->ino, .map_off = (uint64_t)m->off,
+        .nents = (uint32_t)n, .nlists = (uint32_t)nlists, .npost = u,
+    };
+    h.size = sizeof h + n * sizeof *ents + nlists * sizeof *lists + u * sizeof *post + strsz;
+    rc = write_index(path, &h, ents, lists, post, strs, strsz);
+out:
+    free(ents); free(strs); free(pairs); free(tmp); free(lists);
+    return rc;
+}
+
+int tri_refresh(const char *path, struct idmap *m){
+    if (idmap_sync(m) != 0) return -1;
+    struct tri_hdr h;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ssize_t got = pread(fd, &h, sizeof h, 0);
+        close(fd);
+        if (got == (ssize_t)sizeof h && h.magic == TRI_MAGIC && h.version == TRI_VERSION &&
+            h.map_ino == (uint64_t)m->ino && h.map_off <= (uint64_t)m->off) {
+            uint64_t tail = (uint64_t)m->off - h.map_off;
+            if (tail <= TRI_TAIL_MIN || tail * 4 <= h.map_off) return 0;
+        }
+    }
+    return build(path, m);
+}
+
+/* ===== Searching ===== */
+
+struct seg {
+    void *base;
+    size_t size;
+    const struct tri_hdr *h;
+    const struct tri_ent *ents;
+    const struct tri_list *lists;
+    const uint32_t *post;
+    const char *strs;
+};
+
+/* Map the index if it covers the prefix of the map file with inode ino. */
+static int seg_open(struct seg *s, const char *path, ino_t ino){
+    memset(s, 0, sizeof *s);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof *s->h) { close(fd); return -1; }
+    s->size = (size_t)st.st_size;
+    s->base = mmap(NULL, s->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (s->base == MAP_FAILED) { s->base = NULL; return -1; }
+    const struct tri_hdr *h = s->h = s->base;
+    size_t fixed = sizeof *h + (size_t)h->nents * sizeof *s->ents + (size_t)h->nlists * sizeof *s->lists
+                 + h->npost * sizeof *s->post;
+    if (h->magic != TRI_MAGIC || h->version != TRI_VERSION || h->size != s->size ||
+        h->map_ino != (uint64_t)ino || fixed > s->size) {
+        munmap(s->base, s->size);
+        s->base = NULL;
+        return -1;
+    }
+    s->ents = (const void *)((const char *)s->base + sizeof *h);
+    s->lists = (const void *)(s->ents + h->nents);
+    s->post = (const void *)(s->lists + h->nlists);
+    s->strs = (const char *)(s->post + h->npost);
+    return 0;
+}
+
+static const struct tri_list *seg_list(const struct seg *s, uint32_t tri){
+    size_t lo = 0, hi = s->h->nlists;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (s->lists[mid].tri < tri) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < s->h->nlists && s->lists[lo].tri == tri ? &s->lists[lo] : NULL;
+}
+
+static bool post_has(const struct seg *s, const struct tri_list *l, uint32_t ent){
+    const uint32_t *p = s->post + l->at;
+    size_t lo = 0, hi = l->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (p[mid] < ent) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < l->n && p[lo] == ent;
+}
+
+/* The records after the index, in order. Tombstones of the same key are
+ * chained through a small hash; moves are kept in a list. */
+enum { OP_ADD, OP_TOMB, OP_MOVE };
+struct op {
+    char *key;
+    const char *val;
+    size_t plen;
+    int kind;
+    size_t next;                // next tombstone in the chain, +1
+};
+struct tail {
+    char *buf;
+    struct op *ops;
+    size_t n;
+    size_t *slots, cap;         // tombstone chains by key, op index +1
+    size_t *moves, nmoves;
+};
+
+static void tail_free(struct tail *t){
+    free(t->buf); free(t->ops); free(t->slots); free(t->moves);
+    memset(t, 0, sizeof *t);
+}
+
+static size_t *tomb_slot(const struct tail *t, const char *key){
+    size_t i = (size_t)fnv1a64(key, strlen(key)) & (t->cap - 1);
+    while (t->slots[i] && strcmp(t->ops[t->slots[i] - 1].key, key) != 0) i = (i + 1) & (t->cap - 1);
+    return &t->slots[i];
+}
+
+/* Read the map from off on; only whole records count, as in idmap_sync. */
+/* Records from before paths were stored relative name the root. */
+static char *strip_root(char *p, const char *root, size_t rl){
+    return rl && strncmp(p, root, rl) == 0 && p[rl] == '/' ? p + rl + 1 : p;
+}
+
+static int tail_read(struct tail *t, int fd, off_t off, off_t size, const char *root){
+    size_t rl = root ? strlen(root) : 0;
+    memset(t, 0, sizeof *t);
+    size_t len = size > off ? (size_t)(size - off) : 0;
+    if (!(t->buf = malloc(len + 1))) return -1;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t r = pread(fd, t->buf + got, len - got, off + (off_t)got);
+        if (r <= 0) break;
+        got += (size_t)r;
+    }
+    while (got > 0 && t->buf[got-1] != '\n') got--;
+    t->buf[got] = 0;
+    size_t lines = 0, ntomb = 0;
+    for (size_t i = 0; i < got; i++) lines += t->buf[i] == '\n';
+    if (!(t->ops = malloc((lines ? lines : 1) * sizeof *t->ops)) ||
+        !(t->moves = malloc((lines ? lines : 1) * sizeof *t->moves))) return -1;
+    for (char *line = t->buf, *nl; (nl = strchr(line, '\n')); line = nl + 1) {
+        *nl = 0;
+        if (nl > line && nl[-1] == '\r') nl[-1] = 0;
+        char *tab = strrchr(line, '\t');
+        if (!tab) continue;
+        *tab = 0;
+        struct op *o = &t->ops[t->n];
+        *o = (struct op){ .key = strip_root(line, root, rl), .val = tab + 1, .kind = OP_ADD };
+        if (tab[1] == '>') {
+            o->kind = OP_MOVE;
+            o->plen = strlen(o->key);
+            o->val = strip_root(tab + 2, root, rl);
+            t->moves[t->nmoves++] = t->n;
+        }
+        else { o->plen = key_plen(o->key); if (strcmp(tab + 1, "-") == 0) { o->kind = OP_TOMB; ntomb++; } }
+        t->n++;
+    }
+    for (t->cap = 16; t->cap < ntomb * 2; t->cap *= 2) {}
+    if (!(t->slots = calloc(t->cap, sizeof *t->slots))) return -1;
+    for (size_t i = 0; i < t->n; i++) {
+        if (t->ops[i].kind != OP_TOMB) continue;
+        size_t *slot = tomb_slot(t, t->ops[i].key);
+        t->ops[i].next = *slot;
+        *slot = i + 1;
+    }
+    return 0;
+}
+
+static bool tombed(const struct tail *t, const char *key, long from, long to){
+    for (size_t i = *tomb_slot(t, key); i; i = t->ops[i-1].next)
+        if ((long)i - 1 > from && (long)i - 1 < to) return true;
+    return false;
+}
+
+static bool under(const char *key, size_t plen, const char *p, size_t pl){
+    return plen >= pl && memcmp(key, p, pl) == 0 && (plen == pl || key[pl] == '/');
+}
+
+/* Follow a key that was live after record start (-1: in the index) through
+ * the later records, the way idmap replays them. Returns its key now, key
+ * itself or malloced, or NULL if a tombstone or a move removed it. */
+static char *follow(const struct tail *t, const char *key, long start){
+    char *cur = (char *)key;
+    size_t plen = key_plen(cur), mi = 0;
+    while (mi < t->nmoves && (long)t->moves[mi] <= start) mi++;
+    for (;;) {
+        long end = mi < t->nmoves ? (long)t->moves[mi] : (long)t->n;
+        if (tombed(t, cur, start, end)) break;
+        if (mi == t->nmoves) return cur;
+        const struct op *mv = &t->ops[t->moves[mi]];
+        size_t tl = strlen(mv->val);
+        if (under(cur, plen, mv->key, mv->plen)) {
+            char *nk = NULL;
+            if (asprintf(&nk, "%s%s", mv->val, cur + mv->plen) < 0) break;
+            if (cur != key) free(cur);
+            cur = nk;
+            plen = plen - mv->plen + tl;
+        } else if (under(cur, plen, mv->val, tl)) {
+            break;
+        }
+        start = (long)t->moves[mi++];
+    }
+    if (cur != key) free(cur);
+    return NULL;
+}
+
+static void emit(const struct tail *t, struct strset *seen, const char *key, long start, const char *id,
+                 tri_hit_fn fn, void *ud){
+    char *cur = follow(t, key, start);
+    if (!cur) return;
+    // A key's first ID wins; later records for a live key are replays.
+    if (!t->n || strset_add(seen, cur) == 1) fn(ud, cur, id);
+    if (cur != key) free(cur);
+}
+
+int tri_search(const char *path, const char *map_path, const char *root, const struct tri_query *q,
+               tri_hit_fn fn, void *ud){
+    int fd = open(map_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return -1; }
+    struct seg s;
+    bool have = seg_open(&s, path, st.st_ino) == 0;
+    if (have && (off_t)s.h->map_off > st.st_size) { munmap(s.base, s.size); have = false; }
+    struct tail t;
+    int rc = tail_read(&t, fd, have ? (off_t)s.h->map_off : 0, st.st_size, root);
+    close(fd);
+    struct strset seen = {0};
+    if (rc == 0 && have) {
+        // Intersect the posting lists, shortest first, probing the others.
+        const struct tri_list **ls = malloc((q->ntris ? q->ntris : 1) * sizeof *ls);
+        size_t nl = 0;
+        bool none = false;
+        for (size_t i = 0; ls && i < q->ntris && !none; i++)
+            if (!(ls[nl++] = seg_list(&s, q->tris[i]))) none = true;
+        if (!ls) rc = -1;
+        else if (!none && nl) {
+            size_t best = 0;
+            for (size_t i = 1; i < nl; i++) if (ls[i]->n < ls[best]->n) best = i;
+            const struct tri_list *b = ls[best];
+            for (uint32_t j = 0; j < b->n; j++) {
+                uint32_t e = s.post[b->at + j];
+                size_t i = 0;
+                while (i < nl && (i == best || post_has(&s, ls[i], e))) i++;
+                const char *key = s.strs + s.ents[e].key;
+                if (i == nl && query_match(q, key)) emit(&t, &seen, key, -1, s.strs + s.ents[e].id, fn, ud);
+            }
+        } else if (!none) {
+            for (uint32_t e = 0; e < s.h->nents; e++) {
+                const char *key = s.strs + s.ents[e].key;
+                if (query_match(q, key)) emit(&t, &seen, key, -1, s.strs + s.ents[e].id, fn, ud);
+            }
+        }
+        free(ls);
+    }
+    for (size_t i = 0; rc == 0 && i < t.n; i++)
+        if (t.ops[i].kind == OP_ADD && query_match(q, t.ops[i].key))
+            emit(&t, &seen, t.ops[i].key, (long)i, t.ops[i].val, fn, ud);
+    strset_free(&seen);
+    tail_free(&t);
+    if (have) munmap(s.base, s.size);
+    return rc;
+}
@@ -0,0 +1,42 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <regex.h>
+#include "idmap.h"
+
+/* Trigram inverted index over the tag text of a repo's ID map, kept next to
+ * it in .ctags/.state. The index covers the map up to some offset; records
+ * appended since then (the tail) are replayed by every query, and writers
+ * rebuild the index once the tail grows past a fraction of what it covers
+ * or the map was compacted under it. Queries never touch source files. */
+
+/* A compiled pattern: a substring or a POSIX extended regex, matched against
+ * the text of a tag, with the trigrams every match must contain. */
+struct tri_query {
+    const char *pattern;
+    const char *tag;            // only this tag, any case; NULL for all
+    bool regex, icase;
+    regex_t re;
+    uint32_t *tris;             // required trigrams, case-folded; none = scan all
+    size_t ntris;
+};
+
+/* One hit: the live key ("path::TAG::content", path relative to the repo
+ * root if it is below it) and its ID. */
+typedef void (*tri_hit_fn)(void *ud, const char *key, const char *id);
+
+int tri_query_init(struct tri_query *q, const char *pattern, bool regex, bool icase, const char *tag,
+                   char *err, size_t errlen);
+void tri_query_free(struct tri_query *q);
+
+/* Writers, after a batch: rebuild the index at path from m if it is
+ * missing, from another map file or too far behind. */
+int tri_refresh(const char *path, struct idmap *m);
+/* Call fn for every live key of the map at map_path, of the repo at root,
+ * that matches q, in map order. Reads only the index and the map. */
+int tri_search(const char *path, const char *map_path, const char *root, const struct tri_query *q,
+               tri_hit_fn fn, void *ud);
+
+#endif
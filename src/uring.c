@@ -0,0 +1,110 @@
+#define _GNU_SOURCE
+#include "uring.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+static int sys_setup(unsigned entries, struct io_uring_params *p){
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nr){
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+static int sys_enter(int fd, unsigned submit, unsigned min, unsigned flags){
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min, flags, NULL, 0);
+}
+
+/* Fails (ENOSYS, EPERM under seccomp, ...) where io_uring is unavailable;
+ * callers fall back to plain blocking I/O. */
+int uring_init(struct uring *u, unsigned entries){
+    memset(u, 0, sizeof *u);
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+    u->fd = sys_setup(entries, &p);
+    if (u->fd < 0) return -1;
+    u->entries = p.sq_entries;
+    u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_sz > u->sq_ring_sz) u->sq_ring_sz = u->cq_ring_sz;
+        u->cq_ring_sz = u->sq_ring_sz;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) { u->sq_ring = NULL; uring_free(u); return -1; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) { u->cq_ring = NULL; uring_free(u); return -1; }
+    }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_sz, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) { u->sqes = NULL; uring_free(u); return -1; }
+
+    char *sq = u->sq_ring, *cq = u->cq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+void uring_free(struct uring *u){
+    if (u->sqes) munmap(u->sqes, u->sqes_sz);
+    if (u->cq_ring && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_sz);
+    if (u->sq_ring) munmap(u->sq_ring, u->sq_ring_sz);
+    if (u->fd >= 0) close(u->fd);
+    memset(u, 0, sizeof *u);
+    u->fd = -1;
+}
+
+/* Older kernels set up a ring but reject newer opcodes with -EINVAL. */
+int uring_supports(struct uring *u, unsigned op){
+    size_t sz = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *p = calloc(1, sz);
+    if (!p) return 0;
+    int ok = sys_register(u->fd, IORING_REGISTER_PROBE, p, 256) == 0 &&
+             op <= p->last_op && (p->ops[op].flags & IO_URING_OP_SUPPORTED);
+    free(p);
+    return ok;
+}
+
+struct io_uring_sqe *uring_sqe(struct uring *u){
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *u->sq_tail;
+    if (tail - head >= u->entries) return NULL;
+    unsigned i = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[i];
+    memset(sqe, 0, sizeof *sqe);
+    u->sq_array[i] = i;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->queued++;
+    return sqe;
+}
+
+int uring_submit(struct uring *u, unsigned min){
+    for (;;) {
+        int rc = sys_enter(u->fd, u->queued, min, min ? IORING_ENTER_GETEVENTS : 0);
+        if (rc >= 0) { u->queued -= (unsigned)rc < u->queued ? (unsigned)rc : u->queued; return 0; }
+        if (errno != EINTR) return -1;
+    }
+}
+
+struct io_uring_cqe *uring_peek(struct uring *u){
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &u->cqes[head & *u->cq_mask];
+}
+
+void uring_seen(struct uring *u){
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,31 @@
+#ifndef URING_H
+#define URING_H
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/* Minimal io_uring on raw syscalls (no liburing): one submission and one
+ * completion ring, used from a single thread. */
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    unsigned entries;
+    unsigned queued;            // SQEs handed out since the last submit
+};
+
+int uring_init(struct uring *u, unsigned entries);
+void uring_free(struct uring *u);
+int uring_supports(struct uring *u, unsigned op);
+/* Next free SQE, zeroed, or NULL if the submission ring is full. */
+struct io_uring_sqe *uring_sqe(struct uring *u);
+/* Submit queued SQEs and wait until at least min completions are ready. */
+int uring_submit(struct uring *u, unsigned min);
+/* Oldest unconsumed completion, or NULL; uring_seen releases it. */
+struct io_uring_cqe *uring_peek(struct uring *u);
+void uring_seen(struct uring *u);
+
+#endif
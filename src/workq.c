@@ -0,0 +1,251 @@
+#define _GNU_SOURCE
+#include "workq.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define WORKQ_BATCH 32
+
+static void free_task(struct workq_task *t){
+    free(t->path);
+    free(t->from);
+    free(t);
+}
+
+static void link_ready(struct workq *w, struct workq_queue *q){
+    q->ready = 1;
+    q->rnext = NULL;
+    if (w->rtail) w->rtail->rnext = q; else w->rhead = q;
+    w->rtail = q;
+    pthread_cond_signal(&w->work);
+}
+
+static void unlink_ready(struct workq *w, struct workq_queue *q){
+    struct workq_queue *prev = NULL;
+    for (struct workq_queue *p = w->rhead; p; prev = p, p = p->rnext) {
+        if (p != q) continue;
+        if (prev) prev->rnext = q->rnext; else w->rhead = q->rnext;
+        if (w->rtail == q) w->rtail = prev;
+        break;
+    }
+    q->ready = 0;
+    q->rnext = NULL;
+}
+
+/* Next queue to serve: the first one (in round-robin order) holding
+ * interactive work, else the head. Each queue gets one batch per turn. */
+static struct workq_queue *pick(struct workq *w){
+    struct workq_queue *q = w->rhead;
+    while (q && !q->head[WORKQ_INTERACTIVE]) q = q->rnext;
+    if (!q) q = w->rhead;
+    unlink_ready(w, q);
+    return q;
+}
+
+static struct workq_task *take(struct workq_queue *q, int cls, int max){
+    struct workq_task *batch = q->head[cls], *t = batch;
+    for (int n = 1; n < max && t->next; n++) t = t->next;
+    q->head[cls] = t->next;
+    if (!q->head[cls]) q->tail[cls] = NULL;
+    t->next = NULL;
+    for (t = batch; t; t = t->next) q->len--;
+    return batch;
+}
+
+static void *worker_main(void *arg){
+    struct workq *w = arg;
+    // Owners chdir into their repo; give each worker its own cwd. Without
+    // one two workers would move each other's, so this one quits and
+    // workq_init falls back to a single worker.
+    int ok = w->shared_cwd || unshare(CLONE_FS) == 0;
+    pthread_mutex_lock(&w->mu);
+    w->started++;
+    if (!ok) w->refused = 1;
+    pthread_cond_broadcast(&w->idle);
+    for (;;) {
+        if (!ok) break;
+        while (!w->stop && !w->rhead) pthread_cond_wait(&w->work, &w->mu);
+        if (w->stop) break;
+        struct workq_queue *q = pick(w);
+        q->busy = 1;
+        w->running++;
+        struct workq_task *batch = q->head[WORKQ_INTERACTIVE]
+            ? take(q, WORKQ_INTERACTIVE, WORKQ_BATCH)
+            : take(q, WORKQ_BULK, 1);
+        pthread_mutex_unlock(&w->mu);
+
+        struct workq_task *again = NULL, **atail = &again;
+        for (struct workq_task *t = batch, *nx; t; t = nx) {
+            nx = t->next;
+            t->next = NULL;
+            if (w->run(q->owner, t)) { *atail = t; atail = &t->next; }
+            else free_task(t);
+        }
+        if (w->batch_done) w->batch_done(q->owner);
+
+        pthread_mutex_lock(&w->mu);
+        while (again) {
+            struct workq_task *t = again;
+            again = t->next;
+            t->next = q->head[t->cls];
+            q->head[t->cls] = t;
+            if (!q->tail[t->cls]) q->tail[t->cls] = t;
+            q->len++;
+        }
+        q->busy = 0;
+        w->running--;
+        if (q->len) link_ready(w, q);
+        pthread_cond_broadcast(&w->idle);
+    }
+    pthread_mutex_unlock(&w->mu);
+    return NULL;
+}
+
+/* Start up to n workers and wait until each has got going. */
+static void start(struct workq *w, int n){
+    w->stop = w->started = w->refused = w->nworkers = 0;
+    for (int i = 0; i < n; i++) {
+        if (pthread_create(&w->workers[i], NULL, worker_main, w) != 0) break;
+        w->nworkers++;
+    }
+    pthread_mutex_lock(&w->mu);
+    while (w->started < w->nworkers) pthread_cond_wait(&w->idle, &w->mu);
+    pthread_mutex_unlock(&w->mu);
+}
+
+static void stop(struct workq *w){
+    pthread_mutex_lock(&w->mu);
+    w->stop = 1;
+    pthread_cond_broadcast(&w->work);
+    pthread_mutex_unlock(&w->mu);
+    for (int i = 0; i < w->nworkers; i++) pthread_join(w->workers[i], NULL);
+}
+
+int workq_init(struct workq *w, int nworkers, workq_fn run, workq_batch_fn batch_done){
+    memset(w, 0, sizeof *w);
+    pthread_mutex_init(&w->mu, NULL);
+    pthread_cond_init(&w->work, NULL);
+    pthread_cond_init(&w->idle, NULL);
+    w->run = run;
+    w->batch_done = batch_done;
+    w->workers = calloc((size_t)nworkers, sizeof *w->workers);
+    if (!w->workers) return -1;
+    start(w, nworkers);
+    if (w->refused) {
+        stop(w);
+        w->shared_cwd = 1;
+        start(w, 1);
+    }
+    if (!w->nworkers) {
+        workq_shutdown(w);
+        return -1;
+    }
+    return 0;
+}
+
+void workq_shutdown(struct workq *w){
+    stop(w);
+    free(w->workers);
+    pthread_cond_destroy(&w->idle);
+    pthread_cond_destroy(&w->work);
+    pthread_mutex_destroy(&w->mu);
+}
+
+void workq_queue_init(struct workq_queue *q, void *owner, size_t cap){
+    memset(q, 0, sizeof *q);
+    q->owner = owner;
+    q->cap = cap;
+}
+
+static int push(struct workq *w, struct workq_queue *q, int cls, int kind, const char *path, const char *from, int force){
+    pthread_mutex_lock(&w->mu);
+    // A move is a barrier: coalescing a later task into one queued before
+    // it would run that task on the pre-move state.
+    struct workq_task *same = NULL;
+    for (struct workq_task *t = q->head[cls]; t && !from; t = t->next) {
+        if (t->from) same = NULL;
+        else if (t->kind == kind && ((!t->path && !path) || (t->path && path && strcmp(t->path, path) == 0))) same = t;
+    }
+    if (same) {
+        pthread_mutex_unlock(&w->mu);
+        return 0;
+    }
+    if (!force && q->len >= q->cap) {
+        q->overflow = 1;
+        pthread_mutex_unlock(&w->mu);
+        return -1;
+    }
+    struct workq_task *t = calloc(1, sizeof *t);
+    if (!t) { pthread_mutex_unlock(&w->mu); return -1; }
+    t->cls = cls;
+    t->kind = kind;
+    t->path = path ? strdup(path) : NULL;
+    t->from = from ? strdup(from) : NULL;
+    t->queued = workq_now_us();
+    if (q->tail[cls]) q->tail[cls]->next = t; else q->head[cls] = t;
+    q->tail[cls] = t;
+    q->len++;
+    if (!q->ready && !q->busy) link_ready(w, q);
+    pthread_mutex_unlock(&w->mu);
+    return 0;
+}
+
+/* Queue a task unless an identical one is already pending. Once cap tasks
+ * are queued further pushes are dropped and flagged as overflow, unless
+ * force is set. Returns 0 if queued or coalesced, -1 if dropped. */
+int workq_push(struct workq *w, struct workq_queue *q, int cls, int kind, const char *path, int force){
+    return push(w, q, cls, kind, path, NULL, force);
+}
+
+/* Queue a move of from to path. Moves are never coalesced and keep their
+ * order relative to the other tasks of the class. */
+int workq_push_move(struct workq *w, struct workq_queue *q, int cls, int kind, const char *from, const char *path){
+    return push(w, q, cls, kind, path, from, 0);
+}
+
+/* Whether tasks of class cls are queued on q or on any queue waiting for
+ * a worker, for a long-running task to yield to them. */
+int workq_waiting(struct workq *w, struct workq_queue *q, int cls){
+    pthread_mutex_lock(&w->mu);
+    int n = q->head[cls] != NULL;
+    for (struct workq_queue *p = w->rhead; p && !n; p = p->rnext) n = p->head[cls] != NULL;
+    pthread_mutex_unlock(&w->mu);
+    return n;
+}
+
+int workq_take_overflow(struct workq *w, struct workq_queue *q){
+    pthread_mutex_lock(&w->mu);
+    int o = q->overflow;
+    q->overflow = 0;
+    pthread_mutex_unlock(&w->mu);
+    return o;
+}
+
+/* Wait for the queue's running batch, then drop everything still queued.
+ * Returns how many tasks were dropped. */
+size_t workq_detach(struct workq *w, struct workq_queue *q){
+    pthread_mutex_lock(&w->mu);
+    while (q->busy) pthread_cond_wait(&w->idle, &w->mu);
+    if (q->ready) unlink_ready(w, q);
+    size_t dropped = q->len;
+    for (int c = 0; c < WORKQ_NCLASS; c++) {
+        for (struct workq_task *t = q->head[c], *nx; t; t = nx) { nx = t->next; free_task(t); }
+        q->head[c] = q->tail[c] = NULL;
+    }
+    q->len = 0;
+    pthread_mutex_unlock(&w->mu);
+    return dropped;
+}
+
+void workq_wait_idle(struct workq *w){
+    pthread_mutex_lock(&w->mu);
+    while (w->rhead || w->running) pthread_cond_wait(&w->idle, &w->mu);
+    pthread_mutex_unlock(&w->mu);
+}
+
+long long workq_now_us(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
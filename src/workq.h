@@ -0,0 +1,65 @@
+#ifndef WORKQ_H
+#define WORKQ_H
+#include <pthread.h>
+#include <stddef.h>
+
+/* Task classes, served in this order within a queue. */
+enum { WORKQ_INTERACTIVE=0, WORKQ_BULK, WORKQ_NCLASS };
+
+struct workq_task {
+    int cls;
+    int kind;                   // owner-defined
+    char *path;
+    char *from;                 // source path of a move, else NULL
+    long long queued;           // workq_now_us() when first pushed
+    struct workq_task *next;
+};
+
+/* One queue per owner (repo). A queue is handed to at most one worker at a
+ * time, so the owner's state needs no locking of its own. */
+struct workq_queue {
+    void *owner;
+    struct workq_task *head[WORKQ_NCLASS], *tail[WORKQ_NCLASS];
+    size_t len, cap;            // queued tasks, bound before overflow
+    int overflow;               // tasks were dropped since the last check
+    int busy;                   // a worker is running this queue's batch
+    int ready;                  // linked on the scheduler's ready list
+    struct workq_queue *rnext;
+};
+
+/* Runs one task; return 1 to put it back at the front of its class. */
+typedef int (*workq_fn)(void *owner, struct workq_task *t);
+/* Called once after each batch a worker ran for an owner. */
+typedef void (*workq_batch_fn)(void *owner);
+
+struct workq {
+    pthread_mutex_t mu;
+    pthread_cond_t work, idle;
+    struct workq_queue *rhead, *rtail;   // round-robin ready list
+    pthread_t *workers;
+    int nworkers;
+    int running;                // batches being run
+    int stop;
+    int started;                // workers that got going
+    int refused;                // one of them could not unshare its cwd
+    int shared_cwd;             // so one worker runs, in the process's cwd
+    workq_fn run;
+    workq_batch_fn batch_done;
+};
+
+/* -1 if no worker starts. Where workers cannot get a cwd of their own
+ * (unshare(CLONE_FS) refused, e.g. by seccomp) a single one runs in the
+ * process's: the owner's main-thread code must then not rely on the cwd. */
+int workq_init(struct workq *w, int nworkers, workq_fn run, workq_batch_fn batch_done);
+void workq_shutdown(struct workq *w);
+void workq_queue_init(struct workq_queue *q, void *owner, size_t cap);
+int workq_push(struct workq *w, struct workq_queue *q, int cls, int kind, const char *path, int force);
+int workq_push_move(struct workq *w, struct workq_queue *q, int cls, int kind, const char *from, const char *path);
+int workq_waiting(struct workq *w, struct workq_queue *q, int cls);
+int workq_take_overflow(struct workq *w, struct workq_queue *q);
+size_t workq_detach(struct workq *w, struct workq_queue *q);
+/* Block until nothing is queued or running on any queue. */
+void workq_wait_idle(struct workq *w);
+long long workq_now_us(void);   // monotonic
+
+#endif